@@ -205,6 +205,12 @@ void AABB::reset(const glm::vec3& v)
 }
 
 bool AABB::isIntersectedByRay(const glm::vec3& o, const glm::vec3& v) const
+{
+	float entry;
+	return isIntersectedByRay(o, v, entry);
+}
+
+bool AABB::isIntersectedByRay(const glm::vec3& o, const glm::vec3& v, float& entry) const
 {
 	// see 'Essential Math ..., 12.3, pg. 567f
 
@@ -271,6 +277,7 @@ bool AABB::isIntersectedByRay(const glm::vec3& o, const glm::vec3& v) const
 		return false;
 
 
+	entry = maxS;
 	return true;
 }
 
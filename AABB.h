@@ -40,6 +40,8 @@ struct AABB
 
 	/// checks if the ray, defined by the origin o and vector v intersects this box
 	bool isIntersectedByRay(const glm::vec3& o, const glm::vec3& v) const;
+	/// as above, entry is set to the ray parameter where the ray enters the box
+	bool isIntersectedByRay(const glm::vec3& o, const glm::vec3& v, float& entry) const;
 
 	bool isInside(const glm::vec3& pt) const;
 	bool isInside(const AABB& bbox) const;
@@ -0,0 +1,171 @@
+#include "BackgroundJobs.h"
+#include "TaskScheduler.h"
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+struct BackgroundJobs::Job
+{
+	std::string						name;
+	std::vector<const SpimStack*>	stacks;
+	Progress						progress;
+
+	TaskScheduler::TaskGroup		group;
+	std::thread						thread;
+	std::chrono::steady_clock::time_point	start;
+
+	// written by the job's thread before it sets finished
+	Publish							publish;
+	std::string						error;
+	std::atomic<bool>				finished;
+
+	inline Job() : finished(false) {}
+};
+
+BackgroundJobs::BackgroundJobs()
+{
+}
+
+BackgroundJobs::~BackgroundJobs()
+{
+	cancelAll();
+
+	// nothing is published anymore, the results are dropped with the jobs
+	for (size_t i = 0; i < jobs.size(); ++i)
+		jobs[i]->thread.join();
+}
+
+void BackgroundJobs::start(const string& name, const vector<const SpimStack*>& stacks, const Work& work, const Progress& progress)
+{
+	unique_ptr<Job> job(new Job);
+	job->name = name;
+	job->stacks = stacks;
+	job->progress = progress;
+	job->start = chrono::steady_clock::now();
+
+	Job* j = job.get();
+	j->thread = thread([j, work]()
+	{
+		try
+		{
+			// the job's own thread runs the work, threads waiting for other groups only pick up its pieces
+			j->group.runAndWait([j, &work]() { j->publish = work(); });
+		}
+		catch (const exception& e)
+		{
+			j->error = e.what();
+		}
+		catch (...)
+		{
+			j->error = "unknown error";
+		}
+
+		j->finished = true;
+	});
+
+	jobs.push_back(move(job));
+	cout << "[Jobs] Started \"" << name << "\"\n";
+}
+
+unsigned int BackgroundJobs::update()
+{
+	unsigned int published = 0;
+
+	for (auto it = jobs.begin(); it != jobs.end(); )
+	{
+		Job* job = it->get();
+		if (!job->finished)
+		{
+			++it;
+			continue;
+		}
+
+		job->thread.join();
+		const double seconds = chrono::duration<double>(chrono::steady_clock::now() - job->start).count();
+
+		if (!job->error.empty())
+			cerr << "[Jobs] \"" << job->name << "\" failed: " << job->error << endl;
+		else if (job->group.isCancelled())
+			cout << "[Jobs] \"" << job->name << "\" cancelled.\n";
+		else if (job->publish)
+		{
+			try
+			{
+				job->publish();
+				++published;
+				cout << "[Jobs] \"" << job->name << "\" done in " << seconds << "s\n";
+			}
+			catch (const exception& e)
+			{
+				cerr << "[Jobs] Unable to publish \"" << job->name << "\": " << e.what() << endl;
+			}
+		}
+
+		it = jobs.erase(it);
+	}
+
+	return published;
+}
+
+void BackgroundJobs::cancelAll()
+{
+	for (size_t i = 0; i < jobs.size(); ++i)
+		jobs[i]->group.cancel();
+}
+
+bool BackgroundJobs::cancel(const SpimStack* stack)
+{
+	bool running = false;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		Job* job = jobs[i].get();
+		if (find(job->stacks.begin(), job->stacks.end(), stack) == job->stacks.end())
+			continue;
+
+		job->group.cancel();
+		running |= !job->finished;
+	}
+
+	return running;
+}
+
+bool BackgroundJobs::isBusy(const SpimStack* stack) const
+{
+	for (size_t i = 0; i < jobs.size(); ++i)
+		if (find(jobs[i]->stacks.begin(), jobs[i]->stacks.end(), stack) != jobs[i]->stacks.end())
+			return true;
+
+	return false;
+}
+
+bool BackgroundJobs::isRunning(const string& name) const
+{
+	for (size_t i = 0; i < jobs.size(); ++i)
+		if (jobs[i]->name == name)
+			return true;
+
+	return false;
+}
+
+vector<BackgroundJobs::Status> BackgroundJobs::getStatus() const
+{
+	const auto now = chrono::steady_clock::now();
+
+	vector<Status> status(jobs.size());
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		const Job* job = jobs[i].get();
+		status[i].name = job->name;
+		status[i].progress = job->progress ? job->progress() : -1.f;
+		status[i].seconds = chrono::duration<float>(now - job->start).count();
+		status[i].cancelled = job->group.isCancelled();
+	}
+
+	return status;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include <boost/noncopyable.hpp>
+
+class SpimStack;
+
+/// Long running stack operations on background threads, so the viewer keeps drawing meanwhile
+/**	Every job runs on its own thread as a task group of the TaskScheduler: the parallel loops of the
+	operation spread over the worker threads, and cancelling the job skips their remaining pieces.
+
+	Jobs never change what the viewer draws. They work on snapshots (SpimStack::clone) or read stacks the
+	viewer leaves alone while they are busy, and return a function that publishes the result. update()
+	calls it on the GL thread once the job has finished, typically swapping the voxels into the displayed
+	stack (SpimStack::swapContent) which then uploads its texture. Failed and cancelled jobs publish
+	nothing; their snapshots are freed with the functions holding them.
+
+		jobs.start("Median " + name, { stack }, [stack, snapshot, window]() -> BackgroundJobs::Publish
+		{
+			snapshot->applyMedianFilter(window);
+			return [stack, snapshot]() { stack->swapContent(snapshot.get()); };
+		}, [snapshot]() { return snapshot->getProgress(); });
+*/
+class BackgroundJobs : boost::noncopyable
+{
+public:
+	/// publishes the result of a job, called on the GL thread
+	typedef std::function<void()> Publish;
+	/// the operation itself, called on the job's thread. Long serial loops may poll TaskScheduler::isCancelled()
+	typedef std::function<Publish()> Work;
+	/// progress of the operation in [0, 1], polled from the GL thread
+	typedef std::function<float()> Progress;
+
+	struct Status
+	{
+		std::string		name;
+		// negative if the job does not report progress
+		float			progress;
+		float			seconds;
+		bool			cancelled;
+	};
+
+	BackgroundJobs();
+	/// cancels all jobs and waits for them
+	~BackgroundJobs();
+
+	/// starts a job using (reading or replacing) the given stacks, see isBusy()
+	void start(const std::string& name, const std::vector<const SpimStack*>& stacks, const Work& work, const Progress& progress = Progress());
+
+	/// publishes the results of the finished jobs, call regularly on the GL thread. Returns the number of results
+	unsigned int update();
+
+	void cancelAll();
+	/// cancels all jobs using the stack; true if some of them are still running and the stack must not change yet
+	bool cancel(const SpimStack* stack);
+
+	/// true if a running job uses the stack
+	bool isBusy(const SpimStack* stack) const;
+	bool isRunning(const std::string& name) const;
+	inline bool isIdle() const { return jobs.empty(); }
+
+	std::vector<Status> getStatus() const;
+
+private:
+	struct Job;
+	std::vector<std::unique_ptr<Job> >	jobs;
+};
@@ -0,0 +1,435 @@
+#include "BatchPipeline.h"
+#include "SpimStack.h"
+#include "MultiViewFusion.h"
+#include "StackTransformationSolver.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+#include "MacroCellGrid.h"
+#include "VolumeRaycast.h"
+#include "AABB.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace std;
+
+BatchPipeline::BatchPipeline() : solverName("Uniform DX"), metric(SampledMetric::METRIC_NCC), metricSamples(4096)
+{
+	config.setDefaults();
+}
+
+BatchPipeline::~BatchPipeline()
+{
+	for (size_t i = 0; i < stacks.size(); ++i)
+		delete stacks[i];
+}
+
+void BatchPipeline::load(const string& filename)
+{
+	// the settings first, stage lines are ignored by the config
+	config.load(filename);
+
+	ifstream file(filename);
+	if (!file.is_open())
+		throw runtime_error("Unable to open file \"" + filename + "\"!");
+
+	const size_t slash = filename.find_last_of("/\\");
+	path = slash == string::npos ? "" : filename.substr(0, slash + 1);
+
+	static const char* STAGES[] = { "stack", "loadTransforms", "subsample", "median", "gaussian", "solver", "metric", "align", "saveTransforms", "fuse", "saveIsotropic", "render" };
+
+	string line;
+	unsigned int lineNumber = 0;
+	size_t stackCount = 0;
+	while (getline(file, line))
+	{
+		++lineNumber;
+
+		istringstream s(line);
+		Stage stage;
+		if (!(s >> stage.name) || stage.name[0] == '#')
+			continue;
+
+		if (find(begin(STAGES), end(STAGES), stage.name) == end(STAGES))
+		{
+			// the config has read the settings already
+			if (Config::isKey(stage.name))
+				continue;
+
+			throw runtime_error("Line " + to_string(lineNumber) + ": unknown stage or setting \"" + stage.name + "\"!");
+		}
+
+		getline(s >> ws, stage.rest);
+		istringstream a(stage.rest);
+		string arg;
+		while (a >> arg)
+			stage.args.push_back(arg);
+
+		stage.line = lineNumber;
+		validateStage(stage, stackCount);
+		stages.push_back(stage);
+
+		if (stage.name == "stack")
+			++stackCount;
+	}
+
+	cout << "[Batch] Loaded pipeline \"" << filename << "\" with " << stages.size() << " stages\n";
+}
+
+void BatchPipeline::validateStage(const Stage& stage, size_t stackCount)
+{
+	size_t minArgs = 0, maxArgs = 0;
+
+	// names and filenames may contain spaces
+	if (stage.name == "stack" || stage.name == "solver")
+	{
+		minArgs = 1;
+		maxArgs = std::max<size_t>(1, stage.args.size());
+	}
+	else if (stage.name == "median")
+		minArgs = maxArgs = 3;
+	else if (stage.name == "gaussian")
+		minArgs = maxArgs = 2;
+	else if (stage.name == "metric" || stage.name == "fuse")
+	{
+		minArgs = 1;
+		maxArgs = 2;
+	}
+	else if (stage.name == "align")
+		maxArgs = 1;
+	else if (stage.name == "saveIsotropic")
+		minArgs = maxArgs = 2;
+	else if (stage.name == "render")
+	{
+		minArgs = 1;
+		maxArgs = 3;
+	}
+
+	if (stage.args.size() < minArgs || stage.args.size() > maxArgs)
+		throw runtime_error("Line " + to_string(stage.line) + ": invalid number of arguments for \"" + stage.name + "\"!");
+
+	if (stage.name == "metric")
+	{
+		SampledMetric::parseMode(stage.args[0]);
+		if (stage.args.size() > 1)
+			parseInt(stage, 1, 1);
+	}
+
+	if (stage.name == "median")
+		for (size_t i = 0; i < 3; ++i)
+			parseInt(stage, i, 1);
+
+	if (stage.name == "gaussian")
+	{
+		parseFloat(stage, 0, 0.f);
+		parseInt(stage, 1, 0);
+	}
+
+	if (stage.name == "align" && !stage.args.empty())
+		parseInt(stage, 0, 1);
+
+	if (stage.name == "saveIsotropic" && (size_t)parseInt(stage, 0, 0) >= stackCount)
+		throw runtime_error("Line " + to_string(stage.line) + ": stack " + stage.args[0] + " is not loaded before \"" + stage.name + "\"!");
+
+	if (stage.name == "render" && stage.args.size() > 2)
+		parseInt(stage, 2, 1);
+
+	if (stage.name == "fuse" && stage.args.size() > 1 && stage.args[1] != "average" && stage.args[1] != "max" && stage.args[1] != "weighted")
+		throw runtime_error("Line " + to_string(stage.line) + ": unknown blend mode \"" + stage.args[1] + "\"!");
+
+	if (stage.name == "render" && stage.args.size() > 1 && stage.args[1] != "x" && stage.args[1] != "y" && stage.args[1] != "z")
+		throw runtime_error("Line " + to_string(stage.line) + ": unknown axis \"" + stage.args[1] + "\"!");
+}
+
+int BatchPipeline::parseInt(const Stage& stage, size_t arg, int minValue)
+{
+	const string& s = stage.args[arg];
+
+	size_t end = 0;
+	int value = 0;
+	try
+	{
+		value = stoi(s, &end);
+	}
+	catch (const exception&)
+	{
+		end = 0;
+	}
+
+	if (end == 0 || end != s.size() || value < minValue)
+		throw runtime_error("Line " + to_string(stage.line) + ": invalid argument \"" + s + "\" for \"" + stage.name + "\", expected an integer of at least " + to_string(minValue) + "!");
+
+	return value;
+}
+
+float BatchPipeline::parseFloat(const Stage& stage, size_t arg, float minValue)
+{
+	const string& s = stage.args[arg];
+
+	size_t end = 0;
+	float value = 0.f;
+	try
+	{
+		value = stof(s, &end);
+	}
+	catch (const exception&)
+	{
+		end = 0;
+	}
+
+	// also rejects nan
+	if (end == 0 || end != s.size() || !(value > minValue))
+		throw runtime_error("Line " + to_string(stage.line) + ": invalid argument \"" + s + "\" for \"" + stage.name + "\", expected a number larger than " + to_string(minValue) + "!");
+
+	return value;
+}
+
+string BatchPipeline::resolve(const string& filename) const
+{
+	const bool absolute = !filename.empty() && (filename[0] == '/' || filename[0] == '\\' || (filename.size() > 1 && filename[1] == ':'));
+	return absolute ? filename : path + filename;
+}
+
+int BatchPipeline::run()
+{
+	vector<double> timings;
+	const auto start = chrono::steady_clock::now();
+
+	for (size_t i = 0; i < stages.size(); ++i)
+	{
+		const Stage& stage = stages[i];
+		cout << "[Batch] Stage " << i + 1 << "/" << stages.size() << ": " << stage.name << " " << stage.rest << endl;
+
+		const auto stageStart = chrono::steady_clock::now();
+		try
+		{
+			PROFILE_ZONE("Batch::stage");
+			runStage(stage);
+		}
+		catch (const exception& e)
+		{
+			cerr << "[Batch] Stage " << i + 1 << " (line " << stage.line << ", " << stage.name << ") failed: " << e.what() << endl;
+			return EXIT_STAGE_FAILED;
+		}
+		catch (...)
+		{
+			cerr << "[Batch] Stage " << i + 1 << " (line " << stage.line << ", " << stage.name << ") failed.\n";
+			return EXIT_STAGE_FAILED;
+		}
+
+		timings.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - stageStart).count());
+		cout << "[Batch] Stage " << i + 1 << " done in " << timings.back() << "ms\n";
+	}
+
+	const double total = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	cout << "[Batch] Timings:\n";
+	for (size_t i = 0; i < stages.size(); ++i)
+		cout << "[Batch]   " << setw(3) << i + 1 << " " << setw(16) << left << stages[i].name << right << setw(12) << fixed << setprecision(1) << timings[i] << "ms\n";
+	cout << "[Batch]   total " << setw(27) << total << "ms\n";
+
+	return EXIT_OK;
+}
+
+void BatchPipeline::runStage(const Stage& stage)
+{
+	if (stage.name == "stack")
+	{
+		const string filename = resolve(stage.rest);
+		SpimStack* stack = SpimStack::load(filename);
+
+		// chunked volumes carry their own voxel size
+		if (filename.substr(filename.find_last_of(".") + 1) != "cvol")
+			stack->setVoxelDimensions(config.defaultVoxelSize);
+		stacks.push_back(stack);
+		return;
+	}
+
+	if (stage.name == "solver")
+	{
+		solverName = stage.rest;
+		return;
+	}
+
+	if (stage.name == "metric")
+	{
+		metric.setMode(SampledMetric::parseMode(stage.args[0]));
+		if (stage.args.size() > 1)
+			metricSamples = parseInt(stage, 1, 1);
+		return;
+	}
+
+	if (stacks.empty())
+		throw runtime_error("No stacks loaded!");
+
+	if (stage.name == "loadTransforms")
+	{
+		for (size_t i = 0; i < stacks.size(); ++i)
+			stacks[i]->loadTransform(stacks[i]->getFilename() + ".registration.txt");
+	}
+	else if (stage.name == "saveTransforms")
+	{
+		for (size_t i = 0; i < stacks.size(); ++i)
+			stacks[i]->saveTransform(stacks[i]->getFilename() + ".registration.txt");
+	}
+	else if (stage.name == "subsample")
+		forEachStack([](SpimStack* s) { s->subsample(false); });
+	else if (stage.name == "median")
+	{
+		const glm::ivec3 window(parseInt(stage, 0, 1), parseInt(stage, 1, 1), parseInt(stage, 2, 1));
+		forEachStack([&](SpimStack* s) { s->applyMedianFilter(window); });
+	}
+	else if (stage.name == "gaussian")
+	{
+		const float sigma = parseFloat(stage, 0, 0.f);
+		const int radius = parseInt(stage, 1, 0);
+		forEachStack([&](SpimStack* s) { s->applyGaussianBlur(sigma, radius); });
+	}
+	else if (stage.name == "align")
+		align(stage.args.empty() ? 1000 : parseInt(stage, 0, 1));
+	else if (stage.name == "fuse")
+		fuse(resolve(stage.args[0]), stage.args.size() > 1 ? stage.args[1] : "average");
+	else if (stage.name == "saveIsotropic")
+	{
+		const unsigned int index = parseInt(stage, 0, 0);
+		if (index >= stacks.size())
+			throw runtime_error("Stack " + stage.args[0] + " outside valid range!");
+
+		glm::vec3 voxelSize;
+		glm::ivec3 resolution;
+		stacks[index]->getIsotropicGrid(voxelSize, resolution);
+		stacks[index]->saveResliced(stacks[index]->getTransform(), voxelSize, resolution, Resampling::TRILINEAR, resolve(stage.args[1]));
+	}
+	else if (stage.name == "render")
+		render(resolve(stage.args[0]), stage.args.size() > 1 ? stage.args[1] : "z", stage.args.size() > 2 ? parseInt(stage, 2, 1) : 512);
+}
+
+void BatchPipeline::forEachStack(const function<void(SpimStack*)>& f)
+{
+	// the filters are parallel themselves, the stacks only fill the gaps
+	TaskScheduler::TaskGroup group;
+	for (size_t i = 0; i < stacks.size(); ++i)
+	{
+		SpimStack* stack = stacks[i];
+		group.run([stack, &f]() { f(stack); });
+	}
+	group.wait();
+}
+
+void BatchPipeline::align(unsigned int iterations)
+{
+	if (stacks.size() < 2)
+		throw runtime_error("Aligning needs at least two stacks!");
+
+	// created here, some solvers need all stacks
+	vector<InteractionVolume*> volumes(stacks.begin(), stacks.end());
+	unique_ptr<IStackTransformationSolver> solver(IStackTransformationSolver::create(solverName, volumes));
+	if (!solver)
+		throw runtime_error("Unknown solver \"" + solverName + "\"!");
+
+	metric.setReference(SampledMetric::View(stacks[0]), metricSamples);
+
+	for (size_t i = 1; i < stacks.size(); ++i)
+	{
+		const SampledMetric::View view(stacks[i]);
+		const double initial = metric.score(view);
+
+		const unsigned int n = solver->minimize(stacks[i], [&](const glm::mat4& delta) { return metric.score(view, delta); }, iterations);
+
+		const IStackTransformationSolver::Solution& best = solver->getBestSolution();
+		cout << "[Batch] Stack " << i << ": " << n << " candidates, score " << initial << " -> " << best.score << endl;
+
+		if (best.score < initial)
+			stacks[i]->applyTransform(best.matrix);
+	}
+}
+
+void BatchPipeline::fuse(const string& filename, const string& mode)
+{
+	MultiViewFusion::BlendMode blend = MultiViewFusion::BLEND_AVERAGE;
+	if (mode == "max")
+		blend = MultiViewFusion::BLEND_MAX;
+	else if (mode == "weighted")
+		blend = MultiViewFusion::BLEND_WEIGHTED;
+
+	MultiViewFusion fusion(blend);
+	fusion.setFeatherWidth(config.fusionFeatherWidth);
+	fusion.setContentWeight(config.fusionContentWeight);
+	for (size_t i = 0; i < stacks.size(); ++i)
+		fusion.addView(stacks[i]);
+
+	const MultiViewFusion::Grid grid = fusion.getBoundingGrid(stacks[0]->getVoxelDimensions());
+
+	if (filename.substr(filename.find_last_of(".") + 1) == "cvol")
+	{
+		fusion.fuseTiled(grid, filename, (unsigned int)stacks[0]->getBytesPerVoxel(), config.fusionMemoryBudget << 20, glm::ivec3(config.fusionChunkSize));
+		return;
+	}
+
+	unique_ptr<SpimStack> result;
+	if (stacks[0]->getBytesPerVoxel() == 2)
+		result.reset(new SpimStackU16);
+	else
+		result.reset(new SpimStackU8);
+
+	result->setContent(grid.resolution, nullptr);
+	result->setVoxelDimensions(grid.voxelSize);
+	result->setTransform(grid.transform);
+
+	fusion.fuse(result.get());
+	result->save(filename);
+	result->saveTransform(filename + ".registration.txt");
+}
+
+void BatchPipeline::render(const string& filename, const string& axis, int size)
+{
+	using namespace glm;
+
+	if (size <= 0)
+		throw runtime_error("Invalid image size " + to_string(size) + "!");
+
+	AABB bbox = stacks[0]->getTransformedBBox();
+	vector<MacroCellGrid> grids(stacks.size());
+	vector<VolumeRaycast::Volume> volumes(stacks.size());
+	for (size_t i = 0; i < stacks.size(); ++i)
+	{
+		bbox.extend(stacks[i]->getTransformedBBox());
+		grids[i].build(stacks[i]->getData(), (unsigned int)stacks[i]->getBytesPerVoxel(), stacks[i]->getResolution());
+		volumes[i] = VolumeRaycast::Volume(stacks[i], &grids[i]);
+	}
+
+	// orthographic view of the whole bounding box, looking down the axis
+	const vec3 center = bbox.getCentroid();
+	const float radius = bbox.getSpanLength() * 0.5f;
+	vec3 dir(0.f, 0.f, 1.f), up(0.f, 1.f, 0.f);
+	if (axis == "x")
+		dir = vec3(1.f, 0.f, 0.f);
+	else if (axis == "y")
+	{
+		dir = vec3(0.f, 1.f, 0.f);
+		up = vec3(0.f, 0.f, 1.f);
+	}
+
+	const mat4 mvp = ortho(-radius, radius, -radius, radius, radius, radius * 3.f) * lookAt(center + dir * radius * 2.f, center, up);
+
+	VolumeRaycast::Parameters params;
+	params.stepLength = config.raytraceDelta;
+	params.minThreshold = (float)config.threshold.min;
+	params.maxThreshold = (float)config.threshold.max;
+	params.maxSteps = config.raytraceSteps;
+
+	vector<vec4> image;
+	const VolumeRaycast::Stats stats = VolumeRaycast::render(volumes, mvp, bbox, params, true, ivec2(size), image);
+	VolumeRaycast::saveImage(image, ivec2(size), filename);
+
+	cout << "[Batch] Rendered \"" << filename << "\", " << stats.samples << " samples, " << stats.skippedSteps << " of " << stats.steps + stats.skippedSteps << " steps skipped\n";
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <boost/noncopyable.hpp>
+
+#include "Config.h"
+#include "SampledMetric.h"
+
+class SpimStack;
+
+/// Headless processing pipeline, runs without a GL context
+/**	The pipeline file is a config file (see config.cfg, all settings apply) with additional stage lines that
+	are run in order:
+
+		stack <file>					loads a stack, with the configured voxel size unless it is a .cvol
+		loadTransforms					reads "<file>.registration.txt" of every stack
+		subsample						halves the resolution of all stacks
+		median <x> <y> <z>				median filter with the given window on all stacks
+		gaussian <sigma> <radius>		gaussian blur on all stacks
+		solver <name>					selects a solver by its menu name, e.g. "Uniform DX" (default)
+		metric ncc|difference [samples]	selects the similarity metric (see SampledMetric.h)
+		align [iterations]				aligns every stack to stack 0 with the solver and metric
+		saveTransforms					writes "<file>.registration.txt" of every stack
+		fuse <file> [average|max|weighted]	fuses all stacks; tiled into a chunked volume for .cvol files
+		saveIsotropic <stack> <file>	resamples a stack to cubic voxels and streams it to a raw file
+		render <file> [x|y|z] [size]	maximum intensity projection of all stacks along an axis (default z)
+										as PNG, with the configured thresholds and raytrace steps
+
+	Relative filenames are relative to the pipeline file. Lines that are neither a stage nor a setting and
+	invalid stage arguments are rejected when loading. Every stage is timed; the pipeline stops at the
+	first stage that fails.
+*/
+class BatchPipeline : boost::noncopyable
+{
+public:
+	/// exit codes of the batch executable, for job schedulers
+	enum ExitCode
+	{
+		EXIT_OK = 0,
+		EXIT_USAGE,
+		// the pipeline file could not be read or contains invalid stages
+		EXIT_INVALID_PIPELINE,
+		EXIT_STAGE_FAILED
+	};
+
+	BatchPipeline();
+	~BatchPipeline();
+
+	/// reads the settings and stages of a pipeline file. Throws if a stage is invalid
+	void load(const std::string& filename);
+	/// runs all stages and prints their timings. Returns EXIT_OK or EXIT_STAGE_FAILED
+	int run();
+
+	inline size_t getStageCount() const { return stages.size(); }
+
+private:
+	struct Stage
+	{
+		std::string					name;
+		std::vector<std::string>	args;
+		// everything after the name, for names and filenames with spaces
+		std::string					rest;
+		unsigned int				line;
+	};
+
+	Config						config;
+	std::string					path;
+	std::vector<Stage>			stages;
+
+	std::vector<SpimStack*>		stacks;
+	std::string					solverName;
+	SampledMetric				metric;
+	unsigned int				metricSamples;
+
+	// stackCount is the number of stacks loaded by the stages before
+	static void validateStage(const Stage& stage, size_t stackCount);
+	// parse a numeric argument, throw with the line number if it is invalid or below minValue
+	static int parseInt(const Stage& stage, size_t arg, int minValue);
+	static float parseFloat(const Stage& stage, size_t arg, float minValue);
+	void runStage(const Stage& stage);
+	// runs f on all stacks in parallel
+	void forEachStack(const std::function<void(SpimStack*)>& f);
+	std::string resolve(const std::string& filename) const;
+
+	void align(unsigned int iterations);
+	void fuse(const std::string& filename, const std::string& mode);
+	void render(const std::string& filename, const std::string& axis, int size);
+};
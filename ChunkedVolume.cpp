@@ -0,0 +1,608 @@
+#include "ChunkedVolume.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace glm;
+
+// file layout: magic, header, chunk payloads, chunk index
+static const char CHUNKED_MAGIC[4] = { 'S', 'P', 'C', 'V' };
+static const uint32_t CHUNKED_VERSION = 2;
+
+// magic, version, resolution, chunk size, bytes per voxel, voxel size, transform, compression, levels, index offset
+static const std::streamoff CHUNKED_HEADER_SIZE = 4 + sizeof(uint32_t) + sizeof(int32_t) * 6 + sizeof(uint32_t) + sizeof(float) * 3 + sizeof(float) * 16 + sizeof(uint32_t) * 2 + sizeof(uint64_t);
+
+namespace
+{
+	// residuals are bit packed in groups of this size
+	const int DELTA_GROUP_SIZE = 32;
+
+	inline size_t linearChunkIndex(const ivec3& chunk, const ivec3& count)
+	{
+		return chunk.x + count.x * (chunk.y + (size_t)count.y * chunk.z);
+	}
+
+	inline ivec3 levelResolution(const ivec3& resolution, unsigned int level)
+	{
+		const int scale = 1 << level;
+		return (resolution + ivec3(scale - 1)) / scale;
+	}
+
+	inline ivec3 levelChunkCount(const ivec3& resolution, const ivec3& chunkSize, unsigned int level)
+	{
+		return (levelResolution(resolution, level) + chunkSize - ivec3(1)) / chunkSize;
+	}
+
+	// position of the level's first chunk in the index
+	size_t levelIndexStart(const ivec3& resolution, const ivec3& chunkSize, unsigned int level)
+	{
+		size_t start = 0;
+		for (unsigned int l = 0; l < level; ++l)
+		{
+			const ivec3 count = levelChunkCount(resolution, chunkSize, l);
+			start += (size_t)count.x * count.y * count.z;
+		}
+		return start;
+	}
+
+	inline uint32_t zigzag(int32_t v) { return (uint32_t)((v << 1) ^ (v >> 31)); }
+	inline int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+	// residuals of every voxel against its left neighbour, the row above at the start of a row and the plane below at the start of a plane
+	template <typename T>
+	void calculateResiduals(const T* data, const ivec3& e, uint32_t* residuals)
+	{
+		const size_t plane = (size_t)e.x * e.y;
+		for (int z = 0; z < e.z; ++z)
+			for (int y = 0; y < e.y; ++y)
+			{
+				const size_t row = (size_t)e.x * y + plane * z;
+
+				int32_t prev = 0;
+				if (y > 0)
+					prev = data[row - e.x];
+				else if (z > 0)
+					prev = data[row - plane];
+
+				for (int x = 0; x < e.x; ++x)
+				{
+					const int32_t v = data[row + x];
+					residuals[row + x] = zigzag(v - prev);
+					prev = v;
+				}
+			}
+	}
+
+	template <typename T>
+	void applyResiduals(const uint32_t* residuals, const ivec3& e, T* data)
+	{
+		const size_t plane = (size_t)e.x * e.y;
+		for (int z = 0; z < e.z; ++z)
+			for (int y = 0; y < e.y; ++y)
+			{
+				const size_t row = (size_t)e.x * y + plane * z;
+
+				int32_t prev = 0;
+				if (y > 0)
+					prev = data[row - e.x];
+				else if (z > 0)
+					prev = data[row - plane];
+
+				for (int x = 0; x < e.x; ++x)
+				{
+					prev += unzigzag(residuals[row + x]);
+					data[row + x] = (T)prev;
+				}
+			}
+	}
+
+	// one width byte per group, followed by the group's residuals packed with that many bits each. Returns false if the result is not smaller than the raw data
+	template <typename T>
+	bool encodeDelta(const T* data, const ivec3& e, std::vector<unsigned char>& out)
+	{
+		const size_t count = (size_t)e.x * e.y * e.z;
+		const size_t rawSize = count * sizeof(T);
+
+		std::vector<uint32_t> residuals(count);
+		calculateResiduals(data, e, &residuals[0]);
+
+		out.clear();
+		out.reserve(rawSize);
+
+		for (size_t g = 0; g < count; g += DELTA_GROUP_SIZE)
+		{
+			const size_t n = std::min<size_t>(DELTA_GROUP_SIZE, count - g);
+			const uint32_t* r = &residuals[g];
+
+			uint32_t bits = 0;
+			for (size_t k = 0; k < n; ++k)
+				bits |= r[k];
+
+			unsigned int width = 0;
+			while (bits >> width)
+				++width;
+
+			out.push_back((unsigned char)width);
+			if (width == 0)
+				continue;
+
+			uint64_t buffer = 0;
+			unsigned int filled = 0;
+			for (size_t k = 0; k < n; ++k)
+			{
+				buffer |= (uint64_t)r[k] << filled;
+				filled += width;
+				while (filled >= 8)
+				{
+					out.push_back((unsigned char)buffer);
+					buffer >>= 8;
+					filled -= 8;
+				}
+			}
+			if (filled > 0)
+				out.push_back((unsigned char)buffer);
+
+			if (out.size() >= rawSize)
+				return false;
+		}
+
+		return true;
+	}
+
+	template <typename T>
+	void decodeDelta(const unsigned char* in, size_t size, const ivec3& e, T* data)
+	{
+		const size_t count = (size_t)e.x * e.y * e.z;
+		std::vector<uint32_t> residuals(count);
+
+		const unsigned char* end = in + size;
+		for (size_t g = 0; g < count; g += DELTA_GROUP_SIZE)
+		{
+			const size_t n = std::min<size_t>(DELTA_GROUP_SIZE, count - g);
+			uint32_t* r = &residuals[g];
+
+			if (in >= end)
+				throw std::runtime_error("Truncated chunk!");
+			const unsigned int width = *in++;
+
+			if (width == 0)
+			{
+				std::fill(r, r + n, 0);
+				continue;
+			}
+
+			if (width > 32 || in + (n * width + 7) / 8 > end)
+				throw std::runtime_error("Corrupt chunk!");
+
+			const uint64_t mask = (uint64_t(1) << width) - 1;
+			uint64_t buffer = 0;
+			unsigned int filled = 0;
+			for (size_t k = 0; k < n; ++k)
+			{
+				while (filled < width)
+				{
+					buffer |= (uint64_t)(*in++) << filled;
+					filled += 8;
+				}
+				r[k] = (uint32_t)(buffer & mask);
+				buffer >>= width;
+				filled -= width;
+			}
+		}
+
+		applyResiduals(&residuals[0], e, data);
+	}
+
+	// payload of a chunk: compressed if that is smaller, raw otherwise
+	void encodeChunk(const void* data, const ivec3& extent, unsigned int bytesPerVoxel, ChunkedVolumeWriter::Compression compression, std::vector<unsigned char>& payload)
+	{
+		const size_t rawSize = (size_t)extent.x * extent.y * extent.z * bytesPerVoxel;
+
+		if (compression == ChunkedVolumeWriter::COMPRESSION_DELTA)
+		{
+			bool compressed = false;
+			if (bytesPerVoxel == 1)
+				compressed = encodeDelta(static_cast<const unsigned char*>(data), extent, payload);
+			else if (bytesPerVoxel == 2)
+				compressed = encodeDelta(static_cast<const unsigned short*>(data), extent, payload);
+
+			if (compressed)
+				return;
+		}
+
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		payload.assign(bytes, bytes + rawSize);
+	}
+
+	// payloads of the raw size are stored uncompressed
+	void decodeChunk(const std::vector<unsigned char>& payload, const ivec3& extent, unsigned int bytesPerVoxel, void* data)
+	{
+		PROFILE_ZONE("Chunked::decodeChunk");
+		const size_t rawSize = (size_t)extent.x * extent.y * extent.z * bytesPerVoxel;
+
+		if (payload.empty())
+			memset(data, 0, rawSize);
+		else if (payload.size() == rawSize)
+			memcpy(data, &payload[0], rawSize);
+		else if (bytesPerVoxel == 1)
+			decodeDelta(&payload[0], payload.size(), extent, static_cast<unsigned char*>(data));
+		else if (bytesPerVoxel == 2)
+			decodeDelta(&payload[0], payload.size(), extent, static_cast<unsigned short*>(data));
+		else
+			throw std::runtime_error("Invalid chunk size!");
+	}
+
+	// copies the part of a chunk at origin that overlaps the region [rmin, rmax) into the region's data
+	void copyChunkToRegion(const unsigned char* chunk, const ivec3& origin, const ivec3& extent, const ivec3& rmin, const ivec3& rmax, unsigned int bytesPerVoxel, unsigned char* out)
+	{
+		const ivec3 size = rmax - rmin;
+		const ivec3 o0 = max(origin, rmin);
+		const ivec3 o1 = min(origin + extent, rmax);
+		const size_t rowBytes = (size_t)(o1.x - o0.x) * bytesPerVoxel;
+
+		for (int z = o0.z; z < o1.z; ++z)
+			for (int y = o0.y; y < o1.y; ++y)
+			{
+				const size_t src = (o0.x - origin.x) + extent.x * ((y - origin.y) + (size_t)extent.y * (z - origin.z));
+				const size_t dst = (o0.x - rmin.x) + size.x * ((y - rmin.y) + (size_t)size.y * (z - rmin.z));
+				memcpy(out + dst * bytesPerVoxel, chunk + src * bytesPerVoxel, rowBytes);
+			}
+	}
+
+	void readPayload(std::istream& in, uint64_t offset, uint64_t size, std::vector<unsigned char>& payload)
+	{
+		payload.resize((size_t)size);
+		if (size == 0)
+			return;
+
+		in.seekg(offset);
+		in.read(reinterpret_cast<char*>(&payload[0]), size);
+		if (!in)
+			throw std::runtime_error("Unable to read chunk!");
+
+		PROFILE_COUNT("bytes loaded", size);
+	}
+
+	// reads the region [rmin, rmax) of a level. The payloads are read sequentially and decoded in parallel
+	void readLevelRegion(std::istream& in, std::mutex& mutex, const uint64_t* levelIndex, const ivec3& levelRes, const ivec3& chunkSize, unsigned int bytesPerVoxel, const ivec3& rmin, const ivec3& rmax, void* data)
+	{
+		PROFILE_ZONE("Chunked::readRegion");
+		const ivec3 count = (levelRes + chunkSize - ivec3(1)) / chunkSize;
+		const ivec3 c0 = rmin / chunkSize;
+		const ivec3 c1 = (rmax + chunkSize - ivec3(1)) / chunkSize;
+
+		std::vector<ivec3> chunks;
+		for (int cz = c0.z; cz < c1.z; ++cz)
+			for (int cy = c0.y; cy < c1.y; ++cy)
+				for (int cx = c0.x; cx < c1.x; ++cx)
+					chunks.push_back(ivec3(cx, cy, cz));
+
+		std::vector<std::vector<unsigned char> > payloads(chunks.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t i = 0; i < chunks.size(); ++i)
+			{
+				const size_t k = linearChunkIndex(chunks[i], count);
+				readPayload(in, levelIndex[k * 2 + 0], levelIndex[k * 2 + 1], payloads[i]);
+			}
+		}
+
+		unsigned char* out = static_cast<unsigned char*>(data);
+
+		TaskScheduler::parallelFor(0, (int)chunks.size(), 1, [&](int first, int last)
+		{
+			std::vector<unsigned char> buffer((size_t)chunkSize.x * chunkSize.y * chunkSize.z * bytesPerVoxel);
+
+			for (int i = first; i < last; ++i)
+			{
+				const ivec3 origin = chunks[i] * chunkSize;
+				const ivec3 extent = min(chunkSize, levelRes - origin);
+
+				decodeChunk(payloads[i], extent, bytesPerVoxel, &buffer[0]);
+				std::vector<unsigned char>().swap(payloads[i]);
+
+				copyChunkToRegion(&buffer[0], origin, extent, rmin, rmax, bytesPerVoxel, out);
+			}
+		});
+	}
+
+	// 2x2x2 average of src (extent se) into dst (extent de). Voxels past the source's end are clamped
+	template <typename T>
+	void downsample(const T* src, const ivec3& se, T* dst, const ivec3& de)
+	{
+		for (int z = 0; z < de.z; ++z)
+			for (int y = 0; y < de.y; ++y)
+				for (int x = 0; x < de.x; ++x)
+				{
+					unsigned int sum = 0;
+					for (int k = 0; k < 8; ++k)
+					{
+						const int sx = std::min(x * 2 + (k & 1), se.x - 1);
+						const int sy = std::min(y * 2 + ((k >> 1) & 1), se.y - 1);
+						const int sz = std::min(z * 2 + (k >> 2), se.z - 1);
+						sum += src[sx + se.x * (sy + (size_t)se.y * sz)];
+					}
+					dst[x + de.x * (y + (size_t)de.y * z)] = (T)((sum + 4) / 8);
+				}
+	}
+}
+
+
+ChunkedVolumeWriter::ChunkedVolumeWriter(const std::string& f, const ivec3& res, const ivec3& cs, unsigned int bpv, const vec3& voxelSize, const mat4& transform, unsigned int l, Compression c) : filename(f), resolution(res), chunkSize(cs), bytesPerVoxel(bpv), levels(std::max(l, 1u)), compression(c)
+{
+	assert(all(greaterThan(chunkSize, ivec3(0))));
+
+	if (levels > 1 && bytesPerVoxel != 1 && bytesPerVoxel != 2)
+		throw std::runtime_error("Resolution levels are only supported for 8 and 16 bit volumes!");
+
+	file.open(filename, std::ios::binary);
+	if (!file.is_open())
+		throw std::runtime_error("Unable to open file \"" + filename + "\" for writing!");
+
+	index.resize(levelIndexStart(resolution, chunkSize, levels) * 2, 0);
+
+	const int32_t dims[6] = { res.x, res.y, res.z, cs.x, cs.y, cs.z };
+	const uint32_t compressionLevels[2] = { (uint32_t)compression, levels };
+	const uint64_t indexOffset = 0;
+
+	file.write(CHUNKED_MAGIC, 4);
+	file.write(reinterpret_cast<const char*>(&CHUNKED_VERSION), sizeof(uint32_t));
+	file.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+	file.write(reinterpret_cast<const char*>(&bytesPerVoxel), sizeof(uint32_t));
+	file.write(reinterpret_cast<const char*>(value_ptr(voxelSize)), sizeof(float) * 3);
+	file.write(reinterpret_cast<const char*>(value_ptr(transform)), sizeof(float) * 16);
+	file.write(reinterpret_cast<const char*>(compressionLevels), sizeof(compressionLevels));
+	file.write(reinterpret_cast<const char*>(&indexOffset), sizeof(uint64_t));
+
+	const ivec3 count = getChunkCount();
+	std::cout << "[Chunked] Writing " << res.x << "x" << res.y << "x" << res.z << " volume in " << count.x << "x" << count.y << "x" << count.z << " chunks, " << levels << " levels to \"" << filename << "\"\n";
+}
+
+ChunkedVolumeWriter::~ChunkedVolumeWriter()
+{
+	if (file.is_open())
+		close();
+}
+
+unsigned int ChunkedVolumeWriter::getDefaultLevelCount(const ivec3& resolution, const ivec3& chunkSize)
+{
+	unsigned int levels = 1;
+	while (any(greaterThan(levelResolution(resolution, levels - 1), chunkSize)))
+		++levels;
+	return levels;
+}
+
+void ChunkedVolumeWriter::writeChunk(const ivec3& chunk, const void* data)
+{
+	writeChunk(0, chunk, data);
+}
+
+void ChunkedVolumeWriter::writeChunk(unsigned int level, const ivec3& chunk, const void* data)
+{
+	const ivec3 levelRes = levelResolution(resolution, level);
+	const ivec3 extent = min(chunkSize, levelRes - chunk * chunkSize);
+	const size_t i = levelIndexStart(resolution, chunkSize, level) + linearChunkIndex(chunk, levelChunkCount(resolution, chunkSize, level));
+
+	// compress outside the lock, so chunks written from several threads are compressed in parallel
+	std::vector<unsigned char> payload;
+	encodeChunk(data, extent, bytesPerVoxel, compression, payload);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (!file.is_open())
+		throw std::runtime_error("Chunked volume \"" + filename + "\" is already closed!");
+
+	index[i * 2 + 0] = (uint64_t)file.tellp();
+	index[i * 2 + 1] = payload.size();
+	file.write(reinterpret_cast<const char*>(&payload[0]), payload.size());
+
+	if (!file)
+		throw std::runtime_error("Unable to write chunk to \"" + filename + "\"!");
+}
+
+void ChunkedVolumeWriter::writeVolume(const void* data)
+{
+	const ivec3 count = getChunkCount();
+	const int chunks = count.x * count.y * count.z;
+	const unsigned char* in = static_cast<const unsigned char*>(data);
+
+	TaskScheduler::parallelFor(0, chunks, 1, [&](int first, int last)
+	{
+		std::vector<unsigned char> buffer((size_t)chunkSize.x * chunkSize.y * chunkSize.z * bytesPerVoxel);
+
+		for (int i = first; i < last; ++i)
+		{
+			const ivec3 chunk(i % count.x, (i / count.x) % count.y, i / (count.x * count.y));
+			const ivec3 origin = chunk * chunkSize;
+			const ivec3 extent = getChunkExtent(chunk);
+			const size_t rowBytes = (size_t)extent.x * bytesPerVoxel;
+
+			for (int z = 0; z < extent.z; ++z)
+				for (int y = 0; y < extent.y; ++y)
+				{
+					const size_t src = origin.x + resolution.x * ((origin.y + y) + (size_t)resolution.y * (origin.z + z));
+					const size_t dst = extent.x * (y + (size_t)extent.y * z);
+					memcpy(&buffer[dst * bytesPerVoxel], in + src * bytesPerVoxel, rowBytes);
+				}
+
+			writeChunk(chunk, &buffer[0]);
+		}
+	});
+}
+
+void ChunkedVolumeWriter::buildLevel(unsigned int level)
+{
+	const ivec3 sourceRes = levelResolution(resolution, level - 1);
+	const ivec3 levelRes = levelResolution(resolution, level);
+	const ivec3 count = levelChunkCount(resolution, chunkSize, level);
+	const int chunks = count.x * count.y * count.z;
+
+	// read the previous level back from the file written so far
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		file.flush();
+	}
+	std::ifstream in(filename, std::ios::binary);
+	std::mutex inMutex;
+
+	const uint64_t* sourceIndex = &index[levelIndexStart(resolution, chunkSize, level - 1) * 2];
+
+	TaskScheduler::parallelFor(0, chunks, 1, [&](int first, int last)
+	{
+		std::vector<unsigned char> source((size_t)chunkSize.x * chunkSize.y * chunkSize.z * 8 * bytesPerVoxel);
+		std::vector<unsigned char> buffer((size_t)chunkSize.x * chunkSize.y * chunkSize.z * bytesPerVoxel);
+
+		for (int i = first; i < last; ++i)
+		{
+			const ivec3 chunk(i % count.x, (i / count.x) % count.y, i / (count.x * count.y));
+			const ivec3 origin = chunk * chunkSize;
+			const ivec3 extent = min(chunkSize, levelRes - origin);
+
+			const ivec3 smin = origin * 2;
+			const ivec3 smax = min((origin + extent) * 2, sourceRes);
+
+			readLevelRegion(in, inMutex, sourceIndex, sourceRes, chunkSize, bytesPerVoxel, smin, smax, &source[0]);
+
+			if (bytesPerVoxel == 1)
+				downsample(&source[0], smax - smin, &buffer[0], extent);
+			else
+				downsample(reinterpret_cast<const unsigned short*>(&source[0]), smax - smin, reinterpret_cast<unsigned short*>(&buffer[0]), extent);
+
+			writeChunk(level, chunk, &buffer[0]);
+		}
+	});
+}
+
+void ChunkedVolumeWriter::close()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!file.is_open())
+			return;
+	}
+
+	for (unsigned int l = 1; l < levels; ++l)
+		buildLevel(l);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const uint64_t indexOffset = (uint64_t)file.tellp();
+	file.write(reinterpret_cast<const char*>(&index[0]), sizeof(uint64_t) * index.size());
+
+	// compare the stored size with the raw size of all levels
+	uint64_t stored = 0, raw = 0;
+	for (unsigned int l = 0; l < levels; ++l)
+	{
+		const ivec3 r = levelResolution(resolution, l);
+		raw += (uint64_t)r.x * r.y * r.z * bytesPerVoxel;
+	}
+	for (size_t i = 0; i < index.size(); i += 2)
+		stored += index[i + 1];
+
+	file.seekp(CHUNKED_HEADER_SIZE - sizeof(uint64_t));
+	file.write(reinterpret_cast<const char*>(&indexOffset), sizeof(uint64_t));
+	file.close();
+
+	std::cout << "[Chunked] Closed \"" << filename << "\", " << stored << " of " << raw << " bytes (" << (stored > 0 ? (double)raw / stored : 0.0) << "x)\n";
+}
+
+
+ChunkedVolumeReader::ChunkedVolumeReader(const std::string& f) : filename(f), transform(1.f), levels(1), compression(ChunkedVolumeWriter::COMPRESSION_NONE)
+{
+	file.open(filename, std::ios::binary);
+	if (!file.is_open())
+		throw std::runtime_error("Unable to open file \"" + filename + "\"!");
+
+	char magic[4];
+	file.read(magic, 4);
+	if (memcmp(magic, CHUNKED_MAGIC, 4) != 0)
+		throw std::runtime_error("File \"" + filename + "\" is not a chunked volume!");
+
+	uint32_t version = 0;
+	int32_t dims[6];
+	uint64_t indexOffset = 0;
+
+	file.read(reinterpret_cast<char*>(&version), sizeof(uint32_t));
+	if (version != CHUNKED_VERSION)
+		throw std::runtime_error("Unsupported chunked volume version " + std::to_string(version) + " in \"" + filename + "\"!");
+
+	uint32_t compressionLevels[2];
+	file.read(reinterpret_cast<char*>(dims), sizeof(dims));
+	file.read(reinterpret_cast<char*>(&bytesPerVoxel), sizeof(uint32_t));
+	file.read(reinterpret_cast<char*>(value_ptr(voxelSize)), sizeof(float) * 3);
+	file.read(reinterpret_cast<char*>(value_ptr(transform)), sizeof(float) * 16);
+	file.read(reinterpret_cast<char*>(compressionLevels), sizeof(compressionLevels));
+	compression = (ChunkedVolumeWriter::Compression)compressionLevels[0];
+	levels = compressionLevels[1];
+
+	file.read(reinterpret_cast<char*>(&indexOffset), sizeof(uint64_t));
+
+	if (indexOffset == 0)
+		throw std::runtime_error("Chunked volume \"" + filename + "\" was not closed properly!");
+
+	resolution = ivec3(dims[0], dims[1], dims[2]);
+	chunkSize = ivec3(dims[3], dims[4], dims[5]);
+
+	index.resize(levelIndexStart(resolution, chunkSize, levels) * 2);
+
+	file.seekg(indexOffset);
+	file.read(reinterpret_cast<char*>(&index[0]), sizeof(uint64_t) * index.size());
+
+	if (!file)
+		throw std::runtime_error("Unable to read chunk index from \"" + filename + "\"!");
+}
+
+ivec3 ChunkedVolumeReader::getResolution(unsigned int level) const
+{
+	return levelResolution(resolution, level);
+}
+
+size_t ChunkedVolumeReader::getChunkIndex(const ivec3& chunk, unsigned int level) const
+{
+	return levelIndexStart(resolution, chunkSize, level) + linearChunkIndex(chunk, getChunkCount(level));
+}
+
+void ChunkedVolumeReader::readPayload(const ivec3& chunk, unsigned int level, std::vector<unsigned char>& payload) const
+{
+	const size_t i = getChunkIndex(chunk, level);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	::readPayload(file, index[i * 2 + 0], index[i * 2 + 1], payload);
+}
+
+void ChunkedVolumeReader::decodePayload(const std::vector<unsigned char>& payload, const ivec3& extent, void* data) const
+{
+	try
+	{
+		decodeChunk(payload, extent, bytesPerVoxel, data);
+	}
+	catch (const std::runtime_error& e)
+	{
+		throw std::runtime_error(std::string(e.what()) + " in \"" + filename + "\"");
+	}
+}
+
+void ChunkedVolumeReader::readChunk(const ivec3& chunk, void* data, unsigned int level) const
+{
+	if (level >= levels)
+		throw std::runtime_error("Invalid level " + std::to_string(level) + " of \"" + filename + "\"!");
+
+	std::vector<unsigned char> payload;
+	readPayload(chunk, level, payload);
+	decodePayload(payload, getChunkExtent(chunk, level), data);
+}
+
+void ChunkedVolumeReader::readRegion(const ivec3& rmin, const ivec3& rmax, void* data, unsigned int level) const
+{
+	if (level >= levels)
+		throw std::runtime_error("Invalid level " + std::to_string(level) + " of \"" + filename + "\"!");
+
+	readLevelRegion(file, mutex, &index[levelIndexStart(resolution, chunkSize, level) * 2], getResolution(level), chunkSize, bytesPerVoxel, rmin, rmax, data);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <boost/noncopyable.hpp>
+
+/// Chunked on-disk volume
+/**	The volume is split into fixed-size 3D chunks that are stored independently and can be written in any
+	order, so a volume can be produced and read piece by piece without ever holding it in memory.
+
+	File layout: header (resolution, chunk size, voxel format, voxel size, transform, compression, level
+	count), chunk payloads, chunk index (offset and size of every chunk of every level, written last). Each
+	chunk is stored in x-y-z order with its clipped size at the volume borders. Chunks that were never
+	written read back as zeros.
+
+	8 and 16 bit chunks are compressed by predicting every voxel from its neighbour and bit packing the
+	residuals in groups of 32. Constant areas cost one byte per group, noisy 16 bit data typically shrinks
+	2-4x. Chunks that do not compress are stored raw.
+
+	Level 0 is the full resolution volume, every further level halves the resolution and is built from the
+	previous one when the writer is closed.
+*/
+class ChunkedVolumeWriter : boost::noncopyable
+{
+public:
+	enum Compression
+	{
+		COMPRESSION_NONE = 0,
+		// neighbour prediction and bit packing, for 8 and 16 bit voxels
+		COMPRESSION_DELTA
+	};
+
+	ChunkedVolumeWriter(const std::string& filename, const glm::ivec3& resolution, const glm::ivec3& chunkSize, unsigned int bytesPerVoxel, const glm::vec3& voxelSize, const glm::mat4& transform = glm::mat4(1.f), unsigned int levels = 1, Compression compression = COMPRESSION_DELTA);
+	~ChunkedVolumeWriter();
+
+	/// writes a single chunk of level 0. data holds getChunkExtent(chunk) voxels. Thread safe, chunks are compressed in parallel
+	void writeChunk(const glm::ivec3& chunk, const void* data);
+	/// writes a whole volume in memory, compressing the chunks in parallel
+	void writeVolume(const void* data);
+	/// builds the lower resolution levels, writes the chunk index and closes the file
+	void close();
+
+	inline const glm::ivec3& getResolution() const { return resolution; }
+	inline const glm::ivec3& getChunkSize() const { return chunkSize; }
+	inline glm::ivec3 getChunkCount() const { return (resolution + chunkSize - glm::ivec3(1)) / chunkSize; }
+	/// the number of voxels of the chunk in each dimension, smaller than the chunk size at the borders
+	inline glm::ivec3 getChunkExtent(const glm::ivec3& chunk) const { return glm::min(chunkSize, resolution - chunk*chunkSize); }
+
+	/// number of levels until the coarsest one fits into a single chunk
+	static unsigned int getDefaultLevelCount(const glm::ivec3& resolution, const glm::ivec3& chunkSize);
+
+private:
+	std::ofstream			file;
+	std::string				filename;
+	std::mutex				mutex;
+
+	glm::ivec3				resolution, chunkSize;
+	unsigned int			bytesPerVoxel;
+	unsigned int			levels;
+	Compression				compression;
+
+	// offset, size for every chunk of every level
+	std::vector<uint64_t>	index;
+
+	void writeChunk(unsigned int level, const glm::ivec3& chunk, const void* data);
+	void buildLevel(unsigned int level);
+};
+
+class ChunkedVolumeReader : boost::noncopyable
+{
+public:
+	ChunkedVolumeReader(const std::string& filename);
+
+	/// reads a single chunk into data, which has to hold getChunkExtent(chunk, level) voxels. Thread safe
+	void readChunk(const glm::ivec3& chunk, void* data, unsigned int level = 0) const;
+	/// reads the region [min, max) of a level into data in x-y-z order. Only the overlapping chunks are read, they are decompressed in parallel
+	void readRegion(const glm::ivec3& min, const glm::ivec3& max, void* data, unsigned int level = 0) const;
+
+	inline const glm::ivec3& getResolution() const { return resolution; }
+	inline const glm::ivec3& getChunkSize() const { return chunkSize; }
+	inline const glm::vec3& getVoxelSize() const { return voxelSize; }
+	inline const glm::mat4& getTransform() const { return transform; }
+	inline unsigned int getBytesPerVoxel() const { return bytesPerVoxel; }
+	inline unsigned int getLevelCount() const { return levels; }
+	inline ChunkedVolumeWriter::Compression getCompression() const { return compression; }
+
+	/// resolution of a level, halved (rounded up) for every level
+	glm::ivec3 getResolution(unsigned int level) const;
+	/// voxel size of a level, doubled for every level
+	inline glm::vec3 getVoxelSize(unsigned int level) const { return voxelSize * float(1 << level); }
+
+	inline glm::ivec3 getChunkCount(unsigned int level = 0) const { return (getResolution(level) + chunkSize - glm::ivec3(1)) / chunkSize; }
+	inline glm::ivec3 getChunkExtent(const glm::ivec3& chunk, unsigned int level = 0) const { return glm::min(chunkSize, getResolution(level) - chunk*chunkSize); }
+
+private:
+	mutable std::ifstream	file;
+	mutable std::mutex		mutex;
+	std::string				filename;
+
+	glm::ivec3				resolution, chunkSize;
+	glm::vec3				voxelSize;
+	glm::mat4				transform;
+	unsigned int			bytesPerVoxel;
+	unsigned int			levels;
+	ChunkedVolumeWriter::Compression	compression;
+
+	std::vector<uint64_t>	index;
+
+	size_t getChunkIndex(const glm::ivec3& chunk, unsigned int level) const;
+	// reads the stored bytes of a chunk, empty if it was never written
+	void readPayload(const glm::ivec3& chunk, unsigned int level, std::vector<unsigned char>& payload) const;
+	void decodePayload(const std::vector<unsigned char>& payload, const glm::ivec3& extent, void* data) const;
+};
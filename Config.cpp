@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <iterator>
 
 #include <glm/gtx/io.hpp>
 
@@ -17,10 +19,37 @@ void Config::setDefaults()
 
 	resampleResolution = glm::ivec3(512, 512, 64);
 
+	pointBudget = 2000000;
+	downsampleCellSize = 0.01f;
+	outlierNeighbours = 8;
+	outlierStdDevMul = 1.f;
+
+	fusionFeatherWidth = 0.f;
+	fusionContentWeight = MultiViewFusion::CONTENT_NONE;
+	fusionMemoryBudget = 2048;
+	fusionChunkSize = 64;
+
+	datasetMemoryBudget = 4096;
+	datasetPrefetch = 2;
+	timelapseSampleCount = 4096;
+	timelapseDriftCorrection = true;
+
+	gaussianSigma = 1.f;
+	gaussianRadius = 1;
+	medianWindow = glm::ivec3(1);
+
+	textureMemoryBudget = 2048;
+
 	threshold.set(0, 255);
 }
 
 
+bool Config::isKey(const string& name)
+{
+	static const char* KEYS[] = { "voxelSize", "raytraceSteps", "raytraceDelta", "minThreshold", "maxThreshold", "resampleResolution", "pointBudget", "downsampleCellSize", "outlierFilter", "fusionFeather", "fusionContentWeight", "fusionMemoryBudget", "fusionChunkSize", "datasetMemoryBudget", "datasetPrefetch", "timelapseSampleCount", "timelapseDriftCorrection", "gaussianFilter", "medianFilter", "textureMemoryBudget" };
+	return find(begin(KEYS), end(KEYS), name) != end(KEYS);
+}
+
 void Config::load(const string& filename)
 {
 	ifstream file(filename);
@@ -71,6 +100,83 @@ void Config::load(const string& filename)
 			file >> resampleResolution.x >> resampleResolution.y >> resampleResolution.z;
 			cout << "[Config] Resample resolution: " << resampleResolution << endl;
 		}
+		if (temp == "pointBudget")
+		{
+			file >> pointBudget;
+			cout << "[Config] Point budget: " << pointBudget << endl;
+		}
+		if (temp == "downsampleCellSize")
+		{
+			file >> downsampleCellSize;
+			cout << "[Config] Downsample cell size: " << downsampleCellSize << endl;
+		}
+		if (temp == "outlierFilter")
+		{
+			file >> outlierNeighbours >> outlierStdDevMul;
+			cout << "[Config] Outlier filter: " << outlierNeighbours << " neighbours, " << outlierStdDevMul << " std dev\n";
+		}
+		if (temp == "fusionFeather")
+		{
+			file >> fusionFeatherWidth;
+			cout << "[Config] Fusion feather width: " << fusionFeatherWidth << endl;
+		}
+		if (temp == "fusionContentWeight")
+		{
+			string type;
+			file >> type;
+			if (type == "contrast")
+				fusionContentWeight = MultiViewFusion::CONTENT_CONTRAST;
+			else if (type == "entropy")
+				fusionContentWeight = MultiViewFusion::CONTENT_ENTROPY;
+			else
+				fusionContentWeight = MultiViewFusion::CONTENT_NONE;
+			cout << "[Config] Fusion content weight: " << type << endl;
+		}
+		if (temp == "fusionMemoryBudget")
+		{
+			file >> fusionMemoryBudget;
+			cout << "[Config] Fusion memory budget: " << fusionMemoryBudget << "MB" << endl;
+		}
+		if (temp == "fusionChunkSize")
+		{
+			file >> fusionChunkSize;
+			cout << "[Config] Fusion chunk size: " << fusionChunkSize << endl;
+		}
+		if (temp == "datasetMemoryBudget")
+		{
+			file >> datasetMemoryBudget;
+			cout << "[Config] Dataset memory budget: " << datasetMemoryBudget << "MB" << endl;
+		}
+		if (temp == "datasetPrefetch")
+		{
+			file >> datasetPrefetch;
+			cout << "[Config] Dataset prefetch: " << datasetPrefetch << " timepoints" << endl;
+		}
+		if (temp == "timelapseSampleCount")
+		{
+			file >> timelapseSampleCount;
+			cout << "[Config] Timelapse samples: " << timelapseSampleCount << endl;
+		}
+		if (temp == "timelapseDriftCorrection")
+		{
+			file >> timelapseDriftCorrection;
+			cout << "[Config] Timelapse drift correction: " << (timelapseDriftCorrection ? "on" : "off") << endl;
+		}
+		if (temp == "gaussianFilter")
+		{
+			file >> gaussianSigma >> gaussianRadius;
+			cout << "[Config] Gaussian filter: sigma " << gaussianSigma << ", radius " << gaussianRadius << endl;
+		}
+		if (temp == "medianFilter")
+		{
+			file >> medianWindow.x >> medianWindow.y >> medianWindow.z;
+			cout << "[Config] Median filter window: " << medianWindow << endl;
+		}
+		if (temp == "textureMemoryBudget")
+		{
+			file >> textureMemoryBudget;
+			cout << "[Config] Texture memory budget: " << textureMemoryBudget << "MB" << endl;
+		}
 	}
 
 
@@ -97,4 +203,29 @@ void Config::save(const string& filename) const
 
 	file << "# resampling\n";
 	file << "resampleResolution " << resampleResolution.x << " " << resampleResolution.y << " " << resampleResolution.z << endl;
+
+	file << "# point clouds\n";
+	file << "pointBudget " << pointBudget << endl;
+	file << "downsampleCellSize " << downsampleCellSize << endl;
+	file << "outlierFilter " << outlierNeighbours << " " << outlierStdDevMul << endl;
+
+	const char* contentWeightNames[] = { "none", "contrast", "entropy" };
+	file << "# fusion\n";
+	file << "fusionFeather " << fusionFeatherWidth << endl;
+	file << "fusionContentWeight " << contentWeightNames[fusionContentWeight] << endl;
+	file << "fusionMemoryBudget " << fusionMemoryBudget << endl;
+	file << "fusionChunkSize " << fusionChunkSize << endl;
+
+	file << "# time series\n";
+	file << "datasetMemoryBudget " << datasetMemoryBudget << endl;
+	file << "datasetPrefetch " << datasetPrefetch << endl;
+	file << "timelapseSampleCount " << timelapseSampleCount << endl;
+	file << "timelapseDriftCorrection " << timelapseDriftCorrection << endl;
+
+	file << "# filters\n";
+	file << "gaussianFilter " << gaussianSigma << " " << gaussianRadius << endl;
+	file << "medianFilter " << medianWindow.x << " " << medianWindow.y << " " << medianWindow.z << endl;
+
+	file << "# display\n";
+	file << "textureMemoryBudget " << textureMemoryBudget << endl;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <glm/glm.hpp>
 
 #include "StackRegistration.h"
+#include "MultiViewFusion.h"
 
 struct Config
 {
@@ -14,6 +15,36 @@ struct Config
 	
 	unsigned int	raytraceSteps;
 	float			raytraceDelta;
+
+	// maximum number of points drawn per point cloud
+	size_t			pointBudget;
+
+	// point cloud filter settings
+	float			downsampleCellSize;
+	unsigned int	outlierNeighbours;
+	float			outlierStdDevMul;
+
+	// multi-view fusion weights
+	float							fusionFeatherWidth;
+	MultiViewFusion::ContentWeight	fusionContentWeight;
+	// memory budget of tiled fusion in MB
+	size_t							fusionMemoryBudget;
+	unsigned int					fusionChunkSize;
+
+	// time series cache size in MB and number of timepoints loaded ahead
+	size_t			datasetMemoryBudget;
+	unsigned int	datasetPrefetch;
+	// samples per timepoint of the time-lapse registration
+	unsigned int	timelapseSampleCount;
+	bool			timelapseDriftCorrection;
+
+	// filters applied to the selected stack
+	float			gaussianSigma;
+	int				gaussianRadius;
+	glm::ivec3		medianWindow;
+
+	// GPU memory for all stack textures and their atlas copy in MB, stacks are displayed at lower resolution beyond it
+	size_t			textureMemoryBudget;
 	
 	Threshold		threshold;
 
@@ -24,4 +55,7 @@ struct Config
 	void load(const std::string& filename);
 	void save(const std::string& filename) const;
 
+	/// true for the names of the settings load() reads
+	static bool isKey(const std::string& name);
+
 };
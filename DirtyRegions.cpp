@@ -0,0 +1,96 @@
+#include "DirtyRegions.h"
+
+#include <algorithm>
+
+// two boxes are merged if their bounding box has at most this many more voxels than both of them
+static const float MERGE_SLACK = 0.25f;
+// the whole volume is dirty once the boxes cover this fraction of it
+static const float FULL_COVERAGE = 0.5f;
+
+DirtyRegions::DirtyRegions() : resolution(0)
+{
+}
+
+void DirtyRegions::add(const glm::ivec3& min, const glm::ivec3& max)
+{
+	const Box box(glm::max(min, glm::ivec3(0)), glm::min(max, resolution));
+	if (box.isEmpty())
+		return;
+
+	for (size_t i = 0; i < boxes.size(); ++i)
+		if (boxes[i].contains(box))
+			return;
+
+	boxes.erase(std::remove_if(boxes.begin(), boxes.end(), [&box](const Box& b) { return box.contains(b); }), boxes.end());
+	boxes.push_back(box);
+	coalesce();
+
+	const Box all(glm::ivec3(0), resolution);
+	if (getVoxelCount() >= FULL_COVERAGE * all.getVoxelCount())
+		boxes.assign(1, all);
+	else if (boxes.size() > MAX_BOXES)
+	{
+		// one upload of everything the boxes span
+		Box bounds = boxes[0];
+		for (size_t i = 1; i < boxes.size(); ++i)
+		{
+			bounds.min = glm::min(bounds.min, boxes[i].min);
+			bounds.max = glm::max(bounds.max, boxes[i].max);
+		}
+
+		boxes.assign(1, bounds);
+	}
+}
+
+void DirtyRegions::addAll(const glm::ivec3& res)
+{
+	resolution = res;
+	boxes.clear();
+
+	const Box all(glm::ivec3(0), resolution);
+	if (!all.isEmpty())
+		boxes.push_back(all);
+}
+
+void DirtyRegions::clear()
+{
+	boxes.clear();
+}
+
+bool DirtyRegions::isAll() const
+{
+	return boxes.size() == 1 && boxes[0].min == glm::ivec3(0) && boxes[0].max == resolution;
+}
+
+size_t DirtyRegions::getVoxelCount() const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < boxes.size(); ++i)
+		count += boxes[i].getVoxelCount();
+	return count;
+}
+
+void DirtyRegions::coalesce()
+{
+	bool merged = true;
+	while (merged)
+	{
+		merged = false;
+		for (size_t i = 0; i < boxes.size() && !merged; ++i)
+		{
+			for (size_t j = i + 1; j < boxes.size() && !merged; ++j)
+			{
+				const Box bounds(glm::min(boxes[i].min, boxes[j].min), glm::max(boxes[i].max, boxes[j].max));
+
+				// also merges boxes inside each other, and overlapping ones count their shared voxels twice
+				const size_t both = boxes[i].getVoxelCount() + boxes[j].getVoxelCount();
+				if (bounds.getVoxelCount() <= both + (size_t)(MERGE_SLACK * both))
+				{
+					boxes[i] = bounds;
+					boxes.erase(boxes.begin() + j);
+					merged = true;
+				}
+			}
+		}
+	}
+}
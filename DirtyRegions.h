@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/// Boxes of a volume that changed since they were last uploaded to the GPU
+/**	Boxes are merged as they come in. Boxes inside another one are dropped, and two boxes become their
+	bounding box if that is barely larger than both together, so consecutive planes or neighbouring
+	bricks end up as a single upload. Beyond MAX_BOXES boxes, or once most of the volume is covered, the
+	whole volume is dirty: a full upload is cheaper than many small ones then.
+
+	Pure bookkeeping without any GL calls; SpimStack keeps one per texture.
+*/
+class DirtyRegions
+{
+public:
+	/// voxels [min, max)
+	struct Box
+	{
+		glm::ivec3		min, max;
+
+		inline Box() : min(0), max(0) {}
+		inline Box(const glm::ivec3& mn, const glm::ivec3& mx) : min(mn), max(mx) {}
+
+		inline bool isEmpty() const { return glm::any(glm::lessThanEqual(max, min)); }
+		inline size_t getVoxelCount() const { return isEmpty() ? 0 : (size_t)(max.x - min.x) * (max.y - min.y) * (max.z - min.z); }
+		inline bool contains(const Box& b) const { return glm::all(glm::lessThanEqual(min, b.min)) && glm::all(glm::greaterThanEqual(max, b.max)); }
+	};
+
+	static const size_t MAX_BOXES = 8;
+
+	DirtyRegions();
+
+	/// marks the voxels [min, max) as changed, clipped to the volume
+	void add(const glm::ivec3& min, const glm::ivec3& max);
+	/// marks the whole volume of the given resolution as changed, the resolution also clips all later boxes
+	void addAll(const glm::ivec3& resolution);
+	/// called after uploading, the resolution is kept
+	void clear();
+
+	inline bool isEmpty() const { return boxes.empty(); }
+	/// true if the whole volume is dirty
+	bool isAll() const;
+
+	inline const std::vector<Box>& getBoxes() const { return boxes; }
+	size_t getVoxelCount() const;
+
+private:
+	glm::ivec3			resolution;
+	std::vector<Box>	boxes;
+
+	// merges boxes until no pair qualifies anymore
+	void coalesce();
+};
@@ -0,0 +1,181 @@
+#include "GradientField.h"
+#include "SpimStack.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+using namespace glm;
+
+namespace GradientField
+{
+	template <typename T>
+	static inline vec3 gradient(const T* v, const ivec3& res, int x, int y, int z, Operator op)
+	{
+		const size_t sy = (size_t)res.x;
+		const size_t sz = (size_t)res.x * res.y;
+
+		const int x0 = std::max(x - 1, 0), x1 = std::min(x + 1, res.x - 1);
+		const int y0 = std::max(y - 1, 0), y1 = std::min(y + 1, res.y - 1);
+		const int z0 = std::max(z - 1, 0), z1 = std::min(z + 1, res.z - 1);
+
+		// 2 inside the volume, 1 at the borders
+		const vec3 d(std::max(x1 - x0, 1), std::max(y1 - y0, 1), std::max(z1 - z0, 1));
+
+		if (op == CENTRAL_DIFFERENCES)
+		{
+			return vec3(float(v[x1 + y*sy + z*sz]) - float(v[x0 + y*sy + z*sz]),
+						float(v[x + y1*sy + z*sz]) - float(v[x + y0*sy + z*sz]),
+						float(v[x + y*sy + z1*sz]) - float(v[x + y*sy + z0*sz])) / d;
+		}
+
+		// Sobel: derivative along one axis, [1 2 1] smoothing along the other two
+		const int xs[3] = { x0, x, x1 }, ys[3] = { y0, y, y1 }, zs[3] = { z0, z, z1 };
+		const float w[3] = { 1.f, 2.f, 1.f };
+
+		vec3 g(0.f);
+		for (int b = 0; b < 3; ++b)
+		{
+			for (int a = 0; a < 3; ++a)
+			{
+				const float wab = w[a] * w[b];
+				g.x += wab * (float(v[x1 + ys[a] * sy + zs[b] * sz]) - float(v[x0 + ys[a] * sy + zs[b] * sz]));
+				g.y += wab * (float(v[xs[a] + y1 * sy + zs[b] * sz]) - float(v[xs[a] + y0 * sy + zs[b] * sz]));
+				g.z += wab * (float(v[xs[a] + ys[b] * sy + z1 * sz]) - float(v[xs[a] + ys[b] * sy + z0 * sz]));
+			}
+		}
+
+		return g / (d * 16.f);
+	}
+
+	template <typename T, typename F>
+	static void calculateDense(const T* volume, const ivec3& res, const Options& opt, F store)
+	{
+		const vec3 invSpacing = vec3(1.f) / opt.spacing;
+
+		TaskScheduler::parallelFor(0, res.z, 1, [&](int z0, int z1)
+		{
+			for (int z = z0; z < z1; ++z)
+			{
+				size_t i = (size_t)z * res.x * res.y;
+				for (int y = 0; y < res.y; ++y)
+				{
+					for (int x = 0; x < res.x; ++x, ++i)
+					{
+						if (opt.useThreshold && float(volume[i]) < opt.threshold)
+							store(i, vec3(0.f));
+						else
+							store(i, gradient(volume, res, x, y, z, opt.op) * invSpacing);
+					}
+				}
+			}
+		});
+	}
+
+	template <typename T>
+	void calculate(const T* volume, const ivec3& res, std::vector<vec3>& gradients, const Options& opt)
+	{
+		gradients.resize((size_t)res.x * res.y * res.z);
+		vec3* out = gradients.data();
+
+		calculateDense(volume, res, opt, [out](size_t i, const vec3& g) { out[i] = g; });
+	}
+
+	template <typename T>
+	void calculate(const T* volume, const ivec3& res, std::vector<i16vec3>& gradients, float scale, const Options& opt)
+	{
+		gradients.resize((size_t)res.x * res.y * res.z);
+		i16vec3* out = gradients.data();
+
+		calculateDense(volume, res, opt, [out, scale](size_t i, const vec3& g)
+		{
+			const vec3 q = clamp(round(g * scale), vec3(-32767.f), vec3(32767.f));
+			out[i] = i16vec3(q);
+		});
+	}
+
+	template <typename T>
+	vec3 calculateAt(const T* volume, const ivec3& res, const ivec3& c, const Options& opt)
+	{
+		return gradient(volume, res, c.x, c.y, c.z, opt.op) / opt.spacing;
+	}
+
+	template <typename T>
+	void calculateAt(const T* volume, const ivec3& res, const std::vector<size_t>& indices, std::vector<vec3>& gradients, const Options& opt)
+	{
+		gradients.resize(indices.size());
+		const vec3 invSpacing = vec3(1.f) / opt.spacing;
+		const size_t plane = (size_t)res.x * res.y;
+
+		TaskScheduler::parallelFor(0, (int)indices.size(), 4096, [&](int first, int last)
+		{
+			for (int i = first; i < last; ++i)
+			{
+				const size_t index = indices[i];
+				const int z = (int)(index / plane);
+				const int y = (int)((index % plane) / res.x);
+				const int x = (int)(index % res.x);
+
+				gradients[i] = gradient(volume, res, x, y, z, opt.op) * invSpacing;
+			}
+		});
+	}
+
+	template void calculate(const unsigned char*, const ivec3&, std::vector<vec3>&, const Options&);
+	template void calculate(const unsigned short*, const ivec3&, std::vector<vec3>&, const Options&);
+	template void calculate(const float*, const ivec3&, std::vector<vec3>&, const Options&);
+	template void calculate(const unsigned char*, const ivec3&, std::vector<i16vec3>&, float, const Options&);
+	template void calculate(const unsigned short*, const ivec3&, std::vector<i16vec3>&, float, const Options&);
+	template void calculate(const float*, const ivec3&, std::vector<i16vec3>&, float, const Options&);
+	template vec3 calculateAt(const unsigned char*, const ivec3&, const ivec3&, const Options&);
+	template vec3 calculateAt(const unsigned short*, const ivec3&, const ivec3&, const Options&);
+	template vec3 calculateAt(const float*, const ivec3&, const ivec3&, const Options&);
+	template void calculateAt(const unsigned char*, const ivec3&, const std::vector<size_t>&, std::vector<vec3>&, const Options&);
+	template void calculateAt(const unsigned short*, const ivec3&, const std::vector<size_t>&, std::vector<vec3>&, const Options&);
+	template void calculateAt(const float*, const ivec3&, const std::vector<size_t>&, std::vector<vec3>&, const Options&);
+
+
+	void calculate(const SpimStack* stack, std::vector<vec3>& gradients, Options opt)
+	{
+		PROFILE_ZONE("GradientField::calculate");
+		PROFILE_COUNT("voxels processed", stack->getVoxelCount());
+
+		opt.spacing = stack->getVoxelDimensions();
+
+		if (stack->getBytesPerVoxel() == 1)
+			calculate(static_cast<const unsigned char*>(stack->getData()), stack->getResolution(), gradients, opt);
+		else if (stack->getBytesPerVoxel() == 2)
+			calculate(static_cast<const unsigned short*>(stack->getData()), stack->getResolution(), gradients, opt);
+		else
+			throw std::runtime_error("Unsupported stack voxel format!");
+	}
+
+	void calculate(const SpimStack* stack, std::vector<i16vec3>& gradients, float scale, Options opt)
+	{
+		PROFILE_ZONE("GradientField::calculate");
+		PROFILE_COUNT("voxels processed", stack->getVoxelCount());
+
+		opt.spacing = stack->getVoxelDimensions();
+
+		if (stack->getBytesPerVoxel() == 1)
+			calculate(static_cast<const unsigned char*>(stack->getData()), stack->getResolution(), gradients, scale, opt);
+		else if (stack->getBytesPerVoxel() == 2)
+			calculate(static_cast<const unsigned short*>(stack->getData()), stack->getResolution(), gradients, scale, opt);
+		else
+			throw std::runtime_error("Unsupported stack voxel format!");
+	}
+
+	void calculateAt(const SpimStack* stack, const std::vector<size_t>& indices, std::vector<vec3>& gradients, Options opt)
+	{
+		opt.spacing = stack->getVoxelDimensions();
+
+		if (stack->getBytesPerVoxel() == 1)
+			calculateAt(static_cast<const unsigned char*>(stack->getData()), stack->getResolution(), indices, gradients, opt);
+		else if (stack->getBytesPerVoxel() == 2)
+			calculateAt(static_cast<const unsigned short*>(stack->getData()), stack->getResolution(), indices, gradients, opt);
+		else
+			throw std::runtime_error("Unsupported stack voxel format!");
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+class SpimStack;
+
+/// Gradient kernels for raw volumes
+/**	All three components are computed in a single pass in memory order. The volume is split into z-slabs
+	that are processed in parallel; every slab reads its halo planes directly from the shared input and
+	borders are clamped. Gradients are in intensity units per world unit, i.e. divided by the voxel spacing.
+
+	Implemented for unsigned char, unsigned short and float volumes.
+*/
+namespace GradientField
+{
+	enum Operator
+	{
+		// [-1 0 1] / 2 along each axis
+		CENTRAL_DIFFERENCES = 0,
+		// 3x3x3 Sobel-Feldman operator, normalized to the same magnitude as central differences
+		SOBEL
+	};
+
+	struct Options
+	{
+		Operator		op;
+		// voxel size
+		glm::vec3		spacing;
+
+		// only compute gradients for voxels >= threshold, all others are set to zero
+		bool			useThreshold;
+		float			threshold;
+
+		inline Options() : op(CENTRAL_DIFFERENCES), spacing(1.f), useThreshold(false), threshold(0.f) {}
+	};
+
+	/// dense float gradient field, resized to res.x*res.y*res.z
+	template <typename T>
+	void calculate(const T* volume, const glm::ivec3& res, std::vector<glm::vec3>& gradients, const Options& opt = Options());
+
+	/// dense quantized gradient field. Every component is round(g * scale), clamped to the int16 range
+	template <typename T>
+	void calculate(const T* volume, const glm::ivec3& res, std::vector<glm::i16vec3>& gradients, float scale, const Options& opt = Options());
+
+	/// gradient of a single voxel
+	template <typename T>
+	glm::vec3 calculateAt(const T* volume, const glm::ivec3& res, const glm::ivec3& coords, const Options& opt = Options());
+
+	/// gradients of the given voxel indices only, in parallel. The threshold option is ignored.
+	template <typename T>
+	void calculateAt(const T* volume, const glm::ivec3& res, const std::vector<size_t>& indices, std::vector<glm::vec3>& gradients, const Options& opt = Options());
+
+
+	/// convenience versions for stacks, using the stack's voxel dimensions as spacing
+	void calculate(const SpimStack* stack, std::vector<glm::vec3>& gradients, Options opt = Options());
+	void calculate(const SpimStack* stack, std::vector<glm::i16vec3>& gradients, float scale, Options opt = Options());
+	void calculateAt(const SpimStack* stack, const std::vector<size_t>& indices, std::vector<glm::vec3>& gradients, Options opt = Options());
+}
@@ -23,6 +23,7 @@ AABB InteractionVolume::getTransformedBBox() const
 	vector<vec3> verts = getBBox().getVertices();
 
 	AABB bbox;
+	bbox.reset();
 	for (size_t i = 0; i < verts.size(); ++i)
 	{
 		vec4 v = transform * vec4(verts[i], 1.f);
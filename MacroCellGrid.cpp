@@ -0,0 +1,128 @@
+#include "MacroCellGrid.h"
+#include "TaskScheduler.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace glm;
+
+// min and max of the voxels [first, last) of a box of the given size
+template <typename T>
+static void getRange(const T* data, const ivec3& size, const ivec3& first, const ivec3& last, unsigned short& mn, unsigned short& mx)
+{
+	T lo = std::numeric_limits<T>::max(), hi = 0;
+	for (int z = first.z; z < last.z; ++z)
+		for (int y = first.y; y < last.y; ++y)
+		{
+			const T* row = data + (size_t)y * size.x + (size_t)z * size.x * size.y;
+			for (int x = first.x; x < last.x; ++x)
+			{
+				lo = std::min(lo, row[x]);
+				hi = std::max(hi, row[x]);
+			}
+		}
+
+	mn = lo;
+	mx = hi;
+}
+
+// voxels of the cell including its apron, clipped to [0, resolution)
+static void getCellVoxels(const ivec3& cell, const ivec3& resolution, ivec3& first, ivec3& last)
+{
+	first = glm::max(cell * MacroCellGrid::CELL_SIZE - ivec3(1), ivec3(0));
+	last = glm::min((cell + ivec3(1)) * MacroCellGrid::CELL_SIZE + ivec3(1), resolution);
+}
+
+template <typename T>
+static void buildCells(const T* data, const ivec3& volumeResolution, const ivec3& resolution, std::vector<unsigned short>& cells)
+{
+	TaskScheduler::parallelFor(0, resolution.z, 1, [&](int z0, int z1)
+	{
+		for (int z = z0; z < z1; ++z)
+			for (int y = 0; y < resolution.y; ++y)
+				for (int x = 0; x < resolution.x; ++x)
+				{
+					ivec3 first, last;
+					getCellVoxels(ivec3(x, y, z), volumeResolution, first, last);
+
+					const size_t index = x + (size_t)y * resolution.x + (size_t)z * resolution.x * resolution.y;
+					getRange(data, volumeResolution, first, last, cells[index * 2], cells[index * 2 + 1]);
+				}
+	});
+}
+
+template <typename T>
+static void widenCells(const T* data, const ivec3& min, const ivec3& max, const ivec3& volumeResolution, const ivec3& resolution, std::vector<unsigned short>& cells)
+{
+	const ivec3 size = max - min;
+	const ivec3 firstCell = glm::max(min - ivec3(1), ivec3(0)) / MacroCellGrid::CELL_SIZE;
+	const ivec3 lastCell = glm::min(max, resolution * MacroCellGrid::CELL_SIZE - ivec3(1)) / MacroCellGrid::CELL_SIZE;
+
+	for (int z = firstCell.z; z <= lastCell.z; ++z)
+		for (int y = firstCell.y; y <= lastCell.y; ++y)
+			for (int x = firstCell.x; x <= lastCell.x; ++x)
+			{
+				ivec3 first, last;
+				getCellVoxels(ivec3(x, y, z), volumeResolution, first, last);
+
+				// the part of the box within the cell
+				first = glm::max(first, min) - min;
+				last = glm::min(last, max) - min;
+				if (any(lessThanEqual(last, first)))
+					continue;
+
+				unsigned short mn, mx;
+				getRange(data, size, first, last, mn, mx);
+
+				const size_t index = x + (size_t)y * resolution.x + (size_t)z * resolution.x * resolution.y;
+				cells[index * 2] = std::min(cells[index * 2], mn);
+				cells[index * 2 + 1] = std::max(cells[index * 2 + 1], mx);
+			}
+}
+
+MacroCellGrid::MacroCellGrid() : resolution(0), volumeResolution(0)
+{
+}
+
+void MacroCellGrid::build(const void* data, unsigned int bytesPerVoxel, const ivec3& res)
+{
+	PROFILE_ZONE("MacroCellGrid::build");
+
+	volumeResolution = res;
+	resolution = (res + ivec3(CELL_SIZE - 1)) / CELL_SIZE;
+	cells.resize((size_t)resolution.x * resolution.y * resolution.z * 2);
+
+	if (bytesPerVoxel == 2)
+		buildCells(reinterpret_cast<const unsigned short*>(data), volumeResolution, resolution, cells);
+	else
+		buildCells(reinterpret_cast<const unsigned char*>(data), volumeResolution, resolution, cells);
+}
+
+void MacroCellGrid::update(const void* data, unsigned int bytesPerVoxel, const ivec3& min, const ivec3& max)
+{
+	if (cells.empty() || any(lessThanEqual(max, min)))
+		return;
+
+	if (bytesPerVoxel == 2)
+		widenCells(reinterpret_cast<const unsigned short*>(data), min, max, volumeResolution, resolution, cells);
+	else
+		widenCells(reinterpret_cast<const unsigned char*>(data), min, max, volumeResolution, resolution, cells);
+}
+
+void MacroCellGrid::clear()
+{
+	resolution = ivec3(0);
+	volumeResolution = ivec3(0);
+	cells.clear();
+}
+
+size_t MacroCellGrid::getEmptyCellCount(float threshold) const
+{
+	size_t count = 0;
+	for (size_t i = 1; i < cells.size(); i += 2)
+		if (cells[i] < threshold)
+			++count;
+
+	return count;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/// Minimum and maximum value of every CELL_SIZE^3 block of a volume, for skipping empty space while ray marching
+/**	A cell also covers a one voxel apron around its block, so a nearest neighbour sample that rounds
+	into the neighbouring voxel is still bounded by the cell. The values are interleaved as (min, max)
+	pairs in x-y-z cell order, ready for upload as an RG16UI texture.
+
+	SpimStack builds one over the voxels of its texture (the current TextureResidency level), the
+	raycaster skips cells whose maximum is below the lower threshold.
+*/
+class MacroCellGrid
+{
+public:
+	static const int CELL_SIZE = 16;
+
+	MacroCellGrid();
+
+	/// calculates all cells of the volume, in parallel over the planes of cells
+	void build(const void* data, unsigned int bytesPerVoxel, const glm::ivec3& resolution);
+	/// widens the cells the voxels [min, max) contribute to by their values, data holds only the box in x-y-z order
+	/**	Cells never shrink here, they stay a conservative bound for partial uploads until the next build().
+	*/
+	void update(const void* data, unsigned int bytesPerVoxel, const glm::ivec3& min, const glm::ivec3& max);
+	void clear();
+
+	inline bool isEmpty() const { return cells.empty(); }
+	/// resolution in cells
+	inline const glm::ivec3& getResolution() const { return resolution; }
+	/// resolution of the volume it was built for
+	inline const glm::ivec3& getVolumeResolution() const { return volumeResolution; }
+
+	inline glm::ivec3 getCell(const glm::ivec3& voxel) const { return voxel / CELL_SIZE; }
+	inline size_t getIndex(const glm::ivec3& cell) const { return cell.x + (size_t)cell.y * resolution.x + (size_t)cell.z * resolution.x * resolution.y; }
+	inline unsigned short getMin(const glm::ivec3& cell) const { return cells[getIndex(cell) * 2]; }
+	inline unsigned short getMax(const glm::ivec3& cell) const { return cells[getIndex(cell) * 2 + 1]; }
+	/// true if no sample of the cell reaches the threshold
+	inline bool isEmpty(const glm::ivec3& cell, float threshold) const { return getMax(cell) < threshold; }
+
+	/// number of cells that would be skipped at the threshold
+	size_t getEmptyCellCount(float threshold) const;
+
+	/// (min, max) pairs of all cells
+	inline const std::vector<unsigned short>& getCells() const { return cells; }
+
+private:
+	glm::ivec3						resolution, volumeResolution;
+	std::vector<unsigned short>		cells;
+};
@@ -0,0 +1,686 @@
+#include "MultiViewFusion.h"
+#include "SpimStack.h"
+#include "TransformedView.h"
+#include "ChunkedVolume.h"
+#include "AABB.h"
+#include "Resampling.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <limits>
+#include <chrono>
+#include <cmath>
+#include <cassert>
+
+#include <glm/gtc/constants.hpp>
+
+using namespace glm;
+
+namespace
+{
+	// a view prepared for sampling: source voxel coords p = origin + x*dx + y*dy + z*dz for target voxel (x,y,z)
+	struct SourceView
+	{
+		const void*		data;
+		size_t			bytesPerVoxel;
+		ivec3			resolution;
+
+		// the part of the view held in data; the whole view for stacks in memory. Float data holds B-spline coefficients
+		vec3			dataOffset;
+		ivec3			dataResolution;
+		Resampling::Interpolation	interpolation;
+
+		vec3			origin, dx, dy, dz;
+		float			weight;
+
+		// source voxels -> fraction of the feather width; lut is null if feathering is disabled
+		vec3			featherScale;
+		const float*	featherLut;
+
+		// coarse content weights; null if disabled
+		const float*	content;
+		ivec3			contentResolution;
+		float			invCellSize;
+
+		inline vec3 map(const vec3& c) const { return origin + c.x*dx + c.y*dy + c.z*dz; }
+	};
+
+	// lowest weight a contained sample can get, so that regions covered by a single view never go black
+	const float MIN_WEIGHT = 1e-3f;
+	const float MIN_CONTENT_WEIGHT = 0.05f;
+	const int FEATHER_LUT_SIZE = 1024;
+	const int CONTENT_HISTOGRAM_BINS = 64;
+
+	// scaled distance to the closest border of the view; the same falloff at every face
+	inline float featherDistance(const SourceView& v, const vec3& p, const vec3& maxCoord)
+	{
+		return std::min(std::min(std::min(p.x, maxCoord.x - p.x) * v.featherScale.x, std::min(p.y, maxCoord.y - p.y) * v.featherScale.y), std::min(p.z, maxCoord.z - p.z) * v.featherScale.z);
+	}
+
+	inline float featherWeight(const SourceView& v, const vec3& p, const vec3& maxCoord)
+	{
+		const float t = featherDistance(v, p, maxCoord);
+		return v.featherLut[t >= 1.f ? FEATHER_LUT_SIZE : (int)(t * FEATHER_LUT_SIZE)];
+	}
+
+	inline float contentWeight(const SourceView& v, const vec3& p)
+	{
+		const int x = std::min((int)(p.x * v.invCellSize), v.contentResolution.x - 1);
+		const int y = std::min((int)(p.y * v.invCellSize), v.contentResolution.y - 1);
+		const int z = std::min((int)(p.z * v.invCellSize), v.contentResolution.z - 1);
+		return v.content[x + (y + (size_t)z * v.contentResolution.y) * v.contentResolution.x];
+	}
+
+	template <typename T>
+	void calculateContentMap(const SpimStack* stack, MultiViewFusion::ContentWeight type, int cellSize, std::vector<float>& map, ivec3& mapRes)
+	{
+		const T* data = static_cast<const T*>(stack->getData());
+		const ivec3 res = stack->getResolution();
+
+		mapRes = (res + ivec3(cellSize - 1)) / ivec3(cellSize);
+		map.resize((size_t)mapRes.x * mapRes.y * mapRes.z);
+
+		const float minVal = stack->getMinValue();
+		const float binScale = CONTENT_HISTOGRAM_BINS / std::max(stack->getMaxValue() - minVal, 1.f);
+
+		// n*log2(n) for every possible bin count
+		std::vector<float> nlogn(cellSize*cellSize*cellSize + 1, 0.f);
+		for (size_t n = 1; n < nlogn.size(); ++n)
+			nlogn[n] = n * std::log2((float)n);
+
+		TaskScheduler::parallelFor(0, (int)map.size(), 16, [&](int first, int last)
+		{
+			std::vector<unsigned int> histogram(CONTENT_HISTOGRAM_BINS);
+
+			for (int i = first; i < last; ++i)
+			{
+				const ivec3 c((int)(i % mapRes.x), (int)((i / mapRes.x) % mapRes.y), (int)(i / ((long long)mapRes.x*mapRes.y)));
+				const ivec3 c0 = c * cellSize;
+				const ivec3 c1 = min(c0 + ivec3(cellSize), res);
+
+				std::fill(histogram.begin(), histogram.end(), 0);
+				double sum = 0.0, sumSq = 0.0;
+
+				for (int z = c0.z; z < c1.z; ++z)
+					for (int y = c0.y; y < c1.y; ++y)
+					{
+						const T* row = data + y * (size_t)res.x + z * (size_t)res.x * res.y;
+						for (int x = c0.x; x < c1.x; ++x)
+						{
+							const float value = (float)row[x];
+							if (type == MultiViewFusion::CONTENT_ENTROPY)
+								++histogram[std::min((int)((value - minVal) * binScale), CONTENT_HISTOGRAM_BINS - 1)];
+							else
+							{
+								sum += value;
+								sumSq += value * value;
+							}
+						}
+					}
+
+				const size_t n = (size_t)(c1.x - c0.x) * (c1.y - c0.y) * (c1.z - c0.z);
+				if (type == MultiViewFusion::CONTENT_ENTROPY)
+				{
+					// H = -sum(c/n * log2(c/n)) = (n*log2(n) - sum(c*log2(c))) / n
+					float h = nlogn[n];
+					for (int b = 0; b < CONTENT_HISTOGRAM_BINS; ++b)
+						h -= nlogn[histogram[b]];
+					map[i] = h / n;
+				}
+				else
+				{
+					const double mean = sum / n;
+					map[i] = (float)std::sqrt(std::max(sumSq / n - mean*mean, 0.0));
+				}
+			}
+		});
+
+		// normalize to [MIN_CONTENT_WEIGHT, 1]
+		const float maxValue = *std::max_element(map.begin(), map.end());
+		for (size_t i = 0; i < map.size(); ++i)
+			map[i] = (maxValue > 0.f) ? mix(MIN_CONTENT_WEIGHT, 1.f, map[i] / maxValue) : 1.f;
+	}
+
+	template <typename T, bool FEATHER, bool CONTENT>
+	void accumulateView(const SourceView& v, const ivec3& b0, const ivec3& b1, MultiViewFusion::BlendMode mode, float* sum, float* weight, float* row)
+	{
+		const T* data = static_cast<const T*>(v.data);
+		const vec3 maxCoord(v.resolution);
+		const float viewWeight = (mode == MultiViewFusion::BLEND_WEIGHTED) ? v.weight : 1.f;
+		const int width = b1.x - b0.x;
+
+		size_t i = 0;
+		for (int z = b0.z; z < b1.z; ++z)
+		{
+			for (int y = b0.y; y < b1.y; ++y, i += width)
+			{
+				const vec3 p0 = v.map(vec3(b0.x, y, z));
+
+				// the run of the row inside the view, same containment test as the shader
+				int first, last;
+				Resampling::clipRow(p0, v.dx, width, maxCoord, first, last);
+				if (first >= last)
+					continue;
+
+				Resampling::sampleRow(data, v.dataResolution, p0 - v.dataOffset + float(first) * v.dx, v.dx, last - first, v.interpolation, row);
+
+				// samples further than the feather width from every border, p in [width, res - width], need no feathering
+				int innerFirst = first, innerLast = first;
+				if (FEATHER)
+				{
+					const vec3 inner = vec3(1.f) / v.featherScale;
+					Resampling::clipRow(p0 - inner, v.dx, width, maxCoord - inner * 2.f, innerFirst, innerLast);
+				}
+
+				for (int x = first; x < last; ++x)
+				{
+					const float value = row[x - first];
+					const size_t k = i + x;
+
+					if (mode == MultiViewFusion::BLEND_MAX)
+					{
+						sum[k] = std::max(sum[k], value);
+						weight[k] = 1.f;
+						continue;
+					}
+
+					float w = viewWeight;
+					if (FEATHER || CONTENT)
+					{
+						const vec3 p = p0 + float(x) * v.dx;
+						if (FEATHER && (x < innerFirst || x >= innerLast))
+							w *= featherWeight(v, p, maxCoord);
+						if (CONTENT)
+							w *= contentWeight(v, p);
+					}
+
+					sum[k] += value * w;
+					weight[k] += w;
+				}
+			}
+		}
+	}
+
+	template <typename T>
+	void accumulateView(const SourceView& v, const ivec3& b0, const ivec3& b1, MultiViewFusion::BlendMode mode, bool feather, float* sum, float* weight, float* row)
+	{
+		if (feather && v.content)
+			accumulateView<T, true, true>(v, b0, b1, mode, sum, weight, row);
+		else if (feather)
+			accumulateView<T, true, false>(v, b0, b1, mode, sum, weight, row);
+		else if (v.content)
+			accumulateView<T, false, true>(v, b0, b1, mode, sum, weight, row);
+		else
+			accumulateView<T, false, false>(v, b0, b1, mode, sum, weight, row);
+	}
+
+	template <typename T>
+	void storeValues(const float* values, size_t count, T* out)
+	{
+		const float maxVal = (float)std::numeric_limits<T>::max();
+		for (size_t i = 0; i < count; ++i)
+			out[i] = (T)clamp(values[i] + 0.5f, 0.f, maxVal);
+	}
+
+	template <typename T>
+	void storeValues(const std::vector<float>& values, void* data)
+	{
+		T* out = static_cast<T*>(data);
+		const int rows = (int)(values.size() / 4096);
+
+		TaskScheduler::parallelFor(0, rows + 1, 16, [&](int begin, int end)
+		{
+			for (int i = begin; i < end; ++i)
+			{
+				const size_t first = (size_t)i * 4096;
+				storeValues(&values[0] + first, std::min(values.size() - first, (size_t)4096), out + first);
+			}
+		});
+	}
+
+	// copies the sub-box [offset, offset+extent) of the fused tile into a chunk
+	template <typename T>
+	void storeChunk(const std::vector<float>& tile, const ivec3& tileSize, const ivec3& offset, const ivec3& extent, std::vector<unsigned char>& chunk)
+	{
+		chunk.resize((size_t)extent.x * extent.y * extent.z * sizeof(T));
+		T* out = reinterpret_cast<T*>(&chunk[0]);
+
+		for (int z = 0; z < extent.z; ++z)
+			for (int y = 0; y < extent.y; ++y)
+			{
+				const size_t src = offset.x + tileSize.x * ((offset.y + y) + (size_t)tileSize.y * (offset.z + z));
+				storeValues(&tile[src], extent.x, out + extent.x * (y + (size_t)extent.y * z));
+			}
+	}
+
+	// the mapping from target grid voxels to source voxels of a view with the given inverse transform
+	SourceView mapView(const mat4& inverseTransform, const vec3& voxelSize, const ivec3& resolution, const MultiViewFusion::Grid& grid)
+	{
+		const mat4 M = inverseTransform * grid.transform;
+		const vec3 invDims = vec3(1.f) / voxelSize;
+
+		SourceView v;
+		v.resolution = resolution;
+		// grid voxel centers, like the source's voxel centers at i+0.5
+		v.origin = vec3(M * vec4(grid.voxelSize * 0.5f, 1.f)) * invDims;
+		v.dx = vec3(M[0]) * grid.voxelSize.x * invDims;
+		v.dy = vec3(M[1]) * grid.voxelSize.y * invDims;
+		v.dz = vec3(M[2]) * grid.voxelSize.z * invDims;
+		return v;
+	}
+
+	// bounds of a target box [b0, b1] in source voxel coordinates
+	void getSourceBounds(const SourceView& v, const ivec3& b0, const ivec3& b1, vec3& pmin, vec3& pmax)
+	{
+		pmin = vec3(std::numeric_limits<float>::max());
+		pmax = vec3(std::numeric_limits<float>::lowest());
+		for (int c = 0; c < 8; ++c)
+		{
+			const vec3 corner((c & 1) ? b1.x : b0.x, (c & 2) ? b1.y : b0.y, (c & 4) ? b1.z : b0.z);
+			const vec3 p = v.map(corner);
+			pmin = min(pmin, p);
+			pmax = max(pmax, p);
+		}
+	}
+
+	void fuseSources(const std::vector<SourceView>& sources, const ivec3& resolution, MultiViewFusion::BlendMode mode, unsigned int blockSize, float* result)
+	{
+		const ivec3 blocks = (resolution + ivec3(blockSize - 1)) / ivec3(blockSize);
+		const int blockCount = blocks.x * blocks.y * blocks.z;
+
+		TaskScheduler::parallelFor(0, blockCount, 1, [&](int first, int last)
+		{
+			std::vector<float> sum(blockSize*blockSize*blockSize), weight(sum.size()), row(blockSize);
+
+			for (int b = first; b < last; ++b)
+			{
+				const ivec3 bc(b % blocks.x, (b / blocks.x) % blocks.y, b / (blocks.x*blocks.y));
+				const ivec3 b0 = bc * ivec3(blockSize);
+				const ivec3 b1 = min(b0 + ivec3(blockSize), resolution);
+				const ivec3 size = b1 - b0;
+				const size_t count = (size_t)size.x * size.y * size.z;
+
+				std::fill(sum.begin(), sum.begin() + count, 0.f);
+				std::fill(weight.begin(), weight.begin() + count, 0.f);
+
+				for (size_t i = 0; i < sources.size(); ++i)
+				{
+					const SourceView& v = sources[i];
+
+					// skip views that do not overlap this block
+					vec3 pmin, pmax;
+					getSourceBounds(v, b0, b1, pmin, pmax);
+					if (any(lessThan(pmax, vec3(0.f))) || any(greaterThan(pmin, vec3(v.resolution))))
+						continue;
+
+					// the border distance is concave over the block, so it is smallest at one of the corners. Blocks
+					// that are further than the feather width from the border everywhere do not need feathering
+					bool feather = false;
+					if (v.featherLut)
+					{
+						for (int c = 0; c < 8 && !feather; ++c)
+						{
+							const vec3 corner((c & 1) ? b1.x : b0.x, (c & 2) ? b1.y : b0.y, (c & 4) ? b1.z : b0.z);
+							feather = featherDistance(v, v.map(corner), vec3(v.resolution)) < 1.f;
+						}
+					}
+
+					if (v.bytesPerVoxel == 1)
+						accumulateView<unsigned char>(v, b0, b1, mode, feather, &sum[0], &weight[0], &row[0]);
+					else if (v.bytesPerVoxel == 2)
+						accumulateView<unsigned short>(v, b0, b1, mode, feather, &sum[0], &weight[0], &row[0]);
+					else
+						accumulateView<float>(v, b0, b1, mode, feather, &sum[0], &weight[0], &row[0]);
+				}
+
+				// write the block
+				size_t i = 0;
+				for (int z = b0.z; z < b1.z; ++z)
+					for (int y = b0.y; y < b1.y; ++y)
+					{
+						float* out = &result[b0.x + y*(size_t)resolution.x + z*(size_t)resolution.x*resolution.y];
+						for (int x = 0; x < size.x; ++x, ++i)
+						{
+							if (weight[i] > 0.f)
+								out[x] = (mode == MultiViewFusion::BLEND_MAX) ? sum[i] : sum[i] / weight[i];
+						}
+					}
+			}
+		});
+	}
+}
+
+MultiViewFusion::MultiViewFusion(BlendMode m, unsigned int bs) : mode(m), blockSize(bs), interpolation(Resampling::TRILINEAR), featherWidth(0.f), contentWeight(CONTENT_NONE), contentCellSize(8)
+{
+	assert(blockSize > 0);
+}
+
+void MultiViewFusion::addView(const SpimStack* stack, float weight)
+{
+	View v;
+	v.stack = stack;
+	v.transform = stack->getTransform();
+	v.voxelSize = stack->getVoxelDimensions();
+	v.resolution = stack->getResolution();
+	v.bytesPerVoxel = (unsigned int)stack->getBytesPerVoxel();
+	v.weight = weight;
+	views.push_back(v);
+}
+
+void MultiViewFusion::addView(const TransformedView& view, float weight)
+{
+	addView(view.getStack(), weight);
+	views.back().transform = view.getTransform();
+}
+
+void MultiViewFusion::addView(const std::string& filename, const mat4& transform, const vec3& voxelSize, float weight)
+{
+	View v;
+	v.stack = 0;
+	v.filename = filename;
+	v.transform = transform;
+	v.voxelSize = voxelSize;
+	v.weight = weight;
+	SpimStack::getImageInfo(filename, v.resolution, v.bytesPerVoxel);
+	views.push_back(v);
+}
+
+MultiViewFusion::Grid MultiViewFusion::getGrid(const SpimStack* stack)
+{
+	Grid g;
+	g.transform = stack->getTransform();
+	g.resolution = stack->getResolution();
+	g.voxelSize = stack->getVoxelDimensions();
+	return g;
+}
+
+MultiViewFusion::Grid MultiViewFusion::getBoundingGrid(const vec3& voxelSize) const
+{
+	AABB bbox;
+	bbox.reset();
+	for (size_t i = 0; i < views.size(); ++i)
+	{
+		AABB local;
+		local.min = vec3(0.f);
+		local.max = vec3(views[i].resolution) * views[i].voxelSize;
+
+		const std::vector<vec3> verts = local.getVertices();
+		for (size_t k = 0; k < verts.size(); ++k)
+			bbox.extend(vec3(views[i].transform * vec4(verts[k], 1.f)));
+	}
+
+	Grid g;
+	g.transform = mat4(1.f);
+	g.transform[3] = vec4(bbox.min, 1.f);
+	g.resolution = max(ivec3(ceil(bbox.getSpan() / voxelSize)), ivec3(1));
+	g.voxelSize = voxelSize;
+	return g;
+}
+
+void MultiViewFusion::prepareTables(Tables& tables) const
+{
+	const bool weighted = mode != BLEND_MAX;
+
+	// cosine falloff from 0 at the border to 1 at the feather width
+	tables.feather.clear();
+	if (weighted && featherWidth > 0.f)
+	{
+		tables.feather.resize(FEATHER_LUT_SIZE + 1);
+		for (int i = 0; i <= FEATHER_LUT_SIZE; ++i)
+			tables.feather[i] = std::max(0.5f - 0.5f * std::cos(glm::pi<float>() * i / FEATHER_LUT_SIZE), MIN_WEIGHT);
+	}
+
+	// tricubic sampling works on the B-spline coefficients of the views
+	tables.coefficients.assign(views.size(), std::vector<float>());
+	if (interpolation == Resampling::TRICUBIC)
+	{
+		for (size_t i = 0; i < views.size(); ++i)
+		{
+			const SpimStack* s = views[i].stack;
+			if (!s)
+				continue;
+
+			if (s->getBytesPerVoxel() == 1)
+				Resampling::calculateBSplineCoefficients(static_cast<const unsigned char*>(s->getData()), s->getResolution(), tables.coefficients[i]);
+			else
+				Resampling::calculateBSplineCoefficients(static_cast<const unsigned short*>(s->getData()), s->getResolution(), tables.coefficients[i]);
+		}
+	}
+
+	tables.content.assign(views.size(), std::vector<float>());
+	tables.contentResolution.assign(views.size(), ivec3(0));
+
+	if (!weighted || contentWeight == CONTENT_NONE)
+		return;
+
+	for (size_t i = 0; i < views.size(); ++i)
+	{
+		const SpimStack* s = views[i].stack;
+		if (!s)
+		{
+			std::cout << "[Fusion] No content weights for view \"" << views[i].filename << "\", it is not in memory\n";
+			continue;
+		}
+
+		if (s->getBytesPerVoxel() == 1)
+			calculateContentMap<unsigned char>(s, contentWeight, contentCellSize, tables.content[i], tables.contentResolution[i]);
+		else
+			calculateContentMap<unsigned short>(s, contentWeight, contentCellSize, tables.content[i], tables.contentResolution[i]);
+	}
+}
+
+void MultiViewFusion::fuseRegion(const Grid& grid, const Tables& tables, std::vector<float>& result) const
+{
+	PROFILE_ZONE("Fusion::fuseRegion");
+	PROFILE_COUNT("voxels processed", grid.getVoxelCount());
+
+	result.assign(grid.getVoxelCount(), 0.f);
+
+	// bricks loaded from disk for this region only
+	std::vector<std::vector<unsigned char> > bricks(views.size());
+	std::vector<std::vector<float> > brickCoefficients(views.size());
+	const bool cubic = interpolation == Resampling::TRICUBIC;
+
+	std::vector<SourceView> sources;
+	for (size_t i = 0; i < views.size(); ++i)
+	{
+		const View& view = views[i];
+		const SpimStack* s = view.stack;
+
+		SourceView v = mapView(inverse(view.transform), view.voxelSize, view.resolution, grid);
+		v.bytesPerVoxel = view.bytesPerVoxel;
+
+		if (v.bytesPerVoxel != 1 && v.bytesPerVoxel != 2)
+			throw std::runtime_error("Unsupported stack voxel format!");
+
+		v.weight = view.weight;
+		v.interpolation = interpolation;
+
+		vec3 pmin, pmax;
+		getSourceBounds(v, ivec3(0), grid.resolution, pmin, pmax);
+		if (any(lessThan(pmax, vec3(0.f))) || any(greaterThan(pmin, vec3(v.resolution))))
+			continue;
+
+		if (s)
+		{
+			v.data = cubic ? &tables.coefficients[i][0] : s->getData();
+			v.dataOffset = vec3(0.f);
+			v.dataResolution = v.resolution;
+		}
+		else
+		{
+			// load the source voxels this region touches, with a margin for the interpolation kernel
+			const ivec3 lo = clamp(ivec3(floor(pmin)) - ivec3(2), ivec3(0), v.resolution - ivec3(1));
+			const ivec3 hi = clamp(ivec3(ceil(pmax)) + ivec3(3), ivec3(1), v.resolution);
+
+			bricks[i].resize((size_t)(hi.x - lo.x) * (hi.y - lo.y) * (hi.z - lo.z) * v.bytesPerVoxel);
+			SpimStack::loadImageRegion(view.filename, lo, hi, &bricks[i][0]);
+
+			v.data = &bricks[i][0];
+			v.dataOffset = vec3(lo);
+			v.dataResolution = hi - lo;
+
+			if (cubic)
+			{
+				if (v.bytesPerVoxel == 1)
+					Resampling::calculateBSplineCoefficients(&bricks[i][0], v.dataResolution, brickCoefficients[i]);
+				else
+					Resampling::calculateBSplineCoefficients(reinterpret_cast<const unsigned short*>(&bricks[i][0]), v.dataResolution, brickCoefficients[i]);
+
+				std::vector<unsigned char>().swap(bricks[i]);
+				v.data = &brickCoefficients[i][0];
+			}
+		}
+
+		if (cubic)
+			v.bytesPerVoxel = sizeof(float);
+
+		v.featherLut = tables.feather.empty() ? 0 : &tables.feather[0];
+		v.featherScale = view.voxelSize / std::max(featherWidth, 1e-6f);
+
+		v.content = tables.content[i].empty() ? 0 : &tables.content[i][0];
+		v.contentResolution = tables.contentResolution[i];
+		v.invCellSize = 1.f / contentCellSize;
+
+		sources.push_back(v);
+	}
+
+	fuseSources(sources, grid.resolution, mode, blockSize, &result[0]);
+}
+
+void MultiViewFusion::fuse(const Grid& grid, std::vector<float>& result) const
+{
+	PROFILE_ZONE("Fusion::fuse");
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	Tables tables;
+	prepareTables(tables);
+	fuseRegion(grid, tables, result);
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::cout << "[Fusion] Fused " << views.size() << " views into " << grid.resolution.x << "x" << grid.resolution.y << "x" << grid.resolution.z << " in " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms\n";
+}
+
+void MultiViewFusion::fuse(SpimStack* target) const
+{
+	std::vector<float> values;
+	fuse(getGrid(target), values);
+
+	if (target->getBytesPerVoxel() == 1)
+		storeValues<unsigned char>(values, target->getData());
+	else if (target->getBytesPerVoxel() == 2)
+		storeValues<unsigned short>(values, target->getData());
+	else
+		throw std::runtime_error("Unsupported stack voxel format!");
+
+	target->update();
+}
+
+size_t MultiViewFusion::estimateTileMemory(const Grid& grid, const ivec3& tileSize, unsigned int bytesPerVoxel) const
+{
+	// fused floats and the converted chunks
+	size_t bytes = (size_t)tileSize.x * tileSize.y * tileSize.z * (sizeof(float) + bytesPerVoxel);
+
+	// the worst-case brick of every view on disk: the tile's extent mapped into the view
+	for (size_t i = 0; i < views.size(); ++i)
+	{
+		const View& view = views[i];
+		if (view.stack)
+			continue;
+
+		const SourceView v = mapView(inverse(view.transform), view.voxelSize, view.resolution, grid);
+		const vec3 extent = abs(v.dx) * float(tileSize.x) + abs(v.dy) * float(tileSize.y) + abs(v.dz) * float(tileSize.z);
+		const ivec3 brick = min(ivec3(ceil(extent)) + ivec3(5), view.resolution);
+
+		// tricubic sampling keeps the coefficients of the brick instead
+		bytes += (size_t)brick.x * brick.y * brick.z * (interpolation == Resampling::TRICUBIC ? view.bytesPerVoxel + sizeof(float) : view.bytesPerVoxel);
+	}
+
+	return bytes;
+}
+
+void MultiViewFusion::fuseTiled(const Grid& grid, const std::string& filename, unsigned int bytesPerVoxel, size_t memoryBudget, const ivec3& chunkSize) const
+{
+	PROFILE_ZONE("Fusion::fuseTiled");
+
+	if (bytesPerVoxel != 1 && bytesPerVoxel != 2)
+		throw std::runtime_error("Unsupported target voxel format!");
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	ChunkedVolumeWriter writer(filename, grid.resolution, chunkSize, bytesPerVoxel, grid.voxelSize, grid.transform, ChunkedVolumeWriter::getDefaultLevelCount(grid.resolution, chunkSize));
+	const ivec3 chunkCount = writer.getChunkCount();
+
+	// halve the largest tile dimension until the tile fits into the budget
+	ivec3 tileChunks = chunkCount;
+	while (estimateTileMemory(grid, tileChunks * chunkSize, bytesPerVoxel) > memoryBudget && tileChunks != ivec3(1))
+	{
+		const ivec3 size = tileChunks * chunkSize;
+		int axis = 0;
+		if (size.y > size[axis] && tileChunks.y > 1) axis = 1;
+		if (size.z > size[axis] && tileChunks.z > 1) axis = 2;
+		if (tileChunks[axis] == 1)
+			axis = tileChunks.x > 1 ? 0 : (tileChunks.y > 1 ? 1 : 2);
+
+		tileChunks[axis] = (tileChunks[axis] + 1) / 2;
+	}
+
+	const size_t estimate = estimateTileMemory(grid, tileChunks * chunkSize, bytesPerVoxel);
+	if (estimate > memoryBudget)
+		std::cout << "[Fusion] Warning: a single chunk needs " << (estimate >> 20) << "MB, more than the memory budget of " << (memoryBudget >> 20) << "MB\n";
+
+	const ivec3 tiles = (chunkCount + tileChunks - ivec3(1)) / tileChunks;
+	const int tileCount = tiles.x * tiles.y * tiles.z;
+
+	std::cout << "[Fusion] Fusing " << views.size() << " views into " << grid.resolution.x << "x" << grid.resolution.y << "x" << grid.resolution.z << " in " << tileCount << " tiles of " << tileChunks.x << "x" << tileChunks.y << "x" << tileChunks.z << " chunks, ~" << (estimate >> 20) << "MB per tile\n";
+
+	Tables tables;
+	prepareTables(tables);
+
+	std::vector<float> values;
+
+	for (int t = 0; t < tileCount; ++t)
+	{
+		const ivec3 tc(t % tiles.x, (t / tiles.x) % tiles.y, t / (tiles.x*tiles.y));
+		const ivec3 c0 = tc * tileChunks;
+		const ivec3 c1 = min(c0 + tileChunks, chunkCount);
+
+		const ivec3 v0 = c0 * chunkSize;
+		const ivec3 v1 = min(c1 * chunkSize, grid.resolution);
+
+		Grid tile;
+		tile.transform = grid.transform;
+		tile.transform[3] = grid.transform * vec4(vec3(v0) * grid.voxelSize, 1.f);
+		tile.resolution = v1 - v0;
+		tile.voxelSize = grid.voxelSize;
+
+		fuseRegion(tile, tables, values);
+
+		// stream the finished chunks to disk, the writer compresses them in parallel
+		TaskScheduler::parallelFor(c0, c1, ivec3(1), [&](const ivec3& c, const ivec3&)
+		{
+			const ivec3 offset = c * chunkSize - v0;
+			const ivec3 extent = writer.getChunkExtent(c);
+
+			std::vector<unsigned char> chunk;
+			if (bytesPerVoxel == 1)
+				storeChunk<unsigned char>(values, tile.resolution, offset, extent, chunk);
+			else
+				storeChunk<unsigned short>(values, tile.resolution, offset, extent, chunk);
+
+			writer.writeChunk(c, &chunk[0]);
+		});
+
+		if ((t + 1) % std::max(tileCount / 10, 1) == 0)
+			std::cout << "[Fusion] Tile " << (t + 1) << "/" << tileCount << " done\n";
+	}
+
+	writer.close();
+
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::cout << "[Fusion] Tiled fusion finished in " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << "ms\n";
+}
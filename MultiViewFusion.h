@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+
+#include "Resampling.h"
+
+class SpimStack;
+class TransformedView;
+
+/// CPU multi-view fusion
+/**	Resamples any number of views (stacks) into a common target grid with any of the Resampling kernels. The
+	target grid is processed in parallel in cubic blocks; views whose transformed bounds do not touch a
+	block are skipped for that block.
+
+	A target voxel is only influenced by views that contain it, and the average mode blends them with equal
+	weights.
+
+	Volumes larger than memory are fused tile by tile into a chunked file (see ChunkedVolume.h). Views can
+	also stay on disk; for every tile only the source region the tile maps to is loaded.
+
+	In the average and weighted modes every sample can additionally be weighted by its distance to the
+	view's border (cosine falloff over the feather width) and by the local information content of the
+	view (contrast or entropy, precomputed on a coarse grid of cells). Both are table lookups per sample.
+*/
+class MultiViewFusion
+{
+public:
+	enum BlendMode
+	{
+		BLEND_AVERAGE = 0,
+		BLEND_MAX,
+		// weighted average, using the per-view weights
+		BLEND_WEIGHTED
+	};
+
+	/// per-view weighting by local image content
+	enum ContentWeight
+	{
+		CONTENT_NONE = 0,
+		// standard deviation of the cell
+		CONTENT_CONTRAST,
+		// Shannon entropy of the cell's histogram
+		CONTENT_ENTROPY
+	};
+
+	/// the target grid. Voxel (x,y,z) has its center at transform * ((x,y,z) + 0.5)*voxelSize, like stack voxels
+	struct Grid
+	{
+		glm::mat4		transform;
+		glm::ivec3		resolution;
+		glm::vec3		voxelSize;
+
+		inline size_t getVoxelCount() const { return (size_t)resolution.x * resolution.y * resolution.z; }
+	};
+
+	MultiViewFusion(BlendMode mode = BLEND_AVERAGE, unsigned int blockSize = 32);
+
+	void addView(const SpimStack* stack, float weight = 1.f);
+	/// adds the stack of a transformed view with the view's transform, so the view is resampled only once
+	void addView(const TransformedView& view, float weight = 1.f);
+	/// adds a view that is not loaded. Only the parts that are needed are read from the file during fusion
+	void addView(const std::string& filename, const glm::mat4& transform, const glm::vec3& voxelSize, float weight = 1.f);
+	inline void clearViews() { views.clear(); }
+	inline size_t getViewCount() const { return views.size(); }
+
+	inline void setBlendMode(BlendMode m) { mode = m; }
+	inline BlendMode getBlendMode() const { return mode; }
+
+	/// tricubic interpolation prefilters every view into float B-spline coefficients first
+	inline void setInterpolation(Resampling::Interpolation i) { interpolation = i; }
+	inline Resampling::Interpolation getInterpolation() const { return interpolation; }
+
+	/// width of the cosine falloff at the view borders in world units, 0 disables feathering
+	inline void setFeatherWidth(float w) { featherWidth = w; }
+	inline float getFeatherWidth() const { return featherWidth; }
+
+	/// content weights are calculated for cubic cells of cellSize voxels in each view
+	inline void setContentWeight(ContentWeight w, unsigned int cellSize = 8) { contentWeight = w; contentCellSize = cellSize; }
+	inline ContentWeight getContentWeight() const { return contentWeight; }
+
+	/// fuses all views into the grid. result is resized to the grid's voxel count
+	void fuse(const Grid& grid, std::vector<float>& result) const;
+	/// fuses all views into the target stack, using its transform, resolution and voxel size
+	void fuse(SpimStack* target) const;
+
+	/// fuses all views tile by tile and streams the result to a chunked volume file. Tiles are sized so that
+	/// the fused tile and the source regions loaded for it stay within memoryBudget bytes
+	void fuseTiled(const Grid& grid, const std::string& filename, unsigned int bytesPerVoxel, size_t memoryBudget, const glm::ivec3& chunkSize = glm::ivec3(64)) const;
+
+	/// returns the target grid of an existing stack
+	static Grid getGrid(const SpimStack* stack);
+	/// returns a grid covering all views with the given voxel size
+	Grid getBoundingGrid(const glm::vec3& voxelSize) const;
+
+private:
+	struct View
+	{
+		// a stack in memory, or a file on disk. The fields below describe both
+		const SpimStack*	stack;
+
+		std::string			filename;
+		glm::mat4			transform;
+		glm::vec3			voxelSize;
+		glm::ivec3			resolution;
+		unsigned int		bytesPerVoxel;
+
+		float				weight;
+	};
+
+	// lookup tables shared by all regions of one fusion
+	struct Tables
+	{
+		std::vector<std::vector<float> >	coefficients;
+		std::vector<float>					feather;
+		std::vector<std::vector<float> >	content;
+		std::vector<glm::ivec3>				contentResolution;
+	};
+
+	std::vector<View>		views;
+
+	BlendMode				mode;
+	unsigned int			blockSize;
+	Resampling::Interpolation	interpolation;
+
+	float					featherWidth;
+	ContentWeight			contentWeight;
+	unsigned int			contentCellSize;
+
+	void prepareTables(Tables& tables) const;
+	void fuseRegion(const Grid& grid, const Tables& tables, std::vector<float>& result) const;
+	size_t estimateTileMemory(const Grid& grid, const glm::ivec3& tileSize, unsigned int bytesPerVoxel) const;
+};
@@ -0,0 +1,129 @@
+#include "NormalEstimation.h"
+#include "PointKdTree.h"
+#include "TaskScheduler.h"
+
+#include <iostream>
+#include <cmath>
+
+using namespace glm;
+
+vec3 calculateSmallestEigenvector(const mat3& m)
+{
+	// cyclic Jacobi rotations, a holds the matrix and v the accumulated eigenvectors (as columns)
+	double a[3][3], v[3][3];
+	for (int i = 0; i < 3; ++i)
+		for (int j = 0; j < 3; ++j)
+		{
+			a[i][j] = m[j][i];
+			v[i][j] = (i == j) ? 1.0 : 0.0;
+		}
+
+	for (int sweep = 0; sweep < 16; ++sweep)
+	{
+		const double off = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+		if (off < 1e-20)
+			break;
+
+		for (int p = 0; p < 2; ++p)
+		{
+			for (int q = p + 1; q < 3; ++q)
+			{
+				if (std::abs(a[p][q]) < 1e-30)
+					continue;
+
+				const double theta = (a[q][q] - a[p][p]) / (2.0 * a[p][q]);
+				const double t = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta*theta + 1.0));
+				const double c = 1.0 / std::sqrt(t*t + 1.0);
+				const double s = t * c;
+
+				for (int k = 0; k < 3; ++k)
+				{
+					const double akp = a[k][p], akq = a[k][q];
+					a[k][p] = c*akp - s*akq;
+					a[k][q] = s*akp + c*akq;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					const double apk = a[p][k], aqk = a[q][k];
+					a[p][k] = c*apk - s*aqk;
+					a[q][k] = s*apk + c*aqk;
+				}
+				for (int k = 0; k < 3; ++k)
+				{
+					const double vkp = v[k][p], vkq = v[k][q];
+					v[k][p] = c*vkp - s*vkq;
+					v[k][q] = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+
+	int smallest = 0;
+	if (a[1][1] < a[smallest][smallest])
+		smallest = 1;
+	if (a[2][2] < a[smallest][smallest])
+		smallest = 2;
+
+	const vec3 n((float)v[0][smallest], (float)v[1][smallest], (float)v[2][smallest]);
+	return normalize(n);
+}
+
+template <typename P>
+static void estimateNormalsImpl(const std::vector<P>& points, std::vector<vec3>& normals, unsigned int k, const vec3& viewpoint)
+{
+	normals.resize(points.size());
+	if (points.empty())
+		return;
+
+	std::cout << "[Normals] Estimating normals for " << points.size() << " points (k=" << k << ") ... ";
+
+	const PointKdTree<P> tree(points);
+
+	TaskScheduler::parallelFor(0, (int)points.size(), 1024, [&](int first, int last)
+	{
+		std::vector<size_t> indices(k);
+		std::vector<float> distSqrd(k);
+
+		for (int i = first; i < last; ++i)
+		{
+			const vec3 p(points[i]);
+			const size_t found = tree.knn(p, k, &indices[0], &distSqrd[0]);
+
+			if (found < 3)
+			{
+				normals[i] = vec3(0.f);
+				continue;
+			}
+
+			vec3 centroid(0.f);
+			for (size_t j = 0; j < found; ++j)
+				centroid += vec3(points[indices[j]]);
+			centroid /= (float)found;
+
+			mat3 cov(0.f);
+			for (size_t j = 0; j < found; ++j)
+			{
+				const vec3 d = vec3(points[indices[j]]) - centroid;
+				cov += outerProduct(d, d);
+			}
+
+			vec3 n = calculateSmallestEigenvector(cov);
+			if (dot(n, viewpoint - p) < 0.f)
+				n = -n;
+
+			normals[i] = n;
+		}
+	});
+
+	std::cout << "done.\n";
+}
+
+void estimateNormals(const std::vector<vec3>& points, std::vector<vec3>& normals, unsigned int k, const vec3& viewpoint)
+{
+	estimateNormalsImpl(points, normals, k, viewpoint);
+}
+
+void estimateNormals(const std::vector<vec4>& points, std::vector<vec3>& normals, unsigned int k, const vec3& viewpoint)
+{
+	estimateNormalsImpl(points, normals, k, viewpoint);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+/// Estimates point normals from the k nearest neighbours (PCA)
+/**	The normal of every point is the eigenvector of the smallest eigenvalue of its neighbourhood's
+	covariance matrix. Neighbourhood queries run in parallel. Normals are flipped to face the viewpoint.
+	For vec4 points only xyz are used.
+*/
+void estimateNormals(const std::vector<glm::vec3>& points, std::vector<glm::vec3>& normals, unsigned int k = 10, const glm::vec3& viewpoint = glm::vec3(0.f));
+void estimateNormals(const std::vector<glm::vec4>& points, std::vector<glm::vec3>& normals, unsigned int k = 10, const glm::vec3& viewpoint = glm::vec3(0.f));
+
+/// returns the unit eigenvector of the smallest eigenvalue of the symmetric matrix m
+glm::vec3 calculateSmallestEigenvector(const glm::mat3& m);
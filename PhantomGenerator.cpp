@@ -0,0 +1,287 @@
+#include "PhantomGenerator.h"
+#include "SpimStack.h"
+#include "AABB.h"
+#include "Resampling.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cmath>
+
+using namespace glm;
+
+// fraction of the full range used by the background and the specimen
+static const float BACKGROUND = 0.05f;
+static const float SIGNAL = 0.8f;
+
+PhantomGenerator::Options::Options() : type(PHANTOM_BEADS), resolution(128, 128, 64), voxelSize(1.f, 1.f, 3.f), bytesPerVoxel(2), objectCount(500), psfSigma(0.8f, 0.8f, 2.5f), noise(0.01f), photons(1000.f), seed(4711)
+{
+}
+
+PhantomGenerator::PhantomGenerator(const Options& o) : options(o)
+{
+	PROFILE_ZONE("Phantom::createSpecimen");
+
+	if (any(lessThanEqual(options.resolution, ivec3(0))) || any(lessThanEqual(options.voxelSize, vec3(0.f))))
+		throw std::runtime_error("Invalid phantom resolution or voxel size!");
+	if (options.bytesPerVoxel != 1 && options.bytesPerVoxel != 2)
+		throw std::runtime_error("Invalid phantom bit depth!");
+
+	// isotropic at the finest view resolution
+	specimenVoxelSize = std::min(options.voxelSize.x, std::min(options.voxelSize.y, options.voxelSize.z));
+	specimenResolution = ivec3(ceil(vec3(options.resolution) * options.voxelSize / specimenVoxelSize));
+	specimen.assign((size_t)specimenResolution.x * specimenResolution.y * specimenResolution.z, 0.f);
+
+	if (options.type == PHANTOM_TISSUE)
+		createTissue();
+	else
+		createBeads();
+
+	const float maxValue = *std::max_element(specimen.begin(), specimen.end());
+	if (maxValue > 0.f)
+		for (size_t i = 0; i < specimen.size(); ++i)
+			specimen[i] /= maxValue;
+
+	std::cout << "[Phantom] Created " << (options.type == PHANTOM_TISSUE ? "tissue" : "bead") << " specimen with " << options.objectCount << " objects on a " << specimenResolution.x << "x" << specimenResolution.y << "x" << specimenResolution.z << " grid\n";
+}
+
+void PhantomGenerator::splat(const vec3& center, float sigma, float brightness)
+{
+	const vec3 c = center / specimenVoxelSize;
+	const float s = sigma / specimenVoxelSize;
+	const ivec3 r0 = max(ivec3(floor(c - vec3(3.f * s))), ivec3(0));
+	const ivec3 r1 = min(ivec3(ceil(c + vec3(3.f * s))), specimenResolution - ivec3(1));
+
+	for (int z = r0.z; z <= r1.z; ++z)
+		for (int y = r0.y; y <= r1.y; ++y)
+			for (int x = r0.x; x <= r1.x; ++x)
+			{
+				const vec3 d = vec3(x, y, z) + vec3(0.5f) - c;
+				specimen[x + specimenResolution.x * (y + (size_t)specimenResolution.y * z)] += brightness * exp(-dot(d, d) / (2.f * s * s));
+			}
+}
+
+void PhantomGenerator::createBeads()
+{
+	std::mt19937 rng(options.seed);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+	std::uniform_real_distribution<float> brightness(0.5f, 1.f);
+
+	const vec3 center = getCenter();
+	const float radius = 0.9f * std::min(center.x, std::min(center.y, center.z));
+
+	for (unsigned int i = 0; i < options.objectCount; ++i)
+	{
+		// uniform in the sphere
+		vec3 p;
+		do
+		{
+			p = vec3(unit(rng), unit(rng), unit(rng));
+		} while (dot(p, p) > 1.f);
+
+		// beads are smaller than the resolution, their size comes from the PSF
+		splat(center + p * radius, 0.5f * specimenVoxelSize, brightness(rng));
+	}
+}
+
+void PhantomGenerator::createTissue()
+{
+	std::mt19937 rng(options.seed);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+
+	const vec3 center = getCenter();
+	const float radius = 0.9f * std::min(center.x, std::min(center.y, center.z));
+	const vec3 axes = vec3(1.f, 0.8f, 0.9f) * radius;
+
+	// cell texture: a few random plane waves
+	const int WAVES = 4;
+	vec3 directions[WAVES];
+	float phases[WAVES];
+	for (int i = 0; i < WAVES; ++i)
+	{
+		directions[i] = normalize(vec3(unit(rng), unit(rng), unit(rng))) * (0.1f + 0.3f * uniform(rng)) / specimenVoxelSize;
+		phases[i] = 6.283f * uniform(rng);
+	}
+
+	TaskScheduler::parallelFor(ivec3(0), specimenResolution, ivec3(specimenResolution.x, specimenResolution.y, 1), [&](const ivec3& b0, const ivec3& b1)
+	{
+		for (int z = b0.z; z < b1.z; ++z)
+			for (int y = b0.y; y < b1.y; ++y)
+				for (int x = b0.x; x < b1.x; ++x)
+				{
+					const vec3 p = (vec3(x, y, z) + vec3(0.5f)) * specimenVoxelSize;
+					const vec3 e = (p - center) / axes;
+					if (dot(e, e) > 1.f)
+						continue;
+
+					float texture = 0.f;
+					for (int i = 0; i < WAVES; ++i)
+						texture += sin(dot(p, directions[i]) + phases[i]);
+
+					specimen[x + specimenResolution.x * (y + (size_t)specimenResolution.y * z)] = 0.2f + 0.05f * texture;
+				}
+	});
+
+	// nuclei inside the body
+	for (unsigned int i = 0; i < options.objectCount; ++i)
+	{
+		vec3 p;
+		do
+		{
+			p = vec3(unit(rng), unit(rng), unit(rng));
+		} while (dot(p, p) > 0.7f);
+
+		splat(center + p * axes, (1.5f + 1.5f * uniform(rng)) * specimenVoxelSize, 0.3f + 0.4f * uniform(rng));
+	}
+}
+
+// separable gaussian along one axis with clamped borders
+static void blurAxis(std::vector<float>& volume, const ivec3& res, int axis, float sigma)
+{
+	if (sigma < 0.1f)
+		return;
+
+	const int radius = (int)ceil(3.f * sigma);
+	std::vector<float> kernel(2 * radius + 1);
+	float sum = 0.f;
+	for (int i = -radius; i <= radius; ++i)
+		sum += kernel[i + radius] = exp(-(float)(i*i) / (2.f * sigma * sigma));
+	for (size_t i = 0; i < kernel.size(); ++i)
+		kernel[i] /= sum;
+
+	const size_t stride = axis == 0 ? 1 : (axis == 1 ? (size_t)res.x : (size_t)res.x * res.y);
+	const int length = res[axis];
+	const int lines = (int)(volume.size() / length);
+
+	TaskScheduler::parallelFor(0, lines, 256, [&](int first, int last)
+	{
+		std::vector<float> line(length);
+
+		for (int l = first; l < last; ++l)
+		{
+			// first voxel of the line
+			size_t start;
+			if (axis == 0)
+				start = (size_t)l * res.x;
+			else if (axis == 1)
+				start = (size_t)(l % res.x) + (size_t)(l / res.x) * res.x * res.y;
+			else
+				start = (size_t)l;
+
+			for (int i = 0; i < length; ++i)
+				line[i] = volume[start + i * stride];
+
+			for (int i = 0; i < length; ++i)
+			{
+				float v = 0.f;
+				for (int k = -radius; k <= radius; ++k)
+					v += kernel[k + radius] * line[clamp(i + k, 0, length - 1)];
+				volume[start + i * stride] = v;
+			}
+		}
+	});
+}
+
+SpimStack* PhantomGenerator::createView(const mat4& transform, unsigned int noiseSeed) const
+{
+	PROFILE_ZONE("Phantom::createView");
+
+	const ivec3 res = options.resolution;
+
+	// rendered on a finer grid along the view's axes, blurred there and integrated into the view's voxels
+	const ivec3 factor = max(ivec3(round(options.voxelSize / specimenVoxelSize)), ivec3(1));
+	const ivec3 fineRes = res * factor;
+	const vec3 fineVoxelSize = options.voxelSize / vec3(factor);
+
+	const vec3 origin = vec3(transform * vec4(fineVoxelSize * 0.5f, 1.f)) / specimenVoxelSize;
+	const vec3 dx = vec3(transform[0]) * fineVoxelSize.x / specimenVoxelSize;
+	const vec3 dy = vec3(transform[1]) * fineVoxelSize.y / specimenVoxelSize;
+	const vec3 dz = vec3(transform[2]) * fineVoxelSize.z / specimenVoxelSize;
+
+	std::vector<float> fine((size_t)fineRes.x * fineRes.y * fineRes.z);
+	Resampling::resample(&specimen[0], specimenResolution, origin, dx, dy, dz, fineRes, Resampling::TRILINEAR, &fine[0]);
+
+	for (int axis = 0; axis < 3; ++axis)
+		blurAxis(fine, fineRes, axis, options.psfSigma[axis] / fineVoxelSize[axis]);
+
+	std::vector<float> values((size_t)res.x * res.y * res.z, 0.f);
+	const float weight = 1.f / (factor.x * factor.y * factor.z);
+
+	TaskScheduler::parallelFor(ivec3(0), res, ivec3(res.x, res.y, 1), [&](const ivec3& b0, const ivec3& b1)
+	{
+		for (int z = b0.z; z < b1.z; ++z)
+			for (int y = b0.y; y < b1.y; ++y)
+				for (int x = b0.x; x < b1.x; ++x)
+				{
+					float sum = 0.f;
+					for (int k = 0; k < factor.z; ++k)
+						for (int j = 0; j < factor.y; ++j)
+							for (int i = 0; i < factor.x; ++i)
+							{
+								const ivec3 f = ivec3(x, y, z) * factor + ivec3(i, j, k);
+								sum += fine[f.x + fineRes.x * (f.y + (size_t)fineRes.y * f.z)];
+							}
+
+					values[x + res.x * (y + (size_t)res.y * z)] = sum * weight;
+				}
+	});
+
+	// the PSF spreads small objects, the brightest voxel is exposed to the full signal range
+	const float maxValue = *std::max_element(values.begin(), values.end());
+	if (maxValue > 0.f)
+		for (size_t i = 0; i < values.size(); ++i)
+			values[i] /= maxValue;
+
+	// shot noise (normal approximation of the photon counts) and additive read noise, sequential so the
+	// result only depends on the seed
+	std::mt19937 rng(noiseSeed);
+	std::normal_distribution<float> normal(0.f, 1.f);
+	for (size_t i = 0; i < values.size(); ++i)
+	{
+		float v = BACKGROUND + SIGNAL * values[i];
+		if (options.photons > 0.f)
+			v += sqrt(v / options.photons) * normal(rng);
+		v += options.noise * normal(rng);
+		values[i] = clamp(v, 0.f, 1.f);
+	}
+
+	SpimStack* stack = nullptr;
+	if (options.bytesPerVoxel == 2)
+	{
+		// 12 bit camera
+		std::vector<unsigned short> data(values.size());
+		for (size_t i = 0; i < values.size(); ++i)
+			data[i] = (unsigned short)(values[i] * 4095.f + 0.5f);
+
+		stack = new SpimStackU16;
+		stack->setContent(res, &data[0]);
+	}
+	else
+	{
+		std::vector<unsigned char> data(values.size());
+		for (size_t i = 0; i < values.size(); ++i)
+			data[i] = (unsigned char)(values[i] * 255.f + 0.5f);
+
+		stack = new SpimStackU8;
+		stack->setContent(res, &data[0]);
+	}
+
+	stack->setVoxelDimensions(options.voxelSize);
+	stack->setTransform(transform);
+	return stack;
+}
+
+double PhantomGenerator::calculateError(const AABB& bbox, const mat4& a, const mat4& b)
+{
+	const std::vector<vec3> verts = bbox.getVertices();
+
+	double error = 0;
+	for (size_t i = 0; i < verts.size(); ++i)
+		error += distance(vec3(a * vec4(verts[i], 1.f)), vec3(b * vec4(verts[i], 1.f)));
+
+	return error / verts.size();
+}
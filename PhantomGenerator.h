@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+class SpimStack;
+struct AABB;
+
+/// Synthetic specimens with a known ground truth, for registration tests without a GL context
+/**	The specimen is rasterized once on an isotropic world grid covering the box [0, resolution*voxelSize)
+	of a view with the identity transform. Every view is rendered from it by resampling the specimen at the
+	view's voxel centers, blurring with an anisotropic gaussian PSF along the view's axes and adding noise,
+	so differently oriented views differ the way SPIM views do.
+
+	The objects are kept inside the sphere inscribed into the box, rotating a view around the box center
+	does not move them out of it.
+*/
+class PhantomGenerator
+{
+public:
+	enum Type
+	{
+		// sub-resolution fluorescent beads
+		PHANTOM_BEADS = 0,
+		// a textured ellipsoid with bright nuclei
+		PHANTOM_TISSUE
+	};
+
+	struct Options
+	{
+		Type			type;
+
+		// grid of every view
+		glm::ivec3		resolution;
+		glm::vec3		voxelSize;
+		unsigned int	bytesPerVoxel;
+
+		// number of beads or nuclei
+		unsigned int	objectCount;
+
+		// PSF standard deviation along the view's x, y and z axes in world units
+		glm::vec3		psfSigma;
+
+		// standard deviation of the additive noise relative to the full range
+		float			noise;
+		// expected photons at full intensity for the shot noise, 0 disables it
+		float			photons;
+
+		unsigned int	seed;
+
+		Options();
+	};
+
+	PhantomGenerator(const Options& options);
+
+	inline const Options& getOptions() const { return options; }
+	inline glm::vec3 getCenter() const { return glm::vec3(options.resolution) * options.voxelSize * 0.5f; }
+
+	/// renders the specimen as seen by a view with the given ground truth transform. Views with the same
+	/// transform and noise seed are identical
+	SpimStack* createView(const glm::mat4& transform, unsigned int noiseSeed) const;
+
+	/// mean distance of the bbox corners transformed by a and b, the error measure of the phantom alignment
+	static double calculateError(const AABB& bbox, const glm::mat4& a, const glm::mat4& b);
+
+private:
+	Options				options;
+
+	// the specimen on an isotropic grid, starting at the world origin
+	std::vector<float>	specimen;
+	glm::ivec3			specimenResolution;
+	float				specimenVoxelSize;
+
+	void createBeads();
+	void createTissue();
+
+	// adds a gaussian blob, in world coordinates
+	void splat(const glm::vec3& center, float sigma, float brightness);
+};
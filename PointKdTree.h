@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "nanoflann.hpp"
+
+/// nanoflann adaptor for vec3 and vec4 point arrays. Only xyz are used, w is ignored.
+template <typename P>
+struct PointKdAdaptor
+{
+	const std::vector<P>&		points;
+
+	PointKdAdaptor(const std::vector<P>& p) : points(p) { }
+
+	inline size_t kdtree_get_point_count() const { return points.size(); }
+
+	inline float kdtree_distance(const float* p1, const size_t idx_p2, size_t /*size*/) const
+	{
+		const glm::vec3 delta = glm::vec3(p1[0], p1[1], p1[2]) - glm::vec3(points[idx_p2]);
+		return glm::dot(delta, delta);
+	}
+
+	inline float kdtree_get_pt(const size_t idx, int dim) const { return points[idx][dim]; }
+
+	template <class BBOX>
+	bool kdtree_get_bbox(BBOX& /*bb*/) const { return false; }
+};
+
+/// 3D kd-tree over a point array. The array must outlive the tree and must not change.
+template <typename P>
+class PointKdTree
+{
+public:
+	typedef nanoflann::KDTreeSingleIndexAdaptor<nanoflann::L2_Simple_Adaptor<float, PointKdAdaptor<P> >, PointKdAdaptor<P>, 3> Index;
+
+	PointKdTree(const std::vector<P>& points, size_t maxLeaf = 12) : adaptor(points), index(3, adaptor, nanoflann::KDTreeSingleIndexAdaptorParams(maxLeaf))
+	{
+		index.buildIndex();
+	}
+
+	/// finds the k nearest neighbours of pt. Returns the number of found neighbours; pt itself is included if it is part of the tree.
+	inline size_t knn(const glm::vec3& pt, size_t k, size_t* indices, float* distSqrd) const
+	{
+		nanoflann::KNNResultSet<float> resultSet(k);
+		resultSet.init(indices, distSqrd);
+		index.findNeighbors(resultSet, &pt[0], nanoflann::SearchParams(10));
+		return resultSet.size();
+	}
+
+private:
+	PointKdAdaptor<P>			adaptor;
+	Index						index;
+};
@@ -0,0 +1,204 @@
+#include "PointcloudFilter.h"
+#include "PointKdTree.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+#include <cstdint>
+#include <cmath>
+
+using namespace glm;
+
+namespace PointcloudFilter
+{
+	// 21 bits per axis
+	static const uint64_t CELL_MASK = (1 << 21) - 1;
+
+	template <typename P>
+	static size_t voxelGridImpl(std::vector<P>& points, std::vector<vec3>& colors, std::vector<vec3>& normals, float cellSize, VoxelMode mode)
+	{
+		const size_t count = points.size();
+		if (count == 0 || cellSize <= 0.f)
+			return count;
+
+		const bool hasColors = colors.size() == count;
+		const bool hasNormals = normals.size() == count;
+
+		vec3 minPt(points[0]);
+		for (size_t i = 1; i < count; ++i)
+			minPt = min(minPt, vec3(points[i]));
+
+		// calculate the cell key of every point
+		std::vector<uint64_t> keys(count);
+
+		TaskScheduler::parallelFor(0, (int)count, 4096, [&](int first, int last)
+		{
+			for (int i = first; i < last; ++i)
+			{
+				const uvec3 c(min(floor((vec3(points[i]) - minPt) / cellSize), vec3((float)CELL_MASK)));
+				keys[i] = ((uint64_t)c.x << 42) | ((uint64_t)c.y << 21) | (uint64_t)c.z;
+			}
+		});
+
+		// hash grid of the occupied cells, in the order of their first point
+		std::unordered_map<uint64_t, unsigned int> grid;
+		grid.reserve(count / 4);
+
+		std::vector<unsigned int> cellOf(count), firstPoint;
+		for (size_t i = 0; i < count; ++i)
+		{
+			const auto cell = grid.insert(std::make_pair(keys[i], (unsigned int)firstPoint.size()));
+			if (cell.second)
+				firstPoint.push_back((unsigned int)i);
+			cellOf[i] = cell.first->second;
+		}
+
+		const size_t groupCount = firstPoint.size();
+
+		std::vector<P> newPoints(groupCount, P(0.f));
+		std::vector<vec3> newColors(hasColors ? groupCount : 0, vec3(0.f));
+		std::vector<vec3> newNormals(hasNormals ? groupCount : 0, vec3(0.f));
+
+		if (mode == VOXEL_FIRST_POINT)
+		{
+			for (size_t g = 0; g < groupCount; ++g)
+			{
+				newPoints[g] = points[firstPoint[g]];
+				if (hasColors)
+					newColors[g] = colors[firstPoint[g]];
+				if (hasNormals)
+					newNormals[g] = normals[firstPoint[g]];
+			}
+		}
+		else
+		{
+			// sum up every cell, then divide
+			std::vector<unsigned int> cellCounts(groupCount, 0);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const unsigned int g = cellOf[i];
+				++cellCounts[g];
+				newPoints[g] += points[i];
+				if (hasColors)
+					newColors[g] += colors[i];
+				if (hasNormals)
+					newNormals[g] += normals[i];
+			}
+
+			TaskScheduler::parallelFor(0, (int)groupCount, 4096, [&](int g0, int g1)
+			{
+				for (int g = g0; g < g1; ++g)
+				{
+					const float w = 1.f / (float)cellCounts[g];
+					newPoints[g] *= w;
+					if (hasColors)
+						newColors[g] *= w;
+					if (hasNormals)
+						newNormals[g] = dot(newNormals[g], newNormals[g]) > 0.f ? normalize(newNormals[g]) : normals[firstPoint[g]];
+				}
+			});
+		}
+
+		points.swap(newPoints);
+		if (hasColors)
+			colors.swap(newColors);
+		if (hasNormals)
+			normals.swap(newNormals);
+
+		std::cout << "[Filter] Voxel grid (" << cellSize << ") reduced " << count << " to " << groupCount << " points.\n";
+		return groupCount;
+	}
+
+	template <typename P>
+	static size_t removeOutliersImpl(std::vector<P>& points, std::vector<vec3>& colors, std::vector<vec3>& normals, unsigned int k, float stdDevMul)
+	{
+		const size_t count = points.size();
+		if (count <= k || k == 0)
+			return count;
+
+		const bool hasColors = colors.size() == count;
+		const bool hasNormals = normals.size() == count;
+
+		std::vector<float> meanDistance(count);
+		{
+			const PointKdTree<P> tree(points);
+
+			TaskScheduler::parallelFor(0, (int)count, 1024, [&](int first, int last)
+			{
+				// the query point itself is part of the result
+				std::vector<size_t> indices(k + 1);
+				std::vector<float> distSqrd(k + 1);
+
+				for (int i = first; i < last; ++i)
+				{
+					const size_t found = tree.knn(vec3(points[i]), k + 1, &indices[0], &distSqrd[0]);
+
+					float sum = 0.f;
+					for (size_t j = 1; j < found; ++j)
+						sum += sqrtf(distSqrd[j]);
+
+					meanDistance[i] = found > 1 ? sum / (float)(found - 1) : 0.f;
+				}
+			});
+		}
+
+		double mean = 0.0, variance = 0.0;
+		for (size_t i = 0; i < count; ++i)
+			mean += meanDistance[i];
+		mean /= count;
+
+		for (size_t i = 0; i < count; ++i)
+			variance += (meanDistance[i] - mean) * (meanDistance[i] - mean);
+		variance /= count;
+
+		const float maxDistance = (float)(mean + stdDevMul * sqrt(variance));
+
+		// compact in place
+		size_t n = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (meanDistance[i] > maxDistance)
+				continue;
+
+			points[n] = points[i];
+			if (hasColors)
+				colors[n] = colors[i];
+			if (hasNormals)
+				normals[n] = normals[i];
+			++n;
+		}
+
+		points.resize(n);
+		if (hasColors)
+			colors.resize(n);
+		if (hasNormals)
+			normals.resize(n);
+
+		std::cout << "[Filter] Removed " << count - n << " outliers (mean dist: " << mean << ", threshold: " << maxDistance << ").\n";
+		return n;
+	}
+
+
+	size_t voxelGrid(std::vector<vec3>& points, std::vector<vec3>& colors, std::vector<vec3>& normals, float cellSize, VoxelMode mode)
+	{
+		return voxelGridImpl(points, colors, normals, cellSize, mode);
+	}
+
+	size_t voxelGrid(std::vector<vec4>& points, std::vector<vec3>& normals, float cellSize, VoxelMode mode)
+	{
+		std::vector<vec3> noColors;
+		return voxelGridImpl(points, noColors, normals, cellSize, mode);
+	}
+
+	size_t removeOutliers(std::vector<vec3>& points, std::vector<vec3>& colors, std::vector<vec3>& normals, unsigned int k, float stdDevMul)
+	{
+		return removeOutliersImpl(points, colors, normals, k, stdDevMul);
+	}
+
+	size_t removeOutliers(std::vector<vec4>& points, std::vector<vec3>& normals, unsigned int k, float stdDevMul)
+	{
+		std::vector<vec3> noColors;
+		return removeOutliersImpl(points, noColors, normals, k, stdDevMul);
+	}
+}
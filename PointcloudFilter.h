@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+/// In-place point cloud filters
+/**	All filters work directly on the point arrays and keep the optional per-point attributes (colors,
+	normals) in sync. Pass an empty vector if an attribute is not present. For vec4 points the w
+	component is carried along like an attribute.
+*/
+namespace PointcloudFilter
+{
+	enum VoxelMode
+	{
+		// one point per cell at the centroid of all points in the cell, attributes are averaged
+		VOXEL_CENTROID = 0,
+		// keep the first point of every cell unchanged
+		VOXEL_FIRST_POINT
+	};
+
+	/// voxel-grid downsampling with cubic cells of the given size. Returns the number of remaining points.
+	size_t voxelGrid(std::vector<glm::vec3>& points, std::vector<glm::vec3>& colors, std::vector<glm::vec3>& normals, float cellSize, VoxelMode mode = VOXEL_CENTROID);
+	size_t voxelGrid(std::vector<glm::vec4>& points, std::vector<glm::vec3>& normals, float cellSize, VoxelMode mode = VOXEL_CENTROID);
+
+	/// statistical outlier removal
+	/**	Computes the mean distance of every point to its k nearest neighbours and removes all points whose
+		mean distance is larger than the global mean + stdDevMul * standard deviation. Returns the number
+		of remaining points.
+	*/
+	size_t removeOutliers(std::vector<glm::vec3>& points, std::vector<glm::vec3>& colors, std::vector<glm::vec3>& normals, unsigned int k = 8, float stdDevMul = 1.f);
+	size_t removeOutliers(std::vector<glm::vec4>& points, std::vector<glm::vec3>& normals, unsigned int k = 8, float stdDevMul = 1.f);
+}
@@ -0,0 +1,601 @@
+#include "PointcloudOctree.h"
+#include "Ray.h"
+#include "TaskScheduler.h"
+
+#include <queue>
+#include <limits>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace glm;
+
+PointcloudOctree::PointcloudOctree(unsigned int leafPts, unsigned int nodePts, unsigned int depth) : points(nullptr), maxLeafPoints(leafPts), maxNodePoints(nodePts), maxDepth(depth)
+{
+	assert(maxLeafPoints > 0);
+	assert(maxNodePoints > 0);
+}
+
+AABB PointcloudOctree::getChildBBox(const AABB& parent, int child)
+{
+	const vec3 c = parent.getCentroid();
+
+	AABB result;
+	result.min.x = (child & 1) ? c.x : parent.min.x;
+	result.max.x = (child & 1) ? parent.max.x : c.x;
+	result.min.y = (child & 2) ? c.y : parent.min.y;
+	result.max.y = (child & 2) ? parent.max.y : c.y;
+	result.min.z = (child & 4) ? c.z : parent.min.z;
+	result.max.z = (child & 4) ? parent.max.z : c.z;
+	return result;
+}
+
+void PointcloudOctree::partition(unsigned int* indices, size_t count, const AABB& bbox, size_t offsets[9]) const
+{
+	const vec3 c = bbox.getCentroid();
+
+	// counting sort of the indices by octant
+	size_t histogram[8] = { 0 };
+	std::vector<unsigned char> octant(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const vec3& p = (*points)[indices[i]];
+		unsigned char o = (p.x >= c.x ? 1 : 0) | (p.y >= c.y ? 2 : 0) | (p.z >= c.z ? 4 : 0);
+		octant[i] = o;
+		++histogram[o];
+	}
+
+	offsets[0] = 0;
+	for (int i = 0; i < 8; ++i)
+		offsets[i + 1] = offsets[i] + histogram[i];
+
+	std::vector<unsigned int> sorted(count);
+	size_t cursor[8];
+	std::copy(offsets, offsets + 8, cursor);
+	for (size_t i = 0; i < count; ++i)
+		sorted[cursor[octant[i]]++] = indices[i];
+
+	std::copy(sorted.begin(), sorted.end(), indices);
+}
+
+void PointcloudOctree::buildNode(unsigned int* indices, size_t count, const AABB& bbox, unsigned int level, std::vector<Node>& tree) const
+{
+	const size_t n = tree.size();
+	tree.push_back(Node());
+
+	Node& node = tree.back();
+	node.bbox = bbox;
+	node.level = level;
+	node.subtreeCount = count;
+	node.resident = true;
+	node.fileOffset = 0;
+	std::fill(node.children, node.children + 8, -1);
+
+	node.leaf = (count <= maxLeafPoints || level >= maxDepth);
+
+	size_t offsets[9];
+	size_t stride = 1;
+	if (!node.leaf)
+	{
+		// representatives are drawn with a constant stride from the octant-sorted indices, every octant
+		// therefore contributes in proportion to its point count
+		partition(indices, count, bbox, offsets);
+		stride = (count + maxNodePoints - 1) / maxNodePoints;
+	}
+
+	node.indices.reserve((count + stride - 1) / stride);
+	for (size_t i = 0; i < count; i += stride)
+		node.indices.push_back(indices[i]);
+	node.pointCount = node.indices.size();
+
+	if (node.leaf)
+		return;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		const size_t childCount = offsets[i + 1] - offsets[i];
+		if (childCount == 0)
+			continue;
+
+		const int c = (int)tree.size();
+		buildNode(indices + offsets[i], childCount, getChildBBox(bbox, i), level + 1, tree);
+
+		// tree might have been reallocated
+		tree[n].children[i] = c;
+	}
+}
+
+void PointcloudOctree::build(const std::vector<vec3>& pts)
+{
+	nodes.clear();
+	points = &pts;
+
+	if (file.is_open())
+		file.close();
+	filename.clear();
+
+	if (pts.empty())
+		return;
+
+	bounds.calculate(pts);
+
+	// use a cubic root box so that all nodes stay cubic
+	AABB bbox = bounds;
+	const vec3 c = bbox.getCentroid();
+	const vec3 span = bbox.getSpan();
+	const float halfSize = std::max(std::max(span.x, std::max(span.y, span.z)) * 0.5f, 1e-6f);
+	bbox.min = c - vec3(halfSize);
+	bbox.max = c + vec3(halfSize);
+
+	std::vector<unsigned int> indices(pts.size());
+	for (size_t i = 0; i < indices.size(); ++i)
+		indices[i] = (unsigned int)i;
+
+	if (indices.size() <= maxLeafPoints || maxDepth == 0)
+	{
+		buildNode(&indices[0], indices.size(), bbox, 0, nodes);
+		return;
+	}
+
+	// build the root by hand, then the eight subtrees in parallel
+	size_t offsets[9];
+	partition(&indices[0], indices.size(), bbox, offsets);
+
+	Node root;
+	root.bbox = bbox;
+	root.level = 0;
+	root.leaf = false;
+	root.subtreeCount = indices.size();
+	root.resident = true;
+	root.fileOffset = 0;
+	std::fill(root.children, root.children + 8, -1);
+
+	const size_t stride = (indices.size() + maxNodePoints - 1) / maxNodePoints;
+	for (size_t i = 0; i < indices.size(); i += stride)
+		root.indices.push_back(indices[i]);
+	root.pointCount = root.indices.size();
+
+	std::vector<Node> subtrees[8];
+
+	TaskScheduler::parallelFor(0, 8, 1, [&](int first, int last)
+	{
+		for (int i = first; i < last; ++i)
+		{
+			const size_t childCount = offsets[i + 1] - offsets[i];
+			if (childCount > 0)
+				buildNode(&indices[offsets[i]], childCount, getChildBBox(bbox, i), 1, subtrees[i]);
+		}
+	});
+
+	// merge the subtrees, shifting their local child indices
+	nodes.push_back(root);
+	for (int i = 0; i < 8; ++i)
+	{
+		if (subtrees[i].empty())
+			continue;
+
+		const int offset = (int)nodes.size();
+		nodes[0].children[i] = offset;
+
+		for (size_t j = 0; j < subtrees[i].size(); ++j)
+		{
+			Node& n = subtrees[i][j];
+			for (int k = 0; k < 8; ++k)
+				if (n.children[k] >= 0)
+					n.children[k] += offset;
+
+			nodes.push_back(Node());
+			std::swap(nodes.back(), n);
+		}
+	}
+
+	std::cout << "[Octree] Built " << nodes.size() << " nodes for " << pts.size() << " points.\n";
+}
+
+void PointcloudOctree::selectNodes(const mat4& mvp, const ivec2& viewport, size_t pointBudget, std::vector<unsigned int>& result, float minNodeSize) const
+{
+	result.clear();
+	if (nodes.empty())
+		return;
+
+	typedef std::pair<float, unsigned int> Candidate;
+
+	// projected size of a node's bounding sphere in pixels
+	auto projectedSize = [&](const Node& n) -> float
+	{
+		const vec4 c = mvp * vec4(n.bbox.getCentroid(), 1.f);
+		const float r = n.bbox.getBoundingSphereRadius();
+
+		// camera inside or very close to the node
+		if (c.w <= r)
+			return std::numeric_limits<float>::max();
+
+		return r / c.w * (float)viewport.y;
+	};
+
+	if (nodes[0].bbox.isVisible(mvp) == AABB::OUTSIDE)
+		return;
+
+	std::priority_queue<Candidate> queue;
+	queue.push(Candidate(projectedSize(nodes[0]), 0));
+	size_t total = nodes[0].pointCount;
+
+	unsigned int visible[8];
+	while (!queue.empty())
+	{
+		const Candidate current = queue.top();
+		queue.pop();
+
+		const Node& n = nodes[current.second];
+
+		if (n.leaf || current.first < minNodeSize)
+		{
+			result.push_back(current.second);
+			continue;
+		}
+
+		// refining replaces the node by its visible children
+		int visibleCount = 0;
+		size_t childPoints = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			if (n.children[i] < 0)
+				continue;
+
+			const Node& child = nodes[n.children[i]];
+			if (child.bbox.isVisible(mvp) == AABB::OUTSIDE)
+				continue;
+
+			visible[visibleCount++] = n.children[i];
+			childPoints += child.pointCount;
+		}
+
+		if (total - n.pointCount + childPoints > pointBudget)
+		{
+			result.push_back(current.second);
+			continue;
+		}
+
+		total = total - n.pointCount + childPoints;
+		for (int i = 0; i < visibleCount; ++i)
+			queue.push(Candidate(projectedSize(nodes[visible[i]]), visible[i]));
+	}
+
+	// front-to-back, nearer nodes occlude the farther ones
+	std::vector<std::pair<float, unsigned int> > depths(result.size());
+	for (size_t i = 0; i < result.size(); ++i)
+		depths[i] = std::make_pair((mvp * vec4(nodes[result[i]].bbox.getCentroid(), 1.f)).w, result[i]);
+	std::sort(depths.begin(), depths.end());
+
+	for (size_t i = 0; i < result.size(); ++i)
+		result[i] = depths[i].second;
+}
+
+size_t PointcloudOctree::getClosestPoint(const Ray& ray, float& distance) const
+{
+	distance = std::numeric_limits<float>::max();
+	size_t minIndex = 0;
+
+	if (nodes.empty())
+		return minIndex;
+
+	const vec3 dir = normalize(ray.direction);
+
+	// lower bound of the distance of any point inside the node to the ray
+	auto bound = [&](const Node& n) -> float
+	{
+		const vec3 pq = n.bbox.getCentroid() - ray.origin;
+		return std::max(0.f, length(cross(pq, dir)) - n.bbox.getBoundingSphereRadius());
+	};
+
+	// best-first traversal, smallest bound first
+	typedef std::pair<float, unsigned int> Candidate;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > queue;
+	queue.push(Candidate(bound(nodes[0]), 0));
+
+	while (!queue.empty())
+	{
+		const Candidate current = queue.top();
+		queue.pop();
+
+		if (current.first >= distance)
+			break;
+
+		const Node& n = nodes[current.second];
+		if (n.leaf)
+		{
+			// leaves of opened trees are only paged in for the scan
+			const bool wasResident = n.resident;
+			fetch(current.second);
+
+			for (size_t i = 0; i < n.pointCount; ++i)
+			{
+				const float d = length(cross(getPoint(n, i) - ray.origin, dir));
+				if (d < distance)
+				{
+					distance = d;
+					minIndex = n.indices[i];
+				}
+			}
+
+			if (!wasResident)
+				release(current.second);
+		}
+		else
+		{
+			for (int i = 0; i < 8; ++i)
+				if (n.children[i] >= 0)
+					queue.push(Candidate(bound(nodes[n.children[i]]), n.children[i]));
+		}
+	}
+
+	return minIndex;
+}
+
+size_t PointcloudOctree::getNearestPoint(const vec3& pt, float& distSqrd) const
+{
+	distSqrd = std::numeric_limits<float>::max();
+	size_t minIndex = 0;
+
+	if (nodes.empty())
+		return minIndex;
+
+	auto bound = [&](const Node& n) -> float
+	{
+		const vec3 d = max(max(n.bbox.min - pt, pt - n.bbox.max), vec3(0.f));
+		return dot(d, d);
+	};
+
+	typedef std::pair<float, unsigned int> Candidate;
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > queue;
+	queue.push(Candidate(bound(nodes[0]), 0));
+
+	while (!queue.empty())
+	{
+		const Candidate current = queue.top();
+		queue.pop();
+
+		if (current.first >= distSqrd)
+			break;
+
+		const Node& n = nodes[current.second];
+		if (n.leaf)
+		{
+			const bool wasResident = n.resident;
+			fetch(current.second);
+
+			for (size_t i = 0; i < n.pointCount; ++i)
+			{
+				const vec3 d = getPoint(n, i) - pt;
+				const float d2 = dot(d, d);
+				if (d2 < distSqrd)
+				{
+					distSqrd = d2;
+					minIndex = n.indices[i];
+				}
+			}
+
+			if (!wasResident)
+				release(current.second);
+		}
+		else
+		{
+			for (int i = 0; i < 8; ++i)
+				if (n.children[i] >= 0)
+					queue.push(Candidate(bound(nodes[n.children[i]]), n.children[i]));
+		}
+	}
+
+	return minIndex;
+}
+
+void PointcloudOctree::fetch(unsigned int n) const
+{
+	const Node& node = nodes[n];
+	if (node.resident)
+		return;
+
+	if (!file.is_open())
+		throw std::runtime_error("Octree node is not resident and no file is open!");
+
+	node.points.resize(node.pointCount);
+	node.colors.resize(node.pointCount);
+	node.indices.resize(node.pointCount);
+
+	file.clear();
+	file.seekg(node.fileOffset);
+	file.read(reinterpret_cast<char*>(value_ptr(node.points[0])), sizeof(vec3)*node.pointCount);
+	file.read(reinterpret_cast<char*>(value_ptr(node.colors[0])), sizeof(vec3)*node.pointCount);
+	file.read(reinterpret_cast<char*>(&node.indices[0]), sizeof(unsigned int)*node.pointCount);
+
+	if (!file)
+		throw std::runtime_error("Unable to read octree node from \"" + filename + "\"!");
+
+	node.resident = true;
+}
+
+void PointcloudOctree::release(unsigned int n) const
+{
+	const Node& node = nodes[n];
+
+	// built trees reference the cloud, only nodes backed by a file can be released
+	if (!node.resident || !file.is_open() || node.pointCount == 0)
+		return;
+
+	std::vector<vec3>().swap(node.points);
+	std::vector<vec3>().swap(node.colors);
+	std::vector<unsigned int>().swap(node.indices);
+	node.resident = false;
+}
+
+void PointcloudOctree::getPayload(unsigned int n, const std::vector<vec3>& cloudColors, std::vector<vec3>& result, std::vector<vec3>& resultColors) const
+{
+	const Node& node = nodes[n];
+
+	if (file.is_open())
+	{
+		const bool wasResident = node.resident;
+		fetch(n);
+
+		result = node.points;
+		resultColors = node.colors;
+
+		if (!wasResident)
+			release(n);
+		return;
+	}
+
+	// the node only stores indices, gather its points
+	result.resize(node.pointCount);
+	resultColors.assign(node.pointCount, vec3(1.f));
+	for (size_t i = 0; i < node.pointCount; ++i)
+	{
+		const unsigned int idx = node.indices[i];
+		result[i] = (*points)[idx];
+		if (idx < cloudColors.size())
+			resultColors[i] = cloudColors[idx];
+	}
+}
+
+// file layout: header, bounds, node table, payloads (points, colors, indices)
+static const char OCTREE_MAGIC[4] = { 'P', 'C', 'O', 'T' };
+static const uint32_t OCTREE_VERSION = 1;
+
+// bbox, children, level, leaf, point counts and payload offset
+static const std::streamoff NODE_RECORD_SIZE = sizeof(float) * 6 + sizeof(int32_t) * 8 + sizeof(uint32_t) * 2 + sizeof(uint64_t) * 3;
+
+void PointcloudOctree::save(const std::string& f, const std::vector<vec3>& cloudColors) const
+{
+	// the payloads of opened trees are read from the file while writing
+	if (file.is_open() && f == filename)
+		throw std::runtime_error("Unable to save the octree over its own file \"" + f + "\"!");
+
+	std::cout << "[Octree] Saving " << nodes.size() << " nodes to \"" << f << "\" ... ";
+
+	std::ofstream out(f, std::ios::binary);
+	if (!out.is_open())
+		throw std::runtime_error("Unable to open file \"" + f + "\" for writing!");
+
+	const uint32_t header[5] = { OCTREE_VERSION, maxLeafPoints, maxNodePoints, maxDepth, (uint32_t)nodes.size() };
+	out.write(OCTREE_MAGIC, 4);
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(value_ptr(bounds.min)), sizeof(vec3));
+	out.write(reinterpret_cast<const char*>(value_ptr(bounds.max)), sizeof(vec3));
+
+	std::streamoff offset = 4 + sizeof(header) + sizeof(vec3) * 2 + NODE_RECORD_SIZE * (std::streamoff)nodes.size();
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const Node& n = nodes[i];
+		int32_t children[8];
+		std::copy(n.children, n.children + 8, children);
+		const uint32_t info[2] = { n.level, n.leaf ? 1u : 0u };
+		const uint64_t counts[3] = { n.pointCount, n.subtreeCount, (uint64_t)offset };
+
+		out.write(reinterpret_cast<const char*>(value_ptr(n.bbox.min)), sizeof(vec3));
+		out.write(reinterpret_cast<const char*>(value_ptr(n.bbox.max)), sizeof(vec3));
+		out.write(reinterpret_cast<const char*>(children), sizeof(children));
+		out.write(reinterpret_cast<const char*>(info), sizeof(info));
+		out.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+
+		offset += (sizeof(vec3) * 2 + sizeof(unsigned int)) * n.pointCount;
+	}
+
+	// one node at a time, opened trees are never fully resident
+	std::vector<vec3> pts, cols;
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		const Node& n = nodes[i];
+		if (n.pointCount == 0)
+			continue;
+
+		const bool wasResident = n.resident;
+		fetch((unsigned int)i);
+		getPayload((unsigned int)i, cloudColors, pts, cols);
+
+		out.write(reinterpret_cast<const char*>(value_ptr(pts[0])), sizeof(vec3)*n.pointCount);
+		out.write(reinterpret_cast<const char*>(value_ptr(cols[0])), sizeof(vec3)*n.pointCount);
+		out.write(reinterpret_cast<const char*>(&n.indices[0]), sizeof(unsigned int)*n.pointCount);
+
+		if (!wasResident)
+			release((unsigned int)i);
+	}
+
+	if (!out)
+		throw std::runtime_error("Unable to write octree to \"" + f + "\"!");
+
+	std::cout << "done.\n";
+}
+
+void PointcloudOctree::open(const std::string& f)
+{
+	if (file.is_open())
+		file.close();
+
+	nodes.clear();
+	points = nullptr;
+	filename = f;
+
+	file.open(f, std::ios::binary);
+	if (!file.is_open())
+		throw std::runtime_error("Unable to open file \"" + f + "\"!");
+
+	char magic[4] = { 0 };
+	file.read(magic, 4);
+	if (memcmp(magic, OCTREE_MAGIC, 4) != 0)
+	{
+		file.close();
+		throw std::runtime_error("File \"" + f + "\" is not a point cloud octree!");
+	}
+
+	uint32_t header[5];
+	file.read(reinterpret_cast<char*>(header), sizeof(header));
+	if (!file || header[0] != OCTREE_VERSION)
+	{
+		file.close();
+		throw std::runtime_error("Unsupported point cloud octree version in \"" + f + "\"!");
+	}
+
+	maxLeafPoints = header[1];
+	maxNodePoints = header[2];
+	maxDepth = header[3];
+
+	file.read(reinterpret_cast<char*>(value_ptr(bounds.min)), sizeof(vec3));
+	file.read(reinterpret_cast<char*>(value_ptr(bounds.max)), sizeof(vec3));
+
+	nodes.resize(header[4]);
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		Node& n = nodes[i];
+		int32_t children[8];
+		uint32_t info[2];
+		uint64_t counts[3];
+
+		file.read(reinterpret_cast<char*>(value_ptr(n.bbox.min)), sizeof(vec3));
+		file.read(reinterpret_cast<char*>(value_ptr(n.bbox.max)), sizeof(vec3));
+		file.read(reinterpret_cast<char*>(children), sizeof(children));
+		file.read(reinterpret_cast<char*>(info), sizeof(info));
+		file.read(reinterpret_cast<char*>(counts), sizeof(counts));
+
+		std::copy(children, children + 8, n.children);
+		n.level = info[0];
+		n.leaf = info[1] != 0;
+		n.pointCount = (size_t)counts[0];
+		n.subtreeCount = (size_t)counts[1];
+		n.fileOffset = (std::streamoff)counts[2];
+		n.resident = (n.pointCount == 0);
+	}
+
+	if (!file)
+	{
+		nodes.clear();
+		file.close();
+		throw std::runtime_error("Unable to read the octree nodes from \"" + f + "\"!");
+	}
+
+	std::cout << "[Octree] Opened " << nodes.size() << " nodes of " << getPointCount() << " points from \"" << f << "\".\n";
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+#include <glm/glm.hpp>
+#include <boost/utility.hpp>
+
+#include "AABB.h"
+
+struct Ray;
+
+/// Level-of-detail octree for large point clouds
+/**	Every node stores the indices of its payload: leaves hold all of their points, inner nodes hold a
+	subsampled set of representative points of their subtree. Rendering selects a 'cut' through the tree
+	that fits into a point budget; a refined node is replaced by its children.
+
+	A built tree does not copy the points, it references the vector it was built from, which has to outlive
+	it and must not change until the next build(). It can be saved with the payload points and colors and
+	re-opened out-of-core, in which case only the node table is read and payloads are fetched from the file
+	on demand. The tree does not depend on OpenGL.
+*/
+class PointcloudOctree : boost::noncopyable
+{
+public:
+	struct Node
+	{
+		AABB						bbox;
+
+		// child node indices, -1 if not present
+		int							children[8];
+		unsigned int				level;
+		bool						leaf;
+
+		// number of payload points
+		size_t						pointCount;
+		// number of points in the whole subtree
+		size_t						subtreeCount;
+
+		// the payload point's indices in the original point cloud, for opened trees only while resident
+		mutable std::vector<unsigned int>	indices;
+		// payload positions and colors of opened trees, while resident
+		mutable std::vector<glm::vec3>		points, colors;
+		mutable bool				resident;
+
+		// offset of the payload in the octree file
+		std::streamoff				fileOffset;
+	};
+
+	/// sets the tree parameters, call build() afterwards
+	PointcloudOctree(unsigned int maxLeafPoints = 8192, unsigned int maxNodePoints = 8192, unsigned int maxDepth = 12);
+
+	/// builds the tree over the given points in parallel
+	void build(const std::vector<glm::vec3>& points);
+
+	/// selects the nodes to draw for the given (model-)view-projection matrix.
+	/**	Nodes are culled against the frustum and refined largest on screen first, while the total point
+		count stays within the budget and the node is larger than minNodeSize pixels on screen. The result
+		is sorted front-to-back by the view depth of the node centers.
+	*/
+	void selectNodes(const glm::mat4& mvp, const glm::ivec2& viewport, size_t pointBudget, std::vector<unsigned int>& result, float minNodeSize = 1.f) const;
+
+	/// returns the original index of the point closest to the (infinite) ray; the ray has to be in octree coordinates
+	size_t getClosestPoint(const Ray& ray, float& distance) const;
+	/// returns the original index of the point closest to pt
+	size_t getNearestPoint(const glm::vec3& pt, float& distSqrd) const;
+
+	/// makes sure the payload of the node is in memory
+	void fetch(unsigned int node) const;
+	/// releases the payload of a node, only trees opened from disk have payloads to release
+	void release(unsigned int node) const;
+	/// positions and colors of the node's payload. colors is the cloud's colors for built trees, white if missing
+	void getPayload(unsigned int node, const std::vector<glm::vec3>& colors, std::vector<glm::vec3>& points, std::vector<glm::vec3>& pointColors) const;
+
+	/// writes the node table and all payloads to disk, colors as for getPayload()
+	void save(const std::string& filename, const std::vector<glm::vec3>& colors) const;
+	/// opens an octree file out-of-core, only the node table is read
+	void open(const std::string& filename);
+	inline bool isOutOfCore() const { return file.is_open(); }
+
+	inline const Node& getNode(unsigned int n) const { return nodes[n]; }
+	inline size_t getNodeCount() const { return nodes.size(); }
+	inline size_t getPointCount() const { return nodes.empty() ? 0 : nodes[0].subtreeCount; }
+	/// cubic bounding box of the root node
+	inline const AABB& getBBox() const { return nodes[0].bbox; }
+	/// tight bounding box of all points
+	inline const AABB& getPointBounds() const { return bounds; }
+	inline bool empty() const { return nodes.empty(); }
+
+private:
+	std::vector<Node>			nodes;
+	const std::vector<glm::vec3>*	points;
+	AABB						bounds;
+
+	mutable std::ifstream		file;
+	std::string					filename;
+
+	unsigned int				maxLeafPoints;
+	unsigned int				maxNodePoints;
+	unsigned int				maxDepth;
+
+	inline const glm::vec3& getPoint(const Node& n, size_t i) const { return file.is_open() ? n.points[i] : (*points)[n.indices[i]]; }
+
+	void buildNode(unsigned int* indices, size_t count, const AABB& bbox, unsigned int level, std::vector<Node>& tree) const;
+
+	void partition(unsigned int* indices, size_t count, const AABB& bbox, size_t offsets[9]) const;
+
+	static AABB getChildBBox(const AABB& parent, int child);
+};
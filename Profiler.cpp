@@ -0,0 +1,291 @@
+#include "Profiler.h"
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+namespace Profiler
+{
+	namespace detail
+	{
+		std::atomic<bool> enabled(false);
+
+		// all times are relative to the program start
+		static const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+		uint64_t now()
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		struct Event
+		{
+			const char*		name;
+			uint64_t		start;
+			// duration of zones, value of counters
+			uint64_t		value;
+			bool			counter;
+		};
+
+		// events are appended to a list of fixed-size chunks. Only the owning thread writes; it publishes an
+		// event by incrementing count, so readers never see half-written events
+		struct Chunk
+		{
+			static const size_t SIZE = 4096;
+
+			Event					events[SIZE];
+			std::atomic<size_t>		count;
+			std::atomic<Chunk*>		next;
+
+			inline Chunk() : count(0), next(nullptr) {}
+		};
+
+		struct ThreadBuffer
+		{
+			unsigned int				thread;
+			Chunk*						head;
+			// last chunk, only used by the owning thread
+			Chunk*						tail;
+			// the buffer holds events of this generation, it is stale if it is older than the current one
+			std::atomic<unsigned int>	generation;
+		};
+
+		// clear() starts a new generation, every thread resets its own buffer on its next record. Only the
+		// owner ever frees chunks, so readers and zones open during a clear() never see freed memory
+		static std::atomic<unsigned int> generation(0);
+
+		// buffers are registered once per thread and live until the program ends, the scheduler reuses its threads
+		static std::mutex bufferMutex;
+		static std::vector<ThreadBuffer*> buffers;
+
+		static ThreadBuffer* getThreadBuffer()
+		{
+			static thread_local ThreadBuffer* buffer = nullptr;
+			if (!buffer)
+			{
+				buffer = new ThreadBuffer;
+				buffer->head = buffer->tail = new Chunk;
+				buffer->generation.store(generation.load());
+
+				std::lock_guard<std::mutex> lock(bufferMutex);
+				buffer->thread = (unsigned int)buffers.size();
+				buffers.push_back(buffer);
+			}
+
+			return buffer;
+		}
+
+		static void record(const Event& e)
+		{
+			ThreadBuffer* buffer = getThreadBuffer();
+
+			const unsigned int g = generation.load(std::memory_order_acquire);
+			if (buffer->generation.load(std::memory_order_relaxed) != g)
+			{
+				Chunk* c = buffer->head->next.load(std::memory_order_relaxed);
+				while (c)
+				{
+					Chunk* next = c->next.load(std::memory_order_relaxed);
+					delete c;
+					c = next;
+				}
+
+				buffer->head->next.store(nullptr, std::memory_order_relaxed);
+				buffer->head->count.store(0, std::memory_order_relaxed);
+				buffer->tail = buffer->head;
+
+				// readers skip the buffer until it is reset
+				buffer->generation.store(g, std::memory_order_release);
+			}
+
+			Chunk* chunk = buffer->tail;
+			size_t n = chunk->count.load(std::memory_order_relaxed);
+			if (n == Chunk::SIZE)
+			{
+				Chunk* next = new Chunk;
+				chunk->next.store(next, std::memory_order_release);
+				buffer->tail = chunk = next;
+				n = 0;
+			}
+
+			chunk->events[n] = e;
+			chunk->count.store(n + 1, std::memory_order_release);
+		}
+
+		void recordZone(const char* name, uint64_t start, uint64_t end)
+		{
+			const Event e = { name, start, end - start, false };
+			record(e);
+		}
+
+		void recordCounter(const char* name, uint64_t value)
+		{
+			const Event e = { name, now(), value, true };
+			record(e);
+		}
+
+		struct ThreadEvent
+		{
+			unsigned int	thread;
+			Event			event;
+		};
+
+		// copies the published events of all threads
+		static std::vector<ThreadEvent> collect()
+		{
+			std::vector<ThreadEvent> result;
+
+			// clear() takes the lock as well, the generation cannot change while collecting
+			std::lock_guard<std::mutex> lock(bufferMutex);
+			const unsigned int g = generation.load(std::memory_order_acquire);
+			for (size_t i = 0; i < buffers.size(); ++i)
+			{
+				// cleared, its owner has not recorded since
+				if (buffers[i]->generation.load(std::memory_order_acquire) != g)
+					continue;
+
+				for (const Chunk* c = buffers[i]->head; c; c = c->next.load(std::memory_order_acquire))
+				{
+					const size_t n = c->count.load(std::memory_order_acquire);
+					for (size_t j = 0; j < n; ++j)
+					{
+						const ThreadEvent e = { buffers[i]->thread, c->events[j] };
+						result.push_back(e);
+					}
+				}
+			}
+
+			std::sort(result.begin(), result.end(), [](const ThreadEvent& a, const ThreadEvent& b) { return a.event.start < b.event.start; });
+			return result;
+		}
+
+		// names are compared by content, the same literal may have different addresses in different units
+		struct NameLess
+		{
+			inline bool operator()(const char* a, const char* b) const { return strcmp(a, b) < 0; }
+		};
+
+		static void writeString(std::ostream& out, const char* s)
+		{
+			out << '"';
+			for (; *s; ++s)
+			{
+				if (*s == '"' || *s == '\\')
+					out << '\\';
+				out << *s;
+			}
+			out << '"';
+		}
+	}
+
+	void setEnabled(bool e)
+	{
+		detail::enabled.store(e);
+		std::cout << "[Profiler] " << (e ? "Enabled" : "Disabled") << std::endl;
+	}
+
+	void clear()
+	{
+		using namespace detail;
+
+		std::lock_guard<std::mutex> lock(bufferMutex);
+		++generation;
+	}
+
+	void saveChromeTrace(const std::string& filename)
+	{
+		using namespace detail;
+
+		std::ofstream file(filename);
+		if (!file.is_open())
+			throw std::runtime_error("Unable to open file \"" + filename + "\"!");
+
+		const std::vector<ThreadEvent> events = collect();
+
+		unsigned int threads = 0;
+		for (size_t i = 0; i < events.size(); ++i)
+			threads = std::max(threads, events[i].thread + 1);
+
+		file << "{\"traceEvents\":[\n";
+		for (unsigned int i = 0; i < threads; ++i)
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i << ",\"args\":{\"name\":\"Thread " << i << "\"}},\n";
+
+		// counters are shown as running totals over all threads
+		std::map<const char*, uint64_t, NameLess> totals;
+
+		file << std::fixed << std::setprecision(3);
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			const Event& e = events[i].event;
+
+			file << "{\"name\":";
+			writeString(file, e.name);
+			file << ",\"pid\":1,\"tid\":" << events[i].thread << ",\"ts\":" << e.start * 1e-3;
+
+			if (e.counter)
+			{
+				uint64_t& total = totals[e.name];
+				total += e.value;
+				file << ",\"ph\":\"C\",\"args\":{\"value\":" << total << "}}";
+			}
+			else
+				file << ",\"ph\":\"X\",\"dur\":" << e.value * 1e-3 << "}";
+
+			file << (i + 1 < events.size() ? ",\n" : "\n");
+		}
+		file << "]}\n";
+
+		std::cout << "[Profiler] Wrote " << events.size() << " events of " << threads << " threads to \"" << filename << "\"\n";
+	}
+
+	void printSummary(std::ostream& out)
+	{
+		using namespace detail;
+
+		struct ZoneStats
+		{
+			size_t		calls;
+			uint64_t	total, max;
+		};
+
+		std::map<const char*, ZoneStats, NameLess> zones;
+		std::map<const char*, uint64_t, NameLess> counters;
+
+		const std::vector<ThreadEvent> events = collect();
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			const Event& e = events[i].event;
+			if (e.counter)
+				counters[e.name] += e.value;
+			else
+			{
+				ZoneStats& z = zones[e.name];
+				++z.calls;
+				z.total += e.value;
+				z.max = std::max(z.max, e.value);
+			}
+		}
+
+		const std::ios::fmtflags flags = out.flags();
+		out << std::fixed << std::setprecision(2);
+
+		out << "[Profiler] " << std::left << std::setw(40) << "Zone" << std::right << std::setw(10) << "calls" << std::setw(14) << "total ms" << std::setw(12) << "mean ms" << std::setw(12) << "max ms" << "\n";
+		for (auto z = zones.begin(); z != zones.end(); ++z)
+			out << "[Profiler] " << std::left << std::setw(40) << z->first << std::right << std::setw(10) << z->second.calls << std::setw(14) << z->second.total * 1e-6 << std::setw(12) << z->second.total * 1e-6 / z->second.calls << std::setw(12) << z->second.max * 1e-6 << "\n";
+
+		if (!counters.empty())
+		{
+			out << "[Profiler] " << std::left << std::setw(40) << "Counter" << std::right << std::setw(20) << "total" << "\n";
+			for (auto c = counters.begin(); c != counters.end(); ++c)
+				out << "[Profiler] " << std::left << std::setw(40) << c->first << std::right << std::setw(20) << c->second << "\n";
+		}
+
+		out.flags(flags);
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <iostream>
+#include <cstdint>
+
+/// Lightweight instrumentation of the hot paths
+/**	Zones time a scope, counters add up amounts like loaded bytes or processed voxels:
+
+		void SpimStack::update()
+		{
+			PROFILE_ZONE("Stack::update");
+			PROFILE_COUNT("voxels processed", getVoxelCount());
+			...
+		}
+
+	Every thread records into its own buffer, recording takes no locks. Names have to be string literals,
+	only their pointers are stored. Recording is off until setEnabled(true); a disabled zone costs one
+	relaxed atomic load. Defining NO_PROFILING removes the zones at compile time.
+
+	The recorded events can be written as a Chrome trace (chrome://tracing, Perfetto) or summarized per
+	zone and counter.
+*/
+namespace Profiler
+{
+	namespace detail
+	{
+		extern std::atomic<bool> enabled;
+
+		uint64_t now();
+		void recordZone(const char* name, uint64_t start, uint64_t end);
+		void recordCounter(const char* name, uint64_t value);
+	}
+
+	inline bool isEnabled() { return detail::enabled.load(std::memory_order_relaxed); }
+	void setEnabled(bool enabled);
+
+	/// drops all recorded events. Threads free their buffers on their next record, zones may be open
+	void clear();
+
+	/// writes all recorded events as Chrome trace event JSON
+	void saveChromeTrace(const std::string& filename);
+	/// prints calls and times per zone and the totals per counter
+	void printSummary(std::ostream& out = std::cout);
+
+	/// times its scope
+	class Zone
+	{
+	public:
+		inline Zone(const char* n) : name(nullptr), start(0)
+		{
+			if (isEnabled())
+			{
+				name = n;
+				start = detail::now();
+			}
+		}
+
+		inline ~Zone()
+		{
+			if (name)
+				detail::recordZone(name, start, detail::now());
+		}
+
+	private:
+		const char*		name;
+		uint64_t		start;
+
+		Zone(const Zone&);
+		Zone& operator=(const Zone&);
+	};
+
+	inline void count(const char* name, uint64_t value)
+	{
+		if (isEnabled())
+			detail::recordCounter(name, value);
+	}
+}
+
+#ifdef NO_PROFILING
+#define PROFILE_ZONE(name)
+#define PROFILE_COUNT(name, value)
+#else
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) Profiler::Zone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_COUNT(name, value) Profiler::count(name, (uint64_t)(value))
+#endif
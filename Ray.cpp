@@ -36,16 +36,6 @@ bool Ray::intersectsAABB(const AABB& bbox) const
 	return bbox.isIntersectedByRay(origin, direction);
 }
 
-bool Ray::intersectsAABB(const AABB& bbox, const glm::mat4& boxTransform) const
-{
-	// transform ray into box space
-	mat4 invX = inverse(boxTransform);
-	vec4 o = invX * vec4(origin, 1.f);
-	vec4 d = invX * vec4(direction, 0.f);
-
-	return bbox.isIntersectedByRay(vec3(o), normalize(vec3(d)));
-}
-
 size_t Ray::getClosestPoint(const std::vector<vec3>& points, float& minDistance) const
 {
 	size_t minIndex = 0;
@@ -69,17 +59,3 @@ size_t Ray::getClosestPoint(const std::vector<vec3>& points, float& minDistance)
 	
 	return minIndex;
 }
-
-size_t Ray::getClosestPoint(const std::vector<glm::vec3>& points, const glm::mat4& pointTransform, float& distSqrd) const
-{
-	// transform ray into box space
-	mat4 invX = inverse(pointTransform);
-	vec4 o = invX * vec4(origin, 1.f);
-	vec4 d = invX * vec4(direction, 0.f);
-	
-	Ray r2;
-	r2.origin = vec3(o);
-	r2.direction = normalize(vec3(d));
-
-	return r2.getClosestPoint(points, distSqrd);
-}
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include "Resampling.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+using namespace glm;
+
+namespace Resampling
+{
+	static inline size_t index(const ivec3& res, int x, int y, int z)
+	{
+		return x + res.x * (y + (size_t)res.y * z);
+	}
+
+	// each kernel defines the range [lo, hi) of coordinates for which all its taps are inside the volume
+	struct NearestKernel
+	{
+		static inline vec3 lo(const ivec3&) { return vec3(0.f); }
+		static inline vec3 hi(const ivec3& res) { return vec3(res); }
+
+		template <typename T>
+		static inline float fast(const T* v, const ivec3& res, const vec3& p)
+		{
+			return float(v[index(res, (int)p.x, (int)p.y, (int)p.z)]);
+		}
+
+		template <typename T>
+		static inline float clamped(const T* v, const ivec3& res, const vec3& p)
+		{
+			const ivec3 i = clamp(ivec3(floor(p)), ivec3(0), res - ivec3(1));
+			return float(v[index(res, i.x, i.y, i.z)]);
+		}
+	};
+
+	struct LinearKernel
+	{
+		static inline vec3 lo(const ivec3&) { return vec3(0.5f); }
+		static inline vec3 hi(const ivec3& res) { return vec3(res) - vec3(0.5f); }
+
+		template <typename T>
+		static inline float interpolate(const T* v, const ivec3& res, const ivec3& i0, const ivec3& i1, const vec3& f)
+		{
+			const size_t sy = (size_t)res.x, sz = (size_t)res.x * res.y;
+			const size_t y0 = i0.y * sy, y1 = i1.y * sy;
+			const size_t z0 = i0.z * sz, z1 = i1.z * sz;
+
+			const float c00 = mix(float(v[i0.x + y0 + z0]), float(v[i1.x + y0 + z0]), f.x);
+			const float c10 = mix(float(v[i0.x + y1 + z0]), float(v[i1.x + y1 + z0]), f.x);
+			const float c01 = mix(float(v[i0.x + y0 + z1]), float(v[i1.x + y0 + z1]), f.x);
+			const float c11 = mix(float(v[i0.x + y1 + z1]), float(v[i1.x + y1 + z1]), f.x);
+
+			return mix(mix(c00, c10, f.y), mix(c01, c11, f.y), f.z);
+		}
+
+		template <typename T>
+		static inline float fast(const T* v, const ivec3& res, const vec3& p)
+		{
+			const vec3 u = p - vec3(0.5f);
+			const ivec3 i0(u);
+			return interpolate(v, res, i0, i0 + ivec3(1), u - vec3(i0));
+		}
+
+		template <typename T>
+		static inline float clamped(const T* v, const ivec3& res, const vec3& p)
+		{
+			const vec3 u = clamp(p - vec3(0.5f), vec3(0.f), vec3(res - ivec3(1)));
+			const ivec3 i0(u);
+			return interpolate(v, res, i0, min(i0 + ivec3(1), res - ivec3(1)), u - vec3(i0));
+		}
+	};
+
+	struct CubicKernel
+	{
+		static inline vec3 lo(const ivec3&) { return vec3(1.5f); }
+		static inline vec3 hi(const ivec3& res) { return vec3(res) - vec3(1.5f); }
+
+		// mirrored borders, matching the prefilter
+		static inline int mirror(int i, int n)
+		{
+			if (i < 0)
+				i = -i;
+			if (i >= n)
+				i = 2 * n - 2 - i;
+			return clamp(i, 0, n - 1);
+		}
+
+		static inline void weights(float t, float* w)
+		{
+			const float t2 = t*t, t3 = t2*t;
+			w[0] = (1.f - t) * (1.f - t) * (1.f - t) / 6.f;
+			w[1] = (3.f*t3 - 6.f*t2 + 4.f) / 6.f;
+			w[2] = (-3.f*t3 + 3.f*t2 + 3.f*t + 1.f) / 6.f;
+			w[3] = t3 / 6.f;
+		}
+
+		template <typename T>
+		static inline float interpolate(const T* v, const ivec3& res, const int* xs, const int* ys, const int* zs, const vec3& f)
+		{
+			float wx[4], wy[4], wz[4];
+			weights(f.x, wx);
+			weights(f.y, wy);
+			weights(f.z, wz);
+
+			float result = 0.f;
+			for (int k = 0; k < 4; ++k)
+			{
+				float plane = 0.f;
+				for (int j = 0; j < 4; ++j)
+				{
+					const T* row = v + index(res, 0, ys[j], zs[k]);
+					plane += wy[j] * (wx[0] * float(row[xs[0]]) + wx[1] * float(row[xs[1]]) + wx[2] * float(row[xs[2]]) + wx[3] * float(row[xs[3]]));
+				}
+				result += wz[k] * plane;
+			}
+
+			return result;
+		}
+
+		template <typename T>
+		static inline float fast(const T* v, const ivec3& res, const vec3& p)
+		{
+			const vec3 u = p - vec3(0.5f);
+			const ivec3 i(u);
+			const int xs[4] = { i.x - 1, i.x, i.x + 1, i.x + 2 };
+			const int ys[4] = { i.y - 1, i.y, i.y + 1, i.y + 2 };
+			const int zs[4] = { i.z - 1, i.z, i.z + 1, i.z + 2 };
+			return interpolate(v, res, xs, ys, zs, u - vec3(i));
+		}
+
+		template <typename T>
+		static inline float clamped(const T* v, const ivec3& res, const vec3& p)
+		{
+			const vec3 u = clamp(p - vec3(0.5f), vec3(0.f), vec3(res - ivec3(1)));
+			const ivec3 i(u);
+			int xs[4], ys[4], zs[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				xs[k] = mirror(i.x - 1 + k, res.x);
+				ys[k] = mirror(i.y - 1 + k, res.y);
+				zs[k] = mirror(i.z - 1 + k, res.z);
+			}
+			return interpolate(v, res, xs, ys, zs, u - vec3(i));
+		}
+	};
+
+
+	// finds the contiguous run of samples [first, last) that satisfy inside(). The run is estimated analytically
+	// and then corrected sample by sample; p + i*dp is monotonic in i, so the run is exact
+	template <typename F>
+	static void findRun(const vec3& p, const vec3& dp, int count, const vec3& lo, const vec3& hi, F inside, int& first, int& last)
+	{
+		float tmin = 0.f, tmax = (float)count;
+		for (int a = 0; a < 3; ++a)
+		{
+			if (dp[a] == 0.f)
+			{
+				if (p[a] < lo[a] || p[a] > hi[a])
+					tmax = -1.f;
+				continue;
+			}
+
+			float t0 = (lo[a] - p[a]) / dp[a];
+			float t1 = (hi[a] - p[a]) / dp[a];
+			if (t0 > t1)
+				std::swap(t0, t1);
+
+			tmin = std::max(tmin, t0);
+			tmax = std::min(tmax, t1);
+		}
+
+		if (tmax < tmin)
+		{
+			first = last = 0;
+			return;
+		}
+
+		first = (int)std::ceil(clamp(tmin, 0.f, (float)count));
+		last = std::max(first, (int)std::ceil(clamp(tmax, 0.f, (float)count)));
+
+		while (first < last && !inside(first))
+			++first;
+		while (last > first && !inside(last - 1))
+			--last;
+		if (first == last && first < count && inside(first))
+			++last;
+		while (first > 0 && first < last && inside(first - 1))
+			--first;
+		while (last < count && first < last && inside(last))
+			++last;
+	}
+
+	void clipRow(const vec3& p, const vec3& dp, int count, const vec3& max, int& first, int& last)
+	{
+		findRun(p, dp, count, vec3(0.f), max, [&](int i)
+		{
+			const vec3 q = p + float(i) * dp;
+			return q.x >= 0.f && q.y >= 0.f && q.z >= 0.f && q.x <= max.x && q.y <= max.y && q.z <= max.z;
+		}, first, last);
+	}
+
+	template <typename K, typename T>
+	static void sampleRowWith(const T* v, const ivec3& res, const vec3& p, const vec3& dp, int count, float* out)
+	{
+		const vec3 lo = K::lo(res), hi = K::hi(res);
+
+		int first = 0, last = 0;
+		findRun(p, dp, count, lo, hi, [&](int i)
+		{
+			const vec3 q = p + float(i) * dp;
+			return q.x >= lo.x && q.y >= lo.y && q.z >= lo.z && q.x < hi.x && q.y < hi.y && q.z < hi.z;
+		}, first, last);
+
+		for (int i = 0; i < first; ++i)
+			out[i] = K::clamped(v, res, p + float(i) * dp);
+		for (int i = first; i < last; ++i)
+			out[i] = K::fast(v, res, p + float(i) * dp);
+		for (int i = std::max(last, first); i < count; ++i)
+			out[i] = K::clamped(v, res, p + float(i) * dp);
+	}
+
+	template <typename T>
+	void sampleRow(const T* volume, const ivec3& res, const vec3& p, const vec3& dp, int count, Interpolation mode, float* out)
+	{
+		if (mode == NEAREST)
+			sampleRowWith<NearestKernel>(volume, res, p, dp, count, out);
+		else if (mode == TRILINEAR)
+			sampleRowWith<LinearKernel>(volume, res, p, dp, count, out);
+		else
+			sampleRowWith<CubicKernel>(volume, res, p, dp, count, out);
+	}
+
+	template <typename T>
+	float sample(const T* volume, const ivec3& res, const vec3& p, Interpolation mode)
+	{
+		if (mode == NEAREST)
+			return NearestKernel::clamped(volume, res, p);
+		else if (mode == TRILINEAR)
+			return LinearKernel::clamped(volume, res, p);
+		else
+			return CubicKernel::clamped(volume, res, p);
+	}
+
+	template <typename T>
+	void resample(const T* volume, const ivec3& res, const vec3& origin, const vec3& dx, const vec3& dy, const vec3& dz, const ivec3& outRes, Interpolation mode, float* out)
+	{
+		TaskScheduler::parallelFor(0, outRes.z, 1, [&](int first, int last)
+		{
+			for (int z = first; z < last; ++z)
+			{
+				for (int y = 0; y < outRes.y; ++y)
+				{
+					const vec3 p = origin + float(y) * dy + float(z) * dz;
+					sampleRow(volume, res, p, dx, outRes.x, mode, out + index(outRes, 0, y, z));
+				}
+			}
+		});
+	}
+
+
+	// in-place cubic B-spline prefilter of a single line (Unser et al., mirrored borders)
+	static void prefilterLine(float* c, int n)
+	{
+		if (n < 2)
+			return;
+
+		const float z = std::sqrt(3.f) - 2.f;
+		const float lambda = (1.f - z) * (1.f - 1.f / z);
+
+		for (int k = 0; k < n; ++k)
+			c[k] *= lambda;
+
+		// causal initialization, truncated where z^k becomes negligible
+		const int horizon = std::min(n, (int)std::ceil(std::log(1e-6f) / std::log(std::abs(z))));
+		float sum = c[0], zk = z;
+		for (int k = 1; k < horizon; ++k)
+		{
+			sum += zk * c[k];
+			zk *= z;
+		}
+		c[0] = sum;
+
+		for (int k = 1; k < n; ++k)
+			c[k] += z * c[k - 1];
+
+		c[n - 1] = (z / (z*z - 1.f)) * (z * c[n - 2] + c[n - 1]);
+		for (int k = n - 2; k >= 0; --k)
+			c[k] = z * (c[k + 1] - c[k]);
+	}
+
+	// filters all lines along one axis, stride is the distance between two samples of a line
+	static void prefilterAxis(std::vector<float>& c, const ivec3& res, int axis)
+	{
+		const int n = res[axis];
+		const size_t stride = axis == 0 ? 1 : (axis == 1 ? (size_t)res.x : (size_t)res.x * res.y);
+
+		// the two other axes enumerate the lines
+		const int a = axis == 0 ? 1 : 0;
+		const int b = axis == 2 ? 1 : 2;
+		const int lines = res[a] * res[b];
+
+		TaskScheduler::parallelFor(0, lines, 256, [&](int first, int last)
+		{
+			std::vector<float> line(n);
+
+			for (int l = first; l < last; ++l)
+			{
+				ivec3 start(0);
+				start[a] = (int)(l % res[a]);
+				start[b] = (int)(l / res[a]);
+
+				float* base = &c[index(res, start.x, start.y, start.z)];
+				for (int k = 0; k < n; ++k)
+					line[k] = base[k * stride];
+
+				prefilterLine(&line[0], n);
+
+				for (int k = 0; k < n; ++k)
+					base[k * stride] = line[k];
+			}
+		});
+	}
+
+	template <typename T>
+	void calculateBSplineCoefficients(const T* volume, const ivec3& res, std::vector<float>& coefficients)
+	{
+		coefficients.resize((size_t)res.x * res.y * res.z);
+		for (size_t i = 0; i < coefficients.size(); ++i)
+			coefficients[i] = float(volume[i]);
+
+		for (int axis = 0; axis < 3; ++axis)
+			prefilterAxis(coefficients, res, axis);
+	}
+
+
+	template void sampleRow(const unsigned char*, const ivec3&, const vec3&, const vec3&, int, Interpolation, float*);
+	template void sampleRow(const unsigned short*, const ivec3&, const vec3&, const vec3&, int, Interpolation, float*);
+	template void sampleRow(const float*, const ivec3&, const vec3&, const vec3&, int, Interpolation, float*);
+	template float sample(const unsigned char*, const ivec3&, const vec3&, Interpolation);
+	template float sample(const unsigned short*, const ivec3&, const vec3&, Interpolation);
+	template float sample(const float*, const ivec3&, const vec3&, Interpolation);
+	template void resample(const unsigned char*, const ivec3&, const vec3&, const vec3&, const vec3&, const vec3&, const ivec3&, Interpolation, float*);
+	template void resample(const unsigned short*, const ivec3&, const vec3&, const vec3&, const vec3&, const vec3&, const ivec3&, Interpolation, float*);
+	template void resample(const float*, const ivec3&, const vec3&, const vec3&, const vec3&, const vec3&, const ivec3&, Interpolation, float*);
+	template void calculateBSplineCoefficients(const unsigned char*, const ivec3&, std::vector<float>&);
+	template void calculateBSplineCoefficients(const unsigned short*, const ivec3&, std::vector<float>&);
+	template void calculateBSplineCoefficients(const float*, const ivec3&, std::vector<float>&);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+/// Interpolation kernels for raw volumes
+/**	All coordinates are continuous voxel coordinates: voxel i covers [i, i+1) and its center is at i+0.5, the
+	same convention as GL textures and SpimStack::getStackVoxelCoords. Samples outside the volume are
+	clamped to the border.
+
+	Rows of samples p + i*dp are processed in runs: the part of the row for which every tap of the kernel
+	is inside the volume is sampled without any clamping, only the ends of the row take the clamped path.
+	Coordinates are calculated as p + i*dp for every sample, so long rows do not accumulate error.
+
+	Implemented for unsigned char, unsigned short and float volumes.
+*/
+namespace Resampling
+{
+	enum Interpolation
+	{
+		NEAREST = 0,
+		TRILINEAR,
+		// cubic B-spline. Interpolating if sampled from calculateBSplineCoefficients(), smoothing otherwise
+		TRICUBIC
+	};
+
+	/// finds the samples [first, last) of the row p + i*dp, i in [0, count), that are inside the box [0, max]
+	void clipRow(const glm::vec3& p, const glm::vec3& dp, int count, const glm::vec3& max, int& first, int& last);
+
+	/// samples count points p + i*dp into out
+	template <typename T>
+	void sampleRow(const T* volume, const glm::ivec3& res, const glm::vec3& p, const glm::vec3& dp, int count, Interpolation mode, float* out);
+
+	/// samples a single point
+	template <typename T>
+	float sample(const T* volume, const glm::ivec3& res, const glm::vec3& p, Interpolation mode);
+
+	/// resamples the grid out(x,y,z) = sample(origin + x*dx + y*dy + z*dz), in parallel over the output planes
+	template <typename T>
+	void resample(const T* volume, const glm::ivec3& res, const glm::vec3& origin, const glm::vec3& dx, const glm::vec3& dy, const glm::vec3& dz, const glm::ivec3& outRes, Interpolation mode, float* out);
+
+	/// cubic B-spline prefilter with mirrored borders. Sampling the coefficients with TRICUBIC interpolates the volume
+	template <typename T>
+	void calculateBSplineCoefficients(const T* volume, const glm::ivec3& res, std::vector<float>& coefficients);
+}
@@ -0,0 +1,138 @@
+#include "SampledMetric.h"
+#include "SpimStack.h"
+#include "Resampling.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <random>
+#include <limits>
+#include <stdexcept>
+
+using namespace glm;
+
+// candidates the samples are selected from, per sample
+static const unsigned int CANDIDATES_PER_SAMPLE = 64;
+
+SampledMetric::View::View(const SpimStack* stack) : data(stack->getData()), resolution(stack->getResolution()), bytesPerVoxel((unsigned int)stack->getBytesPerVoxel()), transform(stack->getTransform()), voxelSize(stack->getVoxelDimensions())
+{
+}
+
+SampledMetric::SampledMetric(Mode m) : mode(m)
+{
+}
+
+SampledMetric::Mode SampledMetric::parseMode(const std::string& name)
+{
+	if (name == "ncc")
+		return METRIC_NCC;
+	if (name == "difference")
+		return METRIC_MEAN_DIFFERENCE;
+
+	throw std::runtime_error("Unknown metric \"" + name + "\"!");
+}
+
+double SampledMetric::getWorstScore() const
+{
+	return mode == METRIC_NCC ? 2.0 : std::numeric_limits<double>::max();
+}
+
+template <typename T>
+static inline float getVoxel(const SampledMetric::View& v, size_t index)
+{
+	return (float)reinterpret_cast<const T*>(v.data)[index];
+}
+
+template <typename T>
+static inline float sampleView(const SampledMetric::View& v, const vec3& p)
+{
+	return Resampling::sample(reinterpret_cast<const T*>(v.data), v.resolution, p, Resampling::TRILINEAR);
+}
+
+void SampledMetric::setReference(const View& reference, unsigned int sampleCount)
+{
+	PROFILE_ZONE("SampledMetric::setReference");
+
+	const ivec3 res = reference.resolution;
+	const size_t voxels = (size_t)res.x * res.y * res.z;
+	const bool u16 = reference.bytesPerVoxel == 2;
+
+	points.clear();
+	values.clear();
+	if (voxels == 0)
+		return;
+
+	// random candidates, always the same ones for the same volume size
+	std::mt19937 rng(4711);
+	std::uniform_int_distribution<size_t> dist(0, voxels - 1);
+
+	std::vector<std::pair<float, size_t> > candidates(std::min((size_t)sampleCount * CANDIDATES_PER_SAMPLE, voxels));
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		const size_t index = dist(rng);
+		candidates[i] = std::make_pair(u16 ? getVoxel<unsigned short>(reference, index) : getVoxel<unsigned char>(reference, index), index);
+	}
+
+	// half the samples on the brightest structures, the other half spread out
+	const size_t count = std::min((size_t)sampleCount, candidates.size());
+	const size_t bright = count / 2;
+	std::partial_sort(candidates.begin(), candidates.begin() + bright, candidates.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) { return a.first > b.first; });
+	std::shuffle(candidates.begin() + bright, candidates.end(), rng);
+
+	points.resize(count);
+	values.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const size_t index = candidates[i].second;
+		const ivec3 c((int)(index % res.x), (int)((index / res.x) % res.y), (int)(index / ((size_t)res.x * res.y)));
+
+		points[i] = vec3(reference.transform * vec4((vec3(c) + vec3(0.5f)) * reference.voxelSize, 1.f));
+		values[i] = candidates[i].first;
+	}
+}
+
+double SampledMetric::score(const View& view, const mat4& delta) const
+{
+	PROFILE_ZONE("SampledMetric::score");
+
+	const mat4 M = inverse(delta * view.transform);
+	const vec3 res(view.resolution);
+	const bool u16 = view.bytesPerVoxel == 2;
+
+	double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0, sumDiff = 0;
+	size_t inside = 0;
+
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		const vec3 p = vec3(M * vec4(points[i], 1.f)) / view.voxelSize;
+		if (any(lessThan(p, vec3(0.f))) || any(greaterThan(p, res)))
+			continue;
+
+		const double a = values[i];
+		const double b = u16 ? sampleView<unsigned short>(view, p) : sampleView<unsigned char>(view, p);
+
+		sumA += a;
+		sumB += b;
+		sumAA += a*a;
+		sumBB += b*b;
+		sumAB += a*b;
+		sumDiff += std::abs(a - b);
+		++inside;
+	}
+
+	// too little overlap to say anything
+	if (inside == 0 || inside < points.size() / 4)
+		return getWorstScore();
+
+	const double n = (double)inside;
+	if (mode == METRIC_MEAN_DIFFERENCE)
+		return sumDiff / n;
+
+	const double cov = sumAB - sumA*sumB / n;
+	const double varA = sumAA - sumA*sumA / n;
+	const double varB = sumBB - sumB*sumB / n;
+
+	if (varA <= 0.0 || varB <= 0.0)
+		return getWorstScore();
+
+	return 1.0 - cov / sqrt(varA * varB);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <glm/glm.hpp>
+
+class SpimStack;
+
+/// Similarity of two views, evaluated at a fixed set of sample points of the reference
+/**	The samples are taken once from the reference: half of them on its brightest voxels, the other half
+	spread over the rest so the background is covered as well. Scoring a view then costs one trilinear
+	sample per point, independent of the volume size, and needs no GL context.
+
+	Scores are "lower is better", like the image score the solvers minimize. Views that overlap less than a
+	quarter of the samples get the worst possible score.
+*/
+class SampledMetric
+{
+public:
+	enum Mode
+	{
+		// 1 - normalized cross correlation, in [0, 2]
+		METRIC_NCC = 0,
+		// mean absolute difference of the intensities
+		METRIC_MEAN_DIFFERENCE
+	};
+
+	/// raw voxels placed in the world. Voxel (x,y,z) has its center at transform * ((x,y,z) + 0.5)*voxelSize
+	struct View
+	{
+		const void*		data;
+		glm::ivec3		resolution;
+		unsigned int	bytesPerVoxel;
+		glm::mat4		transform;
+		glm::vec3		voxelSize;
+
+		inline View() : data(nullptr), resolution(0), bytesPerVoxel(1), transform(1.f), voxelSize(1.f) {}
+		View(const SpimStack* stack);
+	};
+
+	SampledMetric(Mode mode = METRIC_NCC);
+
+	inline void setMode(Mode m) { mode = m; }
+	inline Mode getMode() const { return mode; }
+
+	/// selects the samples from the reference. Always the same ones for the same reference
+	void setReference(const View& reference, unsigned int sampleCount);
+	inline size_t getSampleCount() const { return points.size(); }
+
+	/// scores the view with delta applied to its transform (delta * view.transform)
+	double score(const View& view, const glm::mat4& delta = glm::mat4(1.f)) const;
+
+	/// the worst possible score of the current mode
+	double getWorstScore() const;
+
+	/// parses "ncc" or "difference"
+	static Mode parseMode(const std::string& name);
+
+private:
+	Mode					mode;
+
+	// world coordinates and intensities of the reference samples
+	std::vector<glm::vec3>	points;
+	std::vector<float>		values;
+};
@@ -416,6 +416,16 @@ void Shader::setTextureCube(const std::string& name, unsigned int texId, unsigne
 	glUniform1i( getUniform(name), unit );
 }
 
+void Shader::setUniformBlock(const std::string& name, unsigned int bufferId, unsigned int bindingPoint) const
+{
+	const GLuint index = glGetUniformBlockIndex(mProgram, name.c_str());
+	if (index == GL_INVALID_INDEX)
+		return;
+
+	glUniformBlockBinding(mProgram, index, bindingPoint);
+	glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, bufferId);
+}
+
 void Shader::setAttributeLocation(unsigned int attributeLocation, const std::string& name)
 {
 	glBindAttribLocation(mProgram, attributeLocation, name.c_str());
@@ -443,6 +453,11 @@ void Shader::setUniform(const std::string& name, const glm::ivec2& v) const
 	glUniform2i(getUniform(name), v.x, v.y);
 }
 
+void Shader::setUniform(const std::string& name, const glm::ivec3& v) const
+{
+	glUniform3i(getUniform(name), v.x, v.y, v.z);
+}
+
 void Shader::setUniform(const std::string& name, int i, int j) const
 {
 	glUniform2i(getUniform(name), i, j);
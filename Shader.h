@@ -86,6 +86,7 @@ public:
 	void setUniform(const std::string& name, const glm::vec3& v) const;
 	void setUniform(const std::string& name, const glm::vec4& v) const;
 	void setUniform(const std::string& name, const glm::ivec2& v) const;
+	void setUniform(const std::string& name, const glm::ivec3& v) const;
 	void setUniform(const std::string& name, int i, int j) const;
 
 	/// Note that the matrix must have 16 elements!
@@ -130,6 +131,13 @@ public:
 	*/
 	void setTextureCube(const std::string& textureName, unsigned int textureId, unsigned int textureUnit=0) const;
 
+	/** Sets a uniform block.
+		@param blockName block name in the shader
+		@param bufferId OpenGL uniform buffer id
+		@param bindingPoint on which uniform buffer binding point should the buffer be bound?
+	*/
+	void setUniformBlock(const std::string& blockName, unsigned int bufferId, unsigned int bindingPoint=0) const;
+
 	/// \}
 
 
@@ -1,5 +1,7 @@
 #include "SimplePointcloud.h"
 #include "Shader.h"
+#include "Ray.h"
+#include "PointcloudFilter.h"
 
 #include <GL/glew.h>
 
@@ -12,7 +14,7 @@
 #include <string>
 #include <cstdio>
 
-SimplePointcloud::SimplePointcloud(const std::string& f, const glm::mat4& t) : filename(f)
+SimplePointcloud::SimplePointcloud(const std::string& f, const glm::mat4& t) : filename(f), bufferedPoints(0), frame(0)
 {
 	this->setTransform(t);
 
@@ -20,6 +22,15 @@ SimplePointcloud::SimplePointcloud(const std::string& f, const glm::mat4& t) : f
 
 	//std::cout << "[Debug] Filename: \"" << filename << "\", extension: " << ext << std::endl;
 
+	if (ext == ".pcot")
+	{
+		octree.open(filename);
+		pointCount = octree.getPointCount();
+		bbox = octree.getPointBounds();
+		std::cout << "[Bbox] " << bbox.min << "->" << bbox.max << std::endl;
+		return;
+	}
+
 	if (ext == ".bin")
 		loadBin(filename);
 	else if (ext == ".txt")
@@ -41,50 +52,128 @@ SimplePointcloud::SimplePointcloud(const std::string& f, const glm::mat4& t) : f
 	
 	std::cout << "[Bbox] " << bbox.min << "->" << bbox.max << std::endl;
 
-	glGenBuffers(2, vertexBuffers);
-	updateBuffers();
+	octree.build(vertices);
+
+	if (pointCount > OUT_OF_CORE_POINTS)
+	{
+		// write the tree next to the source and only keep the node table in memory
+		const std::string octreeFile = filename.substr(0, filename.find_last_of(".")) + ".pcot";
+		octree.save(octreeFile, colors);
+		octree.open(octreeFile);
+
+		PointCloud().swap(vertices);
+		PointCloud().swap(colors);
+	}
 }
 
 
 SimplePointcloud::~SimplePointcloud()
 {
-	glDeleteBuffers(2, vertexBuffers);
+	clearNodeBuffers();
 }
 
-void SimplePointcloud::draw() const
+void SimplePointcloud::draw(const glm::mat4& viewProj, const glm::ivec2& viewport, size_t pointBudget) const
 {
 	if (!enabled)
 		return;
 
+	std::vector<unsigned int> selection;
+	octree.selectNodes(viewProj * getTransform(), viewport, pointBudget, selection);
+
+	++frame;
+
 	glPushMatrix();
 	glMultMatrixf(glm::value_ptr(getTransform()[0]));
 
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_COLOR_ARRAY);
 
-	submitVertices();
+	PointCloud points, pointColors;
+	for (size_t i = 0; i < selection.size(); ++i)
+	{
+		auto it = nodeBuffers.find(selection[i]);
+		if (it == nodeBuffers.end())
+		{
+			NodeBuffer nb;
+			nb.pointCount = octree.getNode(selection[i]).pointCount;
+			glGenBuffers(2, nb.buffers);
+
+			if (nb.pointCount > 0)
+			{
+				// out-of-core payloads are read for the upload and released right after
+				octree.getPayload(selection[i], colors, points, pointColors);
+
+				glBindBuffer(GL_ARRAY_BUFFER, nb.buffers[0]);
+				glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*nb.pointCount, glm::value_ptr(points[0]), GL_STATIC_DRAW);
+				glBindBuffer(GL_ARRAY_BUFFER, nb.buffers[1]);
+				glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*nb.pointCount, glm::value_ptr(pointColors[0]), GL_STATIC_DRAW);
+			}
+
+			bufferedPoints += nb.pointCount;
+			it = nodeBuffers.insert(std::make_pair(selection[i], nb)).first;
+		}
+
+		NodeBuffer& nb = it->second;
+		nb.lastUsed = frame;
+
+		glBindBuffer(GL_ARRAY_BUFFER, nb.buffers[0]);
+		glVertexPointer(3, GL_FLOAT, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, nb.buffers[1]);
+		glColorPointer(3, GL_FLOAT, 0, 0);
+		glDrawArrays(GL_POINTS, 0, (GLsizei)nb.pointCount);
+	}
 
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	glDisableClientState(GL_VERTEX_ARRAY);
-	glDisableClientState(GL_NORMAL_ARRAY);
-	
+	glDisableClientState(GL_COLOR_ARRAY);
 
 	glPopMatrix();
+
+	// keep some unselected nodes around for small camera movements
+	evictNodeBuffers(pointBudget * 2);
 }
 
-void SimplePointcloud::submitVertices() const
+size_t SimplePointcloud::getClosestPoint(const Ray& worldRay, float& dist) const
 {
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffers[0]);
-	glVertexPointer(3, GL_FLOAT, 0, 0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffers[1]);
-	glColorPointer(3, GL_FLOAT, 0, 0);
+	// transform ray into point cloud space, the inverse is cached in the interaction volume
+	Ray r = worldRay;
+	r.transform(getInverseTransform());
 
-	glDrawArrays(GL_POINTS, 0, (GLsizei)pointCount);
+	return octree.getClosestPoint(r, dist);
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+void SimplePointcloud::clearNodeBuffers()
+{
+#ifndef NO_GRAPHICS
+	for (auto it = nodeBuffers.begin(); it != nodeBuffers.end(); ++it)
+		glDeleteBuffers(2, it->second.buffers);
+#endif
+	nodeBuffers.clear();
+	bufferedPoints = 0;
 }
 
+void SimplePointcloud::evictNodeBuffers(size_t maxPoints) const
+{
+	if (bufferedPoints <= maxPoints)
+		return;
+
+	std::vector<std::pair<unsigned int, unsigned int> > candidates;
+	for (auto it = nodeBuffers.begin(); it != nodeBuffers.end(); ++it)
+		if (it->second.lastUsed != frame)
+			candidates.push_back(std::make_pair(it->second.lastUsed, it->first));
+	std::sort(candidates.begin(), candidates.end());
+
+	for (size_t i = 0; i < candidates.size() && bufferedPoints > maxPoints; ++i)
+	{
+		auto it = nodeBuffers.find(candidates[i].second);
+#ifndef NO_GRAPHICS
+		glDeleteBuffers(2, it->second.buffers);
+#endif
+		bufferedPoints -= it->second.pointCount;
+		nodeBuffers.erase(it);
+	}
+}
 
 void SimplePointcloud::loadBin(const std::string& filename)
 {
@@ -103,13 +192,18 @@ void SimplePointcloud::loadBin(const std::string& filename)
 	file.read(reinterpret_cast<char*>(glm::value_ptr(colors[0])), sizeof(glm::vec3)*points);
 
 	std::cout << "done.\n";
-
-	updateBuffers();
 }
 
 
 void SimplePointcloud::saveBin(const std::string& f)
 {
+	// the cloud is rebuilt in memory, saving usually follows editing anyway
+	if (octree.isOutOfCore())
+	{
+		loadAllPoints();
+		updatePoints();
+	}
+
 	assert(vertices.size() == colors.size());
 
 	std::cout << "[Pointcloud] Saving pointcloud to \"" << f<< "\" ... ";
@@ -161,45 +255,87 @@ void SimplePointcloud::loadTxt(const std::string& filename)
 		vertices.push_back(pos);
 		colors.push_back(color / 255.f);
 	}
-
-	updateBuffers();
 }
 
-void SimplePointcloud::updateBuffers()
+void SimplePointcloud::loadAllPoints()
 {
-	
-#ifndef NO_GRAPHICS
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffers[0]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*vertices.size(), glm::value_ptr(vertices[0]), GL_STATIC_DRAW);
-		
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffers[1]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3)*colors.size(), glm::value_ptr(colors[0]), GL_STATIC_DRAW);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (!octree.isOutOfCore())
+		return;
 
-#endif
-}
+	std::cout << "[Pointcloud] Reading all " << pointCount << " points of \"" << filename << "\" ... ";
+
+	vertices.clear();
+	colors.clear();
+	vertices.reserve(pointCount);
+	colors.reserve(pointCount);
 
+	// the leaves partition the cloud
+	PointCloud points, pointColors;
+	for (unsigned int i = 0; i < octree.getNodeCount(); ++i)
+	{
+		if (!octree.getNode(i).leaf)
+			continue;
+
+		octree.getPayload(i, colors, points, pointColors);
+		vertices.insert(vertices.end(), points.begin(), points.end());
+		colors.insert(colors.end(), pointColors.begin(), pointColors.end());
+	}
 
+	std::cout << "done.\n";
+}
 
 void SimplePointcloud::bakeTransform()
 {
 	using namespace glm;
 
+	loadAllPoints();
+
 	const mat4& T = getTransform();
 
 	for (size_t i = 0; i < vertices.size(); ++i)
 		vertices[i] = vec3(T * vec4(vertices[i], 1.f));
 
-	// update bbox
+	updatePoints();
+	setTransform(glm::mat4(1.f));
+}
+
+void SimplePointcloud::downsample(float cellSize)
+{
+	loadAllPoints();
+
+	PointCloud normals;
+	PointcloudFilter::voxelGrid(vertices, colors, normals, cellSize);
+	updatePoints();
+}
+
+void SimplePointcloud::removeOutliers(unsigned int k, float stdDevMul)
+{
+	loadAllPoints();
+
+	PointCloud normals;
+	PointcloudFilter::removeOutliers(vertices, colors, normals, k, stdDevMul);
+	updatePoints();
+}
+
+void SimplePointcloud::updatePoints()
+{
+	pointCount = std::min(vertices.size(), colors.size());
+	clearNodeBuffers();
+
+	// filters might have removed every point
+	if (vertices.empty())
+	{
+		bbox.reset();
+		octree.build(vertices);
+		return;
+	}
+
 	bbox.reset(vertices[0]);
 	for (size_t i = 1; i < vertices.size(); ++i)
 		bbox.extend(vertices[i]);
 
 	std::cout << "[Bbox] " << bbox.min << "->" << bbox.max << std::endl;
 
-
-
-	updateBuffers();
-	setTransform(glm::mat4(1.f));
+	// edited clouds stay in memory
+	octree.build(vertices);
 }
\ No newline at end of file
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <glm/glm.hpp>
 
 #include "InteractionVolume.h"
+#include "PointcloudOctree.h"
 
 class Shader;
+struct Ray;
 
 class SimplePointcloud : public InteractionVolume
 {
@@ -13,40 +16,72 @@ public:
 	SimplePointcloud(const std::string& filename, const glm::mat4& transform = glm::mat4(1.f));
 	~SimplePointcloud();
 
-	void draw() const;
+	/// clouds with more points are converted to an octree file next to the source and drawn out-of-core
+	static const size_t OUT_OF_CORE_POINTS = 20000000;
 
-	// very bare-bones rendering. All the shader setup (including matrices) must be done externally. No colors, only position 
-	void submitVertices() const;
+	/// draws a level-of-detail selection of at most pointBudget points from the octree
+	/**	Node buffers are kept in an LRU cache of twice the point budget, for out-of-core clouds the node
+		payloads are released again once they are uploaded.
+	*/
+	void draw(const glm::mat4& viewProj, const glm::ivec2& viewport, size_t pointBudget) const;
 
 	inline size_t getPointcount() const { return pointCount; }
-	inline const std::vector<glm::vec3> getPoints() const { return vertices; }
+	inline bool isOutOfCore() const { return octree.isOutOfCore(); }
 
 	inline const std::string& getFilename() const { return filename;  }
 
+	inline const PointcloudOctree& getOctree() const { return octree; }
+
+	/// returns the index of the point closest to the world-space ray, distance is measured in point cloud space
+	size_t getClosestPoint(const Ray& worldRay, float& dist) const;
+
 	// transforms all points
 	void bakeTransform() ;
 
 	void saveBin(const std::string& filename);
 
+	/// voxel-grid downsampling with the given cell size in point cloud space
+	void downsample(float cellSize);
+	/// statistical outlier removal, see PointcloudFilter::removeOutliers
+	void removeOutliers(unsigned int k, float stdDevMul);
+
 
 private:	
 	size_t						pointCount;
 
 	std::string					filename;
 
-	// position and color opengl buffer
-	unsigned int				vertexBuffers[2];
-		
 	typedef std::vector<glm::vec3> PointCloud;
 
+	// all points, empty while the cloud is out-of-core
 	PointCloud					vertices, colors;
 
+	PointcloudOctree			octree;
+
+	// position and color buffers of octree nodes, created on first use
+	struct NodeBuffer
+	{
+		unsigned int			buffers[2];
+		size_t					pointCount;
+		// frame the node was last drawn in
+		unsigned int			lastUsed;
+	};
+	mutable std::map<unsigned int, NodeBuffer>	nodeBuffers;
+	mutable size_t				bufferedPoints;
+	mutable unsigned int		frame;
+
 	void loadTxt(const std::string& filename);
 	void loadBin(const std::string& filename);
-	
 
+	/// reads all points back into vertices and colors, the cloud is in memory afterwards
+	void loadAllPoints();
+
+	void clearNodeBuffers();
+	/// deletes buffers of nodes not drawn this frame, oldest first, until the cache fits maxPoints
+	void evictNodeBuffers(size_t maxPoints) const;
 
-	void updateBuffers();
+	// updates the bbox, octree and buffers after the points changed
+	void updatePoints();
 };
 
 
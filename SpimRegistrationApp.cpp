@@ -7,15 +7,28 @@
 #include "OrbitCamera.h"
 #include "BeadDetection.h"
 #include "SimplePointcloud.h"
+#include "MultiViewFusion.h"
+#include "TransformedView.h"
+#include "TimeSeriesDataset.h"
+#include "TimelapseRegistration.h"
+#include "Profiler.h"
 #include "StackTransformationSolver.h"
 #include "TinyStats.h"
 #include "Widget.h"
+#include "BackgroundJobs.h"
+#include "TextureResidency.h"
+#include "VolumeRaycast.h"
+#include "VolumeAtlas.h"
 
 #include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <random>
 #include <thread>
+#include <memory>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
 
 #include <GL/glew.h>
 #include <glm/gtc/type_ptr.hpp>
@@ -46,10 +59,11 @@ SpimRegistrationApp::SpimRegistrationApp(const glm::ivec2& res) : layout(nullptr
 	cameraMoving(false), drawGrid(true), drawBboxes(false), drawSlices(false), currentVolume(-1), sliceCount(100), subsampleOnCameraMove(false),
 	pointShader(nullptr), volumeShader(nullptr), sliceShader(nullptr),
 	volumeRaycaster(nullptr), drawQuad(nullptr), volumeDifferenceShader(nullptr), drawPosition(nullptr), tonemapper(nullptr), gpuStackSampler(nullptr),
-	volumeRenderTarget(nullptr), rayStartTarget(nullptr), stackSamplerTarget(nullptr), pointSpriteShader(nullptr), gpuMultiStackSampler(nullptr),
+	volumeRenderTarget(nullptr), rayStartTarget(nullptr), stackSamplerTarget(nullptr), pointSpriteShader(nullptr),
 	useImageAutoContrast(false), runAlignment(false), renderTargetReadbackCurrent(false), calculateScore(false), drawHistory(false),
 	solver(nullptr), drawPhantoms(false), drawSolutionSpace(false), runAlignmentOnlyOncePlease(false),
-	controlWidget(nullptr), pointSpriteTexture(0), cameraAutoRotate(false)
+	controlWidget(nullptr), pointSpriteTexture(0), cameraAutoRotate(false),
+	dataset(nullptr), datasetFirstStack(0), currentTimepoint(0), pendingTimepoint(-1), timelapse(nullptr), jobs(new BackgroundJobs), volumeAtlas(new VolumeAtlas)
 {
 
 	config.setDefaults();
@@ -79,6 +93,9 @@ SpimRegistrationApp::SpimRegistrationApp(const glm::ivec2& res) : layout(nullptr
 
 SpimRegistrationApp::~SpimRegistrationApp()
 {
+	// stops the background jobs before the stacks they use go away
+	delete jobs;
+
 	delete solver;
 	
 	delete volumeRenderTarget;
@@ -88,16 +105,24 @@ SpimRegistrationApp::~SpimRegistrationApp()
 	delete pointShader;
 	delete sliceShader;
 	delete volumeShader;
-	delete volumeDifferenceShader;
-	delete volumeRaycaster;
+	delete tonemapper;
+	for (auto v = volumeShaderVariants.begin(); v != volumeShaderVariants.end(); ++v)
+	{
+		delete v->second.raycaster;
+		delete v->second.difference;
+	}
+	delete volumeAtlas;
 	delete drawPosition;
 	delete stackSamplerTarget;
 	delete pointSpriteShader;;
 	delete gpuStackSampler;
-	delete gpuMultiStackSampler;
 
 	delete controlWidget;
 
+	// stops the loader thread
+	delete timelapse;
+	delete dataset;
+
 	for (size_t i = 0; i < stacks.size(); ++i)
 		delete stacks[i];
 
@@ -113,10 +138,22 @@ SpimRegistrationApp::~SpimRegistrationApp()
 
 void SpimRegistrationApp::reloadShaders()
 {
-	// these are all the shaders that depend on the number of volumes etc
+	// the volume shaders are compiled again for the capacities in use
+	for (auto v = volumeShaderVariants.begin(); v != volumeShaderVariants.end(); ++v)
+	{
+		delete v->second.raycaster;
+		delete v->second.difference;
+	}
+	volumeShaderVariants.clear();
 	reloadVolumeShader();
 	
 
+	delete tonemapper;
+	tonemapper = new Shader("shaders/drawQuad.vert", "shaders/tonemapper.frag");
+
+	delete volumeShader;
+	volumeShader = new Shader("shaders/volume2.vert", "shaders/volume2.frag");
+
 	delete pointShader;
 	pointShader = new Shader("shaders/points2.vert", "shaders/points2.frag");
 
@@ -139,28 +176,25 @@ void SpimRegistrationApp::reloadShaders()
 
 void SpimRegistrationApp::reloadVolumeShader()
 {
-	int numberOfVolumes = std::max(1, (int)stacks.size());
-
-	std::vector<std::pair<std::string, std::string> > defines;
-	defines.push_back(std::make_pair("VOLUMES", boost::lexical_cast<std::string>(numberOfVolumes)));
-	defines.push_back(std::make_pair("STEPS", boost::lexical_cast<std::string>(config.raytraceSteps)));
-
-
+	// the volumes come from the atlas, their count is a uniform
+	const unsigned int capacity = VolumeAtlas::getCapacity(stacks.size());
 
-	delete tonemapper;
-	tonemapper = new Shader("shaders/drawQuad.vert", "shaders/tonemapper.frag", defines);
+	auto variant = volumeShaderVariants.find(capacity);
+	if (variant == volumeShaderVariants.end())
+	{
+		std::vector<std::pair<std::string, std::string> > defines;
+		defines.push_back(std::make_pair("VOLUMES", boost::lexical_cast<std::string>(capacity)));
 
-	delete volumeShader;
-	volumeShader = new Shader("shaders/volume2.vert", "shaders/volume2.frag", defines);
+		VolumeShaderVariant v;
+		v.raycaster = new Shader("shaders/volumeRaycast.vert", "shaders/volumeRaycast.frag", defines);
+		v.difference = new Shader("shaders/volumeDist.vert", "shaders/volumeDist.frag", defines);
 
-	delete volumeRaycaster;
-	volumeRaycaster = new Shader("shaders/volumeRaycast.vert", "shaders/volumeRaycast.frag", defines);
+		std::cout << "[Shader] Compiled volume shaders for up to " << capacity << " volumes" << std::endl;
+		variant = volumeShaderVariants.insert(std::make_pair(capacity, v)).first;
+	}
 
-	delete volumeDifferenceShader;
-	volumeDifferenceShader = new Shader("shaders/volumeDist.vert", "shaders/volumeDist.frag", defines);
-	
-	delete gpuMultiStackSampler;
-	gpuMultiStackSampler = new Shader("shaders/samplePlane2.vert", "shaders/samplePlane2.frag", defines);
+	volumeRaycaster = variant->second.raycaster;
+	volumeDifferenceShader = variant->second.difference;
 }
 
 
@@ -177,6 +211,9 @@ void SpimRegistrationApp::draw()
 {
 	renderTargetReadbackCurrent = false;
 
+	// voxels changed by filters, loaders or timepoints since the last frame
+	uploadTextures();
+
 	for (size_t i = 0; i < layout->getViewCount(); ++i)
 	{
 		const Viewport* vp = layout->getView((unsigned int)i);
@@ -329,12 +366,15 @@ void SpimRegistrationApp::draw()
 
 				}
 
+				drawJobStatus(vp);
+
 
 			}
 
 			// the query result should be done by now
 			if (runAlignment || calculateScore)
 			{
+				PROFILE_ZONE("Solver::score");
 				double score = calculateImageScore();
 
 				//if (calculateScore)
@@ -423,7 +463,10 @@ void SpimRegistrationApp::addSpimStack(const std::string& filename)
 {
 
 	SpimStack* stack = SpimStack::load(filename);
-	stack->setVoxelDimensions(config.defaultVoxelSize);
+
+	// chunked volumes carry their own voxel size
+	if (filename.substr(filename.find_last_of(".") + 1) != "cvol")
+		stack->setVoxelDimensions(config.defaultVoxelSize);
 	addSpimStack(stack);
 
 }
@@ -441,6 +484,31 @@ void SpimRegistrationApp::addSpimStack(const std::string& filename, const glm::v
 	addSpimStack(stack);
 }
 
+void SpimRegistrationApp::loadSpimStack(const std::string& filename)
+{
+	const glm::vec3 voxelSize = config.defaultVoxelSize;
+
+	jobs->start("Loading " + filename, std::vector<const SpimStack*>(), [this, filename, voxelSize]() -> BackgroundJobs::Publish
+	{
+		// owned by the job until it is published
+		const std::shared_ptr<std::unique_ptr<SpimStack> > stack = std::make_shared<std::unique_ptr<SpimStack> >(SpimStack::load(filename));
+
+		// chunked volumes carry their own voxel size
+		if (filename.substr(filename.find_last_of(".") + 1) != "cvol")
+			(*stack)->setVoxelDimensions(voxelSize);
+
+		return [this, stack]()
+		{
+			SpimStack* s = stack->release();
+			s->loadTransform(s->getFilename() + ".registration.txt");
+			addSpimStack(s);
+
+			centerCamera();
+			histogramsNeedUpdate = true;
+		};
+	});
+}
+
 void SpimRegistrationApp::addPointcloud(const std::string& filename)
 {
 	const glm::mat4 scaleMatrix = glm::scale(glm::vec3(100.f));
@@ -943,60 +1011,418 @@ void SpimRegistrationApp::deselectAll()
 	currentVolume = -1;
 }
 
-void SpimRegistrationApp::subsampleAllStacks()
+void SpimRegistrationApp::loadDataset(const std::string& filename)
 {
-	for (auto it = stacks.begin(); it != stacks.end(); ++it)
-		(*it)->subsample(true);
+	if (dataset)
+		throw std::runtime_error("A dataset is already loaded!");
+
+	std::unique_ptr<TimeSeriesDataset> ds(new TimeSeriesDataset(filename, config.datasetMemoryBudget << 20));
+
+	// check all angles before adding any stack
+	std::vector<std::shared_ptr<const TimeSeriesDataset::Volume> > volumes(ds->getAngleCount());
+	for (unsigned int a = 0; a < ds->getAngleCount(); ++a)
+	{
+		volumes[a] = ds->waitForVolume(0, a);
+		if (volumes[a]->bytesPerVoxel != 1 && volumes[a]->bytesPerVoxel != 2)
+			throw std::runtime_error("Unsupported bit depth of " + std::to_string(volumes[a]->bytesPerVoxel * 8) + " in \"" + ds->getFilename(0, a) + "\"!");
+	}
+
+	dataset = ds.release();
+	datasetFirstStack = stacks.size();
+	currentTimepoint = 0;
+
+	for (unsigned int a = 0; a < dataset->getAngleCount(); ++a)
+	{
+		const std::shared_ptr<const TimeSeriesDataset::Volume>& v = volumes[a];
+
+		SpimStack* stack = nullptr;
+		if (v->bytesPerVoxel == 2)
+			stack = new SpimStackU16;
+		else
+			stack = new SpimStackU8;
+
+		stack->setContent(v->resolution, &v->data[0]);
+		stack->setVoxelDimensions(config.defaultVoxelSize);
+		// registrations are stored with the first timepoint
+		stack->setFilename(dataset->getFilename(0, a));
+		addSpimStack(stack);
+	}
+
+	for (unsigned int i = 1; i <= config.datasetPrefetch; ++i)
+		dataset->prefetch(i);
 }
 
-void SpimRegistrationApp::calculateHistograms()
+void SpimRegistrationApp::setTimepoint(int timepoint)
 {
-	histograms.clear();
+	if (!dataset || timepoint < 0 || timepoint >= (int)dataset->getTimepointCount())
+		return;
 
-	size_t maxVal = 0;
+	pendingTimepoint = timepoint;
+	if (!applyTimepoint(timepoint))
+		std::cout << "[Dataset] Waiting for timepoint " << timepoint << " ...\n";
+}
 
-	std::cout << "[Contrast] Calculating histograms within " << config.threshold.min << " -> " << config.threshold.max << std::endl;
+bool SpimRegistrationApp::applyTimepoint(unsigned int timepoint)
+{
+	std::vector<std::shared_ptr<const TimeSeriesDataset::Volume> > volumes(dataset->getAngleCount());
+	try
+	{
+		for (unsigned int a = 0; a < dataset->getAngleCount(); ++a)
+		{
+			volumes[a] = dataset->getVolume(timepoint, a);
+			if (!volumes[a])
+				return false;
 
-	for (size_t i = 0; i < stacks.size(); ++i)
+			// the stacks keep their type
+			if (volumes[a]->bytesPerVoxel != stacks[datasetFirstStack + a]->getBytesPerVoxel())
+				throw std::runtime_error("Timepoint " + std::to_string(timepoint) + ", angle " + std::to_string(a) + " has a different bit depth than the first timepoint!");
+		}
+	}
+	catch (const std::runtime_error& e)
 	{
-		std::vector<size_t> histoRaw = stacks[i]->calculateHistogram(config.threshold);
+		std::cerr << "[Dataset] " << e.what() << std::endl;
+		pendingTimepoint = -1;
+		return false;
+	}
 
-		for (size_t j = 0; j < histoRaw.size(); ++j)
-			maxVal = std::max(maxVal, histoRaw[j]);
+	// jobs on these stacks are outdated now, the voxels only change once they stopped
+	bool busy = false;
+	for (unsigned int a = 0; a < dataset->getAngleCount(); ++a)
+		busy |= jobs->cancel(stacks[datasetFirstStack + a]);
 
+	queuedOperations.erase(std::remove_if(queuedOperations.begin(), queuedOperations.end(), [this](const QueuedOperation& q)
+	{
+		return std::find(stacks.begin() + datasetFirstStack, stacks.begin() + datasetFirstStack + dataset->getAngleCount(), q.stack) != stacks.begin() + datasetFirstStack + dataset->getAngleCount();
+	}), queuedOperations.end());
+	if (busy)
+		return false;
 
-		std::cout << "[Debug] Size: " << histoRaw.size() << ", max: " << maxVal << std::endl;
-		// convert to floats
-		std::vector<float> histoFloat; 
-		histoFloat.reserve(histoRaw.size());
-		
-		for (size_t j = 0; j < histoRaw.size(); ++j)
-			histoFloat.push_back((float)histoRaw[j]);
+	for (unsigned int a = 0; a < dataset->getAngleCount(); ++a)
+	{
+		SpimStack* stack = stacks[datasetFirstStack + a];
+		const std::string filename = stack->getFilename();
+
+		stack->setContent(volumes[a]->resolution, &volumes[a]->data[0]);
+		stack->setFilename(filename);
 
-		histograms.push_back(histoFloat);
+		// the registration of this session, or the one saved by an earlier one
+		if (timelapse && timelapse->isRegistered(timepoint))
+			stack->setTransform(timelapse->getTransform(timepoint, a));
+		else
+		{
+			const std::string registration = dataset->getFilename(timepoint, a) + ".registration.txt";
+			if (std::ifstream(registration).is_open())
+				stack->loadTransform(registration);
+		}
 	}
 
-	std::cout << "[Contrast] Calculated " << histograms.size() << ", normalizing to " << maxVal << " ... \n";
-		 
+	const int direction = (int)timepoint >= (int)currentTimepoint ? 1 : -1;
+	currentTimepoint = timepoint;
+	pendingTimepoint = -1;
+	histogramsNeedUpdate = true;
 
-	// normalize based on max histogram value
-	for (size_t i = 0; i < histograms.size(); ++i)
+	std::cout << "[Dataset] Timepoint " << currentTimepoint << "/" << dataset->getTimepointCount() << ", " << (dataset->getMemoryUsage() >> 20) << "MB cached\n";
+
+	// load ahead in the direction we are stepping
+	for (unsigned int i = 1; i <= config.datasetPrefetch; ++i)
+	{
+		const int t = (int)timepoint + direction * (int)i;
+		if (t >= 0)
+			dataset->prefetch(t);
+	}
+
+	return true;
+}
+
+void SpimRegistrationApp::registerTimelapse()
+{
+	if (!dataset)
+		return;
+
+	const std::string name = "Timelapse registration";
+	if (jobs->isRunning(name))
+	{
+		std::cout << "[Timelapse] The registration is still running\n";
+		return;
+	}
+
+	std::vector<glm::mat4> transforms;
+	std::vector<glm::vec3> voxelSizes;
+	for (unsigned int a = 0; a < dataset->getAngleCount(); ++a)
 	{
-		for (size_t j = 0; j < histograms[i].size(); ++j)
+		const SpimStack* stack = stacks[datasetFirstStack + a];
+		transforms.push_back(stack->getTransform());
+		voxelSizes.push_back(stack->getVoxelDimensions());
+	}
+
+	// owned by the job until it is published, the previous result stays in use meanwhile
+	const std::shared_ptr<std::unique_ptr<TimelapseRegistration> > registration = std::make_shared<std::unique_ptr<TimelapseRegistration> >(new TimelapseRegistration(dataset, transforms, voxelSizes));
+	(*registration)->setSampleCount(config.timelapseSampleCount);
+	(*registration)->setDriftCorrection(config.timelapseDriftCorrection);
+
+	// the registration only reads the dataset, not the stacks
+	const unsigned int first = currentTimepoint, last = dataset->getTimepointCount();
+	jobs->start(name, std::vector<const SpimStack*>(), [this, registration, first, last]() -> BackgroundJobs::Publish
+	{
+		(*registration)->run(first, last);
+		(*registration)->saveTransforms();
+
+		return [this, registration]()
 		{
-			histograms[i][j] /= maxVal;
+			// runs from a later timepoint keep the results of the earlier ones
+			if (timelapse)
+				timelapse->merge(**registration);
+			else
+				timelapse = registration->release();
+
+			if (timelapse->isRegistered(currentTimepoint))
+				for (unsigned int a = 0; a < dataset->getAngleCount(); ++a)
+					stacks[datasetFirstStack + a]->setTransform(timelapse->getTransform(currentTimepoint, a));
+
+			updateGlobalBbox();
+		};
+	}, [registration]() { return (*registration)->getProgress(); });
+}
+
+void SpimRegistrationApp::toggleProfiling()
+{
+	if (!Profiler::isEnabled())
+	{
+		Profiler::clear();
+		Profiler::setEnabled(true);
+		return;
+	}
+
+	Profiler::setEnabled(false);
+	Profiler::printSummary();
+
+	try
+	{
+		Profiler::saveChromeTrace("profile.trace.json");
+	}
+	catch (const std::runtime_error& e)
+	{
+		std::cerr << "[Profiler] " << e.what() << std::endl;
+	}
+}
+
+void SpimRegistrationApp::subsampleAllStacks()
+{
+	for (size_t i = 0; i < stacks.size(); ++i)
+		runOnSnapshot("Subsample stack " + std::to_string(i), stacks[i], [](SpimStack* s) { s->subsample(false); });
+}
+
+void SpimRegistrationApp::applyGaussFilterToCurrentStack()
+{
+	if (!currentVolumeValid() || currentVolume >= (int)stacks.size())
+		return;
+
+	const float sigma = config.gaussianSigma;
+	const int radius = config.gaussianRadius;
+	runOnSnapshot("Gaussian stack " + std::to_string(currentVolume), stacks[currentVolume], [sigma, radius](SpimStack* s) { s->applyGaussianBlur(sigma, radius); });
+}
+
+void SpimRegistrationApp::applyMedianFilterToCurrentStack()
+{
+	if (!currentVolumeValid() || currentVolume >= (int)stacks.size())
+		return;
+
+	const glm::ivec3 window = config.medianWindow;
+	runOnSnapshot("Median stack " + std::to_string(currentVolume), stacks[currentVolume], [window](SpimStack* s) { s->applyMedianFilter(window); });
+}
+
+void SpimRegistrationApp::runOnSnapshot(const std::string& name, SpimStack* stack, const std::function<void(SpimStack*)>& operation)
+{
+	const bool queued = std::find_if(queuedOperations.begin(), queuedOperations.end(), [stack](const QueuedOperation& q) { return q.stack == stack; }) != queuedOperations.end();
+	if (!queued && !jobs->isBusy(stack))
+	{
+		startOnSnapshot(name, stack, operation);
+		return;
+	}
+
+	QueuedOperation q;
+	q.name = name;
+	q.stack = stack;
+	q.operation = operation;
+	queuedOperations.push_back(q);
+
+	std::cout << "[Jobs] Stack \"" << stack->getFilename() << "\" is busy, queued \"" << name << "\"\n";
+}
+
+void SpimRegistrationApp::startQueuedOperations()
+{
+	for (auto q = queuedOperations.begin(); q != queuedOperations.end(); )
+	{
+		// a started operation keeps the later ones on the same stack waiting
+		if (jobs->isBusy(q->stack))
+			++q;
+		else
+		{
+			startOnSnapshot(q->name, q->stack, q->operation);
+			q = queuedOperations.erase(q);
 		}
 	}
+}
+
+void SpimRegistrationApp::startOnSnapshot(const std::string& name, SpimStack* stack, const std::function<void(SpimStack*)>& operation)
+{
+	// the viewer keeps drawing the stack until the result replaces it
+	const std::shared_ptr<SpimStack> snapshot(stack->clone());
+
+	jobs->start(name, std::vector<const SpimStack*>(1, stack), [this, stack, snapshot, operation]() -> BackgroundJobs::Publish
+	{
+		operation(snapshot.get());
+
+		return [this, stack, snapshot]()
+		{
+			// the old voxels leave with the snapshot, the texture is uploaded before the next frame
+			stack->swapContent(snapshot.get());
+			updateGlobalBbox();
+			histogramsNeedUpdate = true;
+		};
+	}, [snapshot]() { return snapshot->getProgress(); });
+}
 
+void SpimRegistrationApp::cancelJobs()
+{
+	queuedOperations.clear();
+	jobs->cancelAll();
+}
+
+void SpimRegistrationApp::updateTextureResidency()
+{
+	using namespace glm;
+
+	std::vector<TextureResidency::Request> requests(stacks.size());
+	for (size_t i = 0; i < stacks.size(); ++i)
+	{
+		TextureResidency::Request& r = requests[i];
+		r.resolution = stacks[i]->getResolution();
+		r.voxelSize = stacks[i]->getVoxelDimensions();
+		r.bytesPerVoxel = (unsigned int)stacks[i]->getBytesPerVoxel();
+		r.pixelSize = 0.f;
+
+		// solvers compare scores at full resolution as far as the budget allows, whatever the zoom
+		if (runAlignment)
+			continue;
+
+		// the finest pixel any view shows at the stack's center, measured along the camera's right vector
+		const vec3 center = stacks[i]->getCentroid();
+		for (size_t v = 0; v < layout->getViewCount(); ++v)
+		{
+			const Viewport* vp = layout->getView((unsigned int)v);
+			if (vp->name == Viewport::CONTRAST_EDITOR)
+				continue;
+
+			mat4 mvp;
+			vp->camera->getMVP(mvp);
+
+			const vec4 a = mvp * vec4(center, 1.f);
+			const vec4 b = mvp * vec4(center + normalize(vp->camera->getRight()), 1.f);
+			if (a.w <= 0.f || b.w <= 0.f)
+				continue;
+
+			const float pixels = length((vec2(b) / b.w - vec2(a) / a.w) * vec2(vp->size) * 0.5f);
+			if (pixels <= 0.f)
+				continue;
+
+			const float size = 1.f / pixels;
+			if (r.pixelSize == 0.f || size < r.pixelSize)
+				r.pixelSize = size;
+		}
+	}
+
+	std::vector<unsigned int> levels = TextureResidency::selectLevels(requests, config.textureMemoryBudget * 1024 * 1024);
+
+	// the atlas has to fit into a single 3D texture
+	const int maxSize = VolumeAtlas::getMaxSize();
+	for (;;)
+	{
+		std::vector<ivec3> resolutions(stacks.size());
+		for (size_t i = 0; i < stacks.size(); ++i)
+			resolutions[i] = TextureResidency::getLevelResolution(requests[i].resolution, requests[i].voxelSize, levels[i]);
+
+		std::vector<VolumeAtlas::Slot> slots;
+		ivec3 size;
+		if (VolumeAtlas::computeLayout(resolutions, maxSize, slots, size))
+			break;
+
+		size_t largest = stacks.size();
+		for (size_t i = 0; i < stacks.size(); ++i)
+			if (levels[i] + 1 < TextureResidency::getLevelCount(requests[i].resolution, requests[i].voxelSize) &&
+				(largest == stacks.size() || TextureResidency::getLevelBytes(requests[i], levels[i]) > TextureResidency::getLevelBytes(requests[largest], levels[largest])))
+				largest = i;
+
+		if (largest == stacks.size())
+			break;
+		++levels[largest];
+	}
+
+	for (size_t i = 0; i < stacks.size(); ++i)
+		if (stacks[i]->getTextureLevel() != levels[i])
+		{
+			std::cout << "[Residency] Stack " << i << " at level " << levels[i] << ", " << TextureResidency::getLevelResolution(requests[i].resolution, requests[i].voxelSize, levels[i]) << std::endl;
+			stacks[i]->setTextureLevel(levels[i]);
+		}
+}
 
+void SpimRegistrationApp::uploadTextures()
+{
+	volumeAtlas->update(stacks);
+	reloadVolumeShader();
+}
 
+void SpimRegistrationApp::calculateHistograms()
+{
 	histogramsNeedUpdate = false;
+
+	std::cout << "[Contrast] Calculating histograms within " << config.threshold.min << " -> " << config.threshold.max << std::endl;
+
+	// the job only reads the stacks, everything changing them waits for it
+	const std::vector<const SpimStack*> sources(stacks.begin(), stacks.end());
+	const Threshold threshold = config.threshold;
+
+	jobs->start("Histograms", sources, [this, sources, threshold]() -> BackgroundJobs::Publish
+	{
+		std::vector<std::vector<float> > result;
+		size_t maxVal = 0;
+
+		for (size_t i = 0; i < sources.size(); ++i)
+		{
+			std::vector<size_t> histoRaw = sources[i]->calculateHistogram(threshold);
+
+			for (size_t j = 0; j < histoRaw.size(); ++j)
+				maxVal = std::max(maxVal, histoRaw[j]);
+
+			// convert to floats
+			std::vector<float> histoFloat;
+			histoFloat.reserve(histoRaw.size());
+
+			for (size_t j = 0; j < histoRaw.size(); ++j)
+				histoFloat.push_back((float)histoRaw[j]);
+
+			result.push_back(histoFloat);
+		}
+
+		std::cout << "[Contrast] Calculated " << result.size() << ", normalizing to " << maxVal << " ... \n";
+
+		// normalize based on max histogram value
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			for (size_t j = 0; j < result[i].size(); ++j)
+			{
+				result[i][j] /= maxVal;
+			}
+		}
+
+		return [this, result]() { histograms = result; };
+	});
 }
 
 
 void SpimRegistrationApp::drawContrastEditor(const Viewport* vp)
 {
-	if (histograms.empty() || histogramsNeedUpdate)
+	if ((histograms.empty() || histogramsNeedUpdate) && !stacks.empty() && !jobs->isRunning("Histograms"))
 		calculateHistograms();
 		
 	glColor3f(1,1,1);
@@ -1213,34 +1639,13 @@ void SpimRegistrationApp::drawViewplaneSlices(const Viewport* vp, const Shader*
 	shader->setUniform("sliceCount", (float)sliceCount);
 	shader->setUniform("stdDev", (float)config.threshold.stdDeviation);
 
-	// reorder stacks so that the current volume is always at index 0
-	std::vector<SpimStack*> reorderedStacks(stacks);
-	
-	if (currentVolume > 0)
-		std::rotate(reorderedStacks.begin(), reorderedStacks.begin() + currentVolume, reorderedStacks.end());
-	
-	for (size_t i = 0; i < reorderedStacks.size(); ++i)
-	{	
-
-		glActiveTexture((GLenum)(GL_TEXTURE0 + i));
-		glBindTexture(GL_TEXTURE_3D, reorderedStacks[i]->getTexture());
-
-		char uname[256];
-		sprintf_s(uname, "volume[%d].texture", i);
-		shader->setUniform(uname, (int)i);
-
-		AABB bbox = reorderedStacks[i]->getBBox();
-		sprintf_s(uname, "volume[%d].bboxMax", i);
-		shader->setUniform(uname, bbox.max);
-		sprintf_s(uname, "volume[%d].bboxMin", i);
-		shader->setUniform(uname, bbox.min);
+	// the current volume is compared against all others
+	shader->setUniform("activeVolume", std::max(0, currentVolume));
+	shader->setMatrix4("inverseMVP", glm::inverse(mvp));
 
-		sprintf_s(uname, "volume[%d].enabled", i);
-		shader->setUniform(uname, reorderedStacks[i]->enabled);
-
-		sprintf_s(uname, "volume[%d].inverseMVP", i);
-		shader->setMatrix4(uname, glm::inverse(mvp * reorderedStacks[i]->getTransform()));
-	}
+	shader->setUniform("volumeCount", (int)volumeAtlas->getVolumeCount());
+	shader->setTexture3D("atlas", volumeAtlas->getTexture(), 0);
+	shader->setUniformBlock("Volumes", volumeAtlas->getVolumeBuffer());
 
 	// draw all slices
 	glBegin(GL_QUADS);	
@@ -1279,11 +1684,17 @@ void SpimRegistrationApp::drawAxisAlignedSlices(const glm::mat4& mvp, const glm:
 	shader->setUniform("maxThreshold", (int)config.threshold.max);
 	shader->setUniform("minThreshold", (int)config.threshold.min);
 
-	for (size_t i = 0; i < stacks.size(); ++i)
+	// the slices sample the stacks' slots of the atlas
+	shader->setTexture3D("atlas", volumeAtlas->getTexture(), 0);
+	const std::vector<VolumeAtlas::Slot>& slots = volumeAtlas->getSlots();
+
+	for (size_t i = 0; i < stacks.size() && i < volumeAtlas->getVolumeCount(); ++i)
 	{
 		if (stacks[i]->enabled)
 		{
 			shader->setMatrix4("transform", stacks[i]->getTransform());
+			shader->setUniform("offset", slots[i].offset);
+			shader->setUniform("resolution", slots[i].resolution);
 			
 			stacks[i]->drawSlices(volumeShader, viewAxis);
 		}
@@ -1317,11 +1728,17 @@ void SpimRegistrationApp::drawAxisAlignedSlices(const Viewport* vp, const Shader
 	shader->setUniform("maxThreshold", (float)config.threshold.max);
 	shader->setUniform("minThreshold", (float)config.threshold.min);
 
-	for (size_t i = 0; i < stacks.size(); ++i)
+	// the slices sample the stacks' slots of the atlas
+	shader->setTexture3D("atlas", volumeAtlas->getTexture(), 0);
+	const std::vector<VolumeAtlas::Slot>& slots = volumeAtlas->getSlots();
+
+	for (size_t i = 0; i < stacks.size() && i < volumeAtlas->getVolumeCount(); ++i)
 	{
 		if (stacks[i]->enabled)
 		{
 			shader->setMatrix4("transform", stacks[i]->getTransform());
+			shader->setUniform("offset", slots[i].offset);
+			shader->setUniform("resolution", slots[i].resolution);
 			
 			// calculate view vector in volume coordinates
 			glm::vec3 view = vp->camera->getViewDirection();
@@ -1357,30 +1774,12 @@ void SpimRegistrationApp::raytraceVolumes(const Viewport* vp) const
 	
 	volumeRaycaster->bind();
 	
-	// bind all the volumes
-	for (size_t i = 0; i < stacks.size(); ++i)
-	{
-		glActiveTexture((GLenum)(GL_TEXTURE0 + i));
-		glBindTexture(GL_TEXTURE_3D, stacks[i]->getTexture());
-		
-
-		char uname[256];
-		sprintf_s(uname, "volume[%d].texture", i);
-		volumeRaycaster->setUniform(uname, (int)i);
-
-		sprintf_s(uname, "volume[%d].transform", i);
-		volumeRaycaster->setMatrix4(uname, stacks[i]->getTransform());
-
-		sprintf_s(uname, "volume[%d].inverseTransform", i);
-		volumeRaycaster->setMatrix4(uname, stacks[i]->getInverseTransform());
-
-		AABB bbox = stacks[i]->getBBox();
-		sprintf_s(uname, "volume[%d].bboxMax", i);
-		volumeRaycaster->setUniform(uname, bbox.max);
-		sprintf_s(uname, "volume[%d].bboxMin", i);
-		volumeRaycaster->setUniform(uname, bbox.min);
-
-	}
+	// all volumes and their cell grids are in the atlas
+	const bool skipEmptySpace = volumeAtlas->getCellTexture() != 0;
+	volumeRaycaster->setUniform("volumeCount", (int)volumeAtlas->getVolumeCount());
+	volumeRaycaster->setTexture3D("atlas", volumeAtlas->getTexture(), 0);
+	volumeRaycaster->setTexture3D("cellAtlas", volumeAtlas->getCellTexture(), 2);
+	volumeRaycaster->setUniformBlock("Volumes", volumeAtlas->getVolumeBuffer());
 
 	// set the global contrast
 	volumeRaycaster->setUniform("minThreshold", (float)config.threshold.min);
@@ -1390,10 +1789,12 @@ void SpimRegistrationApp::raytraceVolumes(const Viewport* vp) const
 	volumeRaycaster->setUniform("activeVolume", (int)currentVolume);
 
 	// bind the ray start/end textures
-	volumeRaycaster->setTexture2D("rayStart", rayStartTarget->getColorbuffer(), (int)stacks.size());
+	volumeRaycaster->setTexture2D("rayStart", rayStartTarget->getColorbuffer(), 1);
 	volumeRaycaster->setMatrix4("inverseMVP", imvp);
 
 	volumeRaycaster->setUniform("stepLength", config.raytraceDelta);
+	volumeRaycaster->setUniform("maxSteps", (int)config.raytraceSteps);
+	volumeRaycaster->setUniform("skipEmptySpace", (int)skipEmptySpace);
 
 	glDisable(GL_DEPTH_TEST);
 	glDepthMask(GL_FALSE);
@@ -1604,8 +2005,15 @@ void SpimRegistrationApp::update(float dt)
 {
 	using namespace std;
 
+	jobs->update();
+	startQueuedOperations();
+
+	if (pendingTimepoint >= 0)
+		applyTimepoint(pendingTimepoint);
+
 	if (runAlignment)
 	{
+		PROFILE_ZONE("Solver::nextSolution");
 		if (solver->nextSolution())
 		{
 			std::cout << "[Align] Testing transform " << solver->getCurrentSolution().id << " ... \n";
@@ -1635,6 +2043,23 @@ void SpimRegistrationApp::update(float dt)
 	}
 
 
+	static float residencyTime = 0.f;
+	residencyTime -= dt;
+
+	// the textures change level as soon as a solver starts or stops
+	static bool residencyScoring = false;
+	if (residencyScoring != runAlignment)
+	{
+		residencyScoring = runAlignment;
+		residencyTime = 0.f;
+	}
+
+	if (residencyTime <= 0.f)
+	{
+		residencyTime = 0.5f;
+		updateTextureResidency();
+	}
+
 	static float time = 2.f;
 	time -= dt;
 
@@ -1650,6 +2075,8 @@ void SpimRegistrationApp::update(float dt)
 	{
 		time = 2.f;
 
+		PROFILE_ZONE("App::readback");
+
 		// TODO: change me to the _correct_ render target
 		volumeRenderTarget->bind();
 		glReadBuffer(GL_COLOR_ATTACHMENT0);
@@ -1657,16 +2084,11 @@ void SpimRegistrationApp::update(float dt)
 		std::vector<glm::vec4> pixels(volumeRenderTarget->getWidth()*volumeRenderTarget->getHeight());
 		glReadPixels(0, 0, volumeRenderTarget->getWidth(), volumeRenderTarget->getHeight(), GL_RGBA, GL_FLOAT, glm::value_ptr(pixels[0]));
 		volumeRenderTarget->disable();
+		PROFILE_COUNT("bytes read back", pixels.size() * sizeof(glm::vec4));
 
 		calculateImageContrast(pixels);
 	}
 
-	if (sampleStack != -1)
-	{
-
-		addMultiStackSamples();
-		//addStackSamples();
-	}
 }
 
 void SpimRegistrationApp::maximizeViews()
@@ -1728,14 +2150,11 @@ void SpimRegistrationApp::inspectOutputImage(const glm::ivec2& cursor)
 		std::cout << "[Image] " << renderTargetReadback[index] << std::endl;
 
 
-		
-		/*
+
 		// shoot rays!
 		relCoords *= 2.f;
 		relCoords -= vec2(1.f);
 
-		std::cout << "[Debug] CoordS: " << relCoords << std::endl;
-
 		mat4 mvp;
 		vp->camera->getMVP(mvp);
 
@@ -1743,11 +2162,9 @@ void SpimRegistrationApp::inspectOutputImage(const glm::ivec2& cursor)
 		ray.createFromFrustum(mvp, relCoords);
 		rays.push_back(ray);
 		
-		
 		if (pointclouds.size() > 0)
 			inspectPointclouds(ray);
 
-		*/
 	}
 
 	/*
@@ -1843,7 +2260,7 @@ void SpimRegistrationApp::drawPointclouds(const Viewport* vp)
 	
 	for (size_t i = 0; i < pointclouds.size(); ++i)
 	{
-		pointclouds[i]->draw();
+		pointclouds[i]->draw(mvp, vp->size, config.pointBudget);
 	}
 }
 
@@ -1867,7 +2284,7 @@ void SpimRegistrationApp::drawPointSpritePointclouds(const Viewport* vp)
 	for (size_t i = 0; i < pointclouds.size(); ++i)
 	{
 		pointSpriteShader->setUniform("transform", pointclouds[i]->getTransform());
-		pointclouds[i]->draw();
+		pointclouds[i]->draw(mvp, vp->size, config.pointBudget);
 	}
 		
 	glDisableClientState(GL_VERTEX_ARRAY);
@@ -1919,21 +2336,21 @@ void SpimRegistrationApp::drawRays(const Viewport* vp)
 
 void SpimRegistrationApp::inspectPointclouds(const Ray& r)
 {
-	for (size_t i = 0; i < pointclouds.size(); ++i)
-	{
-		const SimplePointcloud* spc = pointclouds[i];
-		if (r.intersectsAABB(spc->getTransformedBBox()))
-		{
-
-			float dist = -1.f;
-			size_t hit = r.getClosestPoint(spc->getPoints(), spc->getTransform(), dist);
-
-			std::cout << "[Debug] Ray intersects point cloud " << i << " at point index: " <<hit  << ", dist: " << sqrtf(dist) << std::endl;
+	pickingBVH.update(interactionVolumes);
 
+	std::vector<VolumeBVH::Hit> hits;
+	pickingBVH.intersect(r, hits);
 
-		}
+	for (size_t i = 0; i < hits.size(); ++i)
+	{
+		const SimplePointcloud* spc = dynamic_cast<const SimplePointcloud*>(interactionVolumes[hits[i].volume]);
+		if (!spc)
+			continue;
 
+		float dist = -1.f;
+		size_t hit = spc->getClosestPoint(r, dist);
 
+		std::cout << "[Debug] Ray intersects point cloud " << hits[i].volume << " at point index: " << hit << ", dist: " << dist << std::endl;
 	}
 }
 
@@ -1967,74 +2384,72 @@ void SpimRegistrationApp::drawScoreHistory(const TinyHistory<double>& hist) cons
 
 }
 
-void SpimRegistrationApp::selectSolver(const std::string& name)
+void SpimRegistrationApp::drawJobStatus(const Viewport* vp) const
 {
-	// do not change solvers mid-run
-	if (runAlignment)
+	const std::vector<BackgroundJobs::Status> status = jobs->getStatus();
+	if (status.empty() && queuedOperations.empty())
 		return;
 
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, vp->size.x, 0, vp->size.y, 0, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
 
-	using namespace std;
-	IStackTransformationSolver* newSolver = nullptr;
-
-	if (name == "Uniform DX")
-	{
-		cout << "[Solver] Creating new Uniform DX Solver\n";
-		newSolver = new DXSolver;
-	}
-
-	if (name == "Uniform DY")
+	// one line per job from the top left, with a progress bar if the job reports its progress
+	for (size_t i = 0; i < status.size(); ++i)
 	{
-		cout << "[Solver] Creating new Uniform DY Solver\n";
-		newSolver = new DYSolver;
-	}
+		const int y = vp->size.y - 24 * ((int)i + 1);
 
-	if (name == "Uniform DZ")
-	{
-		cout << "[Solver] Creating new Uniform DZ Solver\n";
-		newSolver = new DZSolver;
-	}
+		if (status[i].progress >= 0.f)
+		{
+			glColor3f(0.2f, 0.2f, 0.2f);
+			glRecti(10, y - 4, 210, y + 14);
+			glColor3f(0.2f, 0.6f, 0.2f);
+			glRecti(10, y - 4, 10 + (int)(200 * status[i].progress), y + 14);
+		}
 
-	if (name == "Uniform RY")
-	{
-		cout << "[Solver] Creating new Uniform RY Solver\n";
-		newSolver = new RYSolver;
-	}
+		std::ostringstream text;
+		text << status[i].name;
+		if (status[i].progress >= 0.f)
+			text << " " << (int)(status[i].progress * 100) << "%";
+		text << " (" << std::fixed << std::setprecision(0) << status[i].seconds << "s)";
+		if (status[i].cancelled)
+			text << " cancelling ...";
 
-	if (name == "Simulated Annealing")
-	{
-		cout << "[Solver] Creating new Simulated Annealing Solver\n";
-		newSolver = new SimulatedAnnealingSolver;
+		glColor3f(1, 1, 1);
+		glRasterPos2i(220, y);
+		const std::string t = text.str();
+		for (size_t c = 0; c < t.length(); ++c)
+			glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, t[c]);
 	}
 
-	if (name == "Hillclimb")
+	// waiting for their stacks, below the running jobs
+	for (size_t i = 0; i < queuedOperations.size(); ++i)
 	{
-		cout << "[Solver] Creating new Multidimensional hillclimb solver\n";
+		const int y = vp->size.y - 24 * ((int)(status.size() + i) + 1);
 
-		std::vector<InteractionVolume*> volumes;
-		for (size_t i = 0; i < stacks.size(); ++i)
-			volumes.push_back(stacks[i]);
-		newSolver = new MultiDimensionalHillClimb(volumes);
+		glColor3f(0.7f, 0.7f, 0.7f);
+		glRasterPos2i(220, y);
+		const std::string t = queuedOperations[i].name + " (queued)";
+		for (size_t c = 0; c < t.length(); ++c)
+			glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, t[c]);
 	}
+}
 
-	if (name == "Solution Parameterspace")
-	{
-		cout << "[Solver] Creating new solution parameter space explorer.\n";
-		newSolver = new ParameterSpaceMapping;
-	}
+void SpimRegistrationApp::selectSolver(const std::string& name)
+{
+	// do not change solvers mid-run
+	if (runAlignment)
+		return;
 
-	if (name == "Random Rotation")
-	{
-		cout << "[Solver] Creating new random rotation solver\n";
-		newSolver = new RandomRotationSolver;
-	}
 
-	if (name == "Uniform Scale")
-	{
-		cout << "[Solver] Creating new uniform scale solver\n";
-		newSolver = new UniformScaleSolver;
-	}
+	using namespace std;
 
+	std::vector<InteractionVolume*> volumes;
+	for (size_t i = 0; i < stacks.size(); ++i)
+		volumes.push_back(stacks[i]);
+	IStackTransformationSolver* newSolver = IStackTransformationSolver::create(name, volumes);
 
 	// only switch solvers if we have created a valid one
 	if (newSolver)
@@ -2089,6 +2504,8 @@ double SpimRegistrationApp::calculateImageScore()
 
 void SpimRegistrationApp::readbackRenderTarget()
 {
+	PROFILE_ZONE("App::readback");
+
 	volumeRenderTarget->bind();
 	glReadBuffer(GL_COLOR_ATTACHMENT0);
 
@@ -2098,11 +2515,94 @@ void SpimRegistrationApp::readbackRenderTarget()
 
 	glReadPixels(0, 0, volumeRenderTarget->getWidth(), volumeRenderTarget->getHeight(), GL_RGBA, GL_FLOAT, glm::value_ptr(renderTargetReadback[0]));
 	volumeRenderTarget->disable();
+	PROFILE_COUNT("bytes read back", renderTargetReadback.size() * sizeof(glm::vec4));
 
 	renderTargetReadbackCurrent = true;
 	glReadBuffer(GL_BACK);
 }
 
+void SpimRegistrationApp::compareReferenceRender()
+{
+	using namespace glm;
+
+	const Viewport* vp = layout->getActiveViewport();
+	if (!vp || vp->name == Viewport::CONTRAST_EDITOR || stacks.empty())
+		return;
+
+	uploadTextures();
+
+	initializeRayTargets(vp);
+	raytraceVolumes(vp);
+
+	const ivec2 size(volumeRenderTarget->getWidth(), volumeRenderTarget->getHeight());
+	std::vector<vec4> gpuImage((size_t)size.x * size.y);
+	volumeRenderTarget->bind();
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_FLOAT, value_ptr(gpuImage[0]));
+	volumeRenderTarget->disable();
+	glReadBuffer(GL_BACK);
+
+	// the shader sees the volumes at the resolution of their textures
+	std::vector<std::vector<unsigned char> > levels(stacks.size());
+	std::vector<VolumeRaycast::Volume> volumes(stacks.size());
+	for (size_t i = 0; i < stacks.size(); ++i)
+	{
+		volumes[i] = VolumeRaycast::Volume(stacks[i]);
+
+		const ivec3 factor = TextureResidency::getLevelFactor(stacks[i]->getResolution(), stacks[i]->getVoxelDimensions(), stacks[i]->getTextureLevel());
+		if (factor == ivec3(1))
+			continue;
+
+		const ivec3 res = (stacks[i]->getResolution() + factor - ivec3(1)) / factor;
+		levels[i].resize((size_t)res.x * res.y * res.z * stacks[i]->getBytesPerVoxel());
+		TextureResidency::getLevelVoxels(stacks[i]->getData(), (unsigned int)stacks[i]->getBytesPerVoxel(), stacks[i]->getResolution(), factor, ivec3(0), res, &levels[i][0]);
+		volumes[i].data = &levels[i][0];
+		volumes[i].resolution = res;
+	}
+
+	VolumeRaycast::Parameters params;
+	params.stepLength = config.raytraceDelta;
+	params.minThreshold = (float)config.threshold.min;
+	params.maxThreshold = (float)config.threshold.max;
+	params.maxSteps = config.raytraceSteps;
+
+	mat4 mvp;
+	vp->camera->getMVP(mvp);
+
+	std::vector<vec4> cpuImage;
+	const auto start = std::chrono::steady_clock::now();
+	VolumeRaycast::render(volumes, mvp, globalBBox, params, false, size, cpuImage);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// the ray start target has a lower resolution, so some rays start slightly off and border pixels differ
+	float maxDifference = 0.f;
+	double sum = 0.0;
+	size_t differing = 0;
+	for (size_t i = 0; i < cpuImage.size(); ++i)
+	{
+		const vec4 d = abs(cpuImage[i] - gpuImage[i]);
+		const float diff = std::max(std::max(d.x, d.y), std::max(d.z, d.w));
+		maxDifference = std::max(maxDifference, diff);
+		sum += diff;
+		if (diff > 1.f / 255.f)
+			++differing;
+	}
+
+	std::cout << "[Reference] Rendered " << size << " in " << seconds << "s, mean difference " << sum / cpuImage.size() << ", max " << maxDifference << ", "
+		<< differing << " pixels (" << 100.0 * differing / cpuImage.size() << "%) differ\n";
+
+	try
+	{
+		VolumeRaycast::saveImage(cpuImage, size, "reference_cpu.png");
+		VolumeRaycast::saveImage(gpuImage, size, "reference_gpu.png");
+		std::cout << "[Reference] Saved reference_cpu.png and reference_gpu.png\n";
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "[Error] " << e.what() << std::endl;
+	}
+}
+
 void SpimRegistrationApp::initializeRayTargets(const Viewport* vp)
 {
 	
@@ -2673,6 +3173,9 @@ void SpimRegistrationApp::reloadConfig()
 	// apply new default scale to all volumes?
 	for (size_t i = 0; i < stacks.size(); ++i)
 	{
+		// snapshots still have the old voxel size
+		jobs->cancel(stacks[i]);
+
 		stacks[i]->setVoxelDimensions(config.defaultVoxelSize);
 		stacks[i]->update();
 	}
@@ -2749,11 +3252,13 @@ void SpimRegistrationApp::addStackSamples()
 
 
 	// read back
+	PROFILE_ZONE("App::readback");
 	stackSamplerTarget->bind();
 	std::vector<glm::vec4> sliceSamples(stack->getWidth()*stack->getHeight());
 	glReadBuffer(GL_COLOR_ATTACHMENT0);
 
 	glReadPixels(0, 0, stackSamplerTarget->getWidth(), stackSamplerTarget->getHeight(), GL_RGBA, GL_FLOAT, glm::value_ptr(sliceSamples[0]));
+	PROFILE_COUNT("bytes read back", sliceSamples.size() * sizeof(glm::vec4));
 
 	stackSamplerTarget->disable();
 	glReadBuffer(GL_BACK);
@@ -2787,92 +3292,6 @@ void SpimRegistrationApp::addStackSamples()
 }
 
 
-void SpimRegistrationApp::addMultiStackSamples()
-{
-	if (sampleStack == -1)
-		return;
-
-
-
-	SpimStack* stack = stacks[sampleStack];
-
-	if (lastStackSample >= stack->getDepth() || lastStackSample < 0)
-		return;
-
-	//std::cout << "[Sampling] Rendering slice " << lastStackSample << " ... \n";
-
-	stackSamplerTarget->bind();
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	gpuMultiStackSampler->bind();
-
-	// set sampling volume
-	gpuMultiStackSampler->setUniform("planeTransform", stack->getTransform());
-	gpuMultiStackSampler->setUniform("zPlane", (float)lastStackSample);
-	gpuMultiStackSampler->setUniform("planeResolution", (float)stack->getWidth(), (float)stack->getHeight());
-	gpuMultiStackSampler->setUniform("planeScale", stack->getVoxelDimensions());
-
-	// set reference volumes
-	for (size_t i = 0; i < stacks.size(); ++i)
-	{
-		const std::string volumeName = std::string("volumes[") + std::to_string(i) + std::string("]");
-	
-		gpuMultiStackSampler->setTexture3D(volumeName + ".volume", stacks[i]->getTexture(), i);		
-		gpuMultiStackSampler->setUniform(volumeName + ".inverseTransform", stacks[i]->getInverseTransform());
-		gpuMultiStackSampler->setUniform(volumeName + ".resolution", stacks[i]->getVoxelDimensions());
-		gpuMultiStackSampler->setUniform(volumeName + ".scale", stacks[i]->getWidth(), stacks[i]->getHeight(), stacks[i]->getDepth());
-		gpuMultiStackSampler->setUniform(volumeName + ".enabled", i != sampleStack);
-	}
-
-
-	// draw the correct z-plane
-	glBegin(GL_QUADS);
-	glVertex2i(0, 0);
-	glVertex2i(1, 0);
-	glVertex2i(1, 1);
-	glVertex2i(0, 1);
-	glEnd();
-
-
-	gpuMultiStackSampler->disable();
-	stackSamplerTarget->disable();
-
-
-	// read back
-	stackSamplerTarget->bind();
-	std::vector<glm::vec4> sliceSamples(stack->getWidth()*stack->getHeight());
-	glReadBuffer(GL_COLOR_ATTACHMENT0);
-
-	glReadPixels(0, 0, stackSamplerTarget->getWidth(), stackSamplerTarget->getHeight(), GL_RGBA, GL_FLOAT, glm::value_ptr(sliceSamples[0]));
-
-	stackSamplerTarget->disable();
-	glReadBuffer(GL_BACK);
-
-
-
-	// set the sample
-	std::vector<float> samples(sliceSamples.size());
-	for (size_t i = 0; i < samples.size(); ++i)
-		samples[i] = sliceSamples[i].a;
-
-	stack->setPlaneSamples(samples, lastStackSample);
-
-	stackSamples = sliceSamples;
-
-
-	++lastStackSample;
-	if (lastStackSample == stack->getDepth())
-	{
-		stack->update();
-		endSampleStack();
-
-
-		stackSamples.clear();
-	}
-
-}
-
-
 void SpimRegistrationApp::startSampleStack(int n)
 {
 	if (n == 0 || n >= stacks.size())
@@ -2885,12 +3304,36 @@ void SpimRegistrationApp::startSampleStack(int n)
 	sampleStack = n;
 	std::cout << "[Sample] Selecting stack " << sampleStack << " for sampling.\n";
 
-	stackSamples.reserve(stacks[n]->getPlanePixelCount());
+	// fuse all other stacks into the selected one
+	MultiViewFusion fusion;
+	fusion.setFeatherWidth(config.fusionFeatherWidth);
+	fusion.setContentWeight(config.fusionContentWeight);
+	for (size_t i = 0; i < stacks.size(); ++i)
+		if (i != sampleStack)
+			fusion.addView(stacks[i]);
 
-	delete stackSamplerTarget;
-	stackSamplerTarget = new Framebuffer(stacks[n]->getWidth(), stacks[n]->getHeight(), GL_RGBA32F, GL_FLOAT);
+	fusion.fuse(stacks[n]);
+
+	endSampleStack();
+}
+
+void SpimRegistrationApp::fuseStacksToDisk()
+{
+	if (stacks.empty())
+		return;
 
+	MultiViewFusion fusion;
+	fusion.setFeatherWidth(config.fusionFeatherWidth);
+	fusion.setContentWeight(config.fusionContentWeight);
+	for (size_t i = 0; i < stacks.size(); ++i)
+		if (stacks[i]->enabled)
+			fusion.addView(stacks[i]);
 
+	const std::string baseFile = stacks[0]->getFilename();
+	const std::string filename = baseFile.substr(0, baseFile.find_last_of("/") + 1) + "fused.cvol";
+
+	const MultiViewFusion::Grid grid = fusion.getBoundingGrid(stacks[0]->getVoxelDimensions());
+	fusion.fuseTiled(grid, filename, (unsigned int)stacks[0]->getBytesPerVoxel(), config.fusionMemoryBudget << 20, glm::ivec3(config.fusionChunkSize));
 }
 
 void SpimRegistrationApp::endSampleStack()
@@ -2967,6 +3410,36 @@ void SpimRegistrationApp::saveCurrentPointcloud()
 
 }
 
+void SpimRegistrationApp::downsampleCurrentPointcloud()
+{
+	if (currentVolume == -1)
+		return;
+
+	SimplePointcloud* spc = dynamic_cast<SimplePointcloud*>(interactionVolumes[currentVolume]);
+	if (!spc)
+	{
+		std::cout << "[Error] Unable to downsample, selected volume is not a pointcloud\n";
+		return;
+	}
+
+	spc->downsample(config.downsampleCellSize);
+}
+
+void SpimRegistrationApp::removeCurrentPointcloudOutliers()
+{
+	if (currentVolume == -1)
+		return;
+
+	SimplePointcloud* spc = dynamic_cast<SimplePointcloud*>(interactionVolumes[currentVolume]);
+	if (!spc)
+	{
+		std::cout << "[Error] Unable to filter, selected volume is not a pointcloud\n";
+		return;
+	}
+
+	spc->removeOutliers(config.outlierNeighbours, config.outlierStdDevMul);
+}
+
 void SpimRegistrationApp::createPointSpriteTexture()
 {
 	glGenTextures(1, &pointSpriteTexture);
@@ -3020,13 +3493,73 @@ void SpimRegistrationApp::createPointSpriteTexture()
 
 void SpimRegistrationApp::resliceStack(unsigned int stack)
 {
-	if (stack > stacks.size())
+	if (stack >= stacks.size())
 	{
 		std::cerr << "[Reslice] Stack " << stack << " outside valid range.\n";
 		return;
 	}
 
-	stacks[stack]->reslice(0, stacks[stack]->getDepth() / 2);
+	glm::vec3 voxelSize;
+	glm::ivec3 resolution;
+	stacks[stack]->getIsotropicGrid(voxelSize, resolution);
+
+	SpimStack* result = stacks[stack]->createResliced(stacks[stack]->getTransform(), voxelSize, resolution);
+	addSpimStack(result);
+}
+
+void SpimRegistrationApp::resliceStack(unsigned int stack, unsigned int reference)
+{
+	if (stack >= stacks.size() || reference >= stacks.size())
+	{
+		std::cerr << "[Reslice] Stack " << stack << " or reference " << reference << " outside valid range.\n";
+		return;
+	}
+
+	const SpimStack* ref = stacks[reference];
+	TransformedView view(stacks[stack]);
+	view.setGrid(ref->getTransform(), ref->getVoxelDimensions(), ref->getResolution());
+	addSpimStack(view.materialize());
+}
+
+void SpimRegistrationApp::saveIsotropicStack(unsigned int stack)
+{
+	if (stack >= stacks.size())
+	{
+		std::cerr << "[Reslice] Stack " << stack << " outside valid range.\n";
+		return;
+	}
+
+	const SpimStack* s = stacks[stack];
+
+	glm::vec3 voxelSize;
+	glm::ivec3 resolution;
+	s->getIsotropicGrid(voxelSize, resolution);
+
+	// name it so SpimStack::load can read it back: <name>_<w>x<h>x<d>.<bits>bit.bin
+	const std::string baseFile = s->getFilename().substr(0, s->getFilename().find_last_of("."));
+	const std::string filename = baseFile + "_isotropic_" + std::to_string(resolution.x) + "x" + std::to_string(resolution.y) + "x" + std::to_string(resolution.z) + "." + std::to_string(s->getBytesPerVoxel() * 8) + "bit.bin";
+
+	s->saveResliced(s->getTransform(), voxelSize, resolution, Resampling::TRILINEAR, filename);
+	s->saveTransform(filename + ".registration.txt");
+}
+
+void SpimRegistrationApp::resliceCurrentStack(bool toReference)
+{
+	if (!currentVolumeValid() || currentVolume >= (int)stacks.size())
+		return;
+
+	if (toReference)
+		resliceStack(currentVolume, 0);
+	else
+		resliceStack(currentVolume);
+}
+
+void SpimRegistrationApp::saveIsotropicCurrentStack()
+{
+	if (!currentVolumeValid() || currentVolume >= (int)stacks.size())
+		return;
+
+	saveIsotropicStack(currentVolume);
 }
 
 
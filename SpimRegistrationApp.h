@@ -3,12 +3,14 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <functional>
 
 #include <boost/utility.hpp>
 
 #include "AABB.h"
 #include "Config.h"
 #include "Ray.h"
+#include "VolumeBVH.h"
 #include "StackRegistration.h"
 #include "TinyStats.h"
 
@@ -23,6 +25,10 @@ class InteractionVolume;
 class SimplePointcloud;
 class IStackTransformationSolver;
 class IWidget;
+class TimeSeriesDataset;
+class TimelapseRegistration;
+class BackgroundJobs;
+class VolumeAtlas;
 
 class SpimRegistrationApp : boost::noncopyable
 {
@@ -33,8 +39,21 @@ public:
 	void addSpimStack(SpimStack* stack);
 	void addSpimStack(const std::string& filename);
 	void addSpimStack(const std::string& filename, const glm::vec3& voxelScale);
+	/// loads the stack on a background thread, it shows up once it is loaded
+	void loadSpimStack(const std::string& filename);
+	/// halves the x-y resolution of all stacks in the background
 	void subsampleAllStacks();
 
+	/// loads a time series (see TimeSeriesDataset.h). Timepoint 0 is loaded right away, one stack per angle
+	void loadDataset(const std::string& filename);
+	/// switches to a timepoint as soon as all its angles are in memory, without waiting for the disk
+	void setTimepoint(int timepoint);
+	inline void nextTimepoint() { setTimepoint((pendingTimepoint >= 0 ? pendingTimepoint : (int)currentTimepoint) + 1); }
+	inline void previousTimepoint() { setTimepoint((pendingTimepoint >= 0 ? pendingTimepoint : (int)currentTimepoint) - 1); }
+	/// registers the time series from the current timepoint on as a background job, seeded with the current transforms, and saves the transforms of every timepoint
+	void registerTimelapse();
+	/// starts recording the instrumented hot paths; the next call prints the summary and saves "profile.trace.json"
+	void toggleProfiling();
 
 	void addPointcloud(const std::string& filename);
 	void addPhantom(const std::string& stackFilename, const std::string& referenceTransform, const glm::vec3& voxelDimensions, bool fijiTransform = false);
@@ -91,7 +110,14 @@ public:
 	void contrastEditorResetThresholds();
 
 
+	/// filters the selected stack in the background with the filter settings of the config
 	void applyGaussFilterToCurrentStack();
+	void applyMedianFilterToCurrentStack();
+	/// cancels all background operations, their results are dropped
+	void cancelJobs();
+
+	/// raytraces the active view on the GPU and with VolumeRaycast, prints their difference and saves both images
+	void compareReferenceRender();
 
 
 	/// \name Pointclods
@@ -99,6 +125,8 @@ public:
 
 	void bakeSelectedTransform();
 	void saveCurrentPointcloud();
+	void downsampleCurrentPointcloud();
+	void removeCurrentPointcloudOutliers();
 
 	/// \}
 
@@ -113,6 +141,9 @@ public:
 	void clearSampleStack();
 	void endSampleStack();
 
+	/// fuses all stacks at the resolution of the first one into a chunked volume next to it, in tiles
+	void fuseStacksToDisk();
+
 
 
 	/// \}
@@ -194,7 +225,15 @@ public:
 	inline void saveConfig(const std::string& file) const { config.save(file); }
 
 
+	/// adds an isotropically resampled copy of the stack
 	void resliceStack(unsigned int stack);
+	/// adds a copy of the stack resampled into the reference stack's frame
+	void resliceStack(unsigned int stack, unsigned int reference);
+	/// streams an isotropically resampled copy of the stack to a binary file next to it
+	void saveIsotropicStack(unsigned int stack);
+
+	void resliceCurrentStack(bool toReference);
+	void saveIsotropicCurrentStack();
 
 
 
@@ -236,6 +275,9 @@ private:
 	std::vector<InteractionVolume*>		interactionVolumes;
 	int									currentVolume;
 
+	// cached hierarchy over all interaction volumes, used for picking
+	VolumeBVH							pickingBVH;
+
 	// how many planes/slices to draw for the volume
 	unsigned int			sliceCount;
 	bool					subsampleOnCameraMove;
@@ -295,8 +337,17 @@ private:
 	void drawViewplaneSlices(const Viewport* vp, const Shader* shader) const;
 	
 	
+	// selects the volume shaders for the number of stacks, compiling them only for a new VolumeAtlas::getCapacity()
 	void reloadVolumeShader();
 
+	// raycaster and difference shader compiled for a capacity, volumeRaycaster and volumeDifferenceShader point into these
+	struct VolumeShaderVariant
+	{
+		Shader*				raycaster;
+		Shader*				difference;
+	};
+	std::map<unsigned int, VolumeShaderVariant>	volumeShaderVariants;
+
 	// ray tracing section
 	void raytraceVolumes(const Viewport* vp) const;
 	void initializeRayTargets(const Viewport* vp);
@@ -336,16 +387,53 @@ private:
 	
 	size_t						lastStackSample;
 	void addStackSamples();
-	void addMultiStackSamples();
 
 	// for GPU stack sampling
 	// single stack sampler
 	Shader*					gpuStackSampler;
 
-	// multistack sampler
-	Shader*					gpuMultiStackSampler;
 	Framebuffer*			stackSamplerTarget;
 
+	// time series, its angles are the stacks starting at datasetFirstStack
+	TimeSeriesDataset*		dataset;
+	size_t					datasetFirstStack;
+	unsigned int			currentTimepoint;
+	// timepoint waiting for its volumes, -1 if none
+	int						pendingTimepoint;
+	// per-timepoint transforms, null until a registerTimelapse() job finished
+	TimelapseRegistration*	timelapse;
+
+	// copies the timepoint into the dataset's stacks if all angles are loaded
+	bool applyTimepoint(unsigned int timepoint);
+
+	// filters, loading and histograms running in the background
+	BackgroundJobs*			jobs;
+
+	// runs the operation on a snapshot of the stack in the background, the result replaces the stack's voxels.
+	// Operations on busy stacks are queued and start once the stack is free, on top of the earlier results
+	void runOnSnapshot(const std::string& name, SpimStack* stack, const std::function<void(SpimStack*)>& operation);
+
+	struct QueuedOperation
+	{
+		std::string							name;
+		SpimStack*							stack;
+		std::function<void(SpimStack*)>		operation;
+	};
+	std::vector<QueuedOperation>	queuedOperations;
+	// starts the queued operations whose stacks are free, in the order they were requested
+	void startQueuedOperations();
+	void startOnSnapshot(const std::string& name, SpimStack* stack, const std::function<void(SpimStack*)>& operation);
+
+	void drawJobStatus(const Viewport* vp) const;
+
+	// picks the texture level of every stack for the current views and the texture memory budget, full resolution while a solver runs
+	void updateTextureResidency();
+
+	// the stack textures packed for the volume shaders
+	VolumeAtlas*			volumeAtlas;
+	// uploads the changed voxels of all stacks into their atlas slots
+	void uploadTextures();
+
 
 
 	unsigned int	pointSpriteTexture;
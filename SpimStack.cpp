@@ -1,9 +1,14 @@
 #include "SpimStack.h"
+#include "GradientField.h"
 #include "AABB.h"
 #include "Shader.h"
 #include "StackRegistration.h"
 #include "BeadDetection.h"
 #include "TinyStats.h"
+#include "ChunkedVolume.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+#include "TextureResidency.h"
 
 #include <iostream>
 #include <cstring>
@@ -16,8 +21,6 @@
 #include <random>
 #include <chrono>
 
-#include <omp.h>
-
 //#define ENABLE_PCL
 
 
@@ -67,42 +70,189 @@ using namespace glm;
 
 // voxel dimensions in microns
 static const vec3 DEFAULT_DIMENSIONS(0.625, 0.625, 3);
+// chunk size of stacks saved as chunked volumes
+static const ivec3 CHUNKED_CHUNK_SIZE(64);
 
 
-SpimStack::SpimStack() : filename(""), dimensions(DEFAULT_DIMENSIONS), width(0), height(0), depth(0), volumeTextureId(0)
+SpimStack::SpimStack() : filename(""), dimensions(DEFAULT_DIMENSIONS), width(0), height(0), depth(0), textureResolution(0), textureLevel(0), processedPlanes(0)
 {
 	volumeList[0] = 0;
 	volumeList[1] = 0;
+}
 
+SpimStack::~SpimStack()
+{
 #ifndef NO_GRAPHICS
-	glGenTextures(1, &volumeTextureId);
-	cout << "[Stack] Created new texture id: " << volumeTextureId << endl;
-	glBindTexture(GL_TEXTURE_3D, volumeTextureId);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-	glBindTexture(GL_TEXTURE_3D, 0);
+	// clones never touch the GL state and may be deleted on any thread
+	if (volumeList[0])
+		glDeleteLists(volumeList[0], 1);
+	if (volumeList[1])
+		glDeleteLists(volumeList[1], 1);
 #endif
+}
 
+void SpimStack::update()
+{
+	PROFILE_ZONE("Stack::update");
 
+	updateStats();
+	updateTexture();
 }
 
-SpimStack::~SpimStack()
+#ifndef NO_GRAPHICS
+// partial uploads cycle through these pixel unpack buffers, the driver may still be reading the previous ones
+static const unsigned int UPLOAD_BUFFER_COUNT = 4;
+static GLuint uploadBuffers[UPLOAD_BUFFER_COUNT] = { 0 };
+static unsigned int nextUploadBuffer = 0;
+
+// copies the packed voxels of the box into the next pixel buffer and updates that part of the bound texture from it,
+// widened to 16 bit for a 16 bit texture
+static void uploadTextureRegion(const void* voxels, unsigned int bytesPerVoxel, unsigned int textureBytesPerVoxel, const ivec3& offset, const DirtyRegions::Box& box)
+{
+	if (!uploadBuffers[0])
+		glGenBuffers(UPLOAD_BUFFER_COUNT, uploadBuffers);
+
+	std::vector<unsigned short> wide;
+	if (bytesPerVoxel != textureBytesPerVoxel)
+	{
+		const unsigned char* narrow = reinterpret_cast<const unsigned char*>(voxels);
+		wide.assign(narrow, narrow + box.getVoxelCount());
+		voxels = &wide[0];
+	}
+
+	const GLenum type = textureBytesPerVoxel == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+	const ivec3 min = box.min + offset;
+	const ivec3 size = box.max - box.min;
+	const size_t bytes = box.getVoxelCount() * textureBytesPerVoxel;
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadBuffers[nextUploadBuffer]);
+	nextUploadBuffer = (nextUploadBuffer + 1) % UPLOAD_BUFFER_COUNT;
+
+	// orphans the old storage instead of waiting for its transfer
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+	if (mapped)
+	{
+		memcpy(mapped, voxels, bytes);
+
+		// the contents are undefined if the buffer was lost while mapped
+		if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+		{
+			glTexSubImage3D(GL_TEXTURE_3D, 0, min.x, min.y, min.z, size.x, size.y, size.z, GL_RED_INTEGER, type, 0);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			PROFILE_COUNT("bytes uploaded", bytes);
+			return;
+		}
+	}
+
+	// the driver could not map the buffer, upload from client memory instead
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, min.x, min.y, min.z, size.x, size.y, size.z, GL_RED_INTEGER, type, voxels);
+	PROFILE_COUNT("bytes uploaded", bytes);
+}
+#endif
+
+void SpimStack::setTextureLevel(unsigned int level)
 {
+	if (level == textureLevel)
+		return;
+
+	textureLevel = level;
+	updateTexture();
+}
+
+glm::ivec3 SpimStack::getLevelResolution() const
+{
+	return TextureResidency::getLevelResolution(getResolution(), dimensions, textureLevel);
+}
+
+bool SpimStack::uploadTexture(unsigned int textureBytesPerVoxel, const ivec3& offset, bool all)
+{
+	if (dirtyRegions.isEmpty() && !all)
+		return false;
+
 #ifndef NO_GRAPHICS
-	glDeleteTextures(1, &volumeTextureId);
-	glDeleteLists(volumeList[0], 1);
-	glDeleteLists(volumeList[1], 1);
+	PROFILE_ZONE("Stack::uploadTexture");
+
+	const unsigned int bpv = (unsigned int)getBytesPerVoxel();
+	const void* data = getData();
+	assert(data);
+	assert(textureBytesPerVoxel >= bpv);
+
+	const ivec3 factor = TextureResidency::getLevelFactor(getResolution(), dimensions, textureLevel);
+	const ivec3 levelResolution = getLevelResolution();
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if (all || textureResolution != levelResolution || dirtyRegions.isAll())
+	{
+		cout << "[Stack] Updating 3D texture " << levelResolution << " ... ";
+
+		std::vector<unsigned char> level;
+		const void* voxels = data;
+		if (factor != ivec3(1))
+		{
+			level.resize((size_t)levelResolution.x * levelResolution.y * levelResolution.z * bpv);
+			TextureResidency::getLevelVoxels(data, bpv, getResolution(), factor, ivec3(0), levelResolution, &level[0]);
+			voxels = &level[0];
+		}
+
+		uploadTextureRegion(voxels, bpv, textureBytesPerVoxel, offset, DirtyRegions::Box(ivec3(0), levelResolution));
+		cellGrid.build(voxels, bpv, levelResolution);
+
+		textureResolution = levelResolution;
+		cout << "done.\n";
+	}
+	else
+	{
+		const std::vector<DirtyRegions::Box>& boxes = dirtyRegions.getBoxes();
+		std::vector<unsigned char> voxels;
+		for (size_t i = 0; i < boxes.size(); ++i)
+		{
+			// all level voxels the changed voxels contribute to
+			const DirtyRegions::Box box(boxes[i].min / factor, glm::min((boxes[i].max + factor - ivec3(1)) / factor, levelResolution));
+			voxels.resize(box.getVoxelCount() * bpv);
+			TextureResidency::getLevelVoxels(data, bpv, getResolution(), factor, box.min, box.max, &voxels[0]);
+
+			uploadTextureRegion(&voxels[0], bpv, textureBytesPerVoxel, offset, box);
+			cellGrid.update(&voxels[0], bpv, box.min, box.max);
+		}
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 #endif
+
+	dirtyRegions.clear();
+	return true;
 }
 
-void SpimStack::update()
+void SpimStack::copyProperties(SpimStack* clone) const
 {
-	updateStats();
+	clone->width = width;
+	clone->height = height;
+	clone->depth = depth;
+	clone->dimensions = dimensions;
+	clone->minVal = minVal;
+	clone->maxVal = maxVal;
+	clone->bbox = bbox;
+	clone->filename = filename;
+	clone->setTransform(getTransform());
+	clone->updateTexture();
+}
+
+void SpimStack::swapProperties(SpimStack* other)
+{
+	std::swap(width, other->width);
+	std::swap(height, other->height);
+	std::swap(depth, other->depth);
+	std::swap(dimensions, other->dimensions);
+	std::swap(minVal, other->minVal);
+	std::swap(maxVal, other->maxVal);
+	std::swap(bbox, other->bbox);
+
 	updateTexture();
+	other->updateTexture();
 }
 
 
@@ -114,7 +264,8 @@ static void getStackInfoFromFilename(const std::string& filename, glm::ivec3& re
 	cout << "[Debug] " << s << endl;
 	
 	int result = sscanf_s(s.c_str(), "%dx%dx%d.%dbit", &res.x, &res.y, &res.z, &depth);
-	assert( result == 4);
+	if (result != 4)
+		throw std::runtime_error("Unable to read the resolution from \"" + filename + "\", expected <name>_<w>x<h>x<d>.<bits>bit.bin!");
 
 
 	cout << "[Stack] Read volume info: " << res << ", " << depth << " bits.\n";
@@ -137,6 +288,8 @@ void SpimStack::setVoxelDimensions(const glm::vec3& dim)
 
 SpimStack* SpimStack::load(const std::string& file)
 {
+	PROFILE_ZONE("Stack::load");
+
 	const std::string ext = file.substr(file.find_last_of(".")+1);
 	std::cout << "[Debug] Extension: " << ext << std::endl;
 
@@ -168,7 +321,11 @@ SpimStack* SpimStack::load(const std::string& file)
 		else if (bpp == 16)
 			stack = new SpimStackU16;
 
+		if (!stack)
+			throw runtime_error("Unsupported bit depth " + to_string(bpp) + " in \"" + file + "\"!");
+
 		stack->loadImage(file);
+		PROFILE_COUNT("bytes loaded", stack->getVoxelCount() * stack->getBytesPerVoxel());
 
 	}
 	else if (ext == "bin" || ext == "raw")
@@ -190,7 +347,26 @@ SpimStack* SpimStack::load(const std::string& file)
 			throw runtime_error("Invalid bit depth: " + to_string(depth) + "!");
 
 		stack->loadBinary(file, res);
+		PROFILE_COUNT("bytes loaded", stack->getVoxelCount() * stack->getBytesPerVoxel());
+
+	}
+	else if (ext == "cvol")
+	{
+		ChunkedVolumeReader reader(file);
 
+		if (reader.getBytesPerVoxel() == 1)
+			stack = new SpimStackU8;
+		else if (reader.getBytesPerVoxel() == 2)
+			stack = new SpimStackU16;
+		else
+			throw runtime_error("Invalid bit depth in \"" + file + "\"!");
+
+		stack->setContent(reader.getResolution(), nullptr);
+		reader.readRegion(ivec3(0), reader.getResolution(), stack->getData());
+
+		// chunked volumes carry their voxel size and transform
+		stack->setVoxelDimensions(reader.getVoxelSize());
+		stack->setTransform(reader.getTransform());
 	}
 	else
 		throw std::runtime_error("Unknown file extension \"" + ext + "\"");
@@ -206,7 +382,15 @@ SpimStack* SpimStack::load(const std::string& file)
 
 void SpimStack::save(const std::string& file)
 {
-	if (file.find(".bin") == string::npos)
+	PROFILE_ZONE("Stack::save");
+
+	if (file.find(".cvol") != string::npos)
+	{
+		ChunkedVolumeWriter writer(file, getResolution(), CHUNKED_CHUNK_SIZE, (unsigned int)getBytesPerVoxel(), dimensions, getTransform(), ChunkedVolumeWriter::getDefaultLevelCount(getResolution(), CHUNKED_CHUNK_SIZE));
+		writer.writeVolume(getData());
+		writer.close();
+	}
+	else if (file.find(".bin") == string::npos)
 		saveImage(file);
 	else
 		saveBinary(file);
@@ -215,6 +399,99 @@ void SpimStack::save(const std::string& file)
 		filename = file;
 }
 
+void SpimStack::getImageInfo(const std::string& file, glm::ivec3& resolution, unsigned int& bytesPerVoxel)
+{
+	const std::string ext = file.substr(file.find_last_of(".") + 1);
+
+	if (ext == "tiff" || ext == "tif")
+	{
+		FIMULTIBITMAP* fmb = FreeImage_OpenMultiBitmap(FIF_TIFF, file.c_str(), FALSE, TRUE, 0L, FIF_LOAD_NOPIXELS);
+		if (!fmb)
+			throw std::runtime_error("Unable to open image \"" + file + "\"!");
+
+		FIBITMAP* bm = FreeImage_LockPage(fmb, 0);
+		resolution = ivec3(FreeImage_GetWidth(bm), FreeImage_GetHeight(bm), FreeImage_GetPageCount(fmb));
+		bytesPerVoxel = FreeImage_GetBPP(bm) / 8;
+
+		FreeImage_UnlockPage(fmb, bm, FALSE);
+		FreeImage_CloseMultiBitmap(fmb);
+	}
+	else if (ext == "bin" || ext == "raw")
+	{
+		int depth = -1;
+		getStackInfoFromFilename(file, resolution, depth);
+		bytesPerVoxel = depth / 8;
+	}
+	else if (ext == "cvol")
+	{
+		ChunkedVolumeReader reader(file);
+		resolution = reader.getResolution();
+		bytesPerVoxel = reader.getBytesPerVoxel();
+	}
+	else
+		throw std::runtime_error("Unknown file extension \"" + ext + "\"");
+
+	if (bytesPerVoxel != 1 && bytesPerVoxel != 2)
+		throw runtime_error("Invalid bit depth in \"" + file + "\"!");
+}
+
+void SpimStack::loadImageRegion(const std::string& file, const glm::ivec3& rmin, const glm::ivec3& rmax, void* data)
+{
+	PROFILE_ZONE("Stack::loadImageRegion");
+
+	ivec3 res;
+	unsigned int bpv = 0;
+	getImageInfo(file, res, bpv);
+
+	const ivec3 size = rmax - rmin;
+	const size_t rowBytes = (size_t)size.x * bpv;
+	char* out = reinterpret_cast<char*>(data);
+
+	const std::string ext = file.substr(file.find_last_of(".") + 1);
+	if (ext == "tiff" || ext == "tif")
+	{
+		FIMULTIBITMAP* fmb = FreeImage_OpenMultiBitmap(FIF_TIFF, file.c_str(), FALSE, TRUE);
+		if (!fmb)
+			throw std::runtime_error("Unable to open image \"" + file + "\"!");
+
+		// only decode the pages in range and keep the rows in range
+		for (int z = rmin.z; z < rmax.z; ++z)
+		{
+			FIBITMAP* bm = FreeImage_LockPage(fmb, z);
+			const BYTE* bits = FreeImage_GetBits(bm);
+
+			for (int y = rmin.y; y < rmax.y; ++y)
+				memcpy(out + ((y - rmin.y) + (size_t)size.y * (z - rmin.z)) * rowBytes, bits + (rmin.x + (size_t)y * res.x) * bpv, rowBytes);
+
+			FreeImage_UnlockPage(fmb, bm, FALSE);
+		}
+
+		FreeImage_CloseMultiBitmap(fmb);
+		PROFILE_COUNT("bytes loaded", (size_t)size.y * size.z * rowBytes);
+	}
+	else if (ext == "cvol")
+	{
+		// only the chunks overlapping the region are read
+		ChunkedVolumeReader reader(file);
+		reader.readRegion(rmin, rmax, data);
+	}
+	else
+	{
+		std::ifstream f(file, ios::binary);
+		if (!f.is_open())
+			throw std::runtime_error("Unable to open file \"" + file + "\"!");
+
+		for (int z = rmin.z; z < rmax.z; ++z)
+			for (int y = rmin.y; y < rmax.y; ++y)
+			{
+				f.seekg((rmin.x + res.x * (y + (size_t)res.y * z)) * bpv);
+				f.read(out + ((y - rmin.y) + (size_t)size.y * (z - rmin.z)) * rowBytes, rowBytes);
+			}
+
+		PROFILE_COUNT("bytes loaded", (size_t)size.y * size.z * rowBytes);
+	}
+}
+
 
 
 
@@ -317,11 +594,6 @@ glm::ivec3 SpimStack::getStackVoxelCoords(const glm::vec4& worldCoords) const
 void SpimStack::drawSlices(Shader* s, const glm::vec3& view) const
 {
 #ifndef NO_GRAPHICS
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_3D, volumeTextureId);
-	
-	s->setUniform("volumeTexture", 0);
-
 	const glm::vec3 aview = glm::abs(view);
 
 	glPushAttrib(GL_ENABLE_BIT);
@@ -362,8 +634,6 @@ void SpimStack::drawSlices(Shader* s, const glm::vec3& view) const
 
 	glPopAttrib();
 
-	glBindTexture(GL_TEXTURE_3D, 0);
-
 #endif
 
 }
@@ -371,9 +641,6 @@ void SpimStack::drawSlices(Shader* s, const glm::vec3& view) const
 void SpimStack::drawZSlices() const
 {
 #ifndef NO_GRAPHICS
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_3D, volumeTextureId);
-
 	glPushAttrib(GL_ENABLE_BIT);
 	glDisable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
@@ -382,7 +649,6 @@ void SpimStack::drawZSlices() const
 	drawZPlanes(glm::vec3(0, 0, 1));
 
 	glPopAttrib();
-	glBindTexture(GL_TEXTURE_3D, 0);
 
 #endif
 }
@@ -634,6 +900,9 @@ void SpimStack::drawXPlanes(const glm::vec3& view) const
 
 vector<vec4> SpimStack::extractTransformedPoints() const
 {
+	PROFILE_ZONE("Stack::extractTransformedPoints");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	vector<vec4> points;
 	points.reserve(width*height*depth);
 
@@ -664,6 +933,9 @@ vector<vec4> SpimStack::extractTransformedPoints() const
 
 vector<vec4> SpimStack::extractTransformedPoints(const SpimStack* clip, const Threshold& t) const
 {
+	PROFILE_ZONE("Stack::extractTransformedPoints");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	vector<vec4> points;
 	points.reserve(width*height*depth);
 
@@ -742,44 +1014,46 @@ void SpimStack::extractTransformedFeaturePoints(const Threshold& t, ReferencePoi
 
 	}
 	std::cout << "done.\n";
+#endif
 
+	// normals are only calculated for the extracted voxels
+	vector<size_t> indices;
 
-	vector<vec3> normals = this->calculateVolumeNormals();
-	
 
 	result.points.clear();
-	result.points.reserve(width*height*depth);
 	result.normals.clear();
-	result.normals.reserve(width*height*depth);
 
 	
 
 	// extract points based on gradient
-	const float gradientThreshold = 0.28f;
 	std::cout << "[Stack] Extracking points between [" << (int)t.min << "->" << (int)t.max << ") ... ";
 
 	for (unsigned int z = 0; z < depth; ++z)
 	{
-		for (unsigned int x = 0; x < width; ++x)
+		for (unsigned int y = 0; y < height; ++y)
 		{
-			for (unsigned int y = 0; y < height; ++y)
+			for (unsigned int x = 0; x < width; ++x)
 			{
 				const unsigned int index = x + y*width + z*width*height;
 
+#ifdef ENABLE_PCL
 				float g = gradients[index];
 				//if (abs(g) < gradientThreshold)
-				
-				unsigned short val = volume[index];
+#else
+				float g = getRelativeValue(index);
+#endif
+
+				const float val = getValue(index);
 
 				if (val >= t.min && val <= t.max)				
 				{
-					result.normals.push_back(normals[index]);
+					indices.push_back(index);
 
 					vec3 coord(x, y, z);
 					vec4 point(coord * dimensions, 1.f);
 
 					// transform to world space
-					point = transform * point;
+					point = getTransform() * point;
 					point.w = g;
 					
 					result.points.push_back(point);
@@ -790,6 +1064,16 @@ void SpimStack::extractTransformedFeaturePoints(const Threshold& t, ReferencePoi
 
 	cout << "done.\n";
 
+	calculateVolumeNormals(indices, result.normals);
+
+	// normals to world space
+	const mat3 normalMatrix = transpose(mat3(getInverseTransform()));
+	for (size_t i = 0; i < result.normals.size(); ++i)
+	{
+		const vec3 n = normalMatrix * result.normals[i];
+		if (dot(n, n) > 0.f)
+			result.normals[i] = normalize(n);
+	}
 
 
 	std::cout << "[Stack] Extracted " << result.points.size() << " points (" << (float)result.points.size() / (width*height*depth) << ")\n";
@@ -921,115 +1205,69 @@ void SpimStack::extractTransformedFeaturePoints(const Threshold& t, ReferencePoi
 
 	std::cout << "done.\n";
 	*/
-
-
-#else
-	std::cerr << "[Error] ExtractTransformedFeaturePoints disabled, due to missing PCL!\n";
-#endif
 }
 
 
 Threshold SpimStack::getLimits() const
 {
-	Threshold t;
+	PROFILE_ZONE("Stack::getLimits");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
 
-	t.max = 0;
-	t.min = numeric_limits<float>::max();
-	t.mean = 0;
+	Threshold t;
 
 	const size_t count = width*height*depth;
+	const size_t plane = width*height;
 
-	for (size_t i = 0; i < count; ++i)
+	// min, max and sum over z planes
+	const dvec3 limits = TaskScheduler::parallelReduce(0, (int)depth, 1, dvec3(numeric_limits<float>::max(), 0.0, 0.0), [&](int z0, int z1, dvec3 r)
 	{
-		const double v = getValue(i);
-		t.max = std::max(t.max, v);
-		t.min = std::min(t.min, v);
-	
-		t.mean += (unsigned int)v;
-	}
-
-	t.mean /= count;
-
-	float variance = 0;
-	for (size_t i = 0; i < count; ++i)
-	{
-		float v = (float)getValue(i);
-		variance = variance + (v - t.mean)*(v - t.mean);
-	}
-	
-	variance /= count;
-	t.stdDeviation = ::sqrt((float)variance);
-
-	return std::move(t);
-}
-
-std::vector<glm::vec3> SpimStack::calculateVolumeNormals() const
-{
-	std::cout << "[Stack] Calculating volume normals ";
-
-	vector<vec3> normals(width*height*depth);
-
-	for (unsigned int z = 0; z < depth; ++z)
-	{
-		for (unsigned int x = 0; x < width; ++x)
+		for (size_t i = z0 * plane; i < z1 * plane; ++i)
 		{
-			normals[x + z*width*height].y = 0.f;
-			for (unsigned int y = 1; y < height; ++y)
-			{
-				//short v = volume[x + y*width + z*width*height] - volume[x + (y-1)*width + z*width*height];
-				float dy = (float)(getRelativeValue(getIndex(x, y, z)) - getRelativeValue(getIndex(x, y - 1, z)));
-				normals[x + y*width + z*width*height].y = dy;
-			}
+			const double v = getValue(i);
+			r.x = std::min(r.x, v);
+			r.y = std::max(r.y, v);
+			r.z += v;
 		}
-	}
+		return r;
+	}, [](const dvec3& a, const dvec3& b) { return dvec3(std::min(a.x, b.x), std::max(a.y, b.y), a.z + b.z); });
 
-	cout << ".";
+	t.min = limits.x;
+	t.max = limits.y;
+	t.mean = limits.z / count;
 
-	for (unsigned int z = 0; z < depth; ++z)
+	const double variance = TaskScheduler::parallelReduce(0, (int)depth, 1, 0.0, [&](int z0, int z1, double sum)
 	{
-		for (unsigned int y = 0; y < height; ++y)
+		for (size_t i = z0 * plane; i < z1 * plane; ++i)
 		{
-			normals[y*width + z*width*height].x = 0.f;
-			for (unsigned int x = 1; x < width; ++x)
-			{
-				
-				//short v = volume[x + y*width + z*width*height] - volume[x -1 + y*width + z*width*height];
-				float dx = (float)(getRelativeValue(getIndex(x, y, z)) - getRelativeValue(getIndex(x - 1, y, z)));
-				normals[x + y*width + z*width*height].x = dx;
-			}
+			const double v = getValue(i);
+			sum += (v - t.mean)*(v - t.mean);
 		}
-	}
-
-	cout << ".";
-
-	for (unsigned int x = 0; x < width; ++x)
-	{
-		for (unsigned int y = 0; y < height; ++y)
-		{
-			normals[x + y*width].z = 0.f;
-			for (unsigned int z = 1; z < depth; ++z)
-			{
-				//short v = volume[x + y*width + z*width*height] - volume[x + y*width + (z-1)*width*height];
-				float dz = (float)(getRelativeValue(getIndex(x, y, z)) - getRelativeValue(getIndex(x, y, z - 1)));
-				normals[x + y*width + z*width*height].z = dz; // float(v) / numeric_limits<short>::max();
-			}
-		}
-	}
+		return sum;
+	}, std::plus<double>()) / count;
 
-	cout << ".";
+	t.stdDeviation = ::sqrt(variance);
 
-	for (size_t i = 0; i < width*height*depth; ++i)
-		normals[i] = normalize(normals[i]);
-	
+	return std::move(t);
+}
 
-	cout << "done.\n";
+void SpimStack::calculateVolumeNormals(const std::vector<size_t>& indices, std::vector<glm::vec3>& normals) const
+{
+	GradientField::calculateAt(this, indices, normals);
 
-	return std::move(normals);
+	for (size_t i = 0; i < normals.size(); ++i)
+	{
+		const float len = length(normals[i]);
+		if (len > 0.f)
+			normals[i] /= len;
+	}
 }
 
 
 vector<size_t> SpimStack::calculateHistogram(const Threshold& t) const
 {
+	PROFILE_ZONE("Stack::calculateHistogram");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	
 	size_t buckets = (size_t)std::ceil(t.getSpread()) + 1;
 	
@@ -1037,26 +1275,36 @@ vector<size_t> SpimStack::calculateHistogram(const Threshold& t) const
 	buckets = clamp((int)buckets, 1, MAX_BUCKETS);
 	
 	
-	vector<size_t> histogram(buckets, 0);
 	const float binWidth = t.getSpread() / buckets;
-		
-	size_t valid = 0;
-	for (size_t i = 0; i < getVoxelCount(); ++i)
-	{
-		float v = getValue(i);
+	const size_t plane = width*height;
 
-		if (v >= t.min && v <= t.max)
+	// histograms of z slabs, the last entry counts the valid values
+	vector<size_t> histogram = TaskScheduler::parallelReduce(0, (int)depth, 4, vector<size_t>(buckets + 1, 0), [&](int z0, int z1, vector<size_t> h)
+	{
+		for (size_t i = z0 * plane; i < z1 * plane; ++i)
 		{
-			size_t bin = (int)floor((v - t.min) / binWidth);
-			if (bin < buckets)
+			float v = getValue(i);
+
+			if (v >= t.min && v <= t.max)
 			{
-				++histogram[bin];
-				++valid;
+				size_t bin = (int)floor((v - t.min) / binWidth);
+				if (bin < buckets)
+				{
+					++h[bin];
+					++h[buckets];
+				}
 			}
 		}
+		return h;
+	}, [](vector<size_t> a, const vector<size_t>& b)
+	{
+		for (size_t i = 0; i < a.size(); ++i)
+			a[i] += b[i];
+		return a;
+	});
 
-
-	}
+	const size_t valid = histogram.back();
+	histogram.pop_back();
 
 	std::cout << "[Histogram] Sorted " << valid << " valid values, discarded " << getVoxelCount() - valid << " invalid values into " << histogram.size() << " bins.\n";
 
@@ -1215,15 +1463,24 @@ AABB SpimStack::getTransformedBBox() const
 
 void SpimStack::updateStats()
 {
+	PROFILE_ZONE("Stack::updateStats");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	cout << "[Stack] Updating stats ... ";
-	maxVal = 0.f;
-	minVal = std::numeric_limits<float>::max();
-	for (size_t i = 0; i < width*height*depth; ++i)
+	const size_t plane = width*height;
+	const vec2 range = TaskScheduler::parallelReduce(0, (int)depth, 4, vec2(std::numeric_limits<float>::max(), 0.f), [&](int z0, int z1, vec2 r)
 	{
-		float val = getValue(i);
-		maxVal = std::max(maxVal, val);
-		minVal = std::min(minVal, val);
-	}
+		for (size_t i = z0 * plane; i < z1 * plane; ++i)
+		{
+			float val = getValue(i);
+			r.x = std::min(r.x, val);
+			r.y = std::max(r.y, val);
+		}
+		return r;
+	}, [](const vec2& a, const vec2& b) { return vec2(std::min(a.x, b.x), std::max(a.y, b.y)); });
+
+	minVal = range.x;
+	maxVal = range.y;
 	cout << "done; range: " << minVal << "-" << maxVal << endl;
 
 	cout << "[Stack] Calculating bbox ... ";
@@ -1250,6 +1507,185 @@ float SpimStack::getSample(const glm::ivec3& stackCoords) const
 	return result;
 }
 
+void SpimStack::reslice(unsigned int minZ, unsigned int maxZ)
+{
+	if (minZ >= maxZ || maxZ > depth)
+	{
+		std::cerr << "[Spimstack] Invalid z-reslice params: " << minZ << "->" << maxZ << ", valid range: 0-" << depth << std::endl;
+		return;
+	}
+
+	const size_t planeBytes = getPlanePixelCount() * getBytesPerVoxel();
+	const unsigned char* data = reinterpret_cast<const unsigned char*>(getData());
+	const std::vector<unsigned char> planes(data + minZ * planeBytes, data + maxZ * planeBytes);
+
+	const std::string file = filename;
+	setContent(ivec3(width, height, maxZ - minZ), &planes[0]);
+	filename = file;
+
+	// keep the remaining planes at their world position
+	setTransform(getTransform() * glm::translate(vec3(0.f, 0.f, minZ * dimensions.z)));
+
+	std::cout << "[Spimstack] Resliced stack " << getFilename() << " to " << width << "x" << height << "x" << depth << endl;
+}
+
+void SpimStack::getIsotropicGrid(glm::vec3& voxelSize, glm::ivec3& resolution) const
+{
+	const float size = std::min(dimensions.x, std::min(dimensions.y, dimensions.z));
+	voxelSize = vec3(size);
+	resolution = ivec3(ceil(vec3(getResolution()) * dimensions / size));
+}
+
+template <typename S, typename T>
+static void resliceRows(const S* source, const ivec3& res, const vec3& origin, const vec3& dx, const vec3& dy, const vec3& dz, const ivec3& outRes, int z0, int z1, Resampling::Interpolation mode, T* out)
+{
+	const float maxValue = (float)std::numeric_limits<T>::max();
+
+	TaskScheduler::parallelFor(z0, z1, 1, [&](int first, int last)
+	{
+		std::vector<float> row(outRes.x);
+
+		for (int z = first; z < last; ++z)
+		{
+			for (int y = 0; y < outRes.y; ++y)
+			{
+				const vec3 p = origin + float(y) * dy + float(z) * dz;
+				T* dst = out + outRes.x * (y + (size_t)outRes.y * (z - z0));
+
+				// samples outside the source are 0
+				int first = 0, last = 0;
+				Resampling::clipRow(p, dx, outRes.x, vec3(res), first, last);
+				if (first >= last)
+				{
+					std::fill(dst, dst + outRes.x, T(0));
+					continue;
+				}
+
+				Resampling::sampleRow(source, res, p + float(first) * dx, dx, last - first, mode, &row[0]);
+
+				std::fill(dst, dst + first, T(0));
+				for (int x = first; x < last; ++x)
+					dst[x] = (T)std::min(std::max(row[x - first] + 0.5f, 0.f), maxValue);
+				std::fill(dst + last, dst + outRes.x, T(0));
+			}
+		}
+	});
+}
+
+void SpimStack::reslicePlanes(const glm::mat4& frame, const glm::vec3& voxelSize, const glm::ivec3& resolution, Resampling::Interpolation mode, const std::vector<float>& coefficients, int z0, int z1, void* out) const
+{
+	// output voxel centers -> world -> continuous stack voxel coordinates
+	const mat4 m = getInverseTransform() * frame;
+	const vec3 origin = vec3(m * vec4(voxelSize * 0.5f, 1.f)) / dimensions;
+	const vec3 dx = vec3(m[0]) * voxelSize.x / dimensions;
+	const vec3 dy = vec3(m[1]) * voxelSize.y / dimensions;
+	const vec3 dz = vec3(m[2]) * voxelSize.z / dimensions;
+	const ivec3 res = getResolution();
+
+	if (getBytesPerVoxel() == 2)
+	{
+		unsigned short* dst = reinterpret_cast<unsigned short*>(out);
+		if (mode == Resampling::TRICUBIC)
+			resliceRows(&coefficients[0], res, origin, dx, dy, dz, resolution, z0, z1, mode, dst);
+		else
+			resliceRows(reinterpret_cast<const unsigned short*>(getData()), res, origin, dx, dy, dz, resolution, z0, z1, mode, dst);
+	}
+	else
+	{
+		unsigned char* dst = reinterpret_cast<unsigned char*>(out);
+		if (mode == Resampling::TRICUBIC)
+			resliceRows(&coefficients[0], res, origin, dx, dy, dz, resolution, z0, z1, mode, dst);
+		else
+			resliceRows(reinterpret_cast<const unsigned char*>(getData()), res, origin, dx, dy, dz, resolution, z0, z1, mode, dst);
+	}
+}
+
+void SpimStack::calculateResliceCoefficients(Resampling::Interpolation mode, std::vector<float>& coefficients) const
+{
+	if (mode != Resampling::TRICUBIC)
+		return;
+
+	if (getBytesPerVoxel() == 2)
+		Resampling::calculateBSplineCoefficients(reinterpret_cast<const unsigned short*>(getData()), getResolution(), coefficients);
+	else
+		Resampling::calculateBSplineCoefficients(reinterpret_cast<const unsigned char*>(getData()), getResolution(), coefficients);
+}
+
+SpimStack* SpimStack::createResliced(const glm::mat4& frame, const glm::vec3& voxelSize, const glm::ivec3& resolution, Resampling::Interpolation mode) const
+{
+	PROFILE_ZONE("Stack::createResliced");
+	PROFILE_COUNT("voxels processed", (size_t)resolution.x * resolution.y * resolution.z);
+
+	std::cout << "[Stack] Reslicing " << getFilename() << " to " << resolution.x << "x" << resolution.y << "x" << resolution.z << " ... ";
+
+	std::vector<float> coefficients;
+	calculateResliceCoefficients(mode, coefficients);
+
+	SpimStack* result = nullptr;
+	if (getBytesPerVoxel() == 2)
+		result = new SpimStackU16;
+	else
+		result = new SpimStackU8;
+
+	result->setContent(resolution, nullptr);
+	result->setVoxelDimensions(voxelSize);
+	result->setTransform(frame);
+
+	reslicePlanes(frame, voxelSize, resolution, mode, coefficients, 0, resolution.z, result->getData());
+	result->update();
+
+	std::cout << "done.\n";
+	return result;
+}
+
+void SpimStack::saveResliced(const glm::mat4& frame, const glm::vec3& voxelSize, const glm::ivec3& resolution, Resampling::Interpolation mode, const std::string& file) const
+{
+	PROFILE_ZONE("Stack::saveResliced");
+	PROFILE_COUNT("voxels processed", (size_t)resolution.x * resolution.y * resolution.z);
+
+	std::ofstream output(file, ios::binary);
+	if (!output.is_open())
+		throw std::runtime_error("Unable to open file \"" + file + "\" for writing!");
+
+	std::vector<float> coefficients;
+	calculateResliceCoefficients(mode, coefficients);
+
+	// resample slabs of about 64MB in parallel and write them out, so the result never has to fit in memory
+	const size_t planeBytes = (size_t)resolution.x * resolution.y * getBytesPerVoxel();
+	const int slabPlanes = (int)std::max<size_t>(1, std::min<size_t>(resolution.z, (64 << 20) / planeBytes));
+	std::vector<unsigned char> slab(planeBytes * slabPlanes);
+
+	std::cout << "[Stack] Streaming reslice of " << getFilename() << " (" << resolution.x << "x" << resolution.y << "x" << resolution.z << ") to \"" << file << "\"\n";
+
+	for (int z0 = 0; z0 < resolution.z; z0 += slabPlanes)
+	{
+		const int z1 = std::min(z0 + slabPlanes, resolution.z);
+		reslicePlanes(frame, voxelSize, resolution, mode, coefficients, z0, z1, &slab[0]);
+		output.write(reinterpret_cast<const char*>(&slab[0]), planeBytes * (z1 - z0));
+	}
+
+	if (!output)
+		throw std::runtime_error("Unable to write resliced stack to \"" + file + "\"!");
+
+	std::cout << "[Stack] Wrote " << planeBytes * resolution.z << " bytes to \"" << file << "\"\n";
+}
+
+
+float SpimStack::getInterpolatedSample(const glm::vec3& worldCoords, Resampling::Interpolation mode) const
+{
+	const glm::vec4 stackCoords = getInverseTransform() * glm::vec4(worldCoords, 1.f);
+	const glm::vec3 p = glm::vec3(stackCoords) / dimensions;
+	const glm::ivec3 res = getResolution();
+
+	if (glm::any(glm::lessThan(p, glm::vec3(0.f))) || glm::any(glm::greaterThan(p, glm::vec3(res))))
+		return 0.f;
+
+	if (getBytesPerVoxel() == 2)
+		return Resampling::sample(reinterpret_cast<const unsigned short*>(getData()), res, p, mode);
+	else
+		return Resampling::sample(reinterpret_cast<const unsigned char*>(getData()), res, p, mode);
+}
+
 
 void SpimStack::setPlaneSamples(const std::vector<float>& values, size_t zplane)
 {
@@ -1265,6 +1701,8 @@ void SpimStack::setPlaneSamples(const std::vector<float>& values, size_t zplane)
 	size_t offset = planeSize*zplane;
 	for (size_t i = 0; i < planeSize; ++i)
 		this->setSample(offset + i, values[i]);
+
+	markDirty(ivec3(0, 0, (int)zplane), ivec3(width, height, (int)zplane + 1));
 	
 }
 
@@ -1312,6 +1750,8 @@ void SpimStack::addSaltPepperNoise(float salt, float pepper, float amount)
 		else
 			this->setSample(indices[i], pepper);
 
+	updateTexture();
+
 }
 
 static inline float gauss3D(float  sigma, const glm::vec3& coord)
@@ -1328,6 +1768,9 @@ static inline float gauss3D(float  sigma, const glm::vec3& coord)
 
 void SpimStack::applyGaussianBlur(float sigma, int radius)
 {
+	PROFILE_ZONE("Stack::applyGaussianBlur");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	std::cout << "[Stack] Allocating temp array for filtering ... \n";
 	float* temp = new float[getVoxelCount()];
 
@@ -1339,10 +1782,14 @@ void SpimStack::applyGaussianBlur(float sigma, int radius)
 	float minVal = gauss3D(sigma, vec3((float)-radius));
 	float maskSum = 0;
 
-	for (int x = -radius; x <= radius; ++x)
-		for (int y = -radius; y <= radius; ++y)
-			for (int z = -radius; z <= radius; ++z)
-				maskSum += gauss3D(sigma, vec3(x, y, z)) / minVal;
+	size_t m = 0;
+	for (int k = -radius; k <= radius; ++k)
+		for (int j = -radius; j <= radius; ++j)
+			for (int i = -radius; i <= radius; ++i, ++m)
+			{
+				mask[m] = gauss3D(sigma, vec3(i, j, k)) / minVal;
+				maskSum += mask[m];
+			}
 
 	std::cout << "done; sum: " << maskSum << endl;
 	
@@ -1350,114 +1797,101 @@ void SpimStack::applyGaussianBlur(float sigma, int radius)
 
 	std::cout << "[Stack] Running filter, be patient ( O(n^6) ) ... \n";
 
+	processedPlanes = 0;
 	const ivec3 winSize(radius);
+	const ivec3 maxCoord = ivec3(width, height, depth) - ivec3(1);
 
-	int dot = width / 10;
-	for (unsigned x = 0; x < width; ++x)
+	// z slabs in parallel, each voxel multiplies the mask with its neighbourhood
+	TaskScheduler::parallelFor(0, (int)depth, 1, [&](int z0, int z1)
 	{
-		for (unsigned int y = 0; y < height; ++y)
+		for (int z = z0; z < z1; ++z)
 		{
-			for (unsigned int z = 0; z < depth; ++z)
+			for (unsigned int y = 0; y < height; ++y)
 			{
-				ivec3 center(x, y, z);
-				
-
-				float sum = 0;
-
-				// multiply the mask with the surrounding voxel neighbourhood
-#pragma omp parallel for shared (sum)
-				for (int i = -winSize.x; i <= winSize.x; ++i)
+				for (unsigned int x = 0; x < width; ++x)
 				{
-					for (int j = -winSize.y; j <= winSize.y; ++j)
-					{
-						for (int k = -winSize.z; k <= winSize.z; ++k)
-						{
-							ivec3 c = center + ivec3(i, j, k);
-							c = clamp(c, ivec3(0), ivec3(width, height, depth) - ivec3(1));
-
-							float val = getSample(c);
-							float g = gauss3D(sigma, vec3(x, y, z)) / minVal;
+					const ivec3 center(x, y, z);
 
-							val *= g;
+					float sum = 0;
+					size_t m = 0;
+					for (int k = -winSize.z; k <= winSize.z; ++k)
+						for (int j = -winSize.y; j <= winSize.y; ++j)
+							for (int i = -winSize.x; i <= winSize.x; ++i, ++m)
+								sum += getSample(clamp(center + ivec3(i, j, k), ivec3(0), maxCoord)) * mask[m];
 
-#pragma omp atomic
-							sum += val;
-
-						}
-					}
+					// normalize and set
+					temp[getIndex(center)] = sum / maskSum;
 				}
-
-				// normalize and set
-				temp[getIndex(center)] = sum / maskSum;
-
-
-
 			}
+
+			++processedPlanes;
 		}
-		
+	});
 
-		cout << "[Debug] " << x << "/" << width << endl;
+	// skipped slabs leave holes, keep the old values
+	if (TaskScheduler::isCancelled())
+	{
+		delete[] temp;
+		return;
 	}
 
-	
-
 	setValues(temp);
 	delete[] temp;
 }
 
 void SpimStack::applyMedianFilter(const glm::ivec3& winSize)
 {
+	PROFILE_ZONE("Stack::applyMedianFilter");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	std::cout << "[Stack] Allocating temp array for filtering ... \n";
 	float* temp = new float[getVoxelCount()];
 
-	std::cout << "[Stack] Running filter, be patient ( O(n^6) ) ";
-
-
-	int dot = width / 20;
-
-	//chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	std::cout << "[Stack] Running filter, be patient ( O(n^6) ) ... ";
 
-	for (unsigned int x = 0; x < width; ++x)
+	processedPlanes = 0;
+	// z slabs in parallel
+	TaskScheduler::parallelFor(0, (int)depth, 1, [&](int z0, int z1)
 	{
-		for (unsigned int y = 0; y < height; ++y)
+		for (int z = z0; z < z1; ++z)
 		{
-			for (unsigned int z = 0; z < depth; ++z)
+			for (unsigned int y = 0; y < height; ++y)
 			{
-
-
-				ivec3 center(x, y, z);
-				TinyHistory<float> window;
-
-
-				// ouch ... O(n^6) I am weeping inside but also too lazy to optimize
-				for (int i = -winSize.x; i <= winSize.x; ++i)
+				for (unsigned int x = 0; x < width; ++x)
 				{
-					for (int j = -winSize.y; j <= winSize.y; ++j)
+					ivec3 center(x, y, z);
+					TinyHistory<float> window;
+
+					// ouch ... O(n^6) I am weeping inside but also too lazy to optimize
+					for (int i = -winSize.x; i <= winSize.x; ++i)
 					{
-						for (int k = -winSize.z; k <= winSize.z; ++k)
+						for (int j = -winSize.y; j <= winSize.y; ++j)
 						{
-							ivec3 c = center + ivec3(i, j, k);
-							c = clamp(c, ivec3(0), ivec3(width, height, depth) - ivec3(1));
+							for (int k = -winSize.z; k <= winSize.z; ++k)
+							{
+								ivec3 c = center + ivec3(i, j, k);
+								c = clamp(c, ivec3(0), ivec3(width, height, depth) - ivec3(1));
 
-							window.add(getSample(c));
+								window.add(getSample(c));
+							}
 						}
 					}
-				}
-
 
-				temp[getIndex(center)] = window.calculateMedian();
+					temp[getIndex(center)] = window.calculateMedian();
+				}
 			}
-		}
-
-		if (x / dot == 0)
-			std::cout << ".";
 
-	}
+			++processedPlanes;
+		}
+	});
 
 	std::cout << "done.\n";
 
-	//chrono::steady_clock::time_point end = chrono::steady_clock::now();
-	//std::cout << "[Stack] Process took " << chrono::duration_cast<chrono::milliseconds>(end - start) << " ms.\n";
+	if (TaskScheduler::isCancelled())
+	{
+		delete[] temp;
+		return;
+	}
 
 	std::cout << "[Stack] Setting filtered values.\n";
 	setValues(temp);
@@ -1614,6 +2048,9 @@ void SpimStackU16::saveImage(const std::string& filename)
 
 void SpimStackU16::subsample(bool updateTextureData)
 {
+	PROFILE_ZONE("Stack::subsample");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	assert(volume);
 
 
@@ -1623,7 +2060,8 @@ void SpimStackU16::subsample(bool updateTextureData)
 
 	unsigned short* newData = new unsigned short[(width / 2)*(height / 2)*depth];
 
-	for (unsigned int z = 0; z < depth; ++z)
+	processedPlanes = 0;
+	for (unsigned int z = 0; z < depth; ++z, ++processedPlanes)
 	{
 		for (unsigned int x = 0, nx = 0; x < width; x += 2, ++nx)
 		{
@@ -1647,58 +2085,6 @@ void SpimStackU16::subsample(bool updateTextureData)
 		updateTexture();
 }
 
-void SpimStackU16::reslice(unsigned int minZ, unsigned int maxZ)
-{
-	if (minZ >= maxZ ||
-		minZ >= depth ||
-		maxZ >= depth)
-	{
-		std::cerr << "[Spimstack] Invalid z-reslice params: " << minZ << "->" << maxZ << ", valid range: 0-" << width - 1 << std::endl;
-		return;
-	}
-
-
-	unsigned short* newData = new unsigned short[width*height*depth/2];
-
-	for (unsigned int z = minZ; z < maxZ; ++z)
-	{
-		for (unsigned int x = 0, nx = 0; x < width; x += 2, ++nx)
-		{
-			for (unsigned int y = 0, ny = 0; y < height; y += 2, ++ny)
-			{
-				//std::cout << "x y z " << x << "," << y << "," << z << " -> " << (x * 2) << "," << (y * 2) << "," << z << std::endl;
-
-				const unsigned short val = volume[x + y*width + z*width*height];
-				newData[nx + ny*width + z*width * height] = val;
-			}
-		}
-	}
-
-
-	delete[] volume;
-	volume = newData;
-	depth /= 2;
-
-
-	std::cout << "[Spimstack] Resliced stack " << getFilename() << " to " << width << "x" << height << "x" << depth << endl;
-
-	updateTexture();
-
-}
-
-
-void SpimStackU16::updateTexture()
-{
-#ifndef NO_GRAPHICS
-	cout << "[Stack] Updating 3D texture ... ";
-	glBindTexture(GL_TEXTURE_3D, volumeTextureId);
-	assert(volume);
-	glTexImage3D(GL_TEXTURE_3D, 0, GL_R16UI, width, height, depth, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, volume);
-	cout << "done.\n";
-#else
-	cout << "[Stack] Compiled with NO_GRAPHICS, texture will not be updated.\n";
-#endif
-}
 
 
 void SpimStackU16::setContent(const glm::ivec3& res, const void* data)
@@ -1734,6 +2120,26 @@ void SpimStackU16::setContent(const glm::ivec3& res, const void* data)
 }
 
 
+SpimStack* SpimStackU16::clone() const
+{
+	SpimStackU16* copy = new SpimStackU16;
+	copyProperties(copy);
+
+	copy->volume = new unsigned short[getVoxelCount()];
+	memcpy(copy->volume, volume, getVoxelCount()*sizeof(unsigned short));
+	return copy;
+}
+
+void SpimStackU16::swapContent(SpimStack* other)
+{
+	SpimStackU16* o = dynamic_cast<SpimStackU16*>(other);
+	if (!o)
+		throw std::runtime_error("Unable to swap the contents of stacks with different voxel formats!");
+
+	std::swap(volume, o->volume);
+	swapProperties(other);
+}
+
 void SpimStackU16::setSample(size_t index, float value)
 {
 	assert(index < width*height*depth);
@@ -1830,6 +2236,9 @@ void SpimStackU8::loadImage(const std::string& filename)
 
 void SpimStackU8::subsample(bool updateTextureData)
 {
+	PROFILE_ZONE("Stack::subsample");
+	PROFILE_COUNT("voxels processed", getVoxelCount());
+
 	assert(volume);
 
 
@@ -1839,7 +2248,8 @@ void SpimStackU8::subsample(bool updateTextureData)
 
 	unsigned char* newData = new unsigned char[(width / 2)*(height / 2)*depth];
 
-	for (unsigned int z = 0; z < depth; ++z)
+	processedPlanes = 0;
+	for (unsigned int z = 0; z < depth; ++z, ++processedPlanes)
 	{
 		for (unsigned int x = 0, nx = 0; x < width; x += 2, ++nx)
 		{
@@ -1863,70 +2273,45 @@ void SpimStackU8::subsample(bool updateTextureData)
 		updateTexture();
 }
 
-void SpimStackU8::reslice(unsigned int minZ, unsigned int maxZ)
-{
-	if (minZ >= maxZ ||
-		minZ >= depth ||
-		maxZ >= depth)
-	{
-		std::cerr << "[Spimstack] Invalid z-reslice params: " << minZ << "->" << maxZ << ", valid range: 0-" << width - 1 << std::endl;
-		return;
-	}
-
-
-	unsigned char* newData = new unsigned char[width*height*depth / 2];
-
-	for (unsigned int z = minZ; z < maxZ; ++z)
-	{
-		for (unsigned int x = 0, nx = 0; x < width; x += 2, ++nx)
-		{
-			for (unsigned int y = 0, ny = 0; y < height; y += 2, ++ny)
-			{
-				//std::cout << "x y z " << x << "," << y << "," << z << " -> " << (x * 2) << "," << (y * 2) << "," << z << std::endl;
-
-				const unsigned char val = volume[x + y*width + z*width*height];
-				newData[nx + ny*width + z*width * height] = val;
-			}
-		}
-	}
-
-
-	delete[] volume;
-	volume = newData;
-	depth /= 2;
-
-	std::cout << "[Spimstack] Resliced stack " << getFilename() << " to " << width << "x" << height << "x" << depth << endl;
-
-	updateTexture();
-
-}
-
 
 
-void SpimStackU8::updateTexture()
-{
-#ifndef NO_GRAPHICS
-	cout << "[Stack] Updating 3D texture ... ";
-	glBindTexture(GL_TEXTURE_3D, volumeTextureId);
-	assert(volume);
-	glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, width, height, depth, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, volume);
-	cout << "done.\n";
-#endif
-}
 
 void SpimStackU8::setContent(const glm::ivec3& resolution, const void* data)
 {
-	delete volume;
+	delete[] volume;
 	width = resolution.x;
 	height = resolution.y;
 	depth = resolution.z;
 	
 	volume = new unsigned char[width*height*depth];
-	memcpy(volume, data, width*height*depth*sizeof(unsigned char));
+	if (data)
+		memcpy(volume, data, width*height*depth*sizeof(unsigned char));
+	else
+		memset(volume, 0, width*height*depth*sizeof(unsigned char));
 
 	update();
 }
 
+SpimStack* SpimStackU8::clone() const
+{
+	SpimStackU8* copy = new SpimStackU8;
+	copyProperties(copy);
+
+	copy->volume = new unsigned char[getVoxelCount()];
+	memcpy(copy->volume, volume, getVoxelCount()*sizeof(unsigned char));
+	return copy;
+}
+
+void SpimStackU8::swapContent(SpimStack* other)
+{
+	SpimStackU8* o = dynamic_cast<SpimStackU8*>(other);
+	if (!o)
+		throw std::runtime_error("Unable to swap the contents of stacks with different voxel formats!");
+
+	std::swap(volume, o->volume);
+	swapProperties(other);
+}
+
 void SpimStackU8::setSample(const size_t index, float value)
 {
 	assert(index < width*height*depth);
@@ -2,10 +2,15 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 
 #include "InteractionVolume.h"
+#include "Resampling.h"
+#include "DirtyRegions.h"
+#include "MacroCellGrid.h"
 
 struct AABB;
 class Shader;
@@ -23,8 +28,15 @@ public:
 
 	virtual ~SpimStack();
 	
+	// saves as multi-page tiff, raw .bin or compressed, chunked .cvol (see ChunkedVolume.h) depending on the extension
 	void save(const std::string& filename);
 
+	/// reads the resolution and voxel format of a stack file without loading it
+	static void getImageInfo(const std::string& filename, glm::ivec3& resolution, unsigned int& bytesPerVoxel);
+	/// loads the region [min, max) of a stack file into data (x-y-z order). Only the pages in range are read
+	static void loadImageRegion(const std::string& filename, const glm::ivec3& min, const glm::ivec3& max, void* data);
+
+	/// the caller binds the atlas and sets the stack's slot, see VolumeAtlas
 	virtual void drawSlices(Shader* s, const glm::vec3& viewDir) const;
 	virtual void drawZSlices() const;
 
@@ -37,6 +49,15 @@ public:
 
 	// sets the contents for the whole stack. It also erases the data and resizes it
 	virtual void setContent(const glm::ivec3& resolution, const void* data) = 0;
+
+	/// copy of the voxels, voxel size, value range, transform and filename
+	/**	The copy has no texture, so it can be created, changed and deleted on any thread, e.g. as the snapshot
+		a background job works on.
+	*/
+	virtual SpimStack* clone() const = 0;
+	/// exchanges voxels, resolution, voxel size and value range with other, which needs the same voxel format.
+	/// Transforms and filenames stay, both stacks are flagged for upload
+	virtual void swapContent(SpimStack* other) = 0;
 	
 	// sets a single sample at a specific location
 	inline void setSample(const glm::ivec3& pos, float value) { setSample(getIndex(pos.x, pos.y, pos.z), value);	}
@@ -44,6 +65,8 @@ public:
 
 	inline float getSample(const glm::vec3& worldCoords) const { return getSample(getStackVoxelCoords(worldCoords)); }
 	float getSample(const glm::ivec3& stackCoords) const;
+	// interpolated sample at a world position, 0 outside the stack
+	float getInterpolatedSample(const glm::vec3& worldCoords, Resampling::Interpolation mode = Resampling::TRILINEAR) const;
 	
 	// set all samples of a single z plane
 	void setPlaneSamples(const std::vector<float>& values, size_t zplane);
@@ -51,11 +74,29 @@ public:
 	// updates the internal stats and the texture
 	virtual void update();
 
-	// reslices this stack along z
-	virtual void reslice(unsigned int minZ, unsigned int maxZ) = 0;
+	// keeps only the planes [minZ, maxZ), at their current world position
+	void reslice(unsigned int minZ, unsigned int maxZ);
+
+	/// resamples this stack into a new stack with the given voxel size and resolution, placed in the world by frame
+	/**	frame becomes the new stack's transform, so any orientation and spacing can be used: the stack's own
+		transform for isotropic resampling (see getIsotropicGrid) or another stack's transform to bring this stack
+		into its frame. Samples outside this stack are 0.
+	*/
+	SpimStack* createResliced(const glm::mat4& frame, const glm::vec3& voxelSize, const glm::ivec3& resolution, Resampling::Interpolation mode = Resampling::TRILINEAR) const;
+	/// same as createResliced, but streams the planes into a raw binary file instead of keeping them in memory
+	void saveResliced(const glm::mat4& frame, const glm::vec3& voxelSize, const glm::ivec3& resolution, Resampling::Interpolation mode, const std::string& filename) const;
+	/// grid that covers this stack with cubic voxels of its smallest voxel dimension
+	void getIsotropicGrid(glm::vec3& voxelSize, glm::ivec3& resolution) const;
+	/// resamples the output planes [z0, z1) of a reslice into out, in this stack's voxel format, in parallel over the planes
+	void reslicePlanes(const glm::mat4& frame, const glm::vec3& voxelSize, const glm::ivec3& resolution, Resampling::Interpolation mode, const std::vector<float>& coefficients, int z0, int z1, void* out) const;
+	/// B-spline coefficients of this stack for reslicePlanes if mode is TRICUBIC, nothing otherwise
+	void calculateResliceCoefficients(Resampling::Interpolation mode, std::vector<float>& coefficients) const;
 			
 
 	virtual size_t getBytesPerVoxel() const = 0;
+	// raw voxel data in x-y-z order, getBytesPerVoxel() bytes per voxel. Call update() or markDirty() after changing it
+	virtual const void* getData() const = 0;
+	virtual void* getData() = 0;
 
 	// extracts the points in world coords. The w coordinate contains the point's value
 	std::vector<glm::vec4> extractTransformedPoints() const;
@@ -79,7 +120,25 @@ public:
 	
 	inline size_t getPlanePixelCount() const { return width*height; }
 
-	inline const unsigned int getTexture() const { return volumeTextureId; }
+	/// (min, max) cells of the uploaded voxels, see MacroCellGrid
+	inline const MacroCellGrid& getCellGrid() const { return cellGrid; }
+	/// uploads the voxels changed since the last upload into the bound 3D texture at offset. GL thread only
+	/**	The texture belongs to the caller, the stack's slot of the VolumeAtlas, and 8 bit voxels are widened for
+		a 16 bit texture. Only the dirty regions are uploaded unless all is set or the level changed, through a
+		ring of pixel buffers so copying the next region does not wait for the transfer of the previous one.
+		Returns false if nothing changed.
+	*/
+	bool uploadTexture(unsigned int textureBytesPerVoxel, const glm::ivec3& offset, bool all);
+	inline bool isTextureOutdated() const { return !dirtyRegions.isEmpty(); }
+	/// resolution of the uploaded voxels, 0 before the first upload
+	inline const glm::ivec3& getTextureResolution() const { return textureResolution; }
+	/// resolution the next upload will have, at the current texture level
+	glm::ivec3 getLevelResolution() const;
+	/// flags the voxels [min, max) for the next upload, after changing them through getData() or setSample()
+	inline void markDirty(const glm::ivec3& min, const glm::ivec3& max) { dirtyRegions.add(min, max); }
+	/// level of TextureResidency the texture is uploaded at, the voxels themselves stay at full resolution
+	void setTextureLevel(unsigned int level);
+	inline unsigned int getTextureLevel() const { return textureLevel; }
 	
 	Threshold getLimits() const;
 	std::vector<size_t> calculateHistogram(const Threshold& t) const;
@@ -92,6 +151,7 @@ public:
 	void setVoxelDimensions(const glm::vec3& dimensions);
 
 	inline const std::string& getFilename() const { return filename;  }
+	inline void setFilename(const std::string& f) { filename = f; }
 
 
 
@@ -111,6 +171,13 @@ public:
 	inline unsigned int getDepth() const { return depth; }
 	inline size_t getVoxelCount() const { return width*height*depth; }
 
+	// value range, as of the last update()
+	inline float getMinValue() const { return minVal; }
+	inline float getMaxValue() const { return maxVal; }
+
+	/// fraction of the planes the running filter or subsample has finished, can be polled from other threads
+	inline float getProgress() const { return depth > 0 ? std::min(1.f, (float)processedPlanes / depth) : 0.f; }
+
 protected:
 	SpimStack();
 	
@@ -121,18 +188,30 @@ protected:
 
 	std::string			filename;
 
-	
-	// 3d volume texture
-	unsigned int			volumeTextureId;
 
 	// 2 display lists: 0->width and width->0 for quick front-to-back rendering
 	mutable unsigned int	volumeList[2];
 	
 	float					minVal, maxVal;
+
+	// changed voxels, texture uploads only happen on the GL thread
+	DirtyRegions			dirtyRegions;
+	// resolution of the last upload, a different one needs a full upload
+	glm::ivec3				textureResolution;
+	unsigned int			textureLevel;
+	// value range of the texture's cells for empty-space skipping, rebuilt with every full upload
+	MacroCellGrid			cellGrid;
+	std::atomic<unsigned int>	processedPlanes;
 	
 
 	virtual void updateStats();
-	virtual void updateTexture() = 0;
+	// flags the whole texture for the next uploadTexture()
+	inline void updateTexture() { dirtyRegions.addAll(getResolution()); }
+
+	// copies everything but the voxels and the texture to a clone
+	void copyProperties(SpimStack* clone) const;
+	// swaps everything swapContent exchanges except for the voxels
+	void swapProperties(SpimStack* other);
 
 
 	virtual float getValue(size_t index) const = 0;
@@ -158,7 +237,8 @@ protected:
 	void drawXPlanes(const glm::vec3& view) const;
 	void drawYPlanes(const glm::vec3& view) const;
 
-	std::vector<glm::vec3> calculateVolumeNormals() const;
+	// calculates the gradient normals only for the given voxel indices, in parallel
+	void calculateVolumeNormals(const std::vector<size_t>& indices, std::vector<glm::vec3>& normals) const;
 
 
 
@@ -172,19 +252,19 @@ public:
 
 	virtual void subsample(bool updateTexture = true);
 	virtual void setContent(const glm::ivec3& resolution, const void* data);
+	virtual SpimStack* clone() const;
+	virtual void swapContent(SpimStack* other);
 	virtual void setSample(const size_t index, float value);
 
-	virtual void reslice(unsigned int minZ, unsigned int maxZ);
-
 	virtual size_t getBytesPerVoxel() const { return 2; }
+	virtual const void* getData() const { return volume; }
+	virtual void* getData() { return volume; }
 
 private:
 	unsigned short*			volume;
 
 	SpimStackU16(const SpimStackU16& cp);
 
-	virtual void updateTexture();
-
 	virtual void loadImage(const std::string& filename);
 	virtual void loadBinary(const std::string& filename, const glm::ivec3& resolution);
 	
@@ -212,19 +292,19 @@ public:
 
 	virtual void subsample(bool updateTexture = true);
 	virtual void setContent(const glm::ivec3& resolution, const void* data);
+	virtual SpimStack* clone() const;
+	virtual void swapContent(SpimStack* other);
 	virtual void setSample(const size_t index, float value);
 
-	virtual void reslice(unsigned int minZ, unsigned int maxZ);
-
 	virtual size_t getBytesPerVoxel() const { return 1; }
+	virtual const void* getData() const { return volume; }
+	virtual void* getData() { return volume; }
 
 private:
 	unsigned char*			volume;
 
 	SpimStackU8(const SpimStackU8&);
 	
-	virtual void updateTexture();
-
 	virtual void loadImage(const std::string& filename);
 	virtual void loadBinary(const std::string& filename, const glm::ivec3& resolution);
 
@@ -6,6 +6,9 @@
 
 #include <boost/utility.hpp>
 
+#include "PointcloudFilter.h"
+#include "NormalEstimation.h"
+
 class SpimStack;
 
 struct Threshold
@@ -43,6 +46,14 @@ public:
 
 	inline void setPoints(const std::vector<glm::vec4>& pts) { points = pts; }
 
+	/// voxel-grid downsampling, keeps the normals in sync
+	inline size_t downsample(float cellSize, PointcloudFilter::VoxelMode mode = PointcloudFilter::VOXEL_CENTROID) { return PointcloudFilter::voxelGrid(points, normals, cellSize, mode); }
+	/// statistical outlier removal, keeps the normals in sync
+	inline size_t removeOutliers(unsigned int k, float stdDevMul) { return PointcloudFilter::removeOutliers(points, normals, k, stdDevMul); }
+
+	/// replaces the normals by kNN-PCA estimates, oriented towards the viewpoint
+	inline void estimateNormals(unsigned int k = 10, const glm::vec3& viewpoint = glm::vec3(0.f)) { ::estimateNormals(points, normals, k, viewpoint); }
+
 
 	void applyTransform(const glm::mat4& m);
 
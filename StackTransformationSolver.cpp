@@ -6,14 +6,19 @@
 #include <iostream>
 #include <chrono>
 #include <fstream>
+#include <limits>
 
+#ifndef NO_GRAPHICS
 #include <GL/glew.h>
+#endif
 
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/transform2.hpp>
 
 #include "Framebuffer.h"
 #include "InteractionVolume.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
 
 /// returns a uniform random variable in [-1..1]
 static inline double rng_u(std::mt19937& rng)
@@ -48,6 +53,83 @@ void IStackTransformationSolver::recordCurrentScore(Framebuffer* fbo)
 }
 */
 
+unsigned int IStackTransformationSolver::minimize(const InteractionVolume* v, const std::function<double(const glm::mat4&)>& score, unsigned int maxIterations)
+{
+	// the solver starts with a valid candidate, nextSolution() moves on to the next one
+	initialize(v);
+
+	unsigned int n = 0;
+	do
+	{
+		PROFILE_ZONE("Solver::iteration");
+		recordCurrentScore(score(getCurrentSolution().matrix));
+		++n;
+	} while (n < maxIterations && nextSolution());
+
+	return n;
+}
+
+IStackTransformationSolver* IStackTransformationSolver::create(const std::string& name, const std::vector<InteractionVolume*>& volumes)
+{
+	using namespace std;
+
+	if (name == "Uniform DX")
+	{
+		cout << "[Solver] Creating new Uniform DX Solver\n";
+		return new DXSolver;
+	}
+
+	if (name == "Uniform DY")
+	{
+		cout << "[Solver] Creating new Uniform DY Solver\n";
+		return new DYSolver;
+	}
+
+	if (name == "Uniform DZ")
+	{
+		cout << "[Solver] Creating new Uniform DZ Solver\n";
+		return new DZSolver;
+	}
+
+	if (name == "Uniform RY")
+	{
+		cout << "[Solver] Creating new Uniform RY Solver\n";
+		return new RYSolver;
+	}
+
+	if (name == "Simulated Annealing")
+	{
+		cout << "[Solver] Creating new Simulated Annealing Solver\n";
+		return new SimulatedAnnealingSolver;
+	}
+
+	if (name == "Hillclimb")
+	{
+		cout << "[Solver] Creating new Multidimensional hillclimb solver\n";
+		return new MultiDimensionalHillClimb(volumes);
+	}
+
+	if (name == "Solution Parameterspace")
+	{
+		cout << "[Solver] Creating new solution parameter space explorer.\n";
+		return new ParameterSpaceMapping;
+	}
+
+	if (name == "Random Rotation")
+	{
+		cout << "[Solver] Creating new random rotation solver\n";
+		return new RandomRotationSolver;
+	}
+
+	if (name == "Uniform Scale")
+	{
+		cout << "[Solver] Creating new uniform scale solver\n";
+		return new UniformScaleSolver;
+	}
+
+	return nullptr;
+}
+
 glm::mat4 IStackTransformationSolver::createRotationMatrix(float angle, const InteractionVolume* v)
 {
 	using namespace glm;
@@ -95,6 +177,32 @@ bool UniformSamplingSolver::nextSolution()
 	return true;
 }
 
+unsigned int UniformSamplingSolver::minimize(const InteractionVolume* v, const std::function<double(const glm::mat4&)>& score, unsigned int maxIterations)
+{
+	initialize(v);
+
+	const int n = (int)std::min(solutions.size(), (size_t)maxIterations);
+	std::vector<double> scores(n);
+
+	TaskScheduler::parallelFor(0, n, 1, [&](int first, int last)
+	{
+		for (int i = first; i < last; ++i)
+		{
+			PROFILE_ZONE("Solver::iteration");
+			scores[i] = score(solutions[i].matrix);
+		}
+	});
+
+	// recorded in order, as if they were scored one after the other
+	for (int i = 0; i < n; ++i)
+	{
+		currentSolution = i;
+		recordCurrentScore(scores[i]);
+	}
+
+	return n;
+}
+
 bool UniformSamplingSolver::hasValidCurrentSolution() const
 {
 	return !solutions.empty() && (currentSolution >= 0) && (currentSolution < (int)solutions.size());
@@ -449,9 +557,10 @@ void SimulatedAnnealingSolver::initialize(const InteractionVolume* v)
 	temp = 1;
 	cooling = 0.998;
 
-	currentSolution.score = 0;
-	currentSolution.matrix = v->getTransform();
-	bestSolution = currentSolution;
+	// solutions are deltas applied on top of the volume's transform, the first candidate is the identity
+	currentSolution.score = std::numeric_limits<double>::max();
+	currentSolution.matrix = glm::mat4(1.f);
+	acceptedSolution = bestSolution = currentSolution;
 
 	iteration = 0;
 	currentVolume = v;
@@ -466,10 +575,10 @@ void SimulatedAnnealingSolver::resetSolution()
 {
 	currentVolume = nullptr;
 
-	currentSolution.score = 0;
+	currentSolution.score = std::numeric_limits<double>::max();
 	currentSolution.matrix = glm::mat4(1.f);
 	
-	bestSolution = currentSolution;
+	acceptedSolution = bestSolution = currentSolution;
 }
 
 bool SimulatedAnnealingSolver::nextSolution()
@@ -478,8 +587,9 @@ bool SimulatedAnnealingSolver::nextSolution()
 	if (temp > EPS)
 	{
 
+		// candidates are neighbours of the last accepted solution
+		currentSolution = acceptedSolution;
 		modifyCurrentSolution();
-		currentSolution.score = 0;
 		temp *= cooling;
 
 	
@@ -498,19 +608,11 @@ void SimulatedAnnealingSolver::recordCurrentScore(double s)
 	history.add(s);
 
 	if (s < bestSolution.score)
-	{
 		bestSolution = currentSolution;
-		std::cout << "[Debug] Accepted better solution with score " << s << std::endl;
-	}
-	else
-	{
-		double d = exp((currentSolution.score - bestSolution.score) / temp);
-		if ((double)rng() / rng.max() < d)
-		{
-			bestSolution = currentSolution;
-			std::cout << "[Debug] Accepted worse solution with score " << s << std::endl;
-		}
-	}
+
+	// better candidates are always accepted, worse ones less likely the colder it gets
+	if (s < acceptedSolution.score || (double)rng() / rng.max() < exp((acceptedSolution.score - s) / temp))
+		acceptedSolution = currentSolution;
 }
 
 void SimulatedAnnealingSolver::modifyCurrentSolution()
@@ -538,7 +640,7 @@ void SimulatedAnnealingSolver::modifyCurrentSolution()
 	}
 	else if (mode == 2)
 	{
-		mat4 T = translate(vec3(0, f, 0));
+		mat4 T = translate(vec3(0, 0, f));
 		currentSolution.matrix = T * currentSolution.matrix;
 	}
 	else if (mode == 3)
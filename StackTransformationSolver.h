@@ -5,6 +5,8 @@
 
 #include <random>
 #include <vector>
+#include <string>
+#include <functional>
 
 #include "TinyStats.h"
 
@@ -30,6 +32,9 @@ public:
 		
 	virtual ~IStackTransformationSolver() {};
 
+	/// creates a solver by its menu name ("Uniform DX", "Simulated Annealing", ...), null if the name is unknown
+	static IStackTransformationSolver* create(const std::string& name, const std::vector<InteractionVolume*>& volumes);
+
 	/// initializes a new run of the solver
 	virtual void initialize(const InteractionVolume* v) = 0;
 	/// resets all previous solutions
@@ -44,6 +49,11 @@ public:
 	virtual const Solution& getCurrentSolution() const = 0;
 	/// returns the best solution found so far
 	virtual const Solution& getBestSolution() = 0;
+
+	/// runs the solver on v without a GL context: scores candidates until the solver is done or maxIterations
+	/// candidates were scored. score is called with the delta transform of a candidate, lower is better,
+	/// possibly from several threads. Returns the number of scored candidates
+	virtual unsigned int minimize(const InteractionVolume* v, const std::function<double(const glm::mat4&)>& score, unsigned int maxIterations);
 	
 	inline const TinyHistory<double>& getHistory() const { return history; }
 	inline void clearHistory() { history.history.clear(); }
@@ -71,6 +81,9 @@ public:
 	virtual const Solution& getCurrentSolution() const;
 	virtual const Solution& getBestSolution();
 
+	/// the candidates are known up front and scored in parallel, score has to be thread-safe
+	virtual unsigned int minimize(const InteractionVolume* v, const std::function<double(const glm::mat4&)>& score, unsigned int maxIterations);
+
 protected:
 	std::vector<Solution>		solutions;
 	int							currentSolution;
@@ -164,7 +177,8 @@ public:
 	inline double getTemp() const { return temp; }
 
 private:
-	Solution					currentSolution, bestSolution;
+	// the candidate being scored, the state of the annealing and the best candidate so far
+	Solution					currentSolution, acceptedSolution, bestSolution;
 	double						temp, cooling;
 
 	std::mt19937				rng;
@@ -0,0 +1,290 @@
+#include "TaskScheduler.h"
+
+#include <thread>
+#include <deque>
+#include <memory>
+#include <condition_variable>
+#include <iostream>
+
+namespace TaskScheduler
+{
+	namespace detail
+	{
+		struct Task
+		{
+			std::function<void()>	function;
+			TaskGroup*				group;
+		};
+
+		struct Worker
+		{
+			std::mutex				mutex;
+			std::deque<Task*>		tasks;
+		};
+
+		// index of the worker running on this thread, -1 on all other threads
+		static thread_local int workerIndex = -1;
+		// group of the task running on this thread
+		static thread_local TaskGroup* currentGroup = nullptr;
+
+		static unsigned int requestedThreads = 0;
+
+		class Scheduler
+		{
+		public:
+			Scheduler(unsigned int threadCount) : workers(threadCount - 1), queued(0), sleeping(0), stop(false)
+			{
+				for (size_t i = 0; i < workers.size(); ++i)
+					workers[i].reset(new Worker);
+				for (size_t i = 0; i < workers.size(); ++i)
+					threads.push_back(std::thread(&Scheduler::run, this, (int)i));
+
+				std::cout << "[Scheduler] Started " << threadCount << " threads\n";
+			}
+
+			~Scheduler()
+			{
+				{
+					std::lock_guard<std::mutex> lock(sleepMutex);
+					stop = true;
+				}
+				wake.notify_all();
+
+				for (size_t i = 0; i < threads.size(); ++i)
+					threads[i].join();
+			}
+
+			inline unsigned int getThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+			void submit(Task* task)
+			{
+				// workers push to their own deque, other threads to the shared one
+				Worker& w = workerIndex >= 0 ? *workers[workerIndex] : injected;
+				{
+					std::lock_guard<std::mutex> lock(w.mutex);
+					w.tasks.push_back(task);
+				}
+
+				++queued;
+				if (sleeping > 0)
+				{
+					// a worker about to sleep either sees the task or is woken up
+					{
+						std::lock_guard<std::mutex> lock(sleepMutex);
+					}
+					wake.notify_one();
+				}
+			}
+
+			/// runs one queued task, false if there was none
+			bool runOne()
+			{
+				Task* task = nullptr;
+
+				// newest own task first, it is the one whose data is still in the cache
+				if (workerIndex >= 0)
+					task = popBack(*workers[workerIndex]);
+				if (!task)
+					task = popFront(injected);
+
+				// steal the oldest task, the largest piece of work, starting at a different victim on every thread
+				const int victims = (int)workers.size();
+				for (int i = 0; !task && i < victims; ++i)
+				{
+					const int v = (workerIndex + 1 + i) % victims;
+					if (v != workerIndex)
+						task = popFront(*workers[v]);
+				}
+
+				if (!task)
+					return false;
+
+				execute(task);
+				return true;
+			}
+
+		private:
+			std::vector<std::unique_ptr<Worker> >	workers;
+			std::vector<std::thread>				threads;
+			// tasks submitted by threads that are no workers
+			Worker									injected;
+
+			std::atomic<int>						queued, sleeping;
+			std::mutex								sleepMutex;
+			std::condition_variable					wake;
+			bool									stop;
+
+			Task* popBack(Worker& w)
+			{
+				std::lock_guard<std::mutex> lock(w.mutex);
+				if (w.tasks.empty())
+					return nullptr;
+
+				Task* t = w.tasks.back();
+				w.tasks.pop_back();
+				--queued;
+				return t;
+			}
+
+			Task* popFront(Worker& w)
+			{
+				std::lock_guard<std::mutex> lock(w.mutex);
+				if (w.tasks.empty())
+					return nullptr;
+
+				Task* t = w.tasks.front();
+				w.tasks.pop_front();
+				--queued;
+				return t;
+			}
+
+			void run(int index)
+			{
+				workerIndex = index;
+
+				for (;;)
+				{
+					if (runOne())
+						continue;
+
+					std::unique_lock<std::mutex> lock(sleepMutex);
+					++sleeping;
+					wake.wait(lock, [this]() { return stop || queued > 0; });
+					--sleeping;
+
+					if (stop)
+						return;
+				}
+			}
+		};
+
+		static Scheduler& getScheduler()
+		{
+			static Scheduler scheduler(requestedThreads > 0 ? requestedThreads : std::max(std::thread::hardware_concurrency(), 1u));
+			return scheduler;
+		}
+
+		void execute(Task* task)
+		{
+			TaskGroup* group = task->group;
+			TaskGroup* previous = currentGroup;
+			currentGroup = group;
+
+			std::exception_ptr error;
+			if (!group->isCancelled())
+			{
+				try
+				{
+					task->function();
+				}
+				catch (...)
+				{
+					error = std::current_exception();
+				}
+			}
+
+			currentGroup = previous;
+			delete task;
+
+			group->finish(error);
+		}
+	}
+
+	unsigned int getThreadCount()
+	{
+		return detail::getScheduler().getThreadCount();
+	}
+
+	void setThreadCount(unsigned int count)
+	{
+		detail::requestedThreads = count;
+	}
+
+	bool isCancelled()
+	{
+		return detail::currentGroup && detail::currentGroup->isCancelled();
+	}
+
+	TaskGroup::TaskGroup() : pending(0), cancelled(false), parent(detail::currentGroup)
+	{
+	}
+
+	TaskGroup::~TaskGroup()
+	{
+		try
+		{
+			wait();
+		}
+		catch (...)
+		{
+		}
+	}
+
+	void TaskGroup::run(const std::function<void()>& function)
+	{
+		if (isCancelled())
+			return;
+
+		detail::Task* task = new detail::Task;
+		task->function = function;
+		task->group = this;
+
+		++pending;
+		detail::getScheduler().submit(task);
+	}
+
+	void TaskGroup::wait()
+	{
+		detail::Scheduler& scheduler = detail::getScheduler();
+		while (pending.load(std::memory_order_acquire) > 0)
+			if (!scheduler.runOne())
+				std::this_thread::yield();
+
+		std::exception_ptr e;
+		{
+			std::lock_guard<std::mutex> lock(errorMutex);
+			std::swap(e, error);
+		}
+
+		if (e)
+			std::rethrow_exception(e);
+	}
+
+	void TaskGroup::runAndWait(const std::function<void()>& function)
+	{
+		if (!isCancelled())
+		{
+			detail::Task* task = new detail::Task;
+			task->function = function;
+			task->group = this;
+
+			++pending;
+			detail::execute(task);
+		}
+
+		wait();
+	}
+
+	void TaskGroup::cancel()
+	{
+		cancelled = true;
+	}
+
+	bool TaskGroup::isCancelled() const
+	{
+		return cancelled.load(std::memory_order_relaxed) || (parent && parent->isCancelled());
+	}
+
+	void TaskGroup::finish(const std::exception_ptr& e)
+	{
+		if (e)
+		{
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error)
+				error = e;
+			cancelled = true;
+		}
+
+		pending.fetch_sub(1, std::memory_order_release);
+	}
+}
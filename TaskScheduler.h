@@ -0,0 +1,161 @@
+#pragma once
+
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+/// Process-wide work-stealing scheduler used by all compute kernels
+/**	A fixed set of worker threads, one less than there are cores, each with its own task deque. Workers
+	take the newest task of their own deque and steal the oldest one of the others when they run dry.
+	A thread waiting for a task group runs other tasks meanwhile instead of blocking, so nested parallel
+	loops (candidates scored in parallel, each of them sampling in parallel) share the same threads and
+	never oversubscribe the cores.
+
+		TaskScheduler::parallelFor(0, depth, 1, [&](int z0, int z1)
+		{
+			for (int z = z0; z < z1; ++z)
+				...
+		});
+
+	Exceptions thrown by a task cancel its group and are rethrown by wait(), the first one wins.
+	Cancelling a group also cancels the groups created by its tasks; tasks that have not started are
+	skipped, running ones may poll isCancelled().
+*/
+namespace TaskScheduler
+{
+	/// number of threads running tasks, including the thread waiting for them
+	unsigned int getThreadCount();
+	/// sets the number of threads before the scheduler is first used, 0 uses all cores
+	void setThreadCount(unsigned int count);
+
+	/// true if the task running on this thread belongs to a cancelled group
+	bool isCancelled();
+
+	namespace detail
+	{
+		struct Task;
+		void execute(Task* task);
+	}
+
+	/// tasks that can be waited for and cancelled together
+	class TaskGroup
+	{
+	public:
+		TaskGroup();
+		/// waits for the remaining tasks, exceptions are dropped
+		~TaskGroup();
+
+		/// schedules the task, it may run on any thread at any time until wait() returns
+		void run(const std::function<void()>& task);
+		/// returns when all tasks have finished, runs tasks in the meantime. Rethrows the first exception
+		void wait();
+		/// runs the task on this thread as part of the group, then waits like wait(). For long tasks that must
+		/// not end up on a thread that helps out while waiting for something else
+		void runAndWait(const std::function<void()>& task);
+
+		void cancel();
+		bool isCancelled() const;
+
+	private:
+		std::atomic<int>		pending;
+		std::atomic<bool>		cancelled;
+		// the group of the task that created this one
+		const TaskGroup*		parent;
+
+		std::mutex				errorMutex;
+		std::exception_ptr		error;
+
+		friend void detail::execute(detail::Task* task);
+		void finish(const std::exception_ptr& e);
+
+		TaskGroup(const TaskGroup&);
+		TaskGroup& operator=(const TaskGroup&);
+	};
+
+	namespace detail
+	{
+		template <typename F>
+		void splitFor(TaskGroup& group, int begin, int end, int grain, const F& body)
+		{
+			// hand off the upper halves, they are what idle threads steal first
+			while (end - begin > grain)
+			{
+				const int middle = begin + (end - begin) / 2;
+				group.run([&group, &body, middle, end, grain]() { splitFor(group, middle, end, grain, body); });
+				end = middle;
+			}
+
+			if (!group.isCancelled())
+				body(begin, end);
+		}
+	}
+
+	/// calls body(first, last) on disjoint subranges of [begin, end) of at most grain elements
+	template <typename F>
+	void parallelFor(int begin, int end, int grain, const F& body)
+	{
+		if (end <= begin)
+			return;
+
+		grain = std::max(grain, 1);
+		if (end - begin <= grain || getThreadCount() == 1)
+		{
+			body(begin, end);
+			return;
+		}
+
+		TaskGroup group;
+		group.run([&]() { detail::splitFor(group, begin, end, grain, body); });
+		group.wait();
+	}
+
+	/// calls body(min, max) on the bricks of the box [begin, end). Slabs are bricks spanning x and y
+	template <typename F>
+	void parallelFor(const glm::ivec3& begin, const glm::ivec3& end, const glm::ivec3& brick, const F& body)
+	{
+		if (glm::any(glm::lessThanEqual(end, begin)))
+			return;
+
+		const glm::ivec3 size = glm::max(brick, glm::ivec3(1));
+		const glm::ivec3 count = (end - begin + size - glm::ivec3(1)) / size;
+
+		parallelFor(0, count.x * count.y * count.z, 1, [&](int first, int last)
+		{
+			for (int i = first; i < last; ++i)
+			{
+				const glm::ivec3 b(i % count.x, (i / count.x) % count.y, i / (count.x * count.y));
+				const glm::ivec3 min = begin + b * size;
+				body(min, glm::min(min + size, end));
+			}
+		});
+	}
+
+	/// reduces [begin, end) in pieces of grain elements: body(first, last, identity) returns the value of a
+	/// piece, the pieces are combined in order. The result does not depend on the number of threads
+	template <typename T, typename F, typename C>
+	T parallelReduce(int begin, int end, int grain, const T& identity, const F& body, const C& combine)
+	{
+		if (end <= begin)
+			return identity;
+
+		grain = std::max(grain, 1);
+		const int pieces = (end - begin + grain - 1) / grain;
+		std::vector<T> partial(pieces, identity);
+
+		parallelFor(0, pieces, 1, [&](int first, int last)
+		{
+			for (int i = first; i < last; ++i)
+				partial[i] = body(begin + i * grain, std::min(begin + (i + 1) * grain, end), identity);
+		});
+
+		T result = identity;
+		for (int i = 0; i < pieces; ++i)
+			result = combine(result, partial[i]);
+		return result;
+	}
+}
@@ -0,0 +1,157 @@
+#include "TextureResidency.h"
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+using namespace glm;
+
+namespace TextureResidency
+{
+	// doubles the factor of the axes lagging behind the coarsest one, false if no axis can be reduced anymore
+	static bool reduce(const ivec3& resolution, const vec3& voxelSize, ivec3& factor)
+	{
+		const vec3 size = voxelSize * vec3(factor);
+
+		float smallest = std::numeric_limits<float>::max();
+		for (int a = 0; a < 3; ++a)
+			if (resolution[a] > factor[a])
+				smallest = std::min(smallest, size[a]);
+
+		bool reduced = false;
+		for (int a = 0; a < 3; ++a)
+			if (resolution[a] > factor[a] && size[a] < 2.f * smallest)
+			{
+				factor[a] *= 2;
+				reduced = true;
+			}
+
+		return reduced;
+	}
+
+	ivec3 getLevelFactor(const ivec3& resolution, const vec3& voxelSize, unsigned int level)
+	{
+		ivec3 factor(1);
+		for (unsigned int i = 0; i < level && reduce(resolution, voxelSize, factor); ++i)
+			;
+		return factor;
+	}
+
+	ivec3 getLevelResolution(const ivec3& resolution, const vec3& voxelSize, unsigned int level)
+	{
+		const ivec3 factor = getLevelFactor(resolution, voxelSize, level);
+		return (resolution + factor - ivec3(1)) / factor;
+	}
+
+	unsigned int getLevelCount(const ivec3& resolution, const vec3& voxelSize)
+	{
+		ivec3 factor(1);
+		unsigned int count = 1;
+		while (reduce(resolution, voxelSize, factor))
+			++count;
+		return count;
+	}
+
+	size_t getLevelBytes(const Request& request, unsigned int level)
+	{
+		const ivec3 res = getLevelResolution(request.resolution, request.voxelSize, level);
+		return (size_t)res.x * res.y * res.z * request.bytesPerVoxel;
+	}
+
+	std::vector<unsigned int> selectLevels(const std::vector<Request>& requests, size_t budget)
+	{
+		std::vector<unsigned int> levels(requests.size(), 0);
+		std::vector<unsigned int> counts(requests.size());
+		size_t total = 0;
+
+		for (size_t i = 0; i < requests.size(); ++i)
+		{
+			const Request& r = requests[i];
+			counts[i] = getLevelCount(r.resolution, r.voxelSize);
+
+			// the coarsest level whose smallest voxels are not larger than a pixel
+			if (r.pixelSize > 0.f)
+				while (levels[i] + 1 < counts[i])
+				{
+					const vec3 size = r.voxelSize * vec3(getLevelFactor(r.resolution, r.voxelSize, levels[i] + 1));
+					if (std::min(size.x, std::min(size.y, size.z)) > r.pixelSize)
+						break;
+					++levels[i];
+				}
+
+			total += getLevelBytes(r, levels[i]);
+		}
+
+		// the largest texture loses the most by halving, and halving it frees the most memory
+		while (total > budget)
+		{
+			size_t largest = requests.size(), largestBytes = 0;
+			for (size_t i = 0; i < requests.size(); ++i)
+			{
+				const size_t bytes = getLevelBytes(requests[i], levels[i]);
+				if (levels[i] + 1 < counts[i] && bytes > largestBytes)
+				{
+					largest = i;
+					largestBytes = bytes;
+				}
+			}
+
+			if (largest == requests.size())
+				break;
+
+			++levels[largest];
+			total = total - largestBytes + getLevelBytes(requests[largest], levels[largest]);
+		}
+
+		return levels;
+	}
+
+	template <typename T>
+	static void averageBlocks(const T* data, const ivec3& resolution, const ivec3& factor, const ivec3& min, const ivec3& max, T* out)
+	{
+		const ivec3 size = max - min;
+
+		TaskScheduler::parallelFor(0, size.z, 1, [&](int z0, int z1)
+		{
+			for (int z = z0; z < z1; ++z)
+				for (int y = 0; y < size.y; ++y)
+				{
+					T* row = out + ((size_t)z * size.y + y) * size.x;
+
+					// level 0 is a plain copy
+					if (factor == ivec3(1))
+					{
+						memcpy(row, data + min.x + (size_t)(min.y + y) * resolution.x + (size_t)(min.z + z) * resolution.x * resolution.y, size.x * sizeof(T));
+						continue;
+					}
+
+					for (int x = 0; x < size.x; ++x)
+					{
+						const ivec3 first = (min + ivec3(x, y, z)) * factor;
+						const ivec3 last = glm::min(first + factor, resolution);
+
+						unsigned long long sum = 0;
+						for (int k = first.z; k < last.z; ++k)
+							for (int j = first.y; j < last.y; ++j)
+							{
+								const T* v = data + (size_t)j * resolution.x + (size_t)k * resolution.x * resolution.y;
+								for (int i = first.x; i < last.x; ++i)
+									sum += v[i];
+							}
+
+						const unsigned long long count = (unsigned long long)(last.x - first.x) * (last.y - first.y) * (last.z - first.z);
+						row[x] = (T)((sum + count / 2) / count);
+					}
+				}
+		});
+	}
+
+	void getLevelVoxels(const void* data, unsigned int bytesPerVoxel, const ivec3& resolution, const ivec3& factor, const ivec3& min, const ivec3& max, void* out)
+	{
+		if (bytesPerVoxel == 2)
+			averageBlocks(reinterpret_cast<const unsigned short*>(data), resolution, factor, min, max, reinterpret_cast<unsigned short*>(out));
+		else
+			averageBlocks(reinterpret_cast<const unsigned char*>(data), resolution, factor, min, max, reinterpret_cast<unsigned char*>(out));
+	}
+}
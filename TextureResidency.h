@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+/// Chooses the resolution at which each stack's texture lives on the GPU
+/**	A stack's texture is uploaded at a level of a resolution pyramid, averaged from the full-resolution
+	voxels that stay in memory. Level 0 is the stack itself. Each further level halves the axes whose voxels
+	are less than twice as large as the smallest ones, so anisotropic stacks first become isotropic and are
+	then halved along all axes. Axes down to a single voxel stay as they are.
+
+	selectLevels() picks, for every stack, the coarsest level whose voxels are still no larger than a screen
+	pixel, then coarsens the largest textures until all of them fit into the memory budget. It only does
+	bookkeeping, the uploads are up to SpimStack::setTextureLevel().
+*/
+namespace TextureResidency
+{
+	/// what a stack needs on screen
+	struct Request
+	{
+		glm::ivec3		resolution;
+		glm::vec3		voxelSize;
+		unsigned int	bytesPerVoxel;
+		// world size of a screen pixel at the stack, 0 if unknown
+		float			pixelSize;
+	};
+
+	/// power of two each axis is reduced by at the level
+	glm::ivec3 getLevelFactor(const glm::ivec3& resolution, const glm::vec3& voxelSize, unsigned int level);
+	/// resolution of the level, partial blocks at the far borders count as voxels
+	glm::ivec3 getLevelResolution(const glm::ivec3& resolution, const glm::vec3& voxelSize, unsigned int level);
+	/// number of levels, the last one cannot be reduced any further
+	unsigned int getLevelCount(const glm::ivec3& resolution, const glm::vec3& voxelSize);
+	size_t getLevelBytes(const Request& request, unsigned int level);
+
+	/// the level of every request, such that the sum of their bytes is at most budget if at all possible
+	std::vector<unsigned int> selectLevels(const std::vector<Request>& requests, size_t budget);
+
+	/// averages the voxels of the level box [min, max) from the full-resolution data, packed in x-y-z order into out.
+	/// bytesPerVoxel is 1 or 2. Runs in parallel over the planes of the box
+	void getLevelVoxels(const void* data, unsigned int bytesPerVoxel, const glm::ivec3& resolution, const glm::ivec3& factor, const glm::ivec3& min, const glm::ivec3& max, void* out);
+}
@@ -0,0 +1,243 @@
+#include "TimeSeriesDataset.h"
+#include "SpimStack.h"
+#include "Profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+TimeSeriesDataset::TimeSeriesDataset(const std::string& filename, size_t budget) : angleCount(0), memoryBudget(budget), memoryUsage(0), useCounter(0), quit(false)
+{
+	loadDatasetFile(filename);
+
+	std::cout << "[Dataset] Loaded \"" << filename << "\": " << getTimepointCount() << " timepoints, " << angleCount << " angles, " << (memoryBudget >> 20) << "MB cache\n";
+
+	loader = std::thread(&TimeSeriesDataset::run, this);
+}
+
+TimeSeriesDataset::~TimeSeriesDataset()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	requested.notify_all();
+	loader.join();
+}
+
+void TimeSeriesDataset::loadDatasetFile(const std::string& filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+		throw std::runtime_error("Unable to open file \"" + filename + "\"!");
+
+	const size_t slash = filename.find_last_of("/\\");
+	const std::string path = slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		std::istringstream s(line);
+		unsigned int t = 0, a = 0;
+		std::string stackFile;
+		if (!(s >> t >> a) || !std::getline(s >> std::ws, stackFile))
+			throw std::runtime_error("Invalid line \"" + line + "\" in dataset \"" + filename + "\"!");
+
+		// relative to the dataset file unless absolute
+		const bool absolute = stackFile[0] == '/' || stackFile[0] == '\\' || (stackFile.size() > 1 && stackFile[1] == ':');
+		if (!absolute)
+			stackFile = path + stackFile;
+
+		if (t >= files.size())
+			files.resize(t + 1);
+		if (a >= files[t].size())
+			files[t].resize(a + 1);
+		files[t][a] = stackFile;
+		angleCount = std::max(angleCount, a + 1);
+	}
+
+	if (files.empty())
+		throw std::runtime_error("Dataset \"" + filename + "\" is empty!");
+
+	for (size_t t = 0; t < files.size(); ++t)
+	{
+		files[t].resize(angleCount);
+		for (unsigned int a = 0; a < angleCount; ++a)
+			if (files[t][a].empty())
+				throw std::runtime_error("Dataset \"" + filename + "\" is missing timepoint " + std::to_string(t) + ", angle " + std::to_string(a) + "!");
+	}
+}
+
+const std::string& TimeSeriesDataset::getFilename(unsigned int timepoint, unsigned int angle) const
+{
+	if (timepoint >= files.size() || angle >= angleCount)
+		throw std::runtime_error("Invalid timepoint " + std::to_string(timepoint) + ", angle " + std::to_string(angle) + "!");
+
+	return files[timepoint][angle];
+}
+
+void TimeSeriesDataset::request(const Key& key)
+{
+	Entry& e = cache[key];
+	e.lastUse = ++useCounter;
+
+	if (e.volume || e.queued || !e.error.empty())
+		return;
+
+	e.queued = true;
+	queue.push_back(key);
+	requested.notify_one();
+}
+
+std::shared_ptr<const TimeSeriesDataset::Volume> TimeSeriesDataset::getVolume(unsigned int timepoint, unsigned int angle)
+{
+	getFilename(timepoint, angle);
+	const Key key(timepoint, angle);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	request(key);
+
+	const Entry& e = cache[key];
+	if (!e.error.empty())
+		throw std::runtime_error(e.error);
+
+	// volumes asked for directly are loaded before the prefetched ones
+	if (e.queued)
+	{
+		std::deque<Key>::iterator it = std::find(queue.begin(), queue.end(), key);
+		if (it != queue.end() && it != queue.begin())
+		{
+			queue.erase(it);
+			queue.push_front(key);
+		}
+	}
+
+	return e.volume;
+}
+
+std::shared_ptr<const TimeSeriesDataset::Volume> TimeSeriesDataset::waitForVolume(unsigned int timepoint, unsigned int angle)
+{
+	getFilename(timepoint, angle);
+	const Key key(timepoint, angle);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		const Entry& e = cache[key];
+		if (e.volume)
+			return e.volume;
+		if (!e.error.empty())
+			throw std::runtime_error(e.error);
+
+		// the loader might have evicted the volume again for other requests before we woke up
+		request(key);
+		loaded.wait(lock);
+	}
+}
+
+void TimeSeriesDataset::prefetch(unsigned int timepoint)
+{
+	if (timepoint >= files.size())
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (unsigned int a = 0; a < angleCount; ++a)
+		request(Key(timepoint, a));
+}
+
+bool TimeSeriesDataset::isTimepointLoaded(unsigned int timepoint) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for (unsigned int a = 0; a < angleCount; ++a)
+	{
+		std::map<Key, Entry>::const_iterator it = cache.find(Key(timepoint, a));
+		if (it == cache.end() || !it->second.volume)
+			return false;
+	}
+
+	return true;
+}
+
+size_t TimeSeriesDataset::getMemoryUsage() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return memoryUsage;
+}
+
+void TimeSeriesDataset::evict(size_t size, const Key& keep)
+{
+	// least recently used first. The other angles of the same timepoint are kept, it is needed as a whole.
+	// Volumes still referenced by a caller stay in memory whatever the cache does, dropping them would
+	// only hide their size from the budget. New references are only handed out with the mutex held.
+	std::vector<std::pair<uint64_t, Key> > candidates;
+	for (std::map<Key, Entry>::const_iterator it = cache.begin(); it != cache.end(); ++it)
+		if (it->second.volume && it->second.volume.use_count() == 1 && it->first.first != keep.first)
+			candidates.push_back(std::make_pair(it->second.lastUse, it->first));
+
+	std::sort(candidates.begin(), candidates.end());
+
+	for (size_t i = 0; i < candidates.size() && memoryUsage + size > memoryBudget; ++i)
+	{
+		Entry& e = cache[candidates[i].second];
+		memoryUsage -= e.volume->data.size();
+		e.volume.reset();
+	}
+
+	if (memoryUsage + size > memoryBudget)
+		std::cout << "[Dataset] Warning: timepoint " << keep.first << " exceeds the cache budget of " << (memoryBudget >> 20) << "MB\n";
+}
+
+void TimeSeriesDataset::run()
+{
+	for (;;)
+	{
+		Key key;
+		std::string filename;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			requested.wait(lock, [this]() { return quit || !queue.empty(); });
+			if (quit)
+				return;
+
+			key = queue.front();
+			queue.pop_front();
+			filename = files[key.first][key.second];
+		}
+
+		std::shared_ptr<Volume> volume(new Volume);
+		std::string error;
+		try
+		{
+			PROFILE_ZONE("Dataset::load");
+			SpimStack::getImageInfo(filename, volume->resolution, volume->bytesPerVoxel);
+			volume->data.resize((size_t)volume->resolution.x * volume->resolution.y * volume->resolution.z * volume->bytesPerVoxel);
+			SpimStack::loadImageRegion(filename, glm::ivec3(0), volume->resolution, &volume->data[0]);
+		}
+		catch (const std::exception& e)
+		{
+			error = "Unable to load timepoint " + std::to_string(key.first) + ", angle " + std::to_string(key.second) + ": " + e.what();
+			std::cerr << "[Dataset] " << error << std::endl;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Entry& e = cache[key];
+			e.queued = false;
+
+			if (error.empty())
+			{
+				evict(volume->data.size(), key);
+				memoryUsage += volume->data.size();
+				e.volume = volume;
+			}
+			else
+				e.error = error;
+		}
+		loaded.notify_all();
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+#include <boost/noncopyable.hpp>
+
+/// A time-lapse acquisition of timepoints x angles stack files
+/**	Loaded volumes are kept in an LRU cache under a memory budget. A background thread loads the
+	volumes that were requested or prefetched, so stepping through the timepoints only waits for the disk
+	if the prefetch fell behind.
+
+	The cache holds raw voxel data only and never touches OpenGL; copying a volume into a SpimStack (and
+	its texture) is left to the caller on the main thread.
+
+	Dataset files list one volume per line as "<timepoint> <angle> <filename>", lines starting with #
+	are comments. Relative filenames are relative to the dataset file.
+*/
+class TimeSeriesDataset : boost::noncopyable
+{
+public:
+	struct Volume
+	{
+		glm::ivec3					resolution;
+		unsigned int				bytesPerVoxel;
+		std::vector<unsigned char>	data;
+	};
+
+	TimeSeriesDataset(const std::string& filename, size_t memoryBudget);
+	~TimeSeriesDataset();
+
+	inline unsigned int getTimepointCount() const { return (unsigned int)files.size(); }
+	inline unsigned int getAngleCount() const { return angleCount; }
+	const std::string& getFilename(unsigned int timepoint, unsigned int angle) const;
+
+	/// the volume if it is in memory, null otherwise. A missing volume is queued for loading. Does not block
+	std::shared_ptr<const Volume> getVolume(unsigned int timepoint, unsigned int angle);
+	/// blocks until the volume is loaded. Throws if it could not be loaded
+	std::shared_ptr<const Volume> waitForVolume(unsigned int timepoint, unsigned int angle);
+
+	/// queues all angles of a timepoint for loading in the background
+	void prefetch(unsigned int timepoint);
+	/// true if all angles of the timepoint are in memory
+	bool isTimepointLoaded(unsigned int timepoint) const;
+
+	size_t getMemoryUsage() const;
+
+private:
+	typedef std::pair<unsigned int, unsigned int> Key;
+
+	struct Entry
+	{
+		std::shared_ptr<const Volume>	volume;
+		bool							queued;
+		std::string						error;
+		// last access, for the LRU order
+		uint64_t						lastUse;
+
+		inline Entry() : queued(false), lastUse(0) {}
+	};
+
+	// [timepoint][angle]
+	std::vector<std::vector<std::string> >	files;
+	unsigned int			angleCount;
+
+	size_t					memoryBudget, memoryUsage;
+	uint64_t				useCounter;
+
+	std::map<Key, Entry>	cache;
+	std::deque<Key>			queue;
+
+	mutable std::mutex		mutex;
+	std::condition_variable	loaded, requested;
+	std::thread				loader;
+	bool					quit;
+
+	void loadDatasetFile(const std::string& filename);
+	// queues the volume if it is neither loaded nor queued. Call with the mutex held
+	void request(const Key& key);
+	// frees least recently used volumes nobody else holds until size more bytes fit. Call with the mutex held
+	void evict(size_t size, const Key& keep);
+	void run();
+};
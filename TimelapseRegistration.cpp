@@ -0,0 +1,283 @@
+#include "TimelapseRegistration.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <cmath>
+
+#include <glm/gtx/transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+using namespace glm;
+
+// the search stops once the steps were halved this often
+static const unsigned int REFINEMENT_LEVELS = 6;
+// seeded searches start close to the optimum and only try the finest levels
+static const unsigned int SEEDED_LEVELS = 3;
+// seeded searches stop after a level that improved the score by less than this fraction
+static const double PLATEAU = 1e-3;
+// upper bound of accepted moves per refinement
+static const unsigned int MAX_MOVES = 100;
+
+TimelapseRegistration::TimelapseRegistration(TimeSeriesDataset* d, const std::vector<mat4>& initial, const std::vector<vec3>& vs) : dataset(d), voxelSize(vs), sampleCount(4096), driftCorrection(true), timepointsDone(0), timepointCount(0)
+{
+	if (initial.size() != dataset->getAngleCount() || voxelSize.size() != dataset->getAngleCount())
+		throw std::runtime_error("Timelapse registration needs a transform and voxel size for each of the " + std::to_string(dataset->getAngleCount()) + " angles!");
+
+	transforms.assign(dataset->getTimepointCount(), initial);
+	drift.assign(dataset->getTimepointCount(), mat4(1.f));
+	registered.assign(dataset->getTimepointCount(), false);
+
+	const float minVoxel = std::min(voxelSize[0].x, std::min(voxelSize[0].y, voxelSize[0].z));
+	translationStep = minVoxel * 4.f;
+	rotationStep = radians(1.f);
+}
+
+mat4 TimelapseRegistration::getTransform(unsigned int timepoint, unsigned int angle) const
+{
+	if (timepoint >= transforms.size() || angle >= dataset->getAngleCount())
+		throw std::runtime_error("Invalid timepoint " + std::to_string(timepoint) + ", angle " + std::to_string(angle) + "!");
+
+	return drift[timepoint] * transforms[timepoint][angle];
+}
+
+void TimelapseRegistration::merge(const TimelapseRegistration& other)
+{
+	if (other.dataset != dataset)
+		throw std::runtime_error("Timelapse registrations of different datasets cannot be merged!");
+
+	for (unsigned int t = 0; t < other.registered.size() && t < registered.size(); ++t)
+	{
+		if (!other.registered[t])
+			continue;
+
+		transforms[t] = other.transforms[t];
+		drift[t] = other.drift[t];
+		registered[t] = true;
+	}
+}
+
+void TimelapseRegistration::saveTransforms() const
+{
+	unsigned int count = 0;
+	for (unsigned int t = 0; t < transforms.size(); ++t)
+	{
+		if (!registered[t])
+			continue;
+
+		for (unsigned int a = 0; a < dataset->getAngleCount(); ++a)
+		{
+			const std::string filename = dataset->getFilename(t, a) + ".registration.txt";
+			std::ofstream file(filename);
+			if (!file.is_open())
+				throw std::runtime_error("Unable to save transform to \"" + filename + "\"!");
+
+			const mat4 m = getTransform(t, a);
+			const float* v = value_ptr(m);
+			for (int i = 0; i < 16; ++i)
+				file << v[i] << std::endl;
+
+			++count;
+		}
+	}
+
+	std::cout << "[Timelapse] Saved " << count << " transforms\n";
+}
+
+mat4 TimelapseRegistration::refine(const SampledMetric& metric, const SampledMetric::View& target, bool rotation, bool seeded, unsigned int& evaluations) const
+{
+	PROFILE_ZONE("Timelapse::refine");
+
+	// the smallest steps are the same either way
+	const unsigned int levels = seeded ? SEEDED_LEVELS : REFINEMENT_LEVELS;
+	const float scale = 1.f / (float)(1 << (REFINEMENT_LEVELS - levels));
+
+	// rotations are around the center of the target
+	const vec3 center(target.transform * vec4(vec3(target.resolution) * target.voxelSize * 0.5f, 1.f));
+
+	// tx, ty, tz, rx, ry, rz
+	const unsigned int dims = rotation ? 6 : 3;
+	float params[6] = { 0, 0, 0, 0, 0, 0 };
+	float steps[6] = { translationStep, translationStep, translationStep, rotationStep, rotationStep, rotationStep };
+	for (unsigned int d = 0; d < 6; ++d)
+		steps[d] *= scale;
+
+	auto createDelta = [&center](const float* p)
+	{
+		return translate(center + vec3(p[0], p[1], p[2])) * rotate(p[5], vec3(0, 0, 1)) * rotate(p[4], vec3(0, 1, 0)) * rotate(p[3], vec3(1, 0, 0)) * translate(-center);
+	};
+
+	double best = metric.score(target);
+	double levelStart = best;
+	evaluations = 1;
+
+	// the last accepted step, tried again before all others
+	int lastDim = -1;
+	float lastStep = 0.f;
+
+	unsigned int level = 0, moves = 0;
+	while (level < levels && moves < MAX_MOVES)
+	{
+		if (lastDim >= 0)
+		{
+			float candidate[6];
+			std::copy(params, params + 6, candidate);
+			candidate[lastDim] += lastStep;
+
+			const double score = metric.score(target, createDelta(candidate));
+			++evaluations;
+
+			if (score < best)
+			{
+				best = score;
+				params[lastDim] += lastStep;
+				++moves;
+				continue;
+			}
+		}
+
+		// the first single-parameter step that improves the score
+		int bestDim = -1;
+		float bestStep = 0.f;
+		for (unsigned int d = 0; d < dims; ++d)
+		{
+			for (int sign = -1; sign <= 1; sign += 2)
+			{
+				float candidate[6];
+				std::copy(params, params + 6, candidate);
+				candidate[d] += sign * steps[d];
+
+				const double score = metric.score(target, createDelta(candidate));
+				++evaluations;
+
+				if (score < best)
+				{
+					best = score;
+					bestDim = d;
+					bestStep = sign * steps[d];
+					break;
+				}
+			}
+
+			if (bestDim >= 0)
+				break;
+		}
+
+		lastDim = bestDim;
+		lastStep = bestStep;
+
+		if (bestDim >= 0)
+		{
+			params[bestDim] += bestStep;
+			++moves;
+		}
+		else
+		{
+			// finer steps of a seed that barely moved only chase the noise of the samples
+			if (seeded && levelStart - best <= PLATEAU * std::abs(levelStart))
+				break;
+
+			for (unsigned int d = 0; d < 6; ++d)
+				steps[d] *= 0.5f;
+			++level;
+			levelStart = best;
+		}
+	}
+
+	return createDelta(params);
+}
+
+void TimelapseRegistration::run(unsigned int first, unsigned int last)
+{
+	last = std::min(last, dataset->getTimepointCount());
+	const unsigned int angles = dataset->getAngleCount();
+
+	std::cout << "[Timelapse] Registering timepoints " << first << " to " << last - 1 << ", " << angles << " angles, " << sampleCount << " samples\n";
+
+	timepointsDone = 0;
+	timepointCount = last > first ? last - first : 0;
+
+	for (unsigned int i = 0; i < 2 && first + i < last; ++i)
+		dataset->prefetch(first + i);
+
+	// samples of the previous timepoint's reference, for the drift pass
+	SampledMetric previous;
+
+	for (unsigned int t = first; t < last && !TaskScheduler::isCancelled(); ++t)
+	{
+		PROFILE_ZONE("Timelapse::timepoint");
+		const auto start = std::chrono::steady_clock::now();
+
+		// seed from the previous timepoint
+		if (t > 0 && registered[t - 1])
+			transforms[t] = transforms[t - 1];
+
+		std::vector<std::shared_ptr<const TimeSeriesDataset::Volume> > volumes(angles);
+		{
+			PROFILE_ZONE("Timelapse::waitForVolumes");
+			for (unsigned int a = 0; a < angles; ++a)
+				volumes[a] = dataset->waitForVolume(t, a);
+		}
+
+		// the next timepoints load while this one is refined
+		for (unsigned int i = 1; i <= 2 && t + i < last; ++i)
+			dataset->prefetch(t + i);
+
+		std::vector<SampledMetric::View> targets(angles);
+		for (unsigned int a = 0; a < angles; ++a)
+		{
+			targets[a].data = &volumes[a]->data[0];
+			targets[a].resolution = volumes[a]->resolution;
+			targets[a].bytesPerVoxel = volumes[a]->bytesPerVoxel;
+			targets[a].transform = transforms[t][a];
+			targets[a].voxelSize = voxelSize[a];
+		}
+
+		SampledMetric metric;
+		metric.setReference(targets[0], sampleCount);
+
+		const bool seeded = t > 0 && registered[t - 1];
+
+		// tasks 0..angles-2 refine the angles 1..angles-1, the last one is the drift of the reference
+		const bool hasDrift = driftCorrection && seeded && previous.getSampleCount() > 0;
+
+		const int taskCount = (int)angles - 1 + (hasDrift ? 1 : 0);
+
+		std::vector<mat4> deltas(taskCount, mat4(1.f));
+		std::vector<unsigned int> evaluations(taskCount, 0);
+
+		TaskScheduler::parallelFor(0, taskCount, 1, [&](int first, int last)
+		{
+			for (int i = first; i < last; ++i)
+			{
+				if (i < (int)angles - 1)
+					deltas[i] = refine(metric, targets[i + 1], true, seeded, evaluations[i]);
+				else
+					deltas[i] = refine(previous, targets[0], false, true, evaluations[i]);
+			}
+		});
+
+		for (unsigned int a = 1; a < angles; ++a)
+			transforms[t][a] = deltas[a - 1] * transforms[t][a];
+
+		if (hasDrift)
+			drift[t] = drift[t - 1] * deltas.back();
+		else if (seeded)
+			drift[t] = drift[t - 1];
+
+		registered[t] = true;
+		previous = metric;
+		++timepointsDone;
+
+		unsigned int total = 0;
+		for (size_t i = 0; i < evaluations.size(); ++i)
+			total += evaluations[i];
+
+		const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "[Timelapse] Timepoint " << t << ": " << total << " evaluations, drift " << vec3(drift[t][3]).x << "," << vec3(drift[t][3]).y << "," << vec3(drift[t][3]).z << ", " << ms << "ms\n";
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <glm/glm.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "TimeSeriesDataset.h"
+#include "SampledMetric.h"
+
+/// Registration of all timepoints of a time series
+/**	Timepoint t+1 starts from the transforms found for timepoint t, so only a short local refinement is
+	needed instead of a registration from scratch. Angle 0 is the reference of every timepoint; all other
+	angles are refined against it by a pattern search over translation and rotation (around the angle's
+	center) that halves its steps whenever none of them improves the score. Seeded timepoints start at
+	1/8th of the steps and stop as soon as a step size no longer improves the score noticeably.
+
+	Candidates are scored by the normalized cross correlation of the reference and the moving angle (see
+	SampledMetric), so every candidate costs sampleCount trilinear samples, independent of the volume size.
+
+	The drift pass registers the reference of every timepoint to the one before it (translation only) and
+	moves all angles of the timepoint by the accumulated drift, so the specimen stays in place over the whole
+	series. The drift step of a timepoint only depends on the samples of the previous one and runs in
+	parallel with the angle refinements; the next timepoints are prefetched while the current one is refined.
+*/
+class TimelapseRegistration : boost::noncopyable
+{
+public:
+	/// initial[a] and voxelSize[a] are the transform and voxel size of angle a at the first timepoint
+	TimelapseRegistration(TimeSeriesDataset* dataset, const std::vector<glm::mat4>& initial, const std::vector<glm::vec3>& voxelSize);
+
+	/// number of reference samples the score is calculated from
+	inline void setSampleCount(unsigned int n) { sampleCount = n; }
+	/// initial steps of the refinement, in world units and radians. The smallest steps tried are 1/32th of them
+	inline void setSteps(float translation, float rotation) { translationStep = translation; rotationStep = rotation; }
+	inline void setDriftCorrection(bool d) { driftCorrection = d; }
+
+	/// registers the timepoints [first, last). Stops early if the calling task group is cancelled
+	void run(unsigned int first, unsigned int last);
+	inline void run() { run(0, dataset->getTimepointCount()); }
+	/// fraction of the timepoints of the current run() that are registered, may be polled from other threads
+	inline float getProgress() const { return timepointCount > 0 ? (float)timepointsDone / timepointCount : 0.f; }
+
+	inline bool isRegistered(unsigned int timepoint) const { return timepoint < registered.size() && registered[timepoint]; }
+	/// the final transform of an angle, including the drift correction
+	glm::mat4 getTransform(unsigned int timepoint, unsigned int angle) const;
+
+	/// takes over the timepoints registered by other, a run of the same dataset. Others are kept
+	void merge(const TimelapseRegistration& other);
+
+	/// saves the transform of every registered volume to "<file>.registration.txt"
+	void saveTransforms() const;
+
+private:
+	TimeSeriesDataset*		dataset;
+	std::vector<glm::vec3>	voxelSize;
+
+	unsigned int			sampleCount;
+	float					translationStep, rotationStep;
+	bool					driftCorrection;
+
+	// [timepoint][angle], relative to the reference of the timepoint
+	std::vector<std::vector<glm::mat4> >	transforms;
+	// accumulated drift of every timepoint
+	std::vector<glm::mat4>	drift;
+	std::vector<bool>		registered;
+
+	std::atomic<unsigned int>	timepointsDone, timepointCount;
+
+	// pattern search for the delta transform of target that best matches the metric's reference. Seeded
+	// searches start with smaller steps and stop once the score plateaus
+	glm::mat4 refine(const SampledMetric& metric, const SampledMetric::View& target, bool rotation, bool seeded, unsigned int& evaluations) const;
+};
@@ -0,0 +1,135 @@
+#include "TransformedView.h"
+#include "SpimStack.h"
+
+#include <iostream>
+#include <stdexcept>
+
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+
+TransformedView::TransformedView(const SpimStack* s) : stack(s), delta(1.f), followStack(true), frame(1.f), voxelSize(1.f), resolution(0)
+{
+	if (!stack)
+		throw std::runtime_error("Transformed view without a stack!");
+}
+
+mat4 TransformedView::getTransform() const
+{
+	return delta * stack->getTransform();
+}
+
+void TransformedView::setGrid(const mat4& f, const vec3& vs, const ivec3& res)
+{
+	followStack = false;
+	frame = f;
+	voxelSize = vs;
+	resolution = res;
+}
+
+void TransformedView::resetGrid()
+{
+	followStack = true;
+}
+
+mat4 TransformedView::getGridTransform() const
+{
+	return followStack ? getTransform() : frame;
+}
+
+vec3 TransformedView::getGridVoxelSize() const
+{
+	return followStack ? stack->getVoxelDimensions() : voxelSize;
+}
+
+ivec3 TransformedView::getGridResolution() const
+{
+	return followStack ? stack->getResolution() : resolution;
+}
+
+bool TransformedView::isAligned() const
+{
+	if (followStack)
+		return true;
+
+	return frame == getTransform() && voxelSize == stack->getVoxelDimensions() && resolution == stack->getResolution();
+}
+
+AABB TransformedView::getTransformedBBox() const
+{
+	AABB local;
+	local.min = vec3(0.f);
+	local.max = vec3(getGridResolution()) * getGridVoxelSize();
+
+	const mat4 t = getGridTransform();
+	const std::vector<vec3> verts = local.getVertices();
+
+	AABB bbox;
+	bbox.reset();
+	for (size_t i = 0; i < verts.size(); ++i)
+		bbox.extend(vec3(t * vec4(verts[i], 1.f)));
+
+	return bbox;
+}
+
+mat4 TransformedView::getSourceFrame(const mat4& gridFrame) const
+{
+	// stack->getTransform() * inverse(getTransform()) * gridFrame, without the round trip through the stack's transform
+	return inverse(delta) * gridFrame;
+}
+
+const std::vector<float>& TransformedView::getCoefficients(Resampling::Interpolation mode) const
+{
+	if (mode == Resampling::TRICUBIC && coefficients.empty())
+		stack->calculateResliceCoefficients(mode, coefficients);
+	return coefficients;
+}
+
+float TransformedView::getSample(const vec3& worldCoords, Resampling::Interpolation mode) const
+{
+	const vec4 p = inverse(delta) * vec4(worldCoords, 1.f);
+	return stack->getInterpolatedSample(vec3(p), mode);
+}
+
+void TransformedView::resampleRegion(const ivec3& rmin, const ivec3& rmax, Resampling::Interpolation mode, void* data) const
+{
+	// voxel centers of an aligned grid hit the stack's voxel centers, nearest neighbour copies them exactly
+	if (isAligned())
+		mode = Resampling::NEAREST;
+
+	const vec3 vs = getGridVoxelSize();
+	const mat4 regionFrame = getSourceFrame(getGridTransform() * translate(vec3(rmin) * vs));
+	const ivec3 size = rmax - rmin;
+
+	stack->reslicePlanes(regionFrame, vs, size, mode, getCoefficients(mode), 0, size.z, data);
+}
+
+SpimStack* TransformedView::materialize(Resampling::Interpolation mode) const
+{
+	const ivec3 res = getGridResolution();
+	std::cout << "[View] Resampling " << stack->getFilename() << " to " << res.x << "x" << res.y << "x" << res.z << (isAligned() ? " (aligned)" : "") << " ... ";
+
+	SpimStack* result = nullptr;
+	if (stack->getBytesPerVoxel() == 2)
+		result = new SpimStackU16;
+	else
+		result = new SpimStackU8;
+
+	result->setContent(res, nullptr);
+	result->setVoxelDimensions(getGridVoxelSize());
+	result->setTransform(getGridTransform());
+
+	resampleRegion(ivec3(0), res, mode, result->getData());
+	result->update();
+
+	std::cout << "done.\n";
+	return result;
+}
+
+void TransformedView::save(const std::string& filename, Resampling::Interpolation mode) const
+{
+	if (isAligned())
+		mode = Resampling::NEAREST;
+
+	stack->saveResliced(getSourceFrame(getGridTransform()), getGridVoxelSize(), getGridResolution(), mode, filename);
+}
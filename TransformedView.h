@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+#include "Resampling.h"
+
+class SpimStack;
+
+/// Lazy, transformed view of a stack
+/**	Wraps a stack and an accumulated affine transform. Transforms are composed symbolically and the stack is
+	only resampled when voxels are requested, so a chain of operations resamples once instead of once per
+	operation.
+
+	The view's world transform is delta * stack->getTransform(): moving the stack itself also moves the view.
+	Voxels are requested on an output grid, by default the stack's own grid carried along by the view's
+	transform. On that grid no interpolation is needed and the voxels are copied directly.
+*/
+class TransformedView
+{
+public:
+	explicit TransformedView(const SpimStack* stack);
+
+	/// composes t with the accumulated transform, like InteractionVolume::applyTransform. Nothing is resampled
+	inline void applyTransform(const glm::mat4& t) { delta = t * delta; }
+	/// the transform from stack coordinates to world space
+	glm::mat4 getTransform() const;
+	/// the transform accumulated on top of the stack's own transform
+	inline const glm::mat4& getDelta() const { return delta; }
+
+	/// sets the output grid: voxel (x,y,z) has its center at frame * ((x,y,z) + 0.5)*voxelSize
+	void setGrid(const glm::mat4& frame, const glm::vec3& voxelSize, const glm::ivec3& resolution);
+	/// uses the stack's own grid, moved with the view's transform
+	void resetGrid();
+
+	glm::mat4 getGridTransform() const;
+	glm::vec3 getGridVoxelSize() const;
+	glm::ivec3 getGridResolution() const;
+
+	/// true if the output grid coincides with the stack's voxels and requests are plain copies
+	bool isAligned() const;
+
+	inline const SpimStack* getStack() const { return stack; }
+	AABB getTransformedBBox() const;
+
+	/// interpolated sample at a world position, 0 outside the stack
+	float getSample(const glm::vec3& worldCoords, Resampling::Interpolation mode = Resampling::TRILINEAR) const;
+
+	/// resamples the region [min, max) of the output grid into data, in the stack's voxel format
+	void resampleRegion(const glm::ivec3& min, const glm::ivec3& max, Resampling::Interpolation mode, void* data) const;
+	/// resamples the whole output grid into a new stack with the grid's transform
+	SpimStack* materialize(Resampling::Interpolation mode = Resampling::TRILINEAR) const;
+	/// streams the whole output grid into a raw binary file
+	void save(const std::string& filename, Resampling::Interpolation mode = Resampling::TRILINEAR) const;
+
+private:
+	const SpimStack*		stack;
+	glm::mat4				delta;
+
+	// explicit output grid, unless it follows the view
+	bool					followStack;
+	glm::mat4				frame;
+	glm::vec3				voxelSize;
+	glm::ivec3				resolution;
+
+	// B-spline coefficients, calculated on the first tricubic request
+	mutable std::vector<float>	coefficients;
+
+	// the grid frame as seen from the stack's untransformed position
+	glm::mat4 getSourceFrame(const glm::mat4& gridFrame) const;
+	const std::vector<float>& getCoefficients(Resampling::Interpolation mode) const;
+};
@@ -0,0 +1,257 @@
+#include "VolumeAtlas.h"
+#include "SpimStack.h"
+#include "MacroCellGrid.h"
+#include "AABB.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <numeric>
+#include <iostream>
+#include <stdexcept>
+
+#include <glm/gtx/io.hpp>
+
+#ifndef NO_GRAPHICS
+#include <GL/glew.h>
+#endif
+
+using namespace glm;
+
+static_assert(sizeof(VolumeAtlas::VolumeBlock) == 128, "VolumeBlock has to match the std140 layout of the shaders' Volume struct");
+
+static inline ivec3 alignToCells(const ivec3& v)
+{
+	return (v + ivec3(MacroCellGrid::CELL_SIZE - 1)) / MacroCellGrid::CELL_SIZE * MacroCellGrid::CELL_SIZE;
+}
+
+unsigned int VolumeAtlas::getCapacity(size_t volumeCount)
+{
+	if (volumeCount > MAX_VOLUMES)
+		throw std::runtime_error("Too many volumes for the volume shaders!");
+
+	unsigned int capacity = 2;
+	while (capacity < volumeCount)
+		capacity *= 2;
+
+	return capacity;
+}
+
+bool VolumeAtlas::computeLayout(const std::vector<ivec3>& resolutions, int maxSize, std::vector<Slot>& slots, ivec3& size)
+{
+	slots.resize(resolutions.size());
+	size = ivec3(0);
+
+	// the deepest volumes open the layers, the tallest of equal depth open the rows
+	std::vector<size_t> order(resolutions.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+	{
+		return resolutions[a].z != resolutions[b].z ? resolutions[a].z > resolutions[b].z : resolutions[a].y > resolutions[b].y;
+	});
+
+	ivec3 cursor(0);
+	int rowHeight = 0, layerDepth = 0;
+
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		const ivec3& res = resolutions[order[i]];
+		if (any(greaterThan(res, ivec3(maxSize))))
+			return false;
+
+		if (cursor.x > 0 && cursor.x + res.x > maxSize)
+		{
+			cursor.x = 0;
+			cursor.y += rowHeight;
+			rowHeight = 0;
+		}
+
+		if (cursor.y > 0 && cursor.y + res.y > maxSize)
+		{
+			cursor.x = 0;
+			cursor.y = 0;
+			cursor.z += layerDepth;
+			rowHeight = 0;
+			layerDepth = 0;
+		}
+
+		if (cursor.z + res.z > maxSize)
+			return false;
+
+		Slot& s = slots[order[i]];
+		s.offset = cursor;
+		s.resolution = res;
+		size = max(size, cursor + res);
+
+		const ivec3 aligned = alignToCells(res);
+		cursor.x += aligned.x;
+		rowHeight = std::max(rowHeight, aligned.y);
+		layerDepth = std::max(layerDepth, aligned.z);
+	}
+
+	return true;
+}
+
+VolumeAtlas::VolumeBlock VolumeAtlas::getVolumeBlock(const SpimStack* stack, const Slot& slot)
+{
+	const AABB bbox = stack->getBBox();
+
+	VolumeBlock b;
+	b.inverseTransform = stack->getInverseTransform();
+	b.bboxMin = vec4(bbox.min, stack->enabled ? 1.f : 0.f);
+	b.bboxMax = vec4(bbox.max, 0.f);
+	b.offset = ivec4(slot.offset, 0);
+	b.resolution = ivec4(slot.resolution, 0);
+	return b;
+}
+
+VolumeAtlas::VolumeAtlas() : texture(0), cellTexture(0), volumeBuffer(0), bytesPerVoxel(0), size(0)
+{
+}
+
+VolumeAtlas::~VolumeAtlas()
+{
+#ifndef NO_GRAPHICS
+	if (texture)
+		glDeleteTextures(1, &texture);
+	if (cellTexture)
+		glDeleteTextures(1, &cellTexture);
+	if (volumeBuffer)
+		glDeleteBuffers(1, &volumeBuffer);
+#endif
+}
+
+size_t VolumeAtlas::getBytes() const
+{
+	const ivec3 cellSize = (size + ivec3(MacroCellGrid::CELL_SIZE - 1)) / MacroCellGrid::CELL_SIZE;
+	return (size_t)size.x * size.y * size.z * bytesPerVoxel + (size_t)cellSize.x * cellSize.y * cellSize.z * 2 * sizeof(unsigned short);
+}
+
+int VolumeAtlas::getMaxSize()
+{
+	int maxSize = 256;
+#ifndef NO_GRAPHICS
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+#endif
+	return maxSize;
+}
+
+void VolumeAtlas::update(const std::vector<SpimStack*>& stacks)
+{
+#ifndef NO_GRAPHICS
+	PROFILE_ZONE("VolumeAtlas::update");
+
+	std::vector<ivec3> resolutions(stacks.size());
+	unsigned int bpv = 1;
+	for (size_t i = 0; i < stacks.size(); ++i)
+	{
+		// no voxels yet
+		if (stacks[i]->getVoxelCount() == 0)
+		{
+			sources.clear();
+			return;
+		}
+
+		resolutions[i] = stacks[i]->getLevelResolution();
+		bpv = std::max(bpv, (unsigned int)stacks[i]->getBytesPerVoxel());
+	}
+
+	bool relayout = bpv != bytesPerVoxel || resolutions.size() != slots.size();
+	for (size_t i = 0; i < slots.size() && !relayout; ++i)
+		relayout = slots[i].resolution != resolutions[i];
+
+	if (relayout)
+	{
+		sources.clear();
+
+		ivec3 newSize;
+		if (!computeLayout(resolutions, getMaxSize(), slots, newSize))
+		{
+			// TextureResidency coarsens the stacks until they fit
+			slots.clear();
+			return;
+		}
+
+		allocate(newSize, bpv);
+		std::cout << "[Atlas] Packed " << stacks.size() << " volumes into " << size << ", " << getBytes() / (1024 * 1024) << "MB" << std::endl;
+	}
+
+	// stacks may have been replaced or reordered without changing the layout, their slots need all voxels
+	sources.resize(stacks.size());
+	cells.resize(stacks.size());
+
+	std::vector<char> changed(stacks.size());
+	glBindTexture(GL_TEXTURE_3D, texture);
+	for (size_t i = 0; i < stacks.size(); ++i)
+	{
+		changed[i] = stacks[i]->uploadTexture(bytesPerVoxel, slots[i].offset, sources[i] != stacks[i]);
+		sources[i] = stacks[i];
+	}
+
+	for (size_t i = 0; i < stacks.size(); ++i)
+		if (changed[i])
+			cells[i] = copyCells(stacks[i], slots[i]);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	// transforms change with every interaction, the blocks are too small to track
+	std::vector<VolumeBlock> blocks(stacks.size());
+	for (size_t i = 0; i < stacks.size(); ++i)
+		blocks[i] = getVolumeBlock(stacks[i], slots[i]);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, volumeBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, blocks.size() * sizeof(VolumeBlock), blocks.empty() ? nullptr : &blocks[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
+}
+
+void VolumeAtlas::allocate(const ivec3& newSize, unsigned int bpv)
+{
+#ifndef NO_GRAPHICS
+	if (!texture)
+	{
+		glGenTextures(1, &texture);
+		glGenTextures(1, &cellTexture);
+		glGenBuffers(1, &volumeBuffer);
+
+		const unsigned int ids[] = { texture, cellTexture };
+		for (int i = 0; i < 2; ++i)
+		{
+			glBindTexture(GL_TEXTURE_3D, ids[i]);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+	}
+
+	size = newSize;
+	bytesPerVoxel = bpv;
+
+	// the stacks upload into their slots before anything samples them
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glTexImage3D(GL_TEXTURE_3D, 0, bpv == 2 ? GL_R16UI : GL_R8UI, size.x, size.y, size.z, 0, GL_RED_INTEGER, bpv == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, nullptr);
+
+	const ivec3 cellSize = (size + ivec3(MacroCellGrid::CELL_SIZE - 1)) / MacroCellGrid::CELL_SIZE;
+	glBindTexture(GL_TEXTURE_3D, cellTexture);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RG16UI, cellSize.x, cellSize.y, cellSize.z, 0, GL_RG_INTEGER, GL_UNSIGNED_SHORT, nullptr);
+
+	glBindTexture(GL_TEXTURE_3D, 0);
+#endif
+}
+
+bool VolumeAtlas::copyCells(const SpimStack* stack, const Slot& slot)
+{
+	const MacroCellGrid& grid = stack->getCellGrid();
+	if (grid.isEmpty() || grid.getVolumeResolution() != slot.resolution)
+		return false;
+
+#ifndef NO_GRAPHICS
+	// as cheap to replace as the stack's own grid texture
+	const ivec3 offset = slot.offset / MacroCellGrid::CELL_SIZE;
+	const ivec3 res = grid.getResolution();
+	glBindTexture(GL_TEXTURE_3D, cellTexture);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, offset.x, offset.y, offset.z, res.x, res.y, res.z, GL_RG_INTEGER, GL_UNSIGNED_SHORT, &grid.getCells()[0]);
+#endif
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <boost/utility.hpp>
+
+class SpimStack;
+
+/// The textures of all stacks packed into one 3D texture, for shaders that work with any number of volumes
+/**	Instead of a sampler per volume in an array sized at compile time, the volume shaders fetch voxels from
+	the atlas at each volume's offset and read its transform and bounding box from a uniform buffer of
+	VolumeBlocks, looping over a uniform volume count. They are compiled for getCapacity() volumes, which only
+	changes at powers of two, and cached per capacity by the app.
+
+	Slots are aligned to MacroCellGrid::CELL_SIZE so the cell grids share the layout in a second atlas at a
+	1/CELL_SIZE of the resolution. The layout and the blocks need no GL. The stacks keep no texture of their
+	own, update() has them upload their changed voxels straight into their slots.
+*/
+class VolumeAtlas : boost::noncopyable
+{
+public:
+	/// 16KB, the smallest uniform block GL guarantees, of 128 byte VolumeBlocks
+	static const unsigned int MAX_VOLUMES = 128;
+
+	/// where a volume lies in the atlas
+	struct Slot
+	{
+		glm::ivec3		offset;
+		glm::ivec3		resolution;
+	};
+
+	/// std140 layout of the Volume struct in the shaders' Volumes block
+	struct VolumeBlock
+	{
+		glm::mat4		inverseTransform;
+		// local bounding box, w is 1 for enabled volumes
+		glm::vec4		bboxMin, bboxMax;
+		// voxels of the volume in the atlas
+		glm::ivec4		offset, resolution;
+	};
+
+	/// volumes the shaders are compiled for, the count rounded up to a power of two but at least 2
+	static unsigned int getCapacity(size_t volumeCount);
+
+	/// places the volumes in rows along x, rows in layers along y and layers along z, deepest volumes first
+	/**	Returns false if the atlas would exceed maxSize along any axis. size receives the extent of all slots.
+	*/
+	static bool computeLayout(const std::vector<glm::ivec3>& resolutions, int maxSize, std::vector<Slot>& slots, glm::ivec3& size);
+
+	static VolumeBlock getVolumeBlock(const SpimStack* stack, const Slot& slot);
+
+	VolumeAtlas();
+	~VolumeAtlas();
+
+	/// largest 3D texture GL supports along any axis
+	static int getMaxSize();
+
+	/// uploads the voxels of the stacks changed since the last call and refreshes all blocks. GL thread only
+	void update(const std::vector<SpimStack*>& stacks);
+
+	/// R8UI, or R16UI if any stack has 16 bit voxels
+	inline unsigned int getTexture() const { return texture; }
+	/// RG16UI cells of all volumes, 0 if any volume has no cell grid
+	inline unsigned int getCellTexture() const { return std::find(cells.begin(), cells.end(), 0) == cells.end() ? cellTexture : 0; }
+	/// uniform buffer of getVolumeCount() VolumeBlocks
+	inline unsigned int getVolumeBuffer() const { return volumeBuffer; }
+	/// volumes in the atlas, 0 until all stacks have textures that fit
+	inline size_t getVolumeCount() const { return sources.size(); }
+	inline const glm::ivec3& getSize() const { return size; }
+	inline const std::vector<Slot>& getSlots() const { return slots; }
+
+	/// GPU memory of both atlases
+	size_t getBytes() const;
+
+private:
+	unsigned int				texture, cellTexture, volumeBuffer;
+	unsigned int				bytesPerVoxel;
+
+	glm::ivec3					size;
+	std::vector<Slot>			slots;
+
+	// the stacks in the atlas
+	std::vector<const SpimStack*>	sources;
+	// whether the slot's cells were copied
+	std::vector<char>			cells;
+
+	void allocate(const glm::ivec3& size, unsigned int bytesPerVoxel);
+	bool copyCells(const SpimStack* stack, const Slot& slot);
+};
@@ -0,0 +1,147 @@
+#include "VolumeBVH.h"
+#include "InteractionVolume.h"
+#include "Ray.h"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace glm;
+
+void VolumeBVH::update(const std::vector<InteractionVolume*>& vols)
+{
+	bool rebuild = vols.size() != volumes.size();
+	for (size_t i = 0; i < vols.size() && !rebuild; ++i)
+		rebuild = vols[i] != volumes[i];
+
+	if (rebuild)
+	{
+		volumes.assign(vols.begin(), vols.end());
+		boxes.resize(vols.size());
+
+		for (size_t i = 0; i < vols.size(); ++i)
+			boxes[i] = vols[i]->getTransformedBBox();
+
+		nodes.clear();
+		if (vols.empty())
+			return;
+
+		std::vector<unsigned int> indices(vols.size());
+		for (size_t i = 0; i < indices.size(); ++i)
+			indices[i] = (unsigned int)i;
+
+		nodes.reserve(vols.size() * 2);
+		build(&indices[0], indices.size());
+		return;
+	}
+
+	// only refit if one of the volumes was moved or resized, e.g. by subsampling or a new voxel size
+	bool changed = false;
+	for (size_t i = 0; i < volumes.size(); ++i)
+	{
+		const AABB box = volumes[i]->getTransformedBBox();
+		if (box.min != boxes[i].min || box.max != boxes[i].max)
+		{
+			boxes[i] = box;
+			changed = true;
+		}
+	}
+
+	if (changed && !nodes.empty())
+		refit(0);
+}
+
+int VolumeBVH::build(unsigned int* indices, size_t count)
+{
+	const int n = (int)nodes.size();
+	nodes.push_back(Node());
+
+	if (count == 1)
+	{
+		nodes[n].bbox = boxes[indices[0]];
+		nodes[n].left = indices[0];
+		nodes[n].right = -1;
+		return n;
+	}
+
+	// median split along the longest axis of the centroids
+	AABB centroids;
+	centroids.reset(boxes[indices[0]].getCentroid());
+	for (size_t i = 1; i < count; ++i)
+		centroids.extend(boxes[indices[i]].getCentroid());
+
+	const vec3 span = centroids.getSpan();
+	int axis = 0;
+	if (span.y > span[axis])
+		axis = 1;
+	if (span.z > span[axis])
+		axis = 2;
+
+	const size_t half = count / 2;
+	std::nth_element(indices, indices + half, indices + count, [&](unsigned int a, unsigned int b)
+	{
+		return boxes[a].getCentroid()[axis] < boxes[b].getCentroid()[axis];
+	});
+
+	const int left = build(indices, half);
+	const int right = build(indices + half, count - half);
+
+	nodes[n].left = left;
+	nodes[n].right = right;
+	nodes[n].bbox = nodes[left].bbox;
+	nodes[n].bbox.extend(nodes[right].bbox);
+	return n;
+}
+
+void VolumeBVH::refit(int n)
+{
+	Node& node = nodes[n];
+	if (node.right == -1)
+	{
+		node.bbox = boxes[node.left];
+		return;
+	}
+
+	refit(node.left);
+	refit(node.right);
+
+	node.bbox = nodes[node.left].bbox;
+	node.bbox.extend(nodes[node.right].bbox);
+}
+
+void VolumeBVH::intersect(const Ray& ray, std::vector<Hit>& hits) const
+{
+	hits.clear();
+	if (nodes.empty())
+		return;
+
+	std::vector<int> stack;
+	stack.push_back(0);
+
+	while (!stack.empty())
+	{
+		const Node& node = nodes[stack.back()];
+		stack.pop_back();
+
+		float entry;
+		if (!node.bbox.isIntersectedByRay(ray.origin, ray.direction, entry))
+			continue;
+
+		if (node.right == -1)
+		{
+			if (volumes[node.left]->enabled)
+			{
+				Hit h;
+				h.volume = node.left;
+				h.entry = entry;
+				hits.push_back(h);
+			}
+		}
+		else
+		{
+			stack.push_back(node.left);
+			stack.push_back(node.right);
+		}
+	}
+
+	std::sort(hits.begin(), hits.end());
+}
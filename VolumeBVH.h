@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "AABB.h"
+
+class InteractionVolume;
+struct Ray;
+
+/// Bounding volume hierarchy over the transformed bounding boxes of all interaction volumes
+/**	The hierarchy is cached. update() only refits the boxes if the transformed boxes of volumes changed and rebuilds the tree
+	if volumes were added or removed.
+*/
+class VolumeBVH
+{
+public:
+	struct Hit
+	{
+		// index into the volume list
+		unsigned int		volume;
+		// ray parameter where the ray enters the volume's box
+		float				entry;
+
+		inline bool operator < (const Hit& h) const { return entry < h.entry; }
+	};
+
+	/// refits or rebuilds the hierarchy if necessary
+	void update(const std::vector<InteractionVolume*>& volumes);
+
+	/// returns all enabled volumes hit by the ray, sorted front-to-back
+	void intersect(const Ray& ray, std::vector<Hit>& hits) const;
+
+	inline bool empty() const { return nodes.empty(); }
+
+private:
+	struct Node
+	{
+		AABB			bbox;
+		// inner nodes: two children; leaves: a single volume index in left and right = -1
+		int				left, right;
+	};
+
+	std::vector<Node>					nodes;
+
+	// per-volume state the tree was built from
+	std::vector<const InteractionVolume*>	volumes;
+	std::vector<AABB>					boxes;
+
+	int build(unsigned int* indices, size_t count);
+	void refit(int node);
+};
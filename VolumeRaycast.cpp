@@ -0,0 +1,242 @@
+#include "VolumeRaycast.h"
+#include "MacroCellGrid.h"
+#include "SpimStack.h"
+#include "AABB.h"
+#include "TaskScheduler.h"
+#include "Profiler.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+
+using namespace glm;
+
+namespace VolumeRaycast
+{
+	static const float NEVER = std::numeric_limits<float>::max();
+
+	static inline bool isInside(const vec3& p, const Volume& v)
+	{
+		return all(greaterThan(p, v.bboxMin)) && all(lessThan(p, v.bboxMax));
+	}
+
+	// distance in steps until p leaves the box [min, max) it is in
+	static float getExitDistance(const vec3& p, const vec3& step, const vec3& min, const vec3& max)
+	{
+		float t = NEVER;
+		for (int a = 0; a < 3; ++a)
+			if (step[a] > 0.f)
+				t = std::min(t, (max[a] - p[a]) / step[a]);
+			else if (step[a] < 0.f)
+				t = std::min(t, (min[a] - p[a]) / step[a]);
+
+		return t;
+	}
+
+	// distance in steps until p enters the box, NEVER if the ray misses it
+	static float getEntryDistance(const vec3& p, const vec3& step, const vec3& min, const vec3& max)
+	{
+		float tNear = 0.f, tFar = NEVER;
+		for (int a = 0; a < 3; ++a)
+		{
+			if (step[a] == 0.f)
+			{
+				if (p[a] <= min[a] || p[a] >= max[a])
+					return NEVER;
+				continue;
+			}
+
+			float t0 = (min[a] - p[a]) / step[a];
+			float t1 = (max[a] - p[a]) / step[a];
+			if (t0 > t1)
+				std::swap(t0, t1);
+
+			tNear = std::max(tNear, t0);
+			tFar = std::min(tFar, t1);
+		}
+
+		return tNear < tFar ? tNear : NEVER;
+	}
+
+	// whole steps that can be skipped before the distance t is reached, at least one
+	static inline unsigned int getSkip(float t)
+	{
+		return t >= (float)std::numeric_limits<unsigned int>::max() ? std::numeric_limits<unsigned int>::max() : std::max(1u, (unsigned int)t);
+	}
+
+	// the tiles of render(), small enough to balance the threads and keep neighbouring rays on one core
+	static const int TILE_SIZE = 16;
+
+	Volume::Volume(const SpimStack* stack, const MacroCellGrid* grid) : data(stack->getData()), bytesPerVoxel((unsigned int)stack->getBytesPerVoxel()), resolution(stack->getResolution()),
+		inverseTransform(stack->getInverseTransform()), bboxMin(stack->getBBox().min), bboxMax(stack->getBBox().max), grid(grid)
+	{
+	}
+
+	float sample(const Volume& volume, const vec3& coords)
+	{
+		const ivec3 voxel = clamp(ivec3(coords * vec3(volume.resolution)), ivec3(0), volume.resolution - ivec3(1));
+		const size_t index = voxel.x + (size_t)voxel.y * volume.resolution.x + (size_t)voxel.z * volume.resolution.x * volume.resolution.y;
+
+		if (volume.bytesPerVoxel == 2)
+			return (float)reinterpret_cast<const unsigned short*>(volume.data)[index];
+		else
+			return (float)reinterpret_cast<const unsigned char*>(volume.data)[index];
+	}
+
+	bool marchRay(const std::vector<Volume>& volumes, const vec3& origin, const vec3& destination, const Parameters& params, bool skipEmpty, float* maxValues, Stats& stats)
+	{
+		const float maxDistance = length(destination - origin);
+		const vec3 step = (destination - origin) / maxDistance * params.stepLength;
+		const unsigned int stepCount = std::min(params.maxSteps, (unsigned int)std::ceil(maxDistance / params.stepLength));
+
+		std::fill(maxValues, maxValues + volumes.size(), 0.f);
+		bool hit = false;
+
+		for (unsigned int k = 0; k < stepCount; )
+		{
+			const vec3 position = origin + step * (float)k;
+			unsigned int skip = skipEmpty ? std::numeric_limits<unsigned int>::max() : 1;
+			++stats.steps;
+
+			for (size_t i = 0; i < volumes.size(); ++i)
+			{
+				const Volume& v = volumes[i];
+				const vec3 local = vec3(v.inverseTransform * vec4(position, 1.f));
+
+				if (!isInside(local, v))
+				{
+					if (skipEmpty)
+						skip = std::min(skip, getSkip(getEntryDistance(local, vec3(v.inverseTransform * vec4(step, 0.f)), v.bboxMin, v.bboxMax)));
+					continue;
+				}
+
+				hit = true;
+				const vec3 coords = (local - v.bboxMin) / (v.bboxMax - v.bboxMin);
+
+				if (skipEmpty && v.grid)
+				{
+					const ivec3 cell = v.grid->getCell(clamp(ivec3(coords * vec3(v.resolution)), ivec3(0), v.resolution - ivec3(1)));
+					if (v.grid->isEmpty(cell, params.minThreshold))
+					{
+						// the cell in local coordinates, its samples stay below the threshold
+						const vec3 size = (v.bboxMax - v.bboxMin) / vec3(v.resolution);
+						const vec3 cellMin = v.bboxMin + vec3(cell * MacroCellGrid::CELL_SIZE) * size;
+						const vec3 cellMax = v.bboxMin + vec3(min((cell + ivec3(1)) * MacroCellGrid::CELL_SIZE, v.resolution)) * size;
+
+						skip = std::min(skip, getSkip(getExitDistance(local, vec3(v.inverseTransform * vec4(step, 0.f)), cellMin, cellMax)));
+						continue;
+					}
+				}
+
+				maxValues[i] = std::max(maxValues[i], sample(v, coords));
+				++stats.samples;
+				skip = 1;
+			}
+
+			// nothing ahead of the ray anymore
+			if (skip >= stepCount - k)
+			{
+				stats.skippedSteps += stepCount - k - 1;
+				break;
+			}
+
+			stats.skippedSteps += skip - 1;
+			k += skip;
+		}
+
+		return hit;
+	}
+
+	vec3 getColor(size_t volume)
+	{
+		static const vec3 COLORS[] = { vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1), vec3(1, 1, 0), vec3(0, 1, 1), vec3(1, 0, 1), vec3(1, 1, 1) };
+		return COLORS[std::min(volume, (size_t)6)];
+	}
+
+	vec4 shade(const float* maxValues, size_t volumeCount, const Parameters& params)
+	{
+		vec3 color(0.f);
+		for (size_t i = 0; i < volumeCount; ++i)
+			color += getColor(i) * std::max(0.f, (maxValues[i] - params.minThreshold) / (params.maxThreshold - params.minThreshold));
+
+		return vec4(color, 1.f);
+	}
+
+	Stats render(const std::vector<Volume>& volumes, const mat4& mvp, const AABB& bbox, const Parameters& params, bool skipEmpty, const ivec2& size, std::vector<vec4>& image)
+	{
+		PROFILE_ZONE("VolumeRaycast::render");
+
+		image.assign((size_t)size.x * size.y, vec4(0.f));
+		const mat4 inverseMVP = inverse(mvp);
+		const ivec2 tiles = (size + ivec2(TILE_SIZE - 1)) / TILE_SIZE;
+
+		return TaskScheduler::parallelReduce(0, tiles.x * tiles.y, 1, Stats(), [&](int first, int last, Stats stats)
+		{
+			std::vector<float> maxValues(volumes.size());
+
+			for (int t = first; t < last; ++t)
+			{
+				const ivec2 tile(t % tiles.x, t / tiles.x);
+				const ivec2 end = min((tile + ivec2(1)) * TILE_SIZE, size);
+
+				for (int y = tile.y * TILE_SIZE; y < end.y; ++y)
+					for (int x = tile.x * TILE_SIZE; x < end.x; ++x)
+					{
+						// the pixel's segment between the near and far plane
+						const vec2 ndc = (vec2(x, y) + vec2(0.5f)) / vec2(size) * 2.f - vec2(1.f);
+						const vec4 nearPlane = inverseMVP * vec4(ndc, -1.f, 1.f);
+						const vec4 farPlane = inverseMVP * vec4(ndc, 1.f, 1.f);
+						const vec3 nearPoint = vec3(nearPlane) / nearPlane.w;
+						const vec3 segment = vec3(farPlane) / farPlane.w - nearPoint;
+
+						// the ray starts at the back face of the bounding box, which has to lie between the planes
+						float tEntry = -std::numeric_limits<float>::max(), tExit = std::numeric_limits<float>::max();
+						for (int a = 0; a < 3; ++a)
+						{
+							if (segment[a] == 0.f)
+							{
+								if (nearPoint[a] < bbox.min[a] || nearPoint[a] > bbox.max[a])
+									tExit = -1.f;
+								continue;
+							}
+
+							float t0 = (bbox.min[a] - nearPoint[a]) / segment[a];
+							float t1 = (bbox.max[a] - nearPoint[a]) / segment[a];
+							if (t0 > t1)
+								std::swap(t0, t1);
+
+							tEntry = std::max(tEntry, t0);
+							tExit = std::min(tExit, t1);
+						}
+
+						if (tExit < tEntry || tExit < 0.f || tExit > 1.f)
+							continue;
+
+						const vec3 origin = nearPoint + segment * tExit;
+						if (marchRay(volumes, origin, nearPoint, params, skipEmpty, &maxValues[0], stats))
+							image[x + (size_t)y * size.x] = shade(&maxValues[0], volumes.size(), params);
+					}
+			}
+
+			return stats;
+		}, [](Stats a, const Stats& b) { return a += b; });
+	}
+
+	void saveImage(const std::vector<vec4>& image, const ivec2& size, const std::string& filename)
+	{
+		// PNG rows go top to bottom
+		std::vector<unsigned char> pixels(image.size() * 4);
+		for (int y = 0; y < size.y; ++y)
+			for (int x = 0; x < size.x; ++x)
+			{
+				const vec4 c = clamp(image[x + (size_t)(size.y - 1 - y) * size.x], vec4(0.f), vec4(1.f));
+				for (int i = 0; i < 4; ++i)
+					pixels[(x + (size_t)y * size.x) * 4 + i] = (unsigned char)(c[i] * 255.f + 0.5f);
+			}
+
+		if (!stbi_write_png(filename.c_str(), size.x, size.y, 4, &pixels[0], 0))
+			throw std::runtime_error("Unable to write image \"" + filename + "\"!");
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <glm/glm.hpp>
+
+class MacroCellGrid;
+class SpimStack;
+struct AABB;
+
+/// CPU reference of the ray marching in shaders/volumeRaycast.frag
+/**	Rays take fixed steps through the world and sample every volume whose bounding box contains the step
+	with nearest neighbour lookups in normalized coordinates, like the shader does with its textures. Each
+	volume keeps the maximum along the ray.
+
+	With a MacroCellGrid per volume, steps are skipped while every volume is either outside its bounding box
+	or inside a cell whose maximum is below the lower threshold. The skipped steps lie on the same lattice,
+	so every sample that can reach the threshold is taken at exactly the same position as without skipping.
+	Only maxima below the threshold change, and those are displayed as black either way.
+
+	render() produces the whole image the shader would: rays start where they leave the global bounding box
+	(the back faces drawn into the ray start target) and march towards the near plane, each volume adds its
+	color from the shader's color table scaled by its maximum mapped through the thresholds. Tiles of the
+	image are spread over the TaskScheduler threads, so it is both a reference for checking shader changes
+	and the renderer for thumbnails without a GL context.
+*/
+namespace VolumeRaycast
+{
+	/// a volume as the shader sees it
+	struct Volume
+	{
+		// voxels of the texture, which may be a TextureResidency level of the stack
+		const void*				data;
+		unsigned int			bytesPerVoxel;
+		glm::ivec3				resolution;
+
+		glm::mat4				inverseTransform;
+		// local bounding box the texture is stretched over
+		glm::vec3				bboxMin, bboxMax;
+
+		// built over data, null to sample every step
+		const MacroCellGrid*	grid;
+
+		inline Volume() : data(nullptr), bytesPerVoxel(1), resolution(0), inverseTransform(1.f), bboxMin(0.f), bboxMax(0.f), grid(nullptr) {}
+		/// the stack's full-resolution voxels
+		Volume(const SpimStack* stack, const MacroCellGrid* grid = nullptr);
+	};
+
+	struct Parameters
+	{
+		float			stepLength;
+		float			minThreshold, maxThreshold;
+		unsigned int	maxSteps;
+
+		inline Parameters() : stepLength(2.f), minThreshold(0.f), maxThreshold(255.f), maxSteps(4000) {}
+	};
+
+	/// counters of a traversal, summed over all rays
+	struct Stats
+	{
+		size_t			steps;
+		size_t			skippedSteps;
+		size_t			samples;
+
+		inline Stats() : steps(0), skippedSteps(0), samples(0) {}
+		inline Stats& operator += (const Stats& s) { steps += s.steps; skippedSteps += s.skippedSteps; samples += s.samples; return *this; }
+	};
+
+	/// nearest neighbour sample at the normalized coordinates, clamped to the border
+	float sample(const Volume& volume, const glm::vec3& coords);
+
+	/// marches from origin towards destination, maxValues receives the maximum of every volume
+	/**	Returns false if the ray never entered any bounding box. Skips empty space if skipEmpty is set and the
+		volumes have grids.
+	*/
+	bool marchRay(const std::vector<Volume>& volumes, const glm::vec3& origin, const glm::vec3& destination, const Parameters& params, bool skipEmpty, float* maxValues, Stats& stats);
+
+	/// color of the volume in the shader's color table
+	glm::vec3 getColor(size_t volume);
+	/// final color of a ray that hit a volume, from the maxima of all volumes
+	glm::vec4 shade(const float* maxValues, size_t volumeCount, const Parameters& params);
+
+	/// renders the volumes as seen through mvp into an RGBA float image of the given size, rows bottom to top
+	/**	bbox is the global bounding box of all volumes. Pixels whose rays miss it stay 0. Returns the summed
+		counters of all rays.
+	*/
+	Stats render(const std::vector<Volume>& volumes, const glm::mat4& mvp, const AABB& bbox, const Parameters& params, bool skipEmpty, const glm::ivec2& size, std::vector<glm::vec4>& image);
+
+	/// writes the image as 8 bit PNG, colors clamped to [0, 1]
+	void saveImage(const std::vector<glm::vec4>& image, const glm::ivec2& size, const std::string& filename);
+}
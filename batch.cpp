@@ -0,0 +1,49 @@
+#include "BatchPipeline.h"
+#include "Profiler.h"
+
+#include <iostream>
+#include <stdexcept>
+
+int main(int argc, const char** argv)
+{
+	if (argc != 2 && argc != 3)
+	{
+		std::cerr << "[Error] No pipeline given!\n";
+		std::cerr << "[Usage] " << argv[0] << " <pipeline.cfg> [trace.json]\n";
+		return BatchPipeline::EXIT_USAGE;
+	}
+
+	BatchPipeline pipeline;
+
+	try
+	{
+		pipeline.load(argv[1]);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "[Error] " << e.what() << std::endl;
+		return BatchPipeline::EXIT_INVALID_PIPELINE;
+	}
+
+	// records the run as a Chrome trace
+	if (argc == 3)
+		Profiler::setEnabled(true);
+
+	const int result = pipeline.run();
+
+	if (argc == 3)
+	{
+		Profiler::printSummary();
+
+		try
+		{
+			Profiler::saveChromeTrace(argv[2]);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "[Error] " << e.what() << std::endl;
+		}
+	}
+
+	return result;
+}
@@ -54,13 +54,25 @@ enum MenuItem
 
 	MENU_POINTCLOUD_BAKE_TRANSFORM,
 	MENU_POINTCLOUD_SAVE_CURRENT,
+	MENU_POINTCLOUD_DOWNSAMPLE,
+	MENU_POINTCLOUD_REMOVE_OUTLIERS,
 
 	MENU_CREATE_PHANTOM,
 	MENU_SAMPLE_PHANTOM,
 
 	MENU_MISC_RELOAD_CONFIG,
 	MENU_MISC_RELOAD_SHADERS,
-	MENU_MISC_SUBSAMPLE_ALL
+	MENU_MISC_SUBSAMPLE_ALL,
+	MENU_MISC_FUSE_TO_DISK,
+	MENU_MISC_RESLICE_ISOTROPIC,
+	MENU_MISC_RESLICE_TO_REFERENCE,
+	MENU_MISC_SAVE_ISOTROPIC,
+	MENU_MISC_REGISTER_TIMELAPSE,
+	MENU_MISC_TOGGLE_PROFILING,
+	MENU_MISC_GAUSSIAN_CURRENT,
+	MENU_MISC_MEDIAN_CURRENT,
+	MENU_MISC_CANCEL_JOBS,
+	MENU_MISC_COMPARE_REFERENCE
 	
 };
 
@@ -210,6 +222,12 @@ static void menu(int item)
 	case MENU_POINTCLOUD_SAVE_CURRENT:
 		regoApp->saveCurrentPointcloud();
 		break;
+	case MENU_POINTCLOUD_DOWNSAMPLE:
+		regoApp->downsampleCurrentPointcloud();
+		break;
+	case MENU_POINTCLOUD_REMOVE_OUTLIERS:
+		regoApp->removeCurrentPointcloudOutliers();
+		break;
 
 
 	case MENU_MISC_RELOAD_CONFIG:
@@ -223,6 +241,46 @@ static void menu(int item)
 		regoApp->subsampleAllStacks();
 		break;
 
+	case MENU_MISC_FUSE_TO_DISK:
+		regoApp->fuseStacksToDisk();
+		break;
+
+	case MENU_MISC_RESLICE_ISOTROPIC:
+		regoApp->resliceCurrentStack(false);
+		break;
+
+	case MENU_MISC_RESLICE_TO_REFERENCE:
+		regoApp->resliceCurrentStack(true);
+		break;
+
+	case MENU_MISC_SAVE_ISOTROPIC:
+		regoApp->saveIsotropicCurrentStack();
+		break;
+
+	case MENU_MISC_REGISTER_TIMELAPSE:
+		regoApp->registerTimelapse();
+		break;
+
+	case MENU_MISC_TOGGLE_PROFILING:
+		regoApp->toggleProfiling();
+		break;
+
+	case MENU_MISC_GAUSSIAN_CURRENT:
+		regoApp->applyGaussFilterToCurrentStack();
+		break;
+
+	case MENU_MISC_MEDIAN_CURRENT:
+		regoApp->applyMedianFilterToCurrentStack();
+		break;
+
+	case MENU_MISC_CANCEL_JOBS:
+		regoApp->cancelJobs();
+		break;
+
+	case MENU_MISC_COMPARE_REFERENCE:
+		regoApp->compareReferenceRender();
+		break;
+
 	default:
 
 		std::cout << "[Debug] " << (MenuItem)item << " is not a valid menu entry.\n";
@@ -290,11 +348,23 @@ static void createRightClickMenu()
 	int pointclouds = glutCreateMenu(menu);
 	glutAddMenuEntry("Bake transform ", MENU_POINTCLOUD_BAKE_TRANSFORM);
 	glutAddMenuEntry("Save pointcloud", MENU_POINTCLOUD_SAVE_CURRENT);
+	glutAddMenuEntry("Voxel downsample", MENU_POINTCLOUD_DOWNSAMPLE);
+	glutAddMenuEntry("Remove outliers", MENU_POINTCLOUD_REMOVE_OUTLIERS);
 
 	int misc = glutCreateMenu(menu);
 	glutAddMenuEntry("Reload config         [c]", MENU_MISC_RELOAD_CONFIG);
 	glutAddMenuEntry("Reload shaders [Shift][s]", MENU_MISC_RELOAD_SHADERS);
 	glutAddMenuEntry("Subsample all stacks  [u]", MENU_MISC_SUBSAMPLE_ALL);
+	glutAddMenuEntry("Fuse stacks to disk", MENU_MISC_FUSE_TO_DISK);
+	glutAddMenuEntry("Reslice current stack isotropic", MENU_MISC_RESLICE_ISOTROPIC);
+	glutAddMenuEntry("Reslice current stack into stack 0", MENU_MISC_RESLICE_TO_REFERENCE);
+	glutAddMenuEntry("Save current stack isotropic", MENU_MISC_SAVE_ISOTROPIC);
+	glutAddMenuEntry("Register time series", MENU_MISC_REGISTER_TIMELAPSE);
+	glutAddMenuEntry("Start/stop profiling", MENU_MISC_TOGGLE_PROFILING);
+	glutAddMenuEntry("Gaussian current stack[G]", MENU_MISC_GAUSSIAN_CURRENT);
+	glutAddMenuEntry("Median current stack  [M]", MENU_MISC_MEDIAN_CURRENT);
+	glutAddMenuEntry("Cancel background jobs[k]", MENU_MISC_CANCEL_JOBS);
+	glutAddMenuEntry("Compare with CPU raycast", MENU_MISC_COMPARE_REFERENCE);
 
 
 	glutCreateMenu(menu);
@@ -461,6 +531,18 @@ static void keyboard(unsigned char key, int x, int y)
 
 	if (key == 'u')
 		regoApp->subsampleAllStacks();
+
+	if (key == 'G')
+		regoApp->applyGaussFilterToCurrentStack();
+	if (key == 'M')
+		regoApp->applyMedianFilterToCurrentStack();
+	if (key == 'k')
+		regoApp->cancelJobs();
+
+	if (key == ']')
+		regoApp->nextTimepoint();
+	if (key == '[')
+		regoApp->previousTimepoint();
 		
 
 	if (key == '1')
@@ -777,7 +859,7 @@ int main(int argc, const char** argv)
 	if (argc < 2)
 	{
 		std::cerr << "[Error] No filename given!\n";
-		std::cerr << "[Usage] " << argv[0] << " <spimfile>\n";
+		std::cerr << "[Usage] " << argv[0] << " <spimfile>|<timeseries.dataset>\n";
 		return -1;
 	}
 	
@@ -823,7 +905,11 @@ int main(int argc, const char** argv)
 
 		for (int i = 1; i < argc; ++i)
 		{
-			regoApp->addSpimStack(argv[i]);
+			const std::string file(argv[i]);
+			if (file.substr(file.find_last_of(".") + 1) == "dataset")
+				regoApp->loadDataset(file);
+			else
+				regoApp->loadSpimStack(file);
 		}
 
 		/*
@@ -0,0 +1,386 @@
+// registration accuracy harness: synthesizes phantom views with known ground truth transforms, misaligns them
+// and reports the remaining error and the wall time of every solver and metric combination
+//
+// usage: spimphantom [options], run with -help for the list
+
+#include "PhantomGenerator.h"
+#include "SpimStack.h"
+#include "SampledMetric.h"
+#include "StackTransformationSolver.h"
+#include "Profiler.h"
+#include "AABB.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <cstdlib>
+
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+
+struct Settings
+{
+	PhantomGenerator::Options	phantom;
+
+	unsigned int				views;
+	// rotation around y between consecutive views in degrees
+	float						angle;
+
+	unsigned int				trials;
+	// maximum misalignment per axis, world units and degrees around y
+	float						translation;
+	float						rotation;
+
+	// solvers joined by '+' are run one after the other in every round
+	std::vector<std::string>	methods;
+	std::vector<std::string>	metrics;
+	unsigned int				samples;
+	unsigned int				iterations;
+	unsigned int				rounds;
+	// final errors below are counted as successful
+	float						tolerance;
+
+	std::string					output;
+	std::string					savePrefix;
+
+	Settings() : views(2), angle(45.f), trials(3), translation(4.f), rotation(2.f), samples(4096), iterations(1000), rounds(10), tolerance(-1.f), output("phantom.json")
+	{
+		methods.push_back("Uniform DX+Uniform DY+Uniform DZ+Uniform RY");
+		methods.push_back("Simulated Annealing");
+		metrics.push_back("ncc");
+		metrics.push_back("difference");
+	}
+};
+
+struct Result
+{
+	std::string		method, metric;
+	unsigned int	trial;
+
+	// mean corner distance to the ground truth over all aligned views, before and after
+	double			initialError, finalError;
+	double			seconds;
+	unsigned int	candidates;
+};
+
+static std::vector<std::string> split(const std::string& s, char separator)
+{
+	std::vector<std::string> result;
+	std::istringstream stream(s);
+	std::string item;
+	while (std::getline(stream, item, separator))
+		if (!item.empty())
+			result.push_back(item);
+	return result;
+}
+
+static void printUsage(const char* name)
+{
+	std::cerr << "[Usage] " << name << " [options]\n"
+		<< "  -type beads|tissue        specimen (beads)\n"
+		<< "  -size <w> <h> <d>         view resolution (128 128 64)\n"
+		<< "  -voxel <x> <y> <z>        view voxel size (1 1 3)\n"
+		<< "  -objects <n>              beads or nuclei (500)\n"
+		<< "  -psf <x> <y> <z>          PSF sigma along the view axes (0.8 0.8 2.5)\n"
+		<< "  -noise <f>                additive noise, relative (0.01)\n"
+		<< "  -photons <f>              photons at full intensity, 0 disables shot noise (1000)\n"
+		<< "  -bits 8|16                view bit depth (16)\n"
+		<< "  -views <n>                number of views (2)\n"
+		<< "  -angle <deg>              rotation around y between views (45)\n"
+		<< "  -trials <n>               misalignments per combination (3)\n"
+		<< "  -translation <f>          maximum misalignment per axis (4)\n"
+		<< "  -rotation <deg>           maximum misalignment around y (2)\n"
+		<< "  -methods <a;b+c>          solvers, '+' runs several in turn (\"Uniform DX+Uniform DY+Uniform DZ+Uniform RY;Simulated Annealing\")\n"
+		<< "  -metrics <a;b>            ncc and/or difference (ncc;difference)\n"
+		<< "  -samples <n>              metric samples (4096)\n"
+		<< "  -iterations <n>           candidates per solver run (1000)\n"
+		<< "  -rounds <n>               maximum rounds over all solvers (10)\n"
+		<< "  -tolerance <f>            final error counted as success (smallest voxel size)\n"
+		<< "  -seed <n>                 specimen and misalignment seed (4711)\n"
+		<< "  -save <prefix>            saves the views and their ground truth transforms\n"
+		<< "  -out <file.json>          results (phantom.json)\n";
+}
+
+static bool parseArguments(int argc, const char** argv, Settings& s)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg(argv[i]);
+		const int left = argc - i - 1;
+
+		if (arg == "-type" && left >= 1)
+		{
+			const std::string type(argv[++i]);
+			if (type == "beads")
+				s.phantom.type = PhantomGenerator::PHANTOM_BEADS;
+			else if (type == "tissue")
+				s.phantom.type = PhantomGenerator::PHANTOM_TISSUE;
+			else
+				return false;
+		}
+		else if (arg == "-size" && left >= 3)
+		{
+			s.phantom.resolution = ivec3(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+			i += 3;
+		}
+		else if (arg == "-voxel" && left >= 3)
+		{
+			s.phantom.voxelSize = vec3((float)atof(argv[i + 1]), (float)atof(argv[i + 2]), (float)atof(argv[i + 3]));
+			i += 3;
+		}
+		else if (arg == "-psf" && left >= 3)
+		{
+			s.phantom.psfSigma = vec3((float)atof(argv[i + 1]), (float)atof(argv[i + 2]), (float)atof(argv[i + 3]));
+			i += 3;
+		}
+		else if (arg == "-objects" && left >= 1)
+			s.phantom.objectCount = atoi(argv[++i]);
+		else if (arg == "-noise" && left >= 1)
+			s.phantom.noise = (float)atof(argv[++i]);
+		else if (arg == "-photons" && left >= 1)
+			s.phantom.photons = (float)atof(argv[++i]);
+		else if (arg == "-bits" && left >= 1)
+			s.phantom.bytesPerVoxel = atoi(argv[++i]) / 8;
+		else if (arg == "-seed" && left >= 1)
+			s.phantom.seed = atoi(argv[++i]);
+		else if (arg == "-views" && left >= 1)
+			s.views = std::max(2, atoi(argv[++i]));
+		else if (arg == "-angle" && left >= 1)
+			s.angle = (float)atof(argv[++i]);
+		else if (arg == "-trials" && left >= 1)
+			s.trials = std::max(1, atoi(argv[++i]));
+		else if (arg == "-translation" && left >= 1)
+			s.translation = (float)atof(argv[++i]);
+		else if (arg == "-rotation" && left >= 1)
+			s.rotation = (float)atof(argv[++i]);
+		else if (arg == "-methods" && left >= 1)
+			s.methods = split(argv[++i], ';');
+		else if (arg == "-metrics" && left >= 1)
+			s.metrics = split(argv[++i], ';');
+		else if (arg == "-samples" && left >= 1)
+			s.samples = atoi(argv[++i]);
+		else if (arg == "-iterations" && left >= 1)
+			s.iterations = atoi(argv[++i]);
+		else if (arg == "-rounds" && left >= 1)
+			s.rounds = std::max(1, atoi(argv[++i]));
+		else if (arg == "-tolerance" && left >= 1)
+			s.tolerance = (float)atof(argv[++i]);
+		else if (arg == "-save" && left >= 1)
+			s.savePrefix = argv[++i];
+		else if (arg == "-out" && left >= 1)
+			s.output = argv[++i];
+		else
+			return false;
+	}
+
+	if (s.tolerance < 0.f)
+		s.tolerance = std::min(s.phantom.voxelSize.x, std::min(s.phantom.voxelSize.y, s.phantom.voxelSize.z));
+
+	return !s.methods.empty() && !s.metrics.empty();
+}
+
+// rotation around y through the center of the phantom
+static mat4 rotateAroundCenter(float degrees, const vec3& center)
+{
+	return translate(center) * rotate(radians(degrees), vec3(0, 1, 0)) * translate(-center);
+}
+
+static double calculateError(const std::vector<SpimStack*>& stacks, const std::vector<mat4>& truth)
+{
+	double error = 0;
+	for (size_t k = 1; k < stacks.size(); ++k)
+		error += PhantomGenerator::calculateError(stacks[k]->getBBox(), stacks[k]->getTransform(), truth[k]);
+	return error / (stacks.size() - 1);
+}
+
+/// aligns all views to view 0 in rounds until no solver improves the score any more. Returns the number of scored candidates
+static unsigned int align(const std::vector<SpimStack*>& stacks, const std::vector<std::string>& solvers, const SampledMetric& metric, const Settings& settings)
+{
+	std::vector<InteractionVolume*> volumes(stacks.begin(), stacks.end());
+	unsigned int candidates = 0;
+
+	for (unsigned int round = 0; round < settings.rounds; ++round)
+	{
+		bool improved = false;
+
+		for (size_t k = 1; k < stacks.size(); ++k)
+		{
+			for (size_t s = 0; s < solvers.size(); ++s)
+			{
+				std::unique_ptr<IStackTransformationSolver> solver(IStackTransformationSolver::create(solvers[s], volumes));
+
+				const SampledMetric::View view(stacks[k]);
+				candidates += solver->minimize(stacks[k], [&](const mat4& delta) { return metric.score(view, delta); }, settings.iterations);
+
+				// the solvers keep their own notion of the best score, compare them on the metric
+				const mat4 best = solver->getBestSolution().matrix;
+				if (metric.score(view, best) < metric.score(view))
+				{
+					stacks[k]->applyTransform(best);
+					improved = true;
+				}
+			}
+		}
+
+		if (!improved)
+			break;
+	}
+
+	return candidates;
+}
+
+static void writeJSON(const std::string& filename, const Settings& s, const std::vector<Result>& results)
+{
+	std::ofstream file(filename);
+	if (!file.is_open())
+		throw std::runtime_error("Unable to open file \"" + filename + "\"!");
+
+	const PhantomGenerator::Options& p = s.phantom;
+	file << "{\n";
+	file << "\t\"type\": \"" << (p.type == PhantomGenerator::PHANTOM_TISSUE ? "tissue" : "beads") << "\",\n";
+	file << "\t\"resolution\": [" << p.resolution.x << ", " << p.resolution.y << ", " << p.resolution.z << "],\n";
+	file << "\t\"voxelSize\": [" << p.voxelSize.x << ", " << p.voxelSize.y << ", " << p.voxelSize.z << "],\n";
+	file << "\t\"psfSigma\": [" << p.psfSigma.x << ", " << p.psfSigma.y << ", " << p.psfSigma.z << "],\n";
+	file << "\t\"noise\": " << p.noise << ",\n";
+	file << "\t\"photons\": " << p.photons << ",\n";
+	file << "\t\"views\": " << s.views << ",\n";
+	file << "\t\"angle\": " << s.angle << ",\n";
+	file << "\t\"translation\": " << s.translation << ",\n";
+	file << "\t\"rotation\": " << s.rotation << ",\n";
+	file << "\t\"tolerance\": " << s.tolerance << ",\n";
+	file << "\t\"results\": [\n";
+
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		const Result& r = results[i];
+		file << "\t\t{ \"method\": \"" << r.method << "\", \"metric\": \"" << r.metric << "\", \"trial\": " << r.trial;
+		file << ", \"initialError\": " << r.initialError << ", \"finalError\": " << r.finalError << ", \"seconds\": " << r.seconds << ", \"candidates\": " << r.candidates;
+		file << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+
+	file << "\t]\n}\n";
+
+	std::cout << "[Phantom] Wrote " << results.size() << " results to \"" << filename << "\"\n";
+}
+
+int main(int argc, const char** argv)
+{
+	Settings settings;
+	if (!parseArguments(argc, argv, settings))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	std::vector<Result> results;
+
+	try
+	{
+		const PhantomGenerator generator(settings.phantom);
+		const vec3 center = generator.getCenter();
+
+		// ground truth, views rotated around the specimen like a SPIM acquisition
+		std::vector<mat4> truth(settings.views);
+		std::vector<SpimStack*> stacks(settings.views);
+		std::vector<std::unique_ptr<SpimStack> > owner(settings.views);
+		for (unsigned int k = 0; k < settings.views; ++k)
+		{
+			truth[k] = rotateAroundCenter(settings.angle * k, center);
+			owner[k].reset(generator.createView(truth[k], settings.phantom.seed + k + 1));
+			stacks[k] = owner[k].get();
+
+			if (!settings.savePrefix.empty())
+			{
+				const ivec3 res = settings.phantom.resolution;
+				const std::string filename = settings.savePrefix + "_view" + std::to_string(k) + "_" + std::to_string(res.x) + "x" + std::to_string(res.y) + "x" + std::to_string(res.z) + "." + std::to_string(settings.phantom.bytesPerVoxel * 8) + "bit.bin";
+				stacks[k]->save(filename);
+				stacks[k]->saveTransform(filename + ".registration.txt");
+			}
+		}
+
+		// the same misalignments for every combination
+		std::mt19937 rng(settings.phantom.seed);
+		std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+		std::vector<std::vector<mat4> > starts(settings.trials, std::vector<mat4>(settings.views));
+		for (unsigned int t = 0; t < settings.trials; ++t)
+			for (unsigned int k = 0; k < settings.views; ++k)
+			{
+				const vec3 d = vec3(unit(rng), unit(rng), unit(rng)) * settings.translation;
+				const float a = unit(rng) * settings.rotation;
+				starts[t][k] = k == 0 ? truth[0] : translate(d) * rotateAroundCenter(a, center) * truth[k];
+			}
+
+		for (size_t m = 0; m < settings.metrics.size(); ++m)
+		{
+			SampledMetric metric(SampledMetric::parseMode(settings.metrics[m]));
+			metric.setReference(SampledMetric::View(stacks[0]), settings.samples);
+
+			for (size_t s = 0; s < settings.methods.size(); ++s)
+			{
+				const std::vector<std::string> solvers = split(settings.methods[s], '+');
+				std::vector<InteractionVolume*> volumes(stacks.begin(), stacks.end());
+				for (size_t i = 0; i < solvers.size(); ++i)
+					if (!std::unique_ptr<IStackTransformationSolver>(IStackTransformationSolver::create(solvers[i], volumes)))
+						throw std::runtime_error("Unknown solver \"" + solvers[i] + "\"!");
+
+				for (unsigned int t = 0; t < settings.trials; ++t)
+				{
+					for (unsigned int k = 0; k < settings.views; ++k)
+						stacks[k]->setTransform(starts[t][k]);
+
+					Result r;
+					r.method = settings.methods[s];
+					r.metric = settings.metrics[m];
+					r.trial = t;
+					r.initialError = calculateError(stacks, truth);
+
+					const auto start = std::chrono::steady_clock::now();
+					r.candidates = align(stacks, solvers, metric, settings);
+					r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+					r.finalError = calculateError(stacks, truth);
+					results.push_back(r);
+
+					std::cout << "[Phantom] " << r.method << " / " << r.metric << ", trial " << t << ": error " << r.initialError << " -> " << r.finalError << " in " << r.seconds * 1000.0 << "ms, " << r.candidates << " candidates\n";
+				}
+			}
+		}
+
+		writeJSON(settings.output, settings, results);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "[Error] " << e.what() << std::endl;
+		return 1;
+	}
+
+	// error vs. time per combination
+	std::cout << "[Phantom] Summary, tolerance " << settings.tolerance << ":\n";
+	for (size_t i = 0; i < results.size(); i += settings.trials)
+	{
+		double initial = 0, final = 0, worst = 0, seconds = 0;
+		unsigned int successes = 0;
+		for (unsigned int t = 0; t < settings.trials; ++t)
+		{
+			const Result& r = results[i + t];
+			initial += r.initialError;
+			final += r.finalError;
+			worst = std::max(worst, r.finalError);
+			seconds += r.seconds;
+			if (r.finalError <= settings.tolerance)
+				++successes;
+		}
+
+		std::cout << "[Phantom]   " << results[i].method << " / " << results[i].metric << ": mean error " << initial / settings.trials << " -> " << final / settings.trials << " (worst " << worst << "), " << successes << "/" << settings.trials << " within tolerance, " << seconds / settings.trials * 1000.0 << "ms\n";
+	}
+
+	return 0;
+}
@@ -2,7 +2,10 @@
 
 #version 140
 
-uniform isampler3D volumeTexture;
+// VolumeAtlas, the stack's voxels are at offset
+uniform usampler3D atlas;
+uniform ivec3 offset;
+uniform ivec3 resolution;
 
 
 in vec3 texcoord;
@@ -17,7 +20,8 @@ out vec4 fragColor;
 void main()
 {
 
-	float intensity = texture(volumeTexture, texcoord).r;
+	ivec3 voxel = clamp(ivec3(texcoord * vec3(resolution)), ivec3(0), resolution - ivec3(1));
+	float intensity = float(texelFetch(atlas, offset + voxel, 0).r);
 
 	float alpha = intensity - minThreshold;
 	alpha *= sliceWeight;
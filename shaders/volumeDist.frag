@@ -1,20 +1,33 @@
 // renders volume slices
 
 #version 130
+#extension GL_ARB_uniform_buffer_object : require
 
+// VolumeAtlas::VolumeBlock
 struct Volume
 {
-	isampler3D		texture;
-	vec3			bboxMin, bboxMax;
-	mat4			inverseMVP;
-	bool			enabled;
+	mat4			inverseTransform;
+	// w is 1 for enabled volumes
+	vec4			bboxMin, bboxMax;
+	// voxels of the volume in the atlas
+	ivec4			offset, resolution;
 };
 
+// capacity of the variant, volumeCount are used
 #define VOLUMES 2
 
-uniform Volume volume[VOLUMES];
+layout(std140) uniform Volumes
+{
+	Volume volume[VOLUMES];
+};
+
+uniform int volumeCount;
+uniform usampler3D atlas;
 
-int value[VOLUMES];
+// the volume compared against the mean of all others: the selected stack, or the first if none is selected
+uniform int activeVolume = 0;
+
+uniform mat4 inverseMVP;
 
 uniform float minThreshold;
 uniform float maxThreshold;
@@ -27,7 +40,7 @@ in vec4 vertex;
 out vec4 fragColor;
 
 void main()
-{	
+{
 
 	// count of the number volumes this pixel is contained int
 	int count = 0;
@@ -35,44 +48,50 @@ void main()
 	// total intensity of all volumes
 	float sum = 0.0;
 
+	// intensity of the active volume and of all others, 0 below the threshold
+	float reference = 0.0;
+	float others = 0.0;
 
 	float maxVal = 0.0;
 
-	for (int i = 0; i < VOLUMES; ++i)
+	vec4 worldPosition = inverseMVP * vertex;
+	worldPosition /= worldPosition.w;
+
+	for (int i = 0; i < volumeCount; ++i)
 	{
-		if (!volume[i].enabled)
+		if (volume[i].bboxMin.w == 0.0)
 			continue;
 
-		vec4 v = volume[i].inverseMVP * vertex;
-		v /= v.w;
-
-		vec3 worldPosition = v.xyz;
-
-		vec3 texcoord = worldPosition - volume[i].bboxMin; 
-		texcoord /= (volume[i].bboxMax - volume[i].bboxMin);
-	
-		int t = texture(volume[i].texture, texcoord).r;
-
-		value[i] = 0;
-
+		vec3 position = vec3(volume[i].inverseTransform * worldPosition);
+		vec3 bboxMin = volume[i].bboxMin.xyz;
+		vec3 bboxMax = volume[i].bboxMax.xyz;
 
 		// check if the value is inside
-		if (worldPosition.x > volume[i].bboxMin.x && worldPosition.x < volume[i].bboxMax.x &&
-			worldPosition.y > volume[i].bboxMin.y && worldPosition.y < volume[i].bboxMax.y &&
-			worldPosition.z > volume[i].bboxMin.z && worldPosition.z < volume[i].bboxMax.z) 
-		{			
+		if (position.x > bboxMin.x && position.x < bboxMax.x &&
+			position.y > bboxMin.y && position.y < bboxMax.y &&
+			position.z > bboxMin.z && position.z < bboxMax.z)
+		{
+			vec3 texcoord = (position - bboxMin) / (bboxMax - bboxMin);
+
+			ivec3 res = volume[i].resolution.xyz;
+			ivec3 voxel = clamp(ivec3(texcoord * vec3(res)), ivec3(0), res - ivec3(1));
+			float t = float(texelFetch(atlas, volume[i].offset.xyz + voxel, 0).r);
 
 			maxVal = max(maxVal, t);
 
 
-			if (float(t) >= minThreshold)
+			if (t >= minThreshold)
 			{
-				value[i] = t;
 				++count;
-				sum += float(t);
+				sum += t;
+
+				if (i == activeVolume)
+					reference = t;
+				else
+					others += t;
 			}
 		}
-	
+
 
 	}
 
@@ -80,49 +99,10 @@ void main()
 	if (count == 0)
 		discard;
 
-	
-
-	/*
-	bool anyGreater = false;
-	for (int i = 0; i < VOLUMES; ++i)
-	{
-
-		if (value[i] > minThreshold)
-		{			
-			diffValue += (value[i] - value[0]);
-			anyGreater = true;
-		}
-
-		if (value[i] < minThreshold)
-			discard;
-	}
-
-	if (!anyGreater)
-		discard;
-	*/
-
-
-float mean = 0.0;
-float maxCount = 0;
-#if (VOLUMES == 2)
-	mean = value[1];
-	maxCount = 2;
-#endif
-
-#if (VOLUMES == 3)
-	mean = float(value[1] + value[2]) / 2.0;
-	maxCount = 3;
-#endif
 
-#if (VOLUMES == 4)
-	mean = float(value[1] + value[2] + value[3]) / 3.0;
-#endif
+	float mean = others / float(max(volumeCount - 1, 1));
 
-#if (VOLUMES == 5)
-	float(value[1] + value[2] + value[3] + value[4]) / 4.0;
-#endif
-	
-	float diffValue = mean - value[0];
+	float diffValue = mean - reference;
 
 	if (abs(diffValue) > 5.0*stdDev)
 	{
@@ -131,7 +111,8 @@ float maxCount = 0;
 	else
 		diffValue = 0.0;
 
-	if (count < maxCount)
+	// only where all volumes overlap, for any number of volumes
+	if (count < volumeCount)
 		diffValue = 0.0;
 
 	vec3 color = vec3(diffValue, sum, count);
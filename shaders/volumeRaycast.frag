@@ -1,19 +1,32 @@
 // renders volume slices
 
 #version 130
+#extension GL_ARB_uniform_buffer_object : require
 
+// VolumeAtlas::VolumeBlock
 struct Volume
 {
-	isampler3D		texture;
 	mat4			inverseTransform;
-	mat4			transform;
-	vec3			bboxMin, bboxMax;
+	// w is 1 for enabled volumes
+	vec4			bboxMin, bboxMax;
+	// voxels of the volume in the atlas
+	ivec4			offset, resolution;
 };
 
+// capacity of the variant, volumeCount are used
 #define VOLUMES 2
-#define STEPS 4000
+#define CELL_SIZE 16
 
-uniform Volume volume[VOLUMES];
+layout(std140) uniform Volumes
+{
+	Volume volume[VOLUMES];
+};
+
+uniform int			volumeCount;
+
+// all volumes and the (min, max) of their cells, see MacroCellGrid
+uniform usampler3D	atlas;
+uniform usampler3D	cellAtlas;
 
 uniform sampler2D	rayStart;
 
@@ -23,14 +36,55 @@ uniform float		maxThreshold;
 uniform mat4		inverseMVP;
 
 uniform float		stepLength = 2.0;
+uniform int			maxSteps = 4000;
 
 uniform int  		activeVolume = -1;
 
+// jumps over steps where all volumes are outside or in cells below minThreshold, see VolumeRaycast.h
+uniform bool		skipEmptySpace = false;
+
 in vec2 texcoord;
 out vec4 fragColor;
 
 
+// distance in steps until p leaves the box it is in
+float getExitDistance(vec3 p, vec3 dir, vec3 boxMin, vec3 boxMax)
+{
+	float t = float(maxSteps);
+	for (int a = 0; a < 3; ++a)
+	{
+		if (dir[a] > 0.0)
+			t = min(t, (boxMax[a] - p[a]) / dir[a]);
+		else if (dir[a] < 0.0)
+			t = min(t, (boxMin[a] - p[a]) / dir[a]);
+	}
+
+	return t;
+}
+
+// distance in steps until p enters the box, maxSteps if it never does
+float getEntryDistance(vec3 p, vec3 dir, vec3 boxMin, vec3 boxMax)
+{
+	float tNear = 0.0;
+	float tFar = float(maxSteps);
+	for (int a = 0; a < 3; ++a)
+	{
+		if (dir[a] == 0.0)
+		{
+			if (p[a] <= boxMin[a] || p[a] >= boxMax[a])
+				return float(maxSteps);
+		}
+		else
+		{
+			float t0 = (boxMin[a] - p[a]) / dir[a];
+			float t1 = (boxMax[a] - p[a]) / dir[a];
+			tNear = max(tNear, min(t0, t1));
+			tFar = min(tFar, max(t0, t1));
+		}
+	}
 
+	return tNear < tFar ? tNear : float(maxSteps);
+}
 
 void main()
 {
@@ -68,58 +122,87 @@ void main()
 		
 		float maxValue = 0.0;
 		float meanValue = 0.0;
-		float distanceTravelled = 0.0;
 		
 		bool hitActiveVolume = false;
 		bool hitAnyVolume = false;
 
 
 		float maxValues[VOLUMES];
-		for (int i = 0; i < VOLUMES; ++i)
+		for (int i = 0; i < volumeCount; ++i)
 			maxValues[i] = 0.0;
 
-		vec3 worldPosition = rayOrigin;
-		for (int i = 0; i < STEPS; ++i)
+		// steps are taken from the origin so skipped and sampled steps stay on the same lattice
+		int stepCount = min(maxSteps, int(ceil(maxDistance / stepLength)));
+		int i = 0;
+		while (i < stepCount)
 		{
-			if (distanceTravelled >= maxDistance)
-				break;
-
+			vec3 worldPosition = rayOrigin + rayDirection * float(i);
+			int skip = skipEmptySpace ? maxSteps : 1;
 
 			float value[VOLUMES];
 			
 
-			for (int v = 0; v < VOLUMES; ++v)
+			for (int v = 0; v < volumeCount; ++v)
 			{
+				value[v] = 0.0;
 
 				// check all volumes
 				vec3 volPosition = vec3(volume[v].inverseTransform * vec4(worldPosition, 1.0));
+				vec3 bboxMin = volume[v].bboxMin.xyz;
+				vec3 bboxMax = volume[v].bboxMax.xyz;
 
-				if (volPosition.x > volume[v].bboxMin.x && volPosition.x < volume[v].bboxMax.x &&
-					volPosition.y > volume[v].bboxMin.y && volPosition.y < volume[v].bboxMax.y &&
-					volPosition.z > volume[v].bboxMin.z && volPosition.z < volume[v].bboxMax.z) 
+				if (volPosition.x > bboxMin.x && volPosition.x < bboxMax.x &&
+					volPosition.y > bboxMin.y && volPosition.y < bboxMax.y &&
+					volPosition.z > bboxMin.z && volPosition.z < bboxMax.z) 
 				{
 
-					vec3 volCoord = volPosition - volume[v].bboxMin; 
-					volCoord /= (volume[v].bboxMax - volume[v].bboxMin);
+					vec3 volCoord = volPosition - bboxMin; 
+					volCoord /= (bboxMax - bboxMin);
 
-					float val = texture(volume[v].texture, volCoord).r;
+					hitAnyVolume = true;
+
+					// nearest voxel, like VolumeRaycast::sample()
+					ivec3 res = volume[v].resolution.xyz;
+					ivec3 voxel = clamp(ivec3(volCoord * vec3(res)), ivec3(0), res - ivec3(1));
+
+					if (skipEmptySpace)
+					{
+						// slots are aligned to cells
+						ivec3 cell = voxel / CELL_SIZE;
+
+						if (float(texelFetch(cellAtlas, volume[v].offset.xyz / CELL_SIZE + cell, 0).g) < minThreshold)
+						{
+							// leave the cell, none of its samples would show
+							vec3 voxelSize = (bboxMax - bboxMin) / vec3(res);
+							vec3 cellMin = bboxMin + vec3(cell * CELL_SIZE) * voxelSize;
+							vec3 cellMax = bboxMin + vec3(min((cell + ivec3(1)) * CELL_SIZE, res)) * voxelSize;
+							vec3 localStep = mat3(volume[v].inverseTransform) * rayDirection;
+
+							skip = min(skip, max(1, int(getExitDistance(volPosition, localStep, cellMin, cellMax))));
+							continue;
+						}
+					}
+
+					float val = float(texelFetch(atlas, volume[v].offset.xyz + voxel, 0).r);
 		
 					value[v] = val;
 
 					if (v == activeVolume && val > minThreshold && val < maxThreshold)
 						hitActiveVolume = true;
 
-					hitAnyVolume = true;
-
+					skip = 1;
+				}
+				else if (skipEmptySpace)
+				{
+					vec3 localStep = mat3(volume[v].inverseTransform) * rayDirection;
+					skip = min(skip, max(1, int(getEntryDistance(volPosition, localStep, bboxMin, bboxMax))));
 				}
-				else
-					value[v] = 0.0;
 
 			}
 
 
 			float mean = 0.0;
-			for (int v = 0; v < VOLUMES; ++v)
+			for (int v = 0; v < volumeCount; ++v)
 			{
 				// calcualte the max
 				maxValue = max(maxValue, value[v]);
@@ -128,12 +211,11 @@ void main()
 				maxValues[v] = max(maxValues[v], value[v]);
 			}
 
-			mean /= float(VOLUMES);
+			mean /= float(volumeCount);
 			meanValue = max(meanValue, mean);
 
 				
-			worldPosition += rayDirection;
-			distanceTravelled += stepLength;
+			i += skip;
 
 		}
 
@@ -153,9 +235,10 @@ void main()
 
 		
 		vec3 aggregateColor = vec3(0.0);
-		for (int v = 0; v < VOLUMES; ++v) 
+		for (int v = 0; v < volumeCount; ++v) 
 		{
-			float val = (maxValues[v] - minThreshold) / (maxThreshold - minThreshold);
+			// maxima below the threshold are black, whether their steps were skipped or not
+			float val = max(0.0, (maxValues[v] - minThreshold) / (maxThreshold - minThreshold));
 
 			aggregateColor += (color_table[min(v, 6)] * val);	
 		}
@@ -0,0 +1,528 @@
+// benchmark suite for the whole-volume operations: runs every operation on synthetic u8 and u16 stacks and
+// bead phantoms with warmup and repetitions and writes the timings as JSON. Exits with 1 if any operation failed
+//
+// usage: spimbench [-size <w> <h> <d>] [-repeats <n>] [-warmup <n>] [-only <name substring>] [-out <file.json>] [-trace <trace.json>] [-threads <n>]
+
+#include "SpimStack.h"
+#include "StackRegistration.h"
+#include "StackTransformationSolver.h"
+#include "SampledMetric.h"
+#include "GradientField.h"
+#include "GeometryImage.h"
+#include "MultiViewFusion.h"
+#include "Resampling.h"
+#include "MacroCellGrid.h"
+#include "VolumeRaycast.h"
+#include "Profiler.h"
+#include "TaskScheduler.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <memory>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+
+struct Result
+{
+	std::string		name;
+	std::string		type;
+
+	unsigned int	repeats;
+	// best and mean of the repetitions
+	double			seconds, meanSeconds;
+
+	// work done per run, 0 if it does not apply
+	double			voxels, bytes, items;
+
+	std::string		error;
+};
+
+class Benchmark
+{
+public:
+	Benchmark(unsigned int warmup, unsigned int repeats, const std::string& only) : warmup(warmup), repeats(repeats), only(only) {}
+
+	/// runs op warmup + repeats times, setup runs before each of them and is not timed
+	void run(const std::string& name, const std::string& type, double voxels, double bytes, double items, const std::function<void()>& op, const std::function<void()>& setup = std::function<void()>())
+	{
+		if (!only.empty() && (name + " " + type).find(only) == std::string::npos)
+			return;
+
+		Result r;
+		r.name = name;
+		r.type = type;
+		r.repeats = repeats;
+		r.voxels = voxels;
+		r.bytes = bytes;
+		r.items = items;
+		r.seconds = 0;
+		r.meanSeconds = 0;
+
+		try
+		{
+			double best = 1e10, total = 0;
+			for (unsigned int i = 0; i < warmup + repeats; ++i)
+			{
+				if (setup)
+					setup();
+
+				const auto t0 = std::chrono::steady_clock::now();
+				op();
+				const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+				if (i >= warmup)
+				{
+					best = std::min(best, t);
+					total += t;
+				}
+			}
+
+			r.seconds = best;
+			r.meanSeconds = total / repeats;
+
+			std::cout << "[Bench] " << name << " " << type << ": " << best * 1000.0 << "ms";
+			if (voxels > 0)
+				std::cout << ", " << voxels / best * 1e-6 << " Mvoxels/s";
+			if (bytes > 0)
+				std::cout << ", " << bytes / best / (1 << 20) << " MB/s";
+			if (items > 0)
+				std::cout << ", " << items / best << " items/s";
+			std::cout << std::endl;
+		}
+		catch (const std::exception& e)
+		{
+			r.error = e.what();
+			std::cerr << "[Bench] " << name << " " << type << " failed: " << r.error << std::endl;
+		}
+		catch (...)
+		{
+			r.error = "unknown error";
+			std::cerr << "[Bench] " << name << " " << type << " failed.\n";
+		}
+
+		results.push_back(r);
+	}
+
+	/// marks the result of an operation as failed, for checks that run after the timing
+	void fail(const std::string& name, const std::string& type, const std::string& error)
+	{
+		for (size_t i = 0; i < results.size(); ++i)
+			if (results[i].name == name && results[i].type == type)
+				results[i].error = error;
+
+		std::cerr << "[Bench] " << name << " " << type << " failed: " << error << std::endl;
+	}
+
+	size_t getFailureCount() const
+	{
+		return std::count_if(results.begin(), results.end(), [](const Result& r) { return !r.error.empty(); });
+	}
+
+	void writeJSON(const std::string& filename, const ivec3& res) const
+	{
+		std::ofstream file(filename);
+		if (!file.is_open())
+			throw std::runtime_error("Unable to open file \"" + filename + "\"!");
+
+		const unsigned int threads = TaskScheduler::getThreadCount();
+
+		file << "{\n";
+		file << "\t\"resolution\": [" << res.x << ", " << res.y << ", " << res.z << "],\n";
+		file << "\t\"warmup\": " << warmup << ",\n";
+		file << "\t\"repeats\": " << repeats << ",\n";
+		file << "\t\"threads\": " << threads << ",\n";
+		file << "\t\"results\": [\n";
+
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const Result& r = results[i];
+			file << "\t\t{ \"name\": \"" << r.name << "\", \"type\": \"" << r.type << "\"";
+
+			if (r.error.empty())
+			{
+				file << ", \"seconds\": " << r.seconds << ", \"meanSeconds\": " << r.meanSeconds;
+				if (r.voxels > 0)
+					file << ", \"voxels\": " << r.voxels << ", \"voxelsPerSecond\": " << r.voxels / r.seconds;
+				if (r.bytes > 0)
+					file << ", \"bytes\": " << r.bytes << ", \"bytesPerSecond\": " << r.bytes / r.seconds;
+				if (r.items > 0)
+					file << ", \"items\": " << r.items << ", \"itemsPerSecond\": " << r.items / r.seconds;
+			}
+			else
+			{
+				std::string error = r.error;
+				std::replace(error.begin(), error.end(), '"', '\'');
+				file << ", \"error\": \"" << error << "\"";
+			}
+
+			file << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+
+		file << "\t]\n}\n";
+
+		std::cout << "[Bench] Wrote " << results.size() << " results to \"" << filename << "\"\n";
+	}
+
+private:
+	unsigned int			warmup, repeats;
+	std::string				only;
+	std::vector<Result>		results;
+};
+
+/// smooth blobs plus some noise in [0, maxValue]
+template <typename T>
+static void fillBlobs(std::vector<T>& volume, const ivec3& res, float maxValue)
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> noise(0.f, 0.1f);
+
+	volume.resize((size_t)res.x * res.y * res.z);
+	for (int z = 0; z < res.z; ++z)
+		for (int y = 0; y < res.y; ++y)
+			for (int x = 0; x < res.x; ++x)
+			{
+				const float v = 0.5f + 0.4f * sin(x * 0.11f) * cos(y * 0.07f) * sin(z * 0.13f) + noise(rng);
+				volume[x + res.x * (y + (size_t)res.y * z)] = (T)(clamp(v, 0.f, 1.f) * maxValue);
+			}
+}
+
+/// gaussian beads on a dark, noisy background, like a bead calibration stack
+template <typename T>
+static void fillBeads(std::vector<T>& volume, const ivec3& res, float maxValue, unsigned int beadCount)
+{
+	std::mt19937 rng(4711);
+	std::uniform_real_distribution<float> noise(0.f, 0.05f);
+
+	volume.resize((size_t)res.x * res.y * res.z);
+	for (size_t i = 0; i < volume.size(); ++i)
+		volume[i] = (T)((0.05f + noise(rng)) * maxValue);
+
+	const float sigma = 1.5f;
+	const int radius = 4;
+
+	for (unsigned int b = 0; b < beadCount; ++b)
+	{
+		const vec3 center((float)(rng() % res.x), (float)(rng() % res.y), (float)(rng() % res.z));
+		const float brightness = 0.5f + 0.4f * (float)rng() / rng.max();
+
+		for (int z = std::max(0, (int)center.z - radius); z <= std::min(res.z - 1, (int)center.z + radius); ++z)
+			for (int y = std::max(0, (int)center.y - radius); y <= std::min(res.y - 1, (int)center.y + radius); ++y)
+				for (int x = std::max(0, (int)center.x - radius); x <= std::min(res.x - 1, (int)center.x + radius); ++x)
+				{
+					const vec3 d = vec3(x, y, z) - center;
+					const float v = brightness * exp(-dot(d, d) / (2.f * sigma * sigma));
+
+					T& voxel = volume[x + res.x * (y + (size_t)res.y * z)];
+					voxel = (T)std::min(maxValue, (float)voxel + v * maxValue);
+				}
+	}
+}
+
+template <typename T>
+static SpimStack* createStack(const std::vector<T>& data, const ivec3& res)
+{
+	SpimStack* stack = nullptr;
+	if (sizeof(T) == 2)
+		stack = new SpimStackU16;
+	else
+		stack = new SpimStackU8;
+
+	stack->setContent(res, &data[0]);
+	stack->setVoxelDimensions(vec3(1.f));
+	return stack;
+}
+
+/// resampling kernels, on a rotated and slightly scaled grid so no axis is aligned with the input
+template <typename T>
+static void benchmarkResampling(Benchmark& bench, const std::string& type, const ivec3& res, const std::vector<T>& volume)
+{
+	const double voxels = (double)res.x * res.y * res.z;
+	const double bytes = voxels * sizeof(T);
+
+	const float a = radians(30.f);
+	const vec3 dx = vec3(cos(a), sin(a), 0.f) * 0.9f;
+	const vec3 dy = vec3(-sin(a), cos(a), 0.f) * 0.9f;
+	const vec3 dz = vec3(0.f, 0.05f, 0.95f);
+	const vec3 origin = vec3(res.x * 0.3f, -res.y * 0.1f, 0.5f);
+	std::vector<float> resampled(volume.size());
+
+	const char* modeNames[] = { "nearest", "trilinear", "tricubic" };
+	for (int m = Resampling::NEAREST; m <= Resampling::TRICUBIC; ++m)
+		bench.run(std::string("resample ") + modeNames[m], type, voxels, 0, 0, [&]() { Resampling::resample(&volume[0], res, origin, dx, dy, dz, res, (Resampling::Interpolation)m, &resampled[0]); });
+
+	// prefilter cost, needed once per volume for interpolating tricubic sampling
+	std::vector<float> coefficients;
+	bench.run("bspline prefilter", type, voxels, bytes, 0, [&]() { Resampling::calculateBSplineCoefficients(&volume[0], res, coefficients); });
+}
+
+/// CPU ray marching of the bead volume and a rotated copy, with and without empty-space skipping. The skipping
+/// traversal has to find the same maxima above the threshold as the reference that samples every step
+template <typename T>
+static void benchmarkRaycast(Benchmark& bench, const std::string& type, const ivec3& res, const std::vector<T>& beads, const mat4& rotated, float threshold)
+{
+	MacroCellGrid grid;
+	bench.run("cell grid", type, (double)beads.size(), (double)beads.size() * sizeof(T), 0, [&]() { grid.build(&beads[0], sizeof(T), res); });
+	grid.build(&beads[0], sizeof(T), res);
+
+	std::vector<VolumeRaycast::Volume> volumes(2);
+	for (size_t i = 0; i < volumes.size(); ++i)
+	{
+		VolumeRaycast::Volume& v = volumes[i];
+		v.data = &beads[0];
+		v.bytesPerVoxel = sizeof(T);
+		v.resolution = res;
+		v.inverseTransform = i == 0 ? mat4(1.f) : inverse(rotated);
+		v.bboxMin = vec3(0.f);
+		v.bboxMax = vec3(res);
+		v.grid = &grid;
+	}
+
+	VolumeRaycast::Parameters params;
+	params.stepLength = 1.f;
+	params.minThreshold = threshold;
+
+	// an orthographic image looking at the volumes slightly off axis
+	const int IMAGE_SIZE = 128;
+	const vec3 center = vec3(res) * 0.5f;
+	const float extent = length(vec3(res));
+	const vec3 dir = normalize(vec3(0.3f, 0.2f, 1.f));
+	const vec3 right = normalize(cross(dir, vec3(0.f, 1.f, 0.f)));
+	const vec3 up = cross(right, dir);
+
+	std::vector<float> reference(IMAGE_SIZE * IMAGE_SIZE * volumes.size()), skipped(reference.size());
+	VolumeRaycast::Stats referenceStats, skippedStats;
+
+	auto march = [&](bool skip, std::vector<float>& maxValues, VolumeRaycast::Stats& stats)
+	{
+		stats = VolumeRaycast::Stats();
+		for (int y = 0; y < IMAGE_SIZE; ++y)
+			for (int x = 0; x < IMAGE_SIZE; ++x)
+			{
+				const vec2 uv = (vec2(x, y) + vec2(0.5f)) / (float)IMAGE_SIZE - vec2(0.5f);
+				const vec3 origin = center - dir * extent + (right * uv.x + up * uv.y) * extent;
+				VolumeRaycast::marchRay(volumes, origin, origin + dir * extent * 2.f, params, skip, &maxValues[(x + y * IMAGE_SIZE) * volumes.size()], stats);
+			}
+	};
+
+	const double rays = IMAGE_SIZE * IMAGE_SIZE;
+	bench.run("raycast", type, 0, 0, rays, [&]() { march(false, reference, referenceStats); });
+	bench.run("raycast skipping", type, 0, 0, rays, [&]() { march(true, skipped, skippedStats); });
+
+	if (referenceStats.steps == 0 || skippedStats.steps == 0)
+		return;
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < reference.size(); ++i)
+		if (std::max(reference[i], threshold) != std::max(skipped[i], threshold))
+			++mismatches;
+
+	std::cout << "[Bench] raycast skipping " << type << ": " << grid.getEmptyCellCount(threshold) << " of " << grid.getCells().size() / 2 << " cells empty, "
+		<< 100.0 * skippedStats.skippedSteps / (skippedStats.steps + skippedStats.skippedSteps) << "% of the steps and "
+		<< 100.0 - 100.0 * skippedStats.samples / referenceStats.samples << "% of the samples saved\n";
+
+	if (mismatches)
+		bench.fail("raycast skipping", type, "differs from the reference in " + std::to_string(mismatches) + " of " + std::to_string(reference.size()) + " maxima");
+}
+
+template <typename T>
+static void benchmarkStacks(Benchmark& bench, const std::string& type, const ivec3& res, float maxValue)
+{
+	std::vector<T> blobs, beads;
+	fillBlobs(blobs, res, maxValue);
+	fillBeads(beads, res, maxValue, (unsigned int)((size_t)res.x * res.y * res.z / 20000 + 1));
+
+	const double voxels = (double)res.x * res.y * res.z;
+	const double bytes = voxels * sizeof(T);
+
+	std::unique_ptr<SpimStack> stack(createStack(blobs, res));
+	std::unique_ptr<SpimStack> beadStack(createStack(beads, res));
+
+	// loading and saving
+	const std::string resName = std::to_string(res.x) + "x" + std::to_string(res.y) + "x" + std::to_string(res.z);
+	const std::string binFile = "spimbench_" + type + "_" + resName + "." + std::to_string(sizeof(T) * 8) + "bit.bin";
+	const std::string cvolFile = "spimbench_" + type + ".cvol";
+	const std::string tifFile = "spimbench_" + type + ".tif";
+
+	bench.run("save bin", type, voxels, bytes, 0, [&]() { stack->save(binFile); });
+	bench.run("load bin", type, voxels, bytes, 0, [&]() { delete SpimStack::load(binFile); });
+	bench.run("save cvol", type, voxels, bytes, 0, [&]() { stack->save(cvolFile); });
+	bench.run("load cvol", type, voxels, bytes, 0, [&]() { delete SpimStack::load(cvolFile); });
+	bench.run("save tif", type, voxels, bytes, 0, [&]() { stack->save(tifFile); });
+	bench.run("load tif", type, voxels, bytes, 0, [&]() { delete SpimStack::load(tifFile); });
+
+	std::remove(binFile.c_str());
+	std::remove(cvolFile.c_str());
+	std::remove(tifFile.c_str());
+
+	// stats
+	bench.run("update", type, voxels, bytes, 0, [&]() { stack->update(); });
+	bench.run("limits", type, voxels, bytes, 0, [&]() { stack->getLimits(); });
+	const Threshold limits = stack->getLimits();
+	bench.run("histogram", type, voxels, bytes, 0, [&]() { stack->calculateHistogram(limits); });
+
+	// filters work in place, every run starts from the original data
+	auto reset = [&]() { stack->setContent(res, &blobs[0]); };
+	bench.run("subsample", type, voxels, bytes, 0, [&]() { stack->subsample(false); }, reset);
+	bench.run("median 7x7x7", type, voxels, bytes, 0, [&]() { stack->applyMedianFilter(ivec3(3)); }, reset);
+	bench.run("gaussian r1", type, voxels, bytes, 0, [&]() { stack->applyGaussianBlur(1.f, 1); }, reset);
+	reset();
+
+	std::vector<vec3> gradients;
+	bench.run("gradient", type, voxels, bytes, 0, [&]() { GradientField::calculate(stack.get(), gradients); });
+
+	// point extraction and the point cloud operations on the extracted bead points
+	bench.run("extract points", type, voxels, bytes, 0, [&]() { stack->extractTransformedPoints(); });
+
+	Threshold beadThreshold = beadStack->getLimits();
+	beadThreshold.set(beadThreshold.max * 0.3, beadThreshold.max);
+	bench.run("extract clipped points", type, voxels, bytes, 0, [&]() { beadStack->extractTransformedPoints(beadStack.get(), beadThreshold); });
+
+	// everything below runs on its own as well, so the inputs are not taken from the runs above
+	const std::vector<vec4> beadPoints = beadStack->extractTransformedPoints(beadStack.get(), beadThreshold);
+
+	ReferencePoints points;
+	auto resetPoints = [&]() { points.setPoints(beadPoints); points.estimateNormals(); };
+	resetPoints();
+	bench.run("point downsample", type, 0, 0, (double)beadPoints.size(), [&]() { points.downsample(2.f); }, resetPoints);
+	bench.run("point outliers", type, 0, 0, (double)beadPoints.size(), [&]() { points.removeOutliers(8, 1.f); }, resetPoints);
+	bench.run("point normals", type, 0, 0, (double)beadPoints.size(), [&]() { points.estimateNormals(); }, [&]() { points.setPoints(beadPoints); });
+
+	// geometry images of the bead points
+	Pointcloud cloud(beadPoints.size());
+	for (size_t i = 0; i < beadPoints.size(); ++i)
+		cloud[i] = vec3(beadPoints[i]);
+
+	GeometryImage imageA, imageB, diff;
+	bench.run("geometry image", type, 0, 0, (double)cloud.size(), [&]() { imageA.calculate(cloud); });
+	imageA.calculate(cloud);
+	imageB.calculate(cloud);
+	bench.run("geometry image diff", type, 0, 0, (double)cloud.size(), [&]() { diff.calculateDiff(imageA, imageB); });
+	bench.run("geometry image points", type, 0, 0, (double)cloud.size(), [&]() { imageA.reconstructPoints(); });
+
+	benchmarkResampling(bench, type, res, blobs);
+
+	const float a = radians(30.f);
+	const mat4 rotated = translate(vec3(res) * 0.5f) * rotate(a, vec3(0, 1, 0)) * translate(vec3(res) * -0.5f);
+	bench.run("reslice trilinear", type, voxels, bytes, 0, [&]() { delete stack->createResliced(rotated, vec3(1.f), res); });
+
+	// fusion of the stack with a rotated copy
+	std::unique_ptr<SpimStack> second(createStack(blobs, res));
+	second->setTransform(rotated);
+	MultiViewFusion fusion;
+	fusion.addView(stack.get());
+	fusion.addView(second.get());
+	const MultiViewFusion::Grid grid = MultiViewFusion::getGrid(stack.get());
+	std::vector<float> fused;
+	bench.run("fuse 2 views", type, voxels, bytes * 2, 0, [&]() { fusion.fuse(grid, fused); });
+
+	benchmarkRaycast(bench, type, res, beads, rotated, (float)beadThreshold.min);
+
+	// metric and solver throughput, candidates per second
+	SampledMetric metric;
+	const unsigned int SAMPLES = 4096;
+	bench.run("metric samples", type, 0, 0, SAMPLES, [&]() { metric.setReference(SampledMetric::View(beadStack.get()), SAMPLES); });
+	metric.setReference(SampledMetric::View(beadStack.get()), SAMPLES);
+	bench.run("metric score", type, 0, 0, SAMPLES, [&]() { metric.score(SampledMetric::View(second.get())); });
+
+	const char* solverNames[] = { "Uniform DX", "Uniform RY", "Random Rotation", "Simulated Annealing" };
+	for (const char* name : solverNames)
+	{
+		std::vector<InteractionVolume*> volumes(1, second.get());
+		std::unique_ptr<IStackTransformationSolver> solver(IStackTransformationSolver::create(name, volumes));
+
+		const unsigned int MAX_CANDIDATES = 200;
+		const SampledMetric::View view(second.get());
+		auto score = [&](const mat4& delta) { return metric.score(view, delta); };
+
+		// the uniform solvers stop before the limit
+		const unsigned int candidates = solver->minimize(second.get(), score, MAX_CANDIDATES);
+		bench.run(std::string("solver ") + name, type, 0, 0, candidates, [&]() { solver->minimize(second.get(), score, MAX_CANDIDATES); });
+	}
+}
+
+int main(int argc, const char** argv)
+{
+	ivec3 res(256, 256, 64);
+	unsigned int warmup = 1, repeats = 3;
+	std::string only, output = "spimbench.json", trace;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg(argv[i]);
+		if (arg == "-size" && i + 3 < argc)
+		{
+			res = ivec3(atoi(argv[i + 1]), atoi(argv[i + 2]), atoi(argv[i + 3]));
+			i += 3;
+		}
+		else if (arg == "-repeats" && i + 1 < argc)
+			repeats = std::max(1, atoi(argv[++i]));
+		else if (arg == "-warmup" && i + 1 < argc)
+			warmup = atoi(argv[++i]);
+		else if (arg == "-only" && i + 1 < argc)
+			only = argv[++i];
+		else if (arg == "-out" && i + 1 < argc)
+			output = argv[++i];
+		else if (arg == "-trace" && i + 1 < argc)
+			trace = argv[++i];
+		else if (arg == "-threads" && i + 1 < argc)
+			TaskScheduler::setThreadCount(atoi(argv[++i]));
+		else
+		{
+			std::cerr << "[Usage] " << argv[0] << " [-size <w> <h> <d>] [-repeats <n>] [-warmup <n>] [-only <name>] [-out <file.json>] [-trace <trace.json>] [-threads <n>]\n";
+			return 1;
+		}
+	}
+
+	const unsigned int threads = TaskScheduler::getThreadCount();
+	std::cout << "[Bench] " << res.x << "x" << res.y << "x" << res.z << " stacks, " << threads << " threads, " << warmup << " warmup runs, best of " << repeats << " runs\n";
+
+	// the instrumented zones of all runs, the timings include the recording overhead
+	if (!trace.empty())
+		Profiler::setEnabled(true);
+
+	Benchmark bench(warmup, repeats, only);
+	benchmarkStacks<unsigned char>(bench, "u8", res, 255.f);
+	benchmarkStacks<unsigned short>(bench, "u16", res, 4095.f);
+
+	std::vector<float> volume;
+	fillBlobs(volume, res, 1.f);
+	benchmarkResampling(bench, "float", res, volume);
+
+	try
+	{
+		bench.writeJSON(output, res);
+
+		if (!trace.empty())
+		{
+			Profiler::printSummary();
+			Profiler::saveChromeTrace(trace);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "[Error] " << e.what() << std::endl;
+		return 1;
+	}
+
+	// failed operations and results that differ from their reference
+	const size_t failures = bench.getFailureCount();
+	if (failures > 0)
+	{
+		std::cerr << "[Bench] " << failures << " operations failed!\n";
+		return 1;
+	}
+
+	return 0;
+}
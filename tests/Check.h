@@ -0,0 +1,23 @@
+#pragma once
+
+#include <iostream>
+
+/// Minimal checks for the headless tests
+/**	A failed CHECK prints its location and condition and the test goes on, so one run lists all failures.
+	Test executables return checkResult() from main, which CTest reports as a failure if any check failed.
+*/
+inline unsigned int& checkFailures()
+{
+	static unsigned int failures = 0;
+	return failures;
+}
+
+#define CHECK(condition) \
+	do { if (!(condition)) { std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl; ++checkFailures(); } } while (0)
+
+inline int checkResult()
+{
+	if (checkFailures() > 0)
+		std::cerr << checkFailures() << " checks failed\n";
+	return checkFailures() > 0 ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+#include "Check.h"
+#include "DirtyRegions.h"
+
+using namespace glm;
+
+static bool hasBox(const DirtyRegions& d, const ivec3& min, const ivec3& max)
+{
+	for (size_t i = 0; i < d.getBoxes().size(); ++i)
+		if (d.getBoxes()[i].min == min && d.getBoxes()[i].max == max)
+			return true;
+	return false;
+}
+
+static void testOverlappingPlanes()
+{
+	DirtyRegions d;
+	d.addAll(ivec3(64));
+	d.clear();
+	CHECK(d.isEmpty());
+
+	// two filter passes over overlapping slabs become one upload
+	d.add(ivec3(0, 0, 0), ivec3(64, 64, 10));
+	d.add(ivec3(0, 0, 5), ivec3(64, 64, 15));
+	CHECK(d.getBoxes().size() == 1);
+	CHECK(hasBox(d, ivec3(0), ivec3(64, 64, 15)));
+	CHECK(d.getVoxelCount() == 64 * 64 * 15);
+	CHECK(!d.isAll());
+
+	// a box inside another one is dropped, either way round
+	d.add(ivec3(10, 10, 2), ivec3(20, 20, 4));
+	CHECK(d.getBoxes().size() == 1);
+
+	d.clear();
+	d.add(ivec3(10, 10, 2), ivec3(20, 20, 4));
+	d.add(ivec3(0, 0, 0), ivec3(64, 64, 10));
+	CHECK(d.getBoxes().size() == 1);
+	CHECK(hasBox(d, ivec3(0), ivec3(64, 64, 10)));
+}
+
+static void testAdjacentBricks()
+{
+	DirtyRegions d;
+	d.addAll(ivec3(64));
+	d.clear();
+
+	// neighbours along x merge into their bounding box
+	d.add(ivec3(0), ivec3(16));
+	d.add(ivec3(16, 0, 0), ivec3(32, 16, 16));
+	CHECK(d.getBoxes().size() == 1);
+	CHECK(hasBox(d, ivec3(0), ivec3(32, 16, 16)));
+
+	// a distant brick stays separate, its bounding box would be mostly clean voxels
+	d.add(ivec3(48), ivec3(56));
+	CHECK(d.getBoxes().size() == 2);
+	CHECK(hasBox(d, ivec3(48), ivec3(56)));
+	CHECK(d.getVoxelCount() == 32 * 16 * 16 + 8 * 8 * 8);
+}
+
+static void testWholeVolumeFallback()
+{
+	DirtyRegions d;
+	d.addAll(ivec3(64));
+	CHECK(d.isAll());
+	CHECK(d.getVoxelCount() == 64 * 64 * 64);
+
+	// half of the volume in two slabs
+	d.clear();
+	d.add(ivec3(0, 0, 0), ivec3(64, 64, 20));
+	CHECK(!d.isAll());
+	d.add(ivec3(0, 0, 20), ivec3(64, 64, 32));
+	CHECK(d.isAll());
+
+	// boxes are clipped to the volume
+	d.clear();
+	d.add(ivec3(-5), ivec3(70));
+	CHECK(d.isAll());
+	d.clear();
+	d.add(ivec3(64), ivec3(70));
+	CHECK(d.isEmpty());
+}
+
+static void testTooManyBoxes()
+{
+	DirtyRegions d;
+	d.addAll(ivec3(128));
+	d.clear();
+
+	// small bricks along the diagonal, too far apart to merge
+	for (size_t i = 0; i < DirtyRegions::MAX_BOXES; ++i)
+		d.add(ivec3(8 * (int)i), ivec3(8 * (int)i + 4));
+	CHECK(d.getBoxes().size() == DirtyRegions::MAX_BOXES);
+
+	// one more is uploaded as the bounds of all of them
+	const int last = 8 * (int)DirtyRegions::MAX_BOXES;
+	d.add(ivec3(last), ivec3(last + 4));
+	CHECK(d.getBoxes().size() == 1);
+	CHECK(hasBox(d, ivec3(0), ivec3(last + 4)));
+	CHECK(!d.isAll());
+}
+
+static void testNoResolution()
+{
+	// nothing was uploaded yet, every box is clipped away
+	DirtyRegions d;
+	d.add(ivec3(0), ivec3(16));
+	CHECK(d.isEmpty());
+	CHECK(!d.isAll());
+}
+
+int main()
+{
+	testOverlappingPlanes();
+	testAdjacentBricks();
+	testWholeVolumeFallback();
+	testTooManyBoxes();
+	testNoResolution();
+
+	return checkResult();
+}
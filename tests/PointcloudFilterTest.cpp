@@ -0,0 +1,143 @@
+#include "Check.h"
+#include "PointcloudFilter.h"
+
+#include <vector>
+#include <map>
+#include <random>
+#include <cmath>
+
+using namespace glm;
+
+// centroids are averaged in float, the reference in double
+static const float CENTROID_TOLERANCE = 1e-5f;
+
+static const float CELL_SIZE = 0.1f;
+static const int GRID = 12;
+
+/// points in random cells of a 12^3 grid, away from the cell borders, plus one point at the origin so the grids match
+static void createCells(std::vector<vec3>& points, std::vector<vec3>& colors, std::vector<vec3>& normals)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> offset(0.1f, 0.9f);
+
+	points.assign(1, vec3(0.f));
+	colors.assign(1, vec3(1.f, 0.f, 0.f));
+	normals.assign(1, vec3(0.f, 0.f, 1.f));
+
+	for (int z = 0; z < GRID; ++z)
+		for (int y = 0; y < GRID; ++y)
+			for (int x = 0; x < GRID; ++x)
+			{
+				// about a third of the cells is empty, the others hold 1 to 40 points
+				if (rng() % 3 == 0)
+					continue;
+
+				const unsigned int count = 1 + rng() % 40;
+				for (unsigned int i = 0; i < count; ++i)
+				{
+					points.push_back((vec3(x, y, z) + vec3(offset(rng), offset(rng), offset(rng))) * CELL_SIZE);
+					colors.push_back(vec3(offset(rng), offset(rng), offset(rng)));
+					normals.push_back(normalize(vec3(offset(rng), offset(rng), 1.f)));
+				}
+			}
+}
+
+static int getCell(const vec3& p)
+{
+	const ivec3 c(floor(p / CELL_SIZE));
+	return c.x + GRID * (c.y + GRID * c.z);
+}
+
+static void testCentroids()
+{
+	std::vector<vec3> points, colors, normals;
+	createCells(points, colors, normals);
+
+	// reference centroids in double precision
+	std::map<int, dvec3> pointSums, colorSums;
+	std::map<int, unsigned int> counts;
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		const int cell = getCell(points[i]);
+		pointSums.insert(std::make_pair(cell, dvec3(0.0))).first->second += dvec3(points[i]);
+		colorSums.insert(std::make_pair(cell, dvec3(0.0))).first->second += dvec3(colors[i]);
+		++counts[cell];
+	}
+
+	const size_t inputCount = points.size();
+	const size_t remaining = PointcloudFilter::voxelGrid(points, colors, normals, CELL_SIZE);
+	CHECK(remaining == counts.size());
+	CHECK(points.size() == remaining);
+	CHECK(colors.size() == remaining);
+	CHECK(normals.size() == remaining);
+	CHECK(remaining < inputCount);
+
+	// every cell appears once, at its centroid
+	std::map<int, unsigned int> seen;
+	float maxError = 0.f, maxColorError = 0.f;
+	for (size_t i = 0; i < points.size(); ++i)
+	{
+		const int cell = getCell(points[i]);
+		++seen[cell];
+		if (!counts.count(cell))
+			continue;
+
+		const dvec3 centroid = pointSums[cell] / (double)counts[cell];
+		const dvec3 color = colorSums[cell] / (double)counts[cell];
+		maxError = std::max(maxError, (float)length(dvec3(points[i]) - centroid));
+		maxColorError = std::max(maxColorError, (float)length(dvec3(colors[i]) - color));
+
+		CHECK(std::abs(length(normals[i]) - 1.f) < 1e-5f);
+	}
+
+	CHECK(seen.size() == counts.size());
+	for (auto it = seen.begin(); it != seen.end(); ++it)
+		CHECK(it->second == 1);
+
+	CHECK(maxError < CENTROID_TOLERANCE);
+	CHECK(maxColorError < CENTROID_TOLERANCE);
+}
+
+static void testFirstPoint()
+{
+	std::vector<vec3> points, colors, normals;
+	createCells(points, colors, normals);
+	const std::vector<vec3> input = points;
+
+	// the first point of every cell is kept unchanged, in input order
+	std::vector<vec3> expected;
+	std::map<int, bool> occupied;
+	for (size_t i = 0; i < input.size(); ++i)
+		if (!occupied[getCell(input[i])])
+		{
+			occupied[getCell(input[i])] = true;
+			expected.push_back(input[i]);
+		}
+
+	PointcloudFilter::voxelGrid(points, colors, normals, CELL_SIZE, PointcloudFilter::VOXEL_FIRST_POINT);
+	CHECK(points == expected);
+}
+
+static void testVec4Points()
+{
+	// w is averaged like an attribute, points without normals
+	std::vector<vec4> points;
+	points.push_back(vec4(0.01f, 0.01f, 0.01f, 1.f));
+	points.push_back(vec4(0.03f, 0.05f, 0.07f, 3.f));
+	points.push_back(vec4(0.25f, 0.01f, 0.01f, 2.f));
+	std::vector<vec3> normals;
+
+	CHECK(PointcloudFilter::voxelGrid(points, normals, CELL_SIZE) == 2);
+	CHECK(length(points[0] - vec4(0.02f, 0.03f, 0.04f, 2.f)) < CENTROID_TOLERANCE);
+	CHECK(points[1] == vec4(0.25f, 0.01f, 0.01f, 2.f));
+	CHECK(normals.empty());
+}
+
+int main()
+{
+	testCentroids();
+	testFirstPoint();
+	testVec4Points();
+
+	return checkResult();
+}
@@ -0,0 +1,229 @@
+#include "Check.h"
+#include "PointcloudOctree.h"
+#include "Ray.h"
+
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+
+/// a few dense clusters in a sparse background, so the tree is unbalanced
+static std::vector<vec3> createCloud(size_t count)
+{
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+	std::normal_distribution<float> normal(0.f, 0.05f);
+
+	const vec3 clusters[] = { vec3(0.5f, 0.2f, -0.3f), vec3(-0.6f, -0.4f, 0.1f), vec3(0.1f, 0.7f, 0.6f) };
+
+	std::vector<vec3> points(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (i % 4 == 0)
+			points[i] = vec3(unit(rng), unit(rng), unit(rng) * 0.5f);
+		else
+			points[i] = clusters[i % 3] + vec3(normal(rng), normal(rng), normal(rng));
+	}
+
+	return points;
+}
+
+static size_t countPoints(const PointcloudOctree& octree, const std::vector<unsigned int>& nodes)
+{
+	size_t total = 0;
+	for (size_t i = 0; i < nodes.size(); ++i)
+		total += octree.getNode(nodes[i]).pointCount;
+	return total;
+}
+
+static void testSelectNodes(const PointcloudOctree& octree, size_t pointCount)
+{
+	const ivec2 viewport(1024, 768);
+	const mat4 proj = perspective(radians(60.f), 4.f / 3.f, 0.1f, 100.f);
+	const mat4 mvp = proj * lookAt(vec3(0.3f, -0.5f, 4.f), vec3(0.f), vec3(0, 1, 0));
+
+	std::vector<unsigned int> result;
+	const size_t budgets[] = { 1000, 5000, 20000 };
+	for (int b = 0; b < 3; ++b)
+	{
+		octree.selectNodes(mvp, viewport, budgets[b], result);
+		CHECK(!result.empty());
+		CHECK(countPoints(octree, result) <= budgets[b]);
+
+		// front-to-back by the view depth of the node centers
+		for (size_t i = 1; i < result.size(); ++i)
+		{
+			const float w0 = (mvp * vec4(octree.getNode(result[i - 1]).bbox.getCentroid(), 1.f)).w;
+			const float w1 = (mvp * vec4(octree.getNode(result[i]).bbox.getCentroid(), 1.f)).w;
+			CHECK(w0 <= w1);
+		}
+	}
+
+	// unlimited budget and no size limit, the selection ends in the leaves that cover all points
+	octree.selectNodes(mvp, viewport, pointCount, result, 0.f);
+	CHECK(countPoints(octree, result) == pointCount);
+	for (size_t i = 0; i < result.size(); ++i)
+		CHECK(octree.getNode(result[i]).leaf);
+
+	// looking away from the cloud, everything is culled
+	const mat4 away = proj * lookAt(vec3(0.f, 0.f, 4.f), vec3(0.f, 0.f, 8.f), vec3(0, 1, 0));
+	octree.selectNodes(away, viewport, pointCount, result);
+	CHECK(result.empty());
+}
+
+static void testQueries(const PointcloudOctree& octree, const std::vector<vec3>& points)
+{
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> unit(-1.5f, 1.5f);
+
+	size_t nearestMismatches = 0, closestMismatches = 0;
+	for (int q = 0; q < 200; ++q)
+	{
+		// nearest point, against brute force
+		const vec3 pt(unit(rng), unit(rng), unit(rng));
+
+		float bruteDist = std::numeric_limits<float>::max();
+		for (size_t i = 0; i < points.size(); ++i)
+		{
+			const vec3 d = points[i] - pt;
+			bruteDist = min(bruteDist, dot(d, d));
+		}
+
+		float distSqrd = 0.f;
+		const size_t nearest = octree.getNearestPoint(pt, distSqrd);
+		const vec3 d = points[nearest] - pt;
+		if (distSqrd != bruteDist || dot(d, d) != distSqrd)
+			++nearestMismatches;
+
+		// closest point to a ray from outside of the cloud
+		Ray ray;
+		ray.origin = vec3(unit(rng), unit(rng), 5.f);
+		ray.direction = vec3(unit(rng), unit(rng), 0.f) * 0.3f - ray.origin;
+		const vec3 dir = normalize(ray.direction);
+
+		float bruteRayDist = std::numeric_limits<float>::max();
+		for (size_t i = 0; i < points.size(); ++i)
+			bruteRayDist = min(bruteRayDist, length(cross(points[i] - ray.origin, dir)));
+
+		float rayDist = 0.f;
+		const size_t closest = octree.getClosestPoint(ray, rayDist);
+		if (rayDist != bruteRayDist || length(cross(points[closest] - ray.origin, dir)) != rayDist)
+			++closestMismatches;
+	}
+
+	CHECK(nearestMismatches == 0);
+	CHECK(closestMismatches == 0);
+}
+
+static void testSaveAndOpen(const PointcloudOctree& octree, const std::vector<vec3>& points)
+{
+	std::vector<vec3> colors(points.size());
+	for (size_t i = 0; i < colors.size(); ++i)
+		colors[i] = vec3((float)(i % 256) / 255.f, 0.5f, 1.f);
+
+	const std::string filename = "PointcloudOctreeTest.pcot";
+	octree.save(filename, colors);
+
+	{
+		PointcloudOctree opened;
+		opened.open(filename);
+		CHECK(opened.isOutOfCore());
+		CHECK(opened.getNodeCount() == octree.getNodeCount());
+		CHECK(opened.getPointCount() == points.size());
+		CHECK(opened.getPointBounds().min == octree.getPointBounds().min);
+		CHECK(opened.getPointBounds().max == octree.getPointBounds().max);
+
+		// only the node table is read
+		size_t resident = 0;
+		for (unsigned int i = 0; i < opened.getNodeCount(); ++i)
+			if (opened.getNode(i).resident && opened.getNode(i).pointCount > 0)
+				++resident;
+		CHECK(resident == 0);
+
+		// payloads match the built tree
+		std::vector<vec3> a, aColors, b, bColors;
+		size_t payloadMismatches = 0;
+		for (unsigned int i = 0; i < opened.getNodeCount(); ++i)
+		{
+			octree.getPayload(i, colors, a, aColors);
+			opened.getPayload(i, colors, b, bColors);
+			if (a != b || aColors != bColors || opened.getNode(i).resident != (opened.getNode(i).pointCount == 0))
+				++payloadMismatches;
+		}
+		CHECK(payloadMismatches == 0);
+
+		opened.fetch(1);
+		CHECK(opened.getNode(1).resident);
+		CHECK(opened.getNode(1).indices == octree.getNode(1).indices);
+		opened.release(1);
+		CHECK(!opened.getNode(1).resident);
+		CHECK(opened.getNode(1).points.empty());
+
+		// queries page the leaves in and out again
+		float builtDist = 0.f, openedDist = 0.f;
+		CHECK(opened.getNearestPoint(vec3(0.5f, 0.2f, -0.3f), openedDist) == octree.getNearestPoint(vec3(0.5f, 0.2f, -0.3f), builtDist));
+		CHECK(openedDist == builtDist);
+		CHECK(!opened.getNode(opened.getNodeCount() - 1).resident);
+
+		const mat4 mvp = perspective(radians(60.f), 4.f / 3.f, 0.1f, 100.f) * lookAt(vec3(0.3f, -0.5f, 4.f), vec3(0.f), vec3(0, 1, 0));
+		std::vector<unsigned int> builtNodes, openedNodes;
+		octree.selectNodes(mvp, ivec2(1024, 768), 20000, builtNodes);
+		opened.selectNodes(mvp, ivec2(1024, 768), 20000, openedNodes);
+		CHECK(builtNodes == openedNodes);
+
+		// writing over the opened file would read from it while it is truncated
+		bool threw = false;
+		try
+		{
+			opened.save(filename, colors);
+		}
+		catch (const std::runtime_error&)
+		{
+			threw = true;
+		}
+		CHECK(threw);
+	}
+
+	// not an octree file
+	{
+		FILE* f = fopen(filename.c_str(), "wb");
+		fputs("not an octree", f);
+		fclose(f);
+
+		PointcloudOctree broken;
+		bool threw = false;
+		try
+		{
+			broken.open(filename);
+		}
+		catch (const std::runtime_error&)
+		{
+			threw = true;
+		}
+		CHECK(threw);
+		CHECK(!broken.isOutOfCore());
+	}
+
+	std::remove(filename.c_str());
+}
+
+int main()
+{
+	const std::vector<vec3> points = createCloud(60000);
+
+	PointcloudOctree octree(500, 500, 10);
+	octree.build(points);
+	CHECK(octree.getPointCount() == points.size());
+	CHECK(!octree.isOutOfCore());
+
+	testSelectNodes(octree, points.size());
+	testQueries(octree, points);
+	testSaveAndOpen(octree, points);
+
+	return checkResult();
+}
@@ -0,0 +1,126 @@
+#include "Check.h"
+#include "TextureResidency.h"
+
+#include <vector>
+
+using namespace glm;
+
+static TextureResidency::Request createRequest(const ivec3& resolution, const vec3& voxelSize, float pixelSize)
+{
+	TextureResidency::Request r;
+	r.resolution = resolution;
+	r.voxelSize = voxelSize;
+	r.bytesPerVoxel = 1;
+	r.pixelSize = pixelSize;
+	return r;
+}
+
+static void testLevels()
+{
+	using namespace TextureResidency;
+
+	// anisotropic stacks become isotropic first, then all axes are halved
+	const ivec3 res(64, 64, 16);
+	const vec3 voxel(1, 1, 4);
+	CHECK(getLevelFactor(res, voxel, 0) == ivec3(1));
+	CHECK(getLevelFactor(res, voxel, 1) == ivec3(2, 2, 1));
+	CHECK(getLevelFactor(res, voxel, 2) == ivec3(4, 4, 1));
+	CHECK(getLevelFactor(res, voxel, 3) == ivec3(8, 8, 2));
+
+	// partial blocks at the border count as voxels
+	CHECK(getLevelResolution(ivec3(5, 4, 3), vec3(1), 1) == ivec3(3, 2, 2));
+
+	// the last level has a single voxel along every axis, levels beyond it are the same
+	const unsigned int count = getLevelCount(ivec3(4), vec3(1));
+	CHECK(count == 3);
+	CHECK(getLevelResolution(ivec3(4), vec3(1), count - 1) == ivec3(1));
+	CHECK(getLevelResolution(ivec3(4), vec3(1), count + 2) == ivec3(1));
+
+	// axes of a single voxel are never reduced
+	CHECK(getLevelFactor(ivec3(16, 16, 1), vec3(1), 2) == ivec3(4, 4, 1));
+}
+
+static void testZoomThresholds()
+{
+	using namespace TextureResidency;
+
+	std::vector<Request> requests;
+	requests.push_back(createRequest(ivec3(64), vec3(1), 0.f));
+	requests.push_back(createRequest(ivec3(64), vec3(1), 1.9f));
+	requests.push_back(createRequest(ivec3(64), vec3(1), 2.f));
+	requests.push_back(createRequest(ivec3(64), vec3(1), 4.5f));
+	requests.push_back(createRequest(ivec3(64), vec3(1), 1000.f));
+
+	const std::vector<unsigned int> levels = selectLevels(requests, (size_t)-1);
+	CHECK(levels.size() == requests.size());
+
+	// unknown pixel sizes stay at full resolution
+	CHECK(levels[0] == 0);
+	// the coarsest level whose voxels are not larger than a pixel
+	CHECK(levels[1] == 0);
+	CHECK(levels[2] == 1);
+	CHECK(levels[3] == 2);
+	// but no coarser than the last level
+	CHECK(levels[4] == getLevelCount(ivec3(64), vec3(1)) - 1);
+
+	// anisotropic stacks are measured by their smallest voxels
+	requests.assign(1, createRequest(ivec3(64, 64, 16), vec3(1, 1, 4), 2.f));
+	CHECK(selectLevels(requests, (size_t)-1)[0] == 1);
+}
+
+static void testBudget()
+{
+	using namespace TextureResidency;
+
+	std::vector<Request> requests;
+	requests.push_back(createRequest(ivec3(64), vec3(1), 0.f));
+	requests.push_back(createRequest(ivec3(32), vec3(1), 0.f));
+
+	// everything fits
+	std::vector<unsigned int> levels = selectLevels(requests, 64 * 64 * 64 + 32 * 32 * 32);
+	CHECK(levels[0] == 0 && levels[1] == 0);
+
+	// the largest texture is halved first
+	levels = selectLevels(requests, 64 * 64 * 64);
+	CHECK(levels[0] == 1 && levels[1] == 0);
+
+	// of textures of equal size the first one
+	levels = selectLevels(requests, 32 * 32 * 32 + 16 * 16 * 16);
+	CHECK(levels[0] == 2 && levels[1] == 0);
+
+	// an exhausted budget leaves every stack at its last level, never beyond
+	levels = selectLevels(requests, 0);
+	CHECK(levels[0] == getLevelCount(ivec3(64), vec3(1)) - 1);
+	CHECK(levels[1] == getLevelCount(ivec3(32), vec3(1)) - 1);
+	CHECK(getLevelBytes(requests[0], levels[0]) == 1);
+}
+
+static void testLevelVoxels()
+{
+	using namespace TextureResidency;
+
+	// 3x2x2 voxels, the second block along x is partial
+	const unsigned short data[] = { 1, 2, 100, 3, 4, 200, 5, 6, 300, 7, 8, 400 };
+	unsigned short out[2] = { 0 };
+	getLevelVoxels(data, 2, ivec3(3, 2, 2), ivec3(2), ivec3(0), ivec3(2, 1, 1), out);
+
+	// (1+2+3+4+5+6+7+8)/8 rounded, and the average of the partial block's 4 voxels
+	CHECK(out[0] == 5);
+	CHECK(out[1] == 250);
+
+	// level 0 copies the box
+	unsigned char bytes[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	unsigned char copy[2] = { 0 };
+	getLevelVoxels(bytes, 1, ivec3(2, 2, 2), ivec3(1), ivec3(1, 1, 0), ivec3(2, 2, 2), copy);
+	CHECK(copy[0] == 3 && copy[1] == 7);
+}
+
+int main()
+{
+	testLevels();
+	testZoomThresholds();
+	testBudget();
+	testLevelVoxels();
+
+	return checkResult();
+}
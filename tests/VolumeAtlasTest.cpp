@@ -0,0 +1,197 @@
+#include "Check.h"
+#include "VolumeAtlas.h"
+#include "MacroCellGrid.h"
+
+#include <vector>
+#include <random>
+#include <stdexcept>
+
+using namespace glm;
+
+static bool throwsForCapacity(size_t volumeCount)
+{
+	try
+	{
+		VolumeAtlas::getCapacity(volumeCount);
+	}
+	catch (const std::runtime_error&)
+	{
+		return true;
+	}
+	return false;
+}
+
+static void testCapacity()
+{
+	// at least 2, then powers of two up to the size of the uniform block
+	CHECK(VolumeAtlas::getCapacity(0) == 2);
+	CHECK(VolumeAtlas::getCapacity(1) == 2);
+	CHECK(VolumeAtlas::getCapacity(2) == 2);
+	CHECK(VolumeAtlas::getCapacity(3) == 4);
+	CHECK(VolumeAtlas::getCapacity(4) == 4);
+	CHECK(VolumeAtlas::getCapacity(5) == 8);
+	CHECK(VolumeAtlas::getCapacity(VolumeAtlas::MAX_VOLUMES) == VolumeAtlas::MAX_VOLUMES);
+
+	CHECK(!throwsForCapacity(VolumeAtlas::MAX_VOLUMES));
+	CHECK(throwsForCapacity(VolumeAtlas::MAX_VOLUMES + 1));
+}
+
+/// slots are cell aligned, inside the atlas and never share a cell
+static void checkSlots(const std::vector<ivec3>& resolutions, const std::vector<VolumeAtlas::Slot>& slots, const ivec3& size, int maxSize)
+{
+	const int CELL = MacroCellGrid::CELL_SIZE;
+	CHECK(slots.size() == resolutions.size());
+	CHECK(all(lessThanEqual(size, ivec3(maxSize))));
+
+	for (size_t i = 0; i < slots.size(); ++i)
+	{
+		const VolumeAtlas::Slot& s = slots[i];
+		CHECK(s.resolution == resolutions[i]);
+		CHECK(s.offset / CELL * CELL == s.offset);
+		CHECK(all(greaterThanEqual(s.offset, ivec3(0))));
+		CHECK(all(lessThanEqual(s.offset + s.resolution, size)));
+
+		for (size_t j = 0; j < i; ++j)
+		{
+			const ivec3 minA = slots[i].offset / CELL, maxA = (slots[i].offset + slots[i].resolution + ivec3(CELL - 1)) / CELL;
+			const ivec3 minB = slots[j].offset / CELL, maxB = (slots[j].offset + slots[j].resolution + ivec3(CELL - 1)) / CELL;
+			CHECK(any(lessThanEqual(maxA, minB)) || any(lessThanEqual(maxB, minA)));
+		}
+	}
+}
+
+static void testAlignment()
+{
+	std::vector<VolumeAtlas::Slot> slots;
+	ivec3 size;
+
+	// a single volume is not padded
+	std::vector<ivec3> resolutions(1, ivec3(37, 21, 9));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots[0].offset == ivec3(0));
+	CHECK(size == ivec3(37, 21, 9));
+
+	// the deepest volume opens the layer, the next one starts at the following cell
+	resolutions.push_back(ivec3(20, 20, 40));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots[1].offset == ivec3(0));
+	CHECK(slots[0].offset == ivec3(32, 0, 0));
+	CHECK(size == ivec3(69, 21, 40));
+	checkSlots(resolutions, slots, size, 256);
+
+	// of equal depth, the taller one comes first
+	resolutions.assign(1, ivec3(16, 10, 16));
+	resolutions.push_back(ivec3(16, 30, 16));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots[1].offset == ivec3(0));
+	CHECK(slots[0].offset == ivec3(16, 0, 0));
+
+	// no volumes, no atlas
+	resolutions.clear();
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots.empty());
+	CHECK(size == ivec3(0));
+}
+
+static void testRowsAndLayers()
+{
+	std::vector<VolumeAtlas::Slot> slots;
+	ivec3 size;
+
+	// 100^3 volumes take 112^3 cells, two per row, two rows per layer
+	std::vector<ivec3> resolutions(3, ivec3(100));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots[0].offset == ivec3(0));
+	CHECK(slots[1].offset == ivec3(112, 0, 0));
+	CHECK(slots[2].offset == ivec3(0, 112, 0));
+	CHECK(size == ivec3(212, 212, 100));
+
+	resolutions.assign(5, ivec3(100));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots[4].offset == ivec3(0, 0, 112));
+	CHECK(size == ivec3(212, 212, 212));
+	checkSlots(resolutions, slots, size, 256);
+}
+
+static void testLayerFromPartialRow()
+{
+	std::vector<VolumeAtlas::Slot> slots;
+	ivec3 size;
+
+	// C still fits into the second row along x but not along y, it opens a new layer with fresh rows
+	std::vector<ivec3> resolutions;
+	resolutions.push_back(ivec3(100, 200, 64));
+	resolutions.push_back(ivec3(150, 48, 48));
+	resolutions.push_back(ivec3(32, 64, 32));
+	resolutions.push_back(ivec3(200, 200, 16));
+	resolutions.push_back(ivec3(32, 16, 16));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+
+	CHECK(slots[0].offset == ivec3(0));
+	CHECK(slots[1].offset == ivec3(0, 208, 0));
+	CHECK(slots[2].offset == ivec3(0, 0, 64));
+	CHECK(slots[3].offset == ivec3(32, 0, 64));
+	// the first row of the layer is as tall as its own volumes
+	CHECK(slots[4].offset == ivec3(0, 208, 64));
+	CHECK(size == ivec3(232, 256, 96));
+	checkSlots(resolutions, slots, size, 256);
+}
+
+static void testOverflow()
+{
+	std::vector<VolumeAtlas::Slot> slots;
+	ivec3 size;
+
+	// a volume that fits exactly, and one that is larger than the atlas along one axis
+	std::vector<ivec3> resolutions(1, ivec3(256, 16, 16));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(size == ivec3(256, 16, 16));
+
+	resolutions.assign(1, ivec3(16, 257, 16));
+	CHECK(!VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	resolutions.assign(1, ivec3(16, 16, 257));
+	CHECK(!VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+
+	// two layers of four 100^3 volumes fit, a third layer does not
+	resolutions.assign(8, ivec3(100));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	checkSlots(resolutions, slots, size, 256);
+	resolutions.assign(9, ivec3(100));
+	CHECK(!VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+
+	// padding counts, a volume that fits by its voxels may not fit by its cells
+	resolutions.assign(2, ivec3(129, 16, 16));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots[1].offset == ivec3(0, 16, 0));
+	resolutions.assign(2, ivec3(120, 16, 16));
+	CHECK(VolumeAtlas::computeLayout(resolutions, 256, slots, size));
+	CHECK(slots[1].offset == ivec3(128, 0, 0));
+}
+
+static void testRandomLayouts()
+{
+	std::mt19937 rng(5);
+	for (int t = 0; t < 200; ++t)
+	{
+		std::vector<ivec3> resolutions(1 + rng() % 12);
+		for (size_t i = 0; i < resolutions.size(); ++i)
+			resolutions[i] = ivec3(1 + rng() % 200, 1 + rng() % 200, 1 + rng() % 120);
+
+		std::vector<VolumeAtlas::Slot> slots;
+		ivec3 size;
+		if (VolumeAtlas::computeLayout(resolutions, 512, slots, size))
+			checkSlots(resolutions, slots, size, 512);
+	}
+}
+
+int main()
+{
+	testCapacity();
+	testAlignment();
+	testRowsAndLayers();
+	testLayerFromPartialRow();
+	testOverflow();
+	testRandomLayouts();
+
+	return checkResult();
+}
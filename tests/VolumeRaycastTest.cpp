@@ -0,0 +1,168 @@
+#include "Check.h"
+#include "VolumeRaycast.h"
+#include "MacroCellGrid.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+
+/// dim beads on a black background, so most cells are empty at the higher thresholds
+template <typename T>
+static std::vector<T> createBeads(const ivec3& res, float maxValue, unsigned int beadCount)
+{
+	std::mt19937 rng(17);
+	std::vector<T> volume((size_t)res.x * res.y * res.z);
+
+	// a little noise in some cells only
+	for (size_t i = 0; i < volume.size(); ++i)
+		volume[i] = (T)((rng() % 8 == 0 ? 0.02f : 0.f) * maxValue);
+
+	const int radius = 3;
+	for (unsigned int b = 0; b < beadCount; ++b)
+	{
+		const ivec3 center(rng() % res.x, rng() % res.y, rng() % res.z);
+		const float brightness = 0.3f + 0.7f * (float)rng() / rng.max();
+
+		for (int z = std::max(0, center.z - radius); z <= std::min(res.z - 1, center.z + radius); ++z)
+			for (int y = std::max(0, center.y - radius); y <= std::min(res.y - 1, center.y + radius); ++y)
+				for (int x = std::max(0, center.x - radius); x <= std::min(res.x - 1, center.x + radius); ++x)
+				{
+					const vec3 d = vec3(x, y, z) - vec3(center);
+					T& voxel = volume[x + res.x * (y + (size_t)res.y * z)];
+					voxel = std::max(voxel, (T)(brightness * exp(-dot(d, d) / 4.f) * maxValue));
+				}
+	}
+
+	return volume;
+}
+
+static VolumeRaycast::Volume createVolume(const void* data, unsigned int bpv, const ivec3& res, const vec3& voxelSize, const mat4& transform, const MacroCellGrid* grid)
+{
+	VolumeRaycast::Volume v;
+	v.data = data;
+	v.bytesPerVoxel = bpv;
+	v.resolution = res;
+	v.inverseTransform = inverse(transform);
+	v.bboxMin = vec3(0.f);
+	v.bboxMax = vec3(res) * voxelSize;
+	v.grid = grid;
+	return v;
+}
+
+/// the skipping traversal has to find the same maxima above the threshold as the reference that samples every step
+static void checkSkipping(const std::vector<VolumeRaycast::Volume>& volumes, const vec3& center, float radius, float threshold, float stepLength)
+{
+	VolumeRaycast::Parameters params;
+	params.stepLength = stepLength;
+	params.minThreshold = threshold;
+
+	std::mt19937 rng(23);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	std::vector<float> reference(volumes.size()), skipped(volumes.size());
+	VolumeRaycast::Stats referenceStats, skippedStats;
+
+	size_t mismatches = 0;
+	for (int r = 0; r < 300; ++r)
+	{
+		// from outside of all volumes through a random point near the center, some rays miss
+		vec3 dir(unit(rng), unit(rng), unit(rng));
+		if (r < 6)
+			dir = vec3(0.f);
+		dir[r % 3] += 1.f;
+		dir = normalize(dir);
+
+		const vec3 target = center + vec3(unit(rng), unit(rng), unit(rng)) * radius * 0.6f;
+		const vec3 origin = target - dir * radius * 2.f;
+		const vec3 destination = target + dir * radius * 2.f;
+
+		const bool referenceHit = VolumeRaycast::marchRay(volumes, origin, destination, params, false, &reference[0], referenceStats);
+		const bool skippedHit = VolumeRaycast::marchRay(volumes, origin, destination, params, true, &skipped[0], skippedStats);
+
+		bool same = referenceHit == skippedHit;
+		for (size_t i = 0; i < volumes.size(); ++i)
+			same = same && std::max(reference[i], threshold) == std::max(skipped[i], threshold);
+
+		if (!same)
+			++mismatches;
+	}
+
+	CHECK(mismatches == 0);
+	CHECK(skippedStats.samples <= referenceStats.samples);
+	CHECK(skippedStats.steps <= referenceStats.steps);
+}
+
+template <typename T>
+static void testTransforms(float maxValue)
+{
+	const ivec3 res(70, 50, 36);
+	const std::vector<T> beads = createBeads<T>(res, maxValue, 40);
+
+	MacroCellGrid grid;
+	grid.build(&beads[0], sizeof(T), res);
+	CHECK(grid.getEmptyCellCount(maxValue * 0.1f) > 0);
+
+	const vec3 center = vec3(res) * 0.5f;
+	const float radius = length(vec3(res));
+
+	const mat4 rotated = translate(center) * rotate(radians(35.f), normalize(vec3(0.2f, 1.f, 0.3f))) * translate(-center);
+	// anisotropic voxels, the bounding box is stretched along z
+	const mat4 scaled = translate(vec3(-12.f, 5.f, 3.f)) * rotate(radians(-20.f), vec3(1, 0, 0)) * scale(vec3(0.8f, 1.1f, 1.f));
+
+	std::vector<std::vector<VolumeRaycast::Volume> > scenes(4);
+	scenes[0].push_back(createVolume(&beads[0], sizeof(T), res, vec3(1.f), mat4(1.f), &grid));
+	scenes[1].push_back(createVolume(&beads[0], sizeof(T), res, vec3(1.f), rotated, &grid));
+	scenes[2].push_back(createVolume(&beads[0], sizeof(T), res, vec3(1.f, 1.f, 2.5f), scaled, &grid));
+	scenes[3].push_back(scenes[0][0]);
+	scenes[3].push_back(scenes[1][0]);
+
+	// steps shorter than a voxel as well, alternating over the thresholds
+	const float thresholds[] = { 0.f, 0.015f, 0.1f, 0.5f, 0.9f };
+	for (size_t s = 0; s < scenes.size(); ++s)
+		for (int t = 0; t < 5; ++t)
+			checkSkipping(scenes[s], center, radius, thresholds[t] * maxValue, t % 2 ? 0.7f : 1.f);
+}
+
+static void testEmptySpace()
+{
+	// a single bright voxel, the skipping traversal has to find it while sampling far less
+	const ivec3 res(64);
+	std::vector<unsigned char> volume((size_t)res.x * res.y * res.z, 0);
+	volume[40 + res.x * (23 + (size_t)res.y * 17)] = 200;
+
+	MacroCellGrid grid;
+	grid.build(&volume[0], 1, res);
+	CHECK(grid.getEmptyCellCount(100.f) == grid.getCells().size() / 2 - 1);
+
+	std::vector<VolumeRaycast::Volume> volumes(1, createVolume(&volume[0], 1, res, vec3(1.f), mat4(1.f), &grid));
+
+	VolumeRaycast::Parameters params;
+	params.stepLength = 1.f;
+	params.minThreshold = 100.f;
+
+	float reference = 0.f, skipped = 0.f;
+	VolumeRaycast::Stats referenceStats, skippedStats;
+	CHECK(VolumeRaycast::marchRay(volumes, vec3(40.5f, 23.5f, -10.f), vec3(40.5f, 23.5f, 80.f), params, false, &reference, referenceStats));
+	CHECK(VolumeRaycast::marchRay(volumes, vec3(40.5f, 23.5f, -10.f), vec3(40.5f, 23.5f, 80.f), params, true, &skipped, skippedStats));
+
+	CHECK(reference == 200.f);
+	CHECK(skipped == 200.f);
+	CHECK(skippedStats.samples < referenceStats.samples / 2);
+
+	// rays that miss the box sample nothing
+	CHECK(!VolumeRaycast::marchRay(volumes, vec3(-10.f, -10.f, 0.f), vec3(-10.f, 80.f, 0.f), params, true, &skipped, skippedStats));
+	CHECK(skipped == 0.f);
+}
+
+int main()
+{
+	testTransforms<unsigned char>(255.f);
+	testTransforms<unsigned short>(4095.f);
+	testEmptySpace();
+
+	return checkResult();
+}